@@ -3,6 +3,11 @@
  * MODULE:  blas.cpp
  * PURPOSE: nifs for basic linear algebra subprograms (CBLAS)
  *
+ * Vectors are immutable erlang binaries, so every vector operation
+ * allocates its result. For streaming aggregations, the module also
+ * provides an accumulator resource: a native float buffer that is updated
+ * in place, and frozen into a binary (without a copy) at the end.
+ *
  ***************************************************************************/
 /*-------------------[       Pre Include Defines       ]-------------------*/
 /*-------------------[      Library Include Files      ]-------------------*/
@@ -11,13 +16,70 @@
 #else
 #  include <cblas.h>
 #endif
+#include <math.h>
 /*-------------------[      Project Include Files      ]-------------------*/
 #include "penelope.hpp"
 /*-------------------[      Macros/Constants/Types     ]-------------------*/
+// matrix operations with at least this many multiply-adds (roughly a
+// millisecond of work) are rescheduled onto a dirty CPU scheduler
+#define BLAS_DIRTY_WORK (1L << 20)
+typedef ERL_NIF_TERM (*BLAS_NIF)(ErlNifEnv*, int, const ERL_NIF_TERM[]);
+// mutable vector accumulator
+typedef struct tagBlasAcc {
+   ErlNifMutex* lock;             // buffer mutex
+   ErlNifBinary buffer;           // accumulated vector
+   bool         frozen;           // buffer relinquished to erlang?
+} BLAS_ACC;
 /*-------------------[        Global Variables         ]-------------------*/
 /*-------------------[        Global Prototypes        ]-------------------*/
 /*-------------------[        Module Variables         ]-------------------*/
+// the element encoding of :NaN, as historically produced by Vector
+static const unsigned char g_nan[] = { 0, 0, 128, 127 };
+static ErlNifResourceType* g_acc_type = NULL;
 /*-------------------[        Module Prototypes        ]-------------------*/
+static void nif_destruct_acc (
+   ErlNifEnv* env,
+   void*      object);
+static BLAS_ACC* blas_acc_lock (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term);
+static bool erl2blas_float (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term,
+   float*       value);
+static bool erl2blas_matrix (
+   ErlNifEnv*    env,
+   ERL_NIF_TERM  term,
+   long          rows,
+   long          cols,
+   ErlNifBinary* matrix);
+static CBLAS_TRANSPOSE erl2blas_transpose (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term);
+static ERL_NIF_TERM blas_schedule (
+   ErlNifEnv*         env,
+   const char*        name,
+   long               work,
+   BLAS_NIF           run,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM blas_sgemv_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM blas_sgemm_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM blas_cosine_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM blas_accumulate (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM* weights,
+   ERL_NIF_TERM        vectors,
+   bool                mean);
 /*-------------------[         Implementation          ]-------------------*/
 /*-----------< FUNCTION: nif_blas_init >-------------------------------------
 // Purpose:    blas module initialization
@@ -27,7 +89,16 @@
 ---------------------------------------------------------------------------*/
 int nif_blas_init (ErlNifEnv* env)
 {
-   return 1;
+   // register the vector accumulator resource type
+   ErlNifResourceFlags flags = ERL_NIF_RT_CREATE;
+   g_acc_type = enif_open_resource_type(
+      env,
+      NULL,
+      "blas_acc",
+      &nif_destruct_acc,
+      flags,
+      &flags);
+   return g_acc_type ? 1 : 0;
 }
 /*-----------< FUNCTION: nif_blas_sscal >------------------------------------
 // Purpose:    BLAS sscal wrapper
@@ -98,3 +169,827 @@ ERL_NIF_TERM nif_blas_saxpy(
       1);
    return enif_make_binary(env, &r);
 }
+/*-----------< FUNCTION: nif_blas_mean >-------------------------------------
+// Purpose:    computes the mean of a list of vectors
+//             the vectors are accumulated into a single result buffer
+//             (in list order), which is then scaled by 1/m
+// Parameters: vectors - nonempty list of equal-length binary float vectors
+// Returns:    the mean vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_mean(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   return blas_accumulate(env, NULL, argv[0], true);
+}
+/*-----------< FUNCTION: nif_blas_weighted_sum >-----------------------------
+// Purpose:    computes the weighted sum of a list of vectors
+//             the vectors are accumulated into a single result buffer
+// Parameters: weights - list of scalar weights (floats)
+//             vectors - nonempty list of equal-length binary float
+//                       vectors, one per weight
+// Returns:    the weighted sum vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_weighted_sum(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   return blas_accumulate(env, &argv[0], argv[1], false);
+}
+/*-----------< FUNCTION: blas_accumulate >-----------------------------------
+// Purpose:    accumulates a list of (optionally weighted) vectors into a
+//             newly allocated vector, with a single allocation
+// Parameters: env     - current erlang environment
+//             weights - list of scalar weights (NULL for unit weights)
+//             vectors - list of binary float vectors
+//             mean    - scale the sum by 1/m?
+// Returns:    the accumulated vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM blas_accumulate (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM* weights,
+   ERL_NIF_TERM        vectors,
+   bool                mean)
+{
+   unsigned m;
+   unsigned k;
+   double a;
+   ERL_NIF_TERM head;
+   ERL_NIF_TERM tail;
+   ErlNifBinary x, r;
+   // validate parameters
+   if (!enif_get_list_length(env, vectors, &m) || m == 0)
+      return enif_make_badarg(env);
+   if (weights && (!enif_get_list_length(env, *weights, &k) || k != m))
+      return enif_make_badarg(env);
+   enif_get_list_cell(env, vectors, &head, &tail);
+   if (!enif_inspect_binary(env, head, &x))
+      return enif_make_badarg(env);
+   size_t size = x.size;
+   for (tail = vectors; enif_get_list_cell(env, tail, &head, &tail); )
+      if (!enif_inspect_binary(env, head, &x) || x.size != size)
+         return enif_make_badarg(env);
+   if (weights)
+      for (tail = *weights; enif_get_list_cell(env, tail, &head, &tail); )
+         if (!enif_get_double(env, head, &a))
+            return enif_make_badarg(env);
+   // accumulate the vectors into a zeroed result, in list order
+   if (!enif_alloc_binary(size, &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   memset(r.data, 0, r.size);
+   int n = size / sizeof(float);
+   ERL_NIF_TERM w = weights ? *weights : 0;
+   for (tail = vectors; enif_get_list_cell(env, tail, &head, &tail); ) {
+      enif_inspect_binary(env, head, &x);
+      a = 1;
+      if (weights) {
+         enif_get_list_cell(env, w, &head, &w);
+         enif_get_double(env, head, &a);
+      }
+      cblas_saxpy(n, a, (float*)x.data, 1, (float*)r.data, 1);
+   }
+   if (mean)
+      cblas_sscal(n, 1.0 / m, (float*)r.data, 1);
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_from_list >--------------------------------
+// Purpose:    converts a list of numbers to a float vector
+// Parameters: list - list of numbers (floats, integers, or :NaN)
+// Returns:    the float vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_from_list(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   unsigned n;
+   ERL_NIF_TERM head;
+   ERL_NIF_TERM tail = argv[0];
+   ErlNifBinary r;
+   // validate parameters
+   if (!enif_get_list_length(env, argv[0], &n))
+      return enif_make_badarg(env);
+   // convert the list into a new vector
+   if (!enif_alloc_binary(n * sizeof(float), &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   for (unsigned i = 0; enif_get_list_cell(env, tail, &head, &tail); i++)
+      if (!erl2blas_float(env, head, &((float*)r.data)[i])) {
+         enif_release_binary(&r);
+         return enif_make_badarg(env);
+      }
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_to_list >----------------------------------
+// Purpose:    converts a float vector to a list of numbers
+// Parameters: x - vector to convert (binary float vector)
+// Returns:    list of floats, with :NaN for non-finite values, which
+//             erlang cannot represent
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_to_list(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary x;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[0], &x))
+      return enif_make_badarg(env);
+   // build the list from its tail
+   ERL_NIF_TERM nan = enif_make_atom(env, "NaN");
+   ERL_NIF_TERM list = enif_make_list(env, 0);
+   for (int i = x.size / sizeof(float) - 1; i >= 0; i--) {
+      float value = ((float*)x.data)[i];
+      list = enif_make_list_cell(
+         env,
+         isfinite(value) ? enif_make_double(env, value) : nan,
+         list);
+   }
+   return list;
+}
+/*-----------< FUNCTION: nif_blas_fill >-------------------------------------
+// Purpose:    creates a vector with every element set to a value
+// Parameters: n     - vector length (integer)
+//             value - element value (float)
+// Returns:    the filled vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_fill(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int n;
+   double value;
+   ErlNifBinary r;
+   // validate parameters
+   if (!enif_get_int(env, argv[0], &n) || n < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_double(env, argv[1], &value))
+      return enif_make_badarg(env);
+   // fill a new vector
+   if (!enif_alloc_binary(n * sizeof(float), &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   if (value == 0)
+      memset(r.data, 0, r.size);
+   else
+      for (int i = 0; i < n; i++)
+         ((float*)r.data)[i] = (float)value;
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_slice >------------------------------------
+// Purpose:    retrieves a contiguous range of vector elements
+//             the result references the source binary, without a copy
+// Parameters: x     - source vector (binary float vector)
+//             start - 0-based index of the first element (integer)
+//             count - number of elements (integer)
+// Returns:    the sub-vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_slice(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary x;
+   int start;
+   int count;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[0], &x))
+      return enif_make_badarg(env);
+   if (!enif_get_int(env, argv[1], &start) || start < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_int(env, argv[2], &count) || count < 0)
+      return enif_make_badarg(env);
+   if ((size_t)start + count > x.size / sizeof(float))
+      return enif_make_badarg(env);
+   return enif_make_sub_binary(
+      env,
+      argv[0],
+      start * sizeof(float),
+      count * sizeof(float));
+}
+/*-----------< FUNCTION: nif_blas_concat >-----------------------------------
+// Purpose:    concatenates a list of vectors into a single vector
+// Parameters: vectors - list of vectors (binary float vectors)
+// Returns:    the concatenated vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_concat(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ERL_NIF_TERM head;
+   ERL_NIF_TERM tail;
+   ErlNifBinary x, r;
+   // validate parameters, and size the result
+   size_t size = 0;
+   if (!enif_is_list(env, argv[0]))
+      return enif_make_badarg(env);
+   for (tail = argv[0]; enif_get_list_cell(env, tail, &head, &tail); ) {
+      if (!enif_inspect_binary(env, head, &x))
+         return enif_make_badarg(env);
+      size += x.size;
+   }
+   // copy the vectors into a new vector
+   if (!enif_alloc_binary(size, &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   size_t offset = 0;
+   for (tail = argv[0]; enif_get_list_cell(env, tail, &head, &tail); ) {
+      enif_inspect_binary(env, head, &x);
+      memcpy(r.data + offset, x.data, x.size);
+      offset += x.size;
+   }
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_sdot >-------------------------------------
+// Purpose:    BLAS sdot wrapper
+//             computes x . y
+// Parameters: x - vector (binary float vector)
+//             y - vector (binary float vector)
+// Returns:    the dot product (float)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_sdot(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary x, y;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[0], &x))
+      return enif_make_badarg(env);
+   if (!enif_inspect_binary(env, argv[1], &y))
+      return enif_make_badarg(env);
+   if (x.size != y.size)
+      return enif_make_badarg(env);
+   return enif_make_double(
+      env,
+      cblas_sdot(
+         x.size / sizeof(float),
+         (float*)x.data,
+         1,
+         (float*)y.data,
+         1));
+}
+/*-----------< FUNCTION: nif_blas_snrm2 >------------------------------------
+// Purpose:    BLAS snrm2 wrapper
+//             computes ||x||
+// Parameters: x - vector (binary float vector)
+// Returns:    the euclidean norm (float)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_snrm2(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary x;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[0], &x))
+      return enif_make_badarg(env);
+   return enif_make_double(
+      env,
+      cblas_snrm2(x.size / sizeof(float), (float*)x.data, 1));
+}
+/*-----------< FUNCTION: nif_blas_sgemv >------------------------------------
+// Purpose:    BLAS sgemv wrapper
+//             computes y = a op(A) x, for a row-major matrix A, where op
+//             optionally transposes A
+// Parameters: trans - transpose A? (boolean)
+//             m     - number of rows in A (integer)
+//             n     - number of columns in A (integer)
+//             alpha - scalar to multiply (float)
+//             a     - m x n matrix (binary float matrix)
+//             x     - vector to multiply, of length n (m if transposed)
+// Returns:    result of a op(A) x (binary float vector), of length m (n if
+//             transposed)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_sgemv(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int m, n;
+   double alpha;
+   ErlNifBinary a, x;
+   // validate parameters
+   if (!enif_is_atom(env, argv[0]))
+      return enif_make_badarg(env);
+   bool trans = erl2blas_transpose(env, argv[0]) == CblasTrans;
+   if (!enif_get_int(env, argv[1], &m) || m < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_int(env, argv[2], &n) || n < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_double(env, argv[3], &alpha))
+      return enif_make_badarg(env);
+   if (!erl2blas_matrix(env, argv[4], m, n, &a))
+      return enif_make_badarg(env);
+   if (!erl2blas_matrix(env, argv[5], trans ? m : n, 1, &x))
+      return enif_make_badarg(env);
+   return blas_schedule(
+      env,
+      "blas_sgemv",
+      (long)m * n,
+      &blas_sgemv_run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: blas_sgemv_run >------------------------------------
+// Purpose:    computes a validated sgemv (see nif_blas_sgemv)
+// Parameters: see nif_blas_sgemv
+// Returns:    see nif_blas_sgemv
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM blas_sgemv_run(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int m, n;
+   double alpha;
+   ErlNifBinary a, x, r;
+   CBLAS_TRANSPOSE trans = erl2blas_transpose(env, argv[0]);
+   enif_get_int(env, argv[1], &m);
+   enif_get_int(env, argv[2], &n);
+   enif_get_double(env, argv[3], &alpha);
+   enif_inspect_binary(env, argv[4], &a);
+   enif_inspect_binary(env, argv[5], &x);
+   // allocate the result, which blas will overwrite
+   int size = trans == CblasTrans ? n : m;
+   if (!enif_alloc_binary(size * sizeof(float), &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   memset(r.data, 0, r.size);
+   // perform the vectorized computation
+   if (m > 0 && n > 0)
+      cblas_sgemv(
+         CblasRowMajor,
+         trans,
+         m,
+         n,
+         alpha,
+         (float*)a.data,
+         n,
+         (float*)x.data,
+         1,
+         0,
+         (float*)r.data,
+         1);
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_sgemm >------------------------------------
+// Purpose:    BLAS sgemm wrapper
+//             computes C = a op(A) op(B), for row-major matrices, where
+//             op optionally transposes its matrix
+// Parameters: trans_a - transpose A? (boolean)
+//             trans_b - transpose B? (boolean)
+//             m       - number of rows in op(A) and C (integer)
+//             n       - number of columns in op(B) and C (integer)
+//             k       - number of columns in op(A)/rows in op(B) (integer)
+//             alpha   - scalar to multiply (float)
+//             a       - m x k matrix (k x m if transposed)
+//             b       - k x n matrix (n x k if transposed)
+// Returns:    the m x n result (binary float matrix)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_sgemm(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int m, n, k;
+   double alpha;
+   ErlNifBinary a, b;
+   // validate parameters
+   if (!enif_is_atom(env, argv[0]) || !enif_is_atom(env, argv[1]))
+      return enif_make_badarg(env);
+   bool trans_a = erl2blas_transpose(env, argv[0]) == CblasTrans;
+   bool trans_b = erl2blas_transpose(env, argv[1]) == CblasTrans;
+   if (!enif_get_int(env, argv[2], &m) || m < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_int(env, argv[3], &n) || n < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_int(env, argv[4], &k) || k < 0)
+      return enif_make_badarg(env);
+   if (!enif_get_double(env, argv[5], &alpha))
+      return enif_make_badarg(env);
+   if (!erl2blas_matrix(env, argv[6], trans_a ? k : m, trans_a ? m : k, &a))
+      return enif_make_badarg(env);
+   if (!erl2blas_matrix(env, argv[7], trans_b ? n : k, trans_b ? k : n, &b))
+      return enif_make_badarg(env);
+   return blas_schedule(
+      env,
+      "blas_sgemm",
+      (long)m * n * k,
+      &blas_sgemm_run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: blas_sgemm_run >------------------------------------
+// Purpose:    computes a validated sgemm (see nif_blas_sgemm)
+// Parameters: see nif_blas_sgemm
+// Returns:    see nif_blas_sgemm
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM blas_sgemm_run(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int m, n, k;
+   double alpha;
+   ErlNifBinary a, b, r;
+   CBLAS_TRANSPOSE trans_a = erl2blas_transpose(env, argv[0]);
+   CBLAS_TRANSPOSE trans_b = erl2blas_transpose(env, argv[1]);
+   enif_get_int(env, argv[2], &m);
+   enif_get_int(env, argv[3], &n);
+   enif_get_int(env, argv[4], &k);
+   enif_get_double(env, argv[5], &alpha);
+   enif_inspect_binary(env, argv[6], &a);
+   enif_inspect_binary(env, argv[7], &b);
+   // allocate the result, which blas will overwrite
+   if (!enif_alloc_binary((size_t)m * n * sizeof(float), &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   memset(r.data, 0, r.size);
+   // perform the vectorized computation
+   if (m > 0 && n > 0 && k > 0)
+      cblas_sgemm(
+         CblasRowMajor,
+         trans_a,
+         trans_b,
+         m,
+         n,
+         k,
+         alpha,
+         (float*)a.data,
+         trans_a == CblasTrans ? m : k,
+         (float*)b.data,
+         trans_b == CblasTrans ? k : n,
+         0,
+         (float*)r.data,
+         n);
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_cosine >-----------------------------------
+// Purpose:    computes the cosine similarity between a vector and each row
+//             of a row-major matrix
+//             rows (or vectors) with zero norm have zero similarity
+// Parameters: a - m x n matrix (binary float matrix)
+//             x - vector of length n (binary float vector)
+// Returns:    the m similarities (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_cosine(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary a, x;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[0], &a))
+      return enif_make_badarg(env);
+   if (!enif_inspect_binary(env, argv[1], &x) || x.size == 0)
+      return enif_make_badarg(env);
+   if (a.size % x.size != 0)
+      return enif_make_badarg(env);
+   return blas_schedule(
+      env,
+      "blas_cosine",
+      (long)(a.size / sizeof(float)),
+      &blas_cosine_run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: blas_cosine_run >-----------------------------------
+// Purpose:    computes validated cosine similarities (see nif_blas_cosine)
+// Parameters: see nif_blas_cosine
+// Returns:    see nif_blas_cosine
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM blas_cosine_run(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary a, x, r;
+   enif_inspect_binary(env, argv[0], &a);
+   enif_inspect_binary(env, argv[1], &x);
+   int n = x.size / sizeof(float);
+   int m = a.size / x.size;
+   // compute the dot products with a single matrix-vector product
+   if (!enif_alloc_binary(m * sizeof(float), &r))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   float* cosine = (float*)r.data;
+   memset(cosine, 0, r.size);
+   if (m > 0)
+      cblas_sgemv(
+         CblasRowMajor,
+         CblasNoTrans,
+         m,
+         n,
+         1,
+         (float*)a.data,
+         n,
+         (float*)x.data,
+         1,
+         0,
+         cosine,
+         1);
+   // normalize by the vector/row norms
+   float norm = cblas_snrm2(n, (float*)x.data, 1);
+   for (int i = 0; i < m; i++) {
+      float row = cblas_snrm2(n, (float*)a.data + (size_t)i * n, 1);
+      cosine[i] = norm > 0 && row > 0 ? cosine[i] / (norm * row) : 0;
+   }
+   return enif_make_binary(env, &r);
+}
+/*-----------< FUNCTION: nif_blas_acc_new >----------------------------------
+// Purpose:    creates a vector accumulator
+// Parameters: init - initial vector (binary float vector), or the vector
+//                    length (integer) for a zero vector
+// Returns:    reference to the accumulator resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_new(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   int n;
+   ErlNifBinary x;
+   bool copy = enif_inspect_binary(env, argv[0], &x);
+   // validate parameters
+   if (copy)
+      n = x.size / sizeof(float);
+   else if (!enif_get_int(env, argv[0], &n) || n < 0)
+      return enif_make_badarg(env);
+   // create the accumulator resource
+   BLAS_ACC* acc = (BLAS_ACC*)enif_alloc_resource(g_acc_type, sizeof(BLAS_ACC));
+   if (!acc)
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   memset(acc, 0, sizeof(*acc));
+   acc->frozen = true;
+   ERL_NIF_TERM result = enif_make_resource(env, acc);
+   enif_release_resource(acc);
+   // allocate/initialize the buffer
+   acc->lock = enif_mutex_create((char*)"blas_acc");
+   if (!acc->lock || !enif_alloc_binary(n * sizeof(float), &acc->buffer))
+      return enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   acc->frozen = false;
+   if (copy)
+      memcpy(acc->buffer.data, x.data, acc->buffer.size);
+   else
+      memset(acc->buffer.data, 0, acc->buffer.size);
+   return result;
+}
+/*-----------< FUNCTION: nif_blas_acc_axpy >---------------------------------
+// Purpose:    accumulates a scaled vector in place
+//             computes acc = ax + acc
+// Parameters: acc - accumulator reference
+//             a   - scalar to multiply (float)
+//             x   - vector to add (binary float vector)
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_axpy(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   double a;
+   ErlNifBinary x;
+   // validate parameters
+   if (!enif_get_double(env, argv[1], &a))
+      return enif_make_badarg(env);
+   if (!enif_inspect_binary(env, argv[2], &x))
+      return enif_make_badarg(env);
+   BLAS_ACC* acc = blas_acc_lock(env, argv[0]);
+   if (!acc)
+      return enif_make_badarg(env);
+   ERL_NIF_TERM result = enif_make_atom(env, "ok");
+   if (x.size == acc->buffer.size)
+      cblas_saxpy(
+         x.size / sizeof(float),
+         a,
+         (float*)x.data,
+         1,
+         (float*)acc->buffer.data,
+         1);
+   else
+      result = enif_make_badarg(env);
+   enif_mutex_unlock(acc->lock);
+   return result;
+}
+/*-----------< FUNCTION: nif_blas_acc_scale >--------------------------------
+// Purpose:    scales an accumulator in place
+//             computes acc = a acc
+// Parameters: acc - accumulator reference
+//             a   - scalar to multiply (float)
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_scale(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   double a;
+   // validate parameters
+   if (!enif_get_double(env, argv[1], &a))
+      return enif_make_badarg(env);
+   BLAS_ACC* acc = blas_acc_lock(env, argv[0]);
+   if (!acc)
+      return enif_make_badarg(env);
+   cblas_sscal(
+      acc->buffer.size / sizeof(float),
+      a,
+      (float*)acc->buffer.data,
+      1);
+   enif_mutex_unlock(acc->lock);
+   return enif_make_atom(env, "ok");
+}
+/*-----------< FUNCTION: nif_blas_acc_add_many >-----------------------------
+// Purpose:    accumulates a list of vectors in place
+//             the list is validated before any vector is added
+// Parameters: acc     - accumulator reference
+//             vectors - list of vectors to add (binary float vectors)
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_add_many(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ERL_NIF_TERM head;
+   ERL_NIF_TERM tail;
+   ErlNifBinary x;
+   // validate parameters
+   if (!enif_is_list(env, argv[1]))
+      return enif_make_badarg(env);
+   BLAS_ACC* acc = blas_acc_lock(env, argv[0]);
+   if (!acc)
+      return enif_make_badarg(env);
+   ERL_NIF_TERM result = enif_make_atom(env, "ok");
+   for (tail = argv[1]; enif_get_list_cell(env, tail, &head, &tail); )
+      if (!enif_inspect_binary(env, head, &x) || x.size != acc->buffer.size)
+         result = enif_make_badarg(env);
+   if (enif_is_atom(env, result))
+      for (tail = argv[1]; enif_get_list_cell(env, tail, &head, &tail); ) {
+         enif_inspect_binary(env, head, &x);
+         cblas_saxpy(
+            x.size / sizeof(float),
+            1,
+            (float*)x.data,
+            1,
+            (float*)acc->buffer.data,
+            1);
+      }
+   enif_mutex_unlock(acc->lock);
+   return result;
+}
+/*-----------< FUNCTION: nif_blas_acc_read >---------------------------------
+// Purpose:    copies the current value of an accumulator
+// Parameters: acc - accumulator reference
+// Returns:    the accumulated vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_read(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary r;
+   BLAS_ACC* acc = blas_acc_lock(env, argv[0]);
+   if (!acc)
+      return enif_make_badarg(env);
+   ERL_NIF_TERM result;
+   if (enif_alloc_binary(acc->buffer.size, &r)) {
+      memcpy(r.data, acc->buffer.data, r.size);
+      result = enif_make_binary(env, &r);
+   } else
+      result = enif_raise_exception(env, enif_make_atom(env, "alloc_failed"));
+   enif_mutex_unlock(acc->lock);
+   return result;
+}
+/*-----------< FUNCTION: nif_blas_acc_freeze >-------------------------------
+// Purpose:    relinquishes the accumulator buffer to erlang as a binary,
+//             without a copy
+//             the accumulator can no longer be used after it is frozen
+// Parameters: acc - accumulator reference
+// Returns:    the accumulated vector (binary float vector)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_blas_acc_freeze(
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   BLAS_ACC* acc = blas_acc_lock(env, argv[0]);
+   if (!acc)
+      return enif_make_badarg(env);
+   ERL_NIF_TERM result = enif_make_binary(env, &acc->buffer);
+   acc->frozen = true;
+   enif_mutex_unlock(acc->lock);
+   return result;
+}
+/*-----------< FUNCTION: nif_destruct_acc >----------------------------------
+// Purpose:    frees the memory associated with a vector accumulator
+// Parameters: env    - current erlang environment
+//             object - accumulator resource to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_acc (ErlNifEnv* env, void* object)
+{
+   BLAS_ACC* acc = (BLAS_ACC*)object;
+   if (!acc->frozen)
+      enif_release_binary(&acc->buffer);
+   if (acc->lock)
+      enif_mutex_destroy(acc->lock);
+}
+/*-----------< FUNCTION: blas_acc_lock >-------------------------------------
+// Purpose:    retrieves and locks a vector accumulator
+// Parameters: env  - current erlang environment
+//             term - accumulator reference
+// Returns:    the locked accumulator, or NULL if the term is not an
+//             accumulator or the accumulator is frozen
+---------------------------------------------------------------------------*/
+BLAS_ACC* blas_acc_lock (ErlNifEnv* env, ERL_NIF_TERM term)
+{
+   BLAS_ACC* acc = NULL;
+   if (!enif_get_resource(env, term, g_acc_type, (void**)&acc))
+      return NULL;
+   enif_mutex_lock(acc->lock);
+   if (acc->frozen) {
+      enif_mutex_unlock(acc->lock);
+      return NULL;
+   }
+   return acc;
+}
+/*-----------< FUNCTION: blas_schedule >-------------------------------------
+// Purpose:    runs a validated matrix operation, inline if it is small, or
+//             rescheduled onto a dirty CPU scheduler otherwise
+// Parameters: env  - current erlang environment
+//             name - nif name, for the rescheduled call
+//             work - number of multiply-adds in the operation
+//             run  - operation implementation
+//             argc - number of nif arguments
+//             argv - nif arguments
+// Returns:    the operation result
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM blas_schedule (
+   ErlNifEnv*         env,
+   const char*        name,
+   long               work,
+   BLAS_NIF           run,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   if (work < BLAS_DIRTY_WORK)
+      return run(env, argc, argv);
+   return enif_schedule_nif(
+      env,
+      name,
+      ERL_NIF_DIRTY_JOB_CPU_BOUND,
+      run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: erl2blas_matrix >-----------------------------------
+// Purpose:    retrieves a row-major matrix of a given shape
+// Parameters: env    - current erlang environment
+//             term   - matrix binary
+//             rows   - expected number of rows
+//             cols   - expected number of columns
+//             matrix - return the matrix binary via here
+// Returns:    true if the matrix has the expected shape, false otherwise
+---------------------------------------------------------------------------*/
+bool erl2blas_matrix (
+   ErlNifEnv*    env,
+   ERL_NIF_TERM  term,
+   long          rows,
+   long          cols,
+   ErlNifBinary* matrix)
+{
+   return enif_inspect_binary(env, term, matrix) &&
+      matrix->size == (size_t)(rows * cols) * sizeof(float);
+}
+/*-----------< FUNCTION: erl2blas_transpose >--------------------------------
+// Purpose:    converts an erlang transpose flag to its blas constant
+// Parameters: env  - current erlang environment
+//             term - transpose flag (boolean atom)
+// Returns:    CblasTrans if the flag is true, CblasNoTrans otherwise
+---------------------------------------------------------------------------*/
+CBLAS_TRANSPOSE erl2blas_transpose (ErlNifEnv* env, ERL_NIF_TERM term)
+{
+   return enif_is_identical(term, enif_make_atom(env, "true"))
+      ? CblasTrans
+      : CblasNoTrans;
+}
+/*-----------< FUNCTION: erl2blas_float >------------------------------------
+// Purpose:    converts an erlang number to a vector element
+// Parameters: env   - current erlang environment
+//             term  - float, integer, or :NaN (encoded as g_nan)
+//             value - return the element value via here
+// Returns:    true if the term was converted, false otherwise
+---------------------------------------------------------------------------*/
+bool erl2blas_float (ErlNifEnv* env, ERL_NIF_TERM term, float* value)
+{
+   double d;
+   ErlNifSInt64 i;
+   if (enif_get_double(env, term, &d))
+      *value = (float)d;
+   else if (enif_get_int64(env, term, &i))
+      *value = (float)i;
+   else if (enif_is_identical(term, enif_make_atom(env, "NaN")))
+      memcpy(value, g_nan, sizeof(float));
+   else
+      return false;
+   return true;
+}
@@ -8,17 +8,24 @@
  ***************************************************************************/
 /*-------------------[       Pre Include Defines       ]-------------------*/
 /*-------------------[      Library Include Files      ]-------------------*/
+#include <ctype.h>
 #include <math.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <unordered_map>
 /*-------------------[      Project Include Files      ]-------------------*/
-#include "deps/crfsuite/include/crfsuite.h"
-#include "penelope.hpp"
+#include "crf.hpp"
+#include "job.hpp"
 /*-------------------[      Macros/Constants/Types     ]-------------------*/
-typedef struct tagCrfModel {
-   char              path[PATH_MAX + 1];
-   crfsuite_model_t* crf;
-} CRF_MODEL;
+// training instance index, for collapsing duplicates (hash -> instance)
+typedef std::unordered_multimap<uint64_t, int> CRF_INSTANCE_INDEX;
+typedef void (*CRF_DATA_LOADER)(
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM  argv[],
+   crfsuite_data_t*    data,
+   CRF_INSTANCE_INDEX* index);
 /*-------------------[        Global Variables         ]-------------------*/
 /*-------------------[        Global Prototypes        ]-------------------*/
 /*-------------------[        Module Variables         ]-------------------*/
@@ -27,6 +34,18 @@ static ErlNifResourceType* g_model_type = NULL;
 static void nif_destruct_model (
    ErlNifEnv* env,
    void*      object);
+static ERL_NIF_TERM crf_train_nif (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM  argv[],
+   const ERL_NIF_TERM& options,
+   CRF_DATA_LOADER     load);
+static ERL_NIF_TERM crf_train_job (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[]);
+static int crf_job_callback (
+   void*       instance,
+   const char* format,
+   va_list     args);
 static crfsuite_trainer_t* erl2crf_trainer (
    ErlNifEnv*          env,
    const ERL_NIF_TERM& options);
@@ -34,6 +53,68 @@ static void erl2crf_params (
    ErlNifEnv*          env,
    const ERL_NIF_TERM& options,
    crfsuite_trainer_t* trainer);
+static bool erl2crf_decoder (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options);
+static bool erl2crf_dedupe (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options);
+static int erl2crf_threads (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options);
+static void erl2crf_stopping (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   crfsuite_data_t*    data,
+   CRF_STOPPING*       stopping);
+static void crf_holdout_split (
+   crfsuite_data_t* data,
+   double           fraction);
+static void erl2crf_decode (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   CRF_MODEL*          model);
+static void crf_iob_constraints (
+   const CRF_MODEL* model,
+   bool*            allowed,
+   bool*            start);
+static int crf_label_id (
+   ErlNifEnv*          env,
+   const CRF_MODEL*    model,
+   const ERL_NIF_TERM& label);
+static ERL_NIF_TERM crf2erl_constraints (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model);
+static ERL_NIF_TERM crf2erl_decode (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model);
+static void erl2crf_update (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   CRF_UPDATE_PARAMS*  params);
+static void crf_train_model (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   crfsuite_trainer_t* trainer,
+   crfsuite_data_t*    data,
+   const CRF_STOPPING* stopping,
+   const char*         path);
+static void crf_load_model (
+   CRF_MODEL* model,
+   bool       native);
+static double crf_prune_agreement (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model,
+   const CRF_MODEL* pruned,
+   ERL_NIF_TERM     sample);
+static ERL_NIF_TERM crf_predict_labels (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model,
+   ERL_NIF_TERM     x);
+static long crf_file_size (
+   const char* path);
+static int crf_cache_capacity (
+   const CRF_MODEL* model);
 static void erl2crf_param_bool(
    ErlNifEnv*          erl_env,
    const ERL_NIF_TERM& erl_params,
@@ -58,11 +139,42 @@ static void erl2crf_param_string(
    const char*         erl_name,
    crfsuite_params_t*  crf_params,
    const char*         crf_name = NULL);
+static void erl2crf_list_data(
+   ErlNifEnv*          erl_env,
+   const ERL_NIF_TERM  argv[],
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index);
+static void erl2crf_file_data(
+   ErlNifEnv*          erl_env,
+   const ERL_NIF_TERM  argv[],
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index);
+static void crf_data_append(
+   crfsuite_data_t*     crf_data,
+   crfsuite_instance_t* crf_instance,
+   CRF_INSTANCE_INDEX*  index);
+static uint64_t crf_instance_hash(
+   const crfsuite_instance_t* crf_instance);
+static bool crf_instance_equal(
+   const crfsuite_instance_t* a,
+   const crfsuite_instance_t* b);
+static void crf_read_file_field(
+   char*                  field,
+   crfsuite_dictionary_t* crf_attrs,
+   crfsuite_item_t*       crf_item);
 static void erl2crf_train_data(
-   ErlNifEnv*       erl_env,
-   ERL_NIF_TERM     x,
-   ERL_NIF_TERM     y,
-   crfsuite_data_t* data);
+   ErlNifEnv*          erl_env,
+   ERL_NIF_TERM        x,
+   ERL_NIF_TERM        y,
+   crfsuite_data_t*    data,
+   CRF_INSTANCE_INDEX* index);
+static void erl2crf_append_data(
+   ErlNifEnv*          erl_env,
+   ERL_NIF_TERM        x,
+   ERL_NIF_TERM        y,
+   int                 group,
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index);
 static void erl2crf_train_instance(
    ErlNifEnv*             erl_env,
    ERL_NIF_TERM           x_i,
@@ -75,6 +187,11 @@ static void erl2crf_predict_instance(
    ERL_NIF_TERM           x_i,
    crfsuite_dictionary_t* crf_attrs,
    crfsuite_instance_t*   crf_instance);
+static void erl2crf_shared_features(
+   ErlNifEnv*             erl_env,
+   const ERL_NIF_TERM&    erl_features,
+   crfsuite_dictionary_t* crf_attrs,
+   crfsuite_item_t*       crf_item);
 static void erl2crf_features(
    ErlNifEnv*             erl_env,
    const ERL_NIF_TERM&    erl_features,
@@ -101,11 +218,13 @@ static void erl2crf_free_model (
    CRF_MODEL* model);
 static int crf_create_file(
    char* path);
+static void crf_load_labels (
+   CRF_MODEL* model);
 static ERL_NIF_TERM crf2erl_labels(
-   ErlNifEnv*             erl_env,
-   crfsuite_dictionary_t* crf_labels,
-   int*                   crf_path,
-   int                    n);
+   ErlNifEnv*       erl_env,
+   const CRF_MODEL* model,
+   int*             crf_path,
+   int              n);
 /*-------------------[         Implementation          ]-------------------*/
 static int message_callback(void *instance, const char *_format, va_list args)
 {
@@ -114,7 +233,8 @@ static int message_callback(void *instance, const char *_format, va_list args)
    if (strlen(format) == 1 && strncmp(format, "\n", 1) == 0)
       printf("\r\n");
    else if (format != NULL) {
-      char *token = strtok(format, "\r\n");
+      char *save = NULL;
+      char *token = strtok_r(format, "\r\n", &save);
 
       while (token) {
          if (*token) {
@@ -125,7 +245,7 @@ static int message_callback(void *instance, const char *_format, va_list args)
             }
          }
 
-         token = strtok(NULL, "\r\n");
+         token = strtok_r(NULL, "\r\n", &save);
       }
 
       fflush(stdout);
@@ -155,6 +275,8 @@ int nif_crf_init (ErlNifEnv* env)
       &flags);
    if (!g_model_type)
       return 0;
+   // select the native decoder kernels for this cpu
+   crf_decoder_init();
    return 1;
 }
 /*-----------< FUNCTION: nif_crf_train >-------------------------------------
@@ -176,50 +298,70 @@ ERL_NIF_TERM nif_crf_train (
       return enif_make_badarg(env);
    if (!enif_is_map(env, argv[2]))
       return enif_make_badarg(env);
-   // train the CRF model
-   crfsuite_trainer_t* trainer  = NULL;
-   CRF_MODEL* model = NULL;
-   ERL_NIF_TERM result;
    try {
-      // allocate and configure the model trainer
-      trainer = erl2crf_trainer(env, argv[2]);
-      erl2crf_params(env, argv[2], trainer);
-      // allocate a new model instance and file
-      model = nif_alloc<CRF_MODEL>();
-      close(crf_create_file(model->path));
-      // build the training data structure and train the model
-      crfsuite_data_t train_data;
-      try {
-         erl2crf_train_data(env, argv[0], argv[1], &train_data);
-         CHECK(trainer->train(trainer, &train_data, model->path, -1) == 0,
-            "train_failed");
-         erl2crf_free_train_data(&train_data);
-      } catch (NifError& e) {
-         erl2crf_free_train_data(&train_data);
-         throw;
-      }
-      // load the CRF model from the model file
-      CHECK(crfsuite_create_instance_from_file(
-            model->path,
-            (void**)&model->crf) == 0,
-         "load_failed");
-      // create an erlang resource for the model
-      CRF_MODEL** resource = (CRF_MODEL**)CHECKALLOC(enif_alloc_resource(
-         g_model_type,
-         sizeof(CRF_MODEL*)));
-      *resource = model;
-      // relinquish the model resource to erlang
-      result = enif_make_resource(env, resource);
-      enif_release_resource(resource);
+      return crf_train_nif(env, argv, argv[2], &erl2crf_list_data);
    } catch (NifError& e) {
-      if (model != NULL)
-         erl2crf_free_model(model);
-      result = e.to_term(env);
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_crf_train_async >-------------------------------
+// Purpose:    trains a CRF model on a background job thread
+//             L-BFGS training reports progress and can be cancelled after
+//             each iteration, while the other algorithms report progress
+//             per epoch, but can only be cancelled once training completes
+//             (crfsuite ignores the log callback's result, so there is no
+//             way to stop its trainers early)
+// Parameters: x      - list of list of features (map)
+//             y      - list of list of labels (string)
+//             params - map of CRF parameters
+// Returns:    reference to the training job resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_train_async (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   if (!enif_is_list(env, argv[0]))
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[1]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[2]))
+      return enif_make_badarg(env);
+   // start the training job
+   return nif_job_start(env, argc, argv, &crf_train_job);
+}
+/*-----------< FUNCTION: nif_crf_train_file >--------------------------------
+// Purpose:    trains a CRF model from a crfsuite-format training file,
+//             which is streamed directly into the crfsuite data structure
+//
+//             each line contains a label followed by tab-separated
+//             attributes (name or name:value, with ':' and '\' escaped
+//             by '\'), sequences are separated by blank lines, and an
+//             optional "@weight:<value>" line sets the sequence weight
+// Parameters: path   - path to the training file (string)
+//             params - map of CRF parameters
+// Returns:    reference to a trained CRF model resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_train_file (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   if (!enif_is_binary(env, argv[0]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[1]))
+      return enif_make_badarg(env);
+   try {
+      return crf_train_nif(env, argv, argv[1], &erl2crf_file_data);
+   } catch (NifError& e) {
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      return NifError("alloc_failed").to_term(env);
    }
-   // clean up
-   if (trainer != NULL)
-      trainer->release(trainer);
-   return result;
 }
 /*-----------< FUNCTION: nif_crf_export >------------------------------------
 // Purpose:    extracts model parameters from a CRF resource,
@@ -256,8 +398,27 @@ ERL_NIF_TERM nif_crf_export (
       // add the model buffer to a map
       ERL_NIF_TERM key   = enif_make_atom(env, "model");
       ERL_NIF_TERM value = enif_make_binary(env, &buffer);
+      buffer.data = NULL;
       result = enif_make_new_map(env);
       CHECKALLOC(enif_make_map_put(env, result, key, value, &result));
+      // add the decoder selection
+      key   = enif_make_atom(env, "decoder");
+      value = enif_make_atom(
+         env,
+         (*resource)->decoder != NULL ? "native" : "crfsuite");
+      CHECKALLOC(enif_make_map_put(env, result, key, value, &result));
+      // add the decoding options
+      key   = enif_make_atom(env, "constraints");
+      value = crf2erl_constraints(env, *resource);
+      CHECKALLOC(enif_make_map_put(env, result, key, value, &result));
+      key   = enif_make_atom(env, "beam");
+      value = enif_make_int(
+         env,
+         (*resource)->decoder != NULL ? (*resource)->decoder->beam : 0);
+      CHECKALLOC(enif_make_map_put(env, result, key, value, &result));
+      key   = enif_make_atom(env, "state_cache");
+      value = enif_make_int(env, crf_cache_capacity(*resource));
+      CHECKALLOC(enif_make_map_put(env, result, key, value, &result));
    } catch (NifError& e) {
       if (buffer.data)
          enif_release_binary(&buffer);
@@ -300,10 +461,8 @@ ERL_NIF_TERM nif_crf_compile (
          "store_failed");
       fflush(file);
       // load the CRF model from the model file
-      CHECK(crfsuite_create_instance_from_file(
-            model->path,
-            (void**)&model->crf) == 0,
-         "load_failed");
+      crf_load_model(model, erl2crf_decoder(env, argv[0]));
+      erl2crf_decode(env, argv[0], model);
       // create an erlang resource for the model
       CRF_MODEL** resource = (CRF_MODEL**)CHECKALLOC(enif_alloc_resource(
          g_model_type,
@@ -324,8 +483,10 @@ ERL_NIF_TERM nif_crf_compile (
 }
 /*-----------< FUNCTION: nif_crf_predict >-----------------------------------
 // Purpose:    predicts a sequence of tags from a sequence of features
-// Parameters: model - reference to the trained CRF model
-//             x     - feature sequence (list) to predict
+// Parameters: model  - reference to the trained CRF model
+//             x      - feature sequence (list) to predict
+//             shared - optional feature map shared by every item in the
+//                      sequence, which is resolved once per sequence
 // Returns:    a tuple containing the predicted tag sequence (list) and the
 //             probability of sequence
 ---------------------------------------------------------------------------*/
@@ -335,55 +496,413 @@ ERL_NIF_TERM nif_crf_predict (
    const ERL_NIF_TERM argv[])
 {
    // validate parameters
-   CRF_MODEL** resource = NULL;
-   if (!enif_get_resource(env, argv[0], g_model_type, (void**)&resource))
+   CRF_MODEL* model = crf_model_resource(env, argv[0]);
+   if (model == NULL)
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[1]))
       return enif_make_badarg(env);
-   CRF_MODEL* model = *resource;
-   ERL_NIF_TERM x = argv[1];
-   unsigned n;
-   CHECK(enif_get_list_length(env, x, &n), "invalid_x");
    // generate a model prediction from the source sequence
    crfsuite_dictionary_t* crf_attrs = NULL;
-   crfsuite_dictionary_t* crf_labels = NULL;
-   crfsuite_tagger_t* crf_tagger = NULL;
    crfsuite_instance_t crf_instance;
-   int* path = NULL;
+   crfsuite_item_t crf_shared;
    ERL_NIF_TERM result;
    try {
       crfsuite_instance_init(&crf_instance);
-      // create a new stateful tagger
+      crfsuite_item_init(&crf_shared);
+      // retrieve the model attribute dictionary
+      CHECKALLOC(model->crf->get_attrs(model->crf, &crf_attrs) == 0);
+      // transfer the source sequence to a CRF instance
+      erl2crf_predict_instance(env, argv[1], crf_attrs, &crf_instance);
+      if (argc > 2)
+         erl2crf_shared_features(env, argv[2], crf_attrs, &crf_shared);
+      result = crf_predict_instance(env, model, &crf_instance, &crf_shared);
+   } catch (NifError& e) {
+      result = e.to_term(env);
+   }
+   // clean up
+   if (crf_attrs != NULL)
+      crf_attrs->release(crf_attrs);
+   crfsuite_instance_finish(&crf_instance);
+   crfsuite_item_finish(&crf_shared);
+   return result;
+}
+/*-----------< FUNCTION: nif_crf_prune >-------------------------------------
+// Purpose:    compacts a CRF model, by removing features whose weight
+//             magnitudes are below a threshold and attributes left without
+//             any features, and compares its predictions to the original
+// Parameters: model     - reference to the trained CRF model
+//             threshold - minimum feature weight magnitude to keep
+//             sample    - list of feature sequences used to measure the
+//                         agreement between the original/pruned models
+// Returns:    a tuple containing a reference to the pruned model and a
+//             map of size/agreement statistics
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_prune (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   CRF_MODEL* model = crf_model_resource(env, argv[0]);
+   if (model == NULL)
+      return enif_make_badarg(env);
+   double threshold;
+   if (!enif_get_double(env, argv[1], &threshold) || threshold < 0)
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[2]))
+      return enif_make_badarg(env);
+   // prune the model into a new model file
+   CRF_MODEL* pruned = NULL;
+   ERL_NIF_TERM result;
+   try {
+      pruned = nif_alloc<CRF_MODEL>();
+      close(crf_create_file(pruned->path));
+      CRF_PRUNE_STATS stats;
+      crf_prune_model(model->path, pruned->path, threshold, &stats);
+      // load the pruned model, with the original decoding options
+      crf_load_model(pruned, model->decoder != NULL);
+      erl2crf_decode(env, crf2erl_decode(env, model), pruned);
+      // compare the pruned model to the original
+      double agreement = crf_prune_agreement(env, model, pruned, argv[2]);
+      // report the pruning statistics
+      const char* keys[] = {
+         "features_before",
+         "features_after",
+         "attrs_before",
+         "attrs_after",
+         "bytes_before",
+         "bytes_after",
+         "agreement"
+      };
+      ERL_NIF_TERM values[] = {
+         enif_make_int(env, stats.num_features),
+         enif_make_int(env, stats.pruned_features),
+         enif_make_int(env, stats.num_attrs),
+         enif_make_int(env, stats.pruned_attrs),
+         enif_make_long(env, crf_file_size(model->path)),
+         enif_make_long(env, crf_file_size(pruned->path)),
+         enif_make_double(env, agreement)
+      };
+      ERL_NIF_TERM report = enif_make_new_map(env);
+      for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+         CHECKALLOC(enif_make_map_put(
+            env,
+            report,
+            enif_make_atom(env, keys[i]),
+            values[i],
+            &report));
+      // create an erlang resource for the pruned model
+      CRF_MODEL** resource = (CRF_MODEL**)CHECKALLOC(enif_alloc_resource(
+         g_model_type,
+         sizeof(CRF_MODEL*)));
+      *resource = pruned;
+      // relinquish the model resource to erlang
+      result = enif_make_tuple2(
+         env,
+         enif_make_resource(env, resource),
+         report);
+      enif_release_resource(resource);
+   } catch (NifError& e) {
+      if (pruned != NULL)
+         erl2crf_free_model(pruned);
+      result = e.to_term(env);
+   }
+   return result;
+}
+/*-----------< FUNCTION: nif_crf_update >------------------------------------
+// Purpose:    applies online (perceptron/passive-aggressive) updates to a
+//             CRF model for a batch of labeled sequences
+//             the updated weights are written to a new model, so that the
+//             original model (and any predictions in flight on it) are
+//             unaffected; new attributes and labels are added to the model
+// Parameters: model   - reference to the trained CRF model
+//             x       - list of feature sequences
+//             y       - list of label sequences
+//             options - erlang update option map
+// Returns:    a reference to the updated model
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_update (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   CRF_MODEL* model = crf_model_resource(env, argv[0]);
+   if (model == NULL)
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[1]) || !enif_is_list(env, argv[2]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[3]))
+      return enif_make_badarg(env);
+   // update the model into a new model file
+   crfsuite_data_t data;
+   CRF_MODEL* updated = NULL;
+   ERL_NIF_TERM result;
+   crfsuite_data_init(&data);
+   try {
+      CRF_UPDATE_PARAMS params;
+      erl2crf_update(env, argv[3], &params);
+      erl2crf_train_data(env, argv[1], argv[2], &data, NULL);
+      updated = nif_alloc<CRF_MODEL>();
+      close(crf_create_file(updated->path));
+      crf_update_model(model->path, updated->path, &data, &params);
+      // load the updated model, with the original decoding options
+      crf_load_model(updated, model->decoder != NULL);
+      erl2crf_decode(env, crf2erl_decode(env, model), updated);
+      // create an erlang resource for the updated model
+      CRF_MODEL** resource = (CRF_MODEL**)CHECKALLOC(enif_alloc_resource(
+         g_model_type,
+         sizeof(CRF_MODEL*)));
+      *resource = updated;
+      // relinquish the model resource to erlang
+      result = enif_make_resource(env, resource);
+      enif_release_resource(resource);
+   } catch (NifError& e) {
+      if (updated != NULL)
+         erl2crf_free_model(updated);
+      result = e.to_term(env);
+   }
+   erl2crf_free_train_data(&data);
+   return result;
+}
+/*-----------< FUNCTION: erl2crf_update >------------------------------------
+// Purpose:    retrieves the online update parameters from an option map
+// Parameters: env     - current erlang environment
+//             options - erlang update option map
+//             params  - return the update parameters via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_update (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   CRF_UPDATE_PARAMS*  params)
+{
+   ERL_NIF_TERM value;
+   params->algorithm = CRF_UPDATE_PA;
+   params->c         = 1.0;
+   params->epochs    = 1;
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "algorithm"),
+         &value)) {
+      if (enif_is_identical(value, enif_make_atom(env, "perceptron")))
+         params->algorithm = CRF_UPDATE_PERCEPTRON;
+      else
+         CHECK(enif_is_identical(value, enif_make_atom(env, "pa")),
+            "invalid_algorithm");
+   }
+   if (enif_get_map_value(env, options, enif_make_atom(env, "c"), &value))
+      CHECK(enif_get_double(env, value, &params->c) && params->c > 0,
+         "invalid_c");
+   if (enif_get_map_value(env, options, enif_make_atom(env, "epochs"), &value))
+      CHECK(enif_get_int(env, value, &params->epochs) && params->epochs > 0,
+         "invalid_epochs");
+}
+/*-----------< FUNCTION: crf_prune_agreement >-------------------------------
+// Purpose:    measures the label agreement between a model and its pruned
+//             copy over a sample of feature sequences
+// Parameters: env    - current erlang environment
+//             model  - original CRF model
+//             pruned - pruned CRF model
+//             sample - list of feature sequences
+// Returns:    the fraction of sample items whose predicted labels match
+//             (1.0 for an empty sample)
+---------------------------------------------------------------------------*/
+double crf_prune_agreement (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model,
+   const CRF_MODEL* pruned,
+   ERL_NIF_TERM     sample)
+{
+   long total = 0;
+   long agree = 0;
+   ERL_NIF_TERM x;
+   while (enif_get_list_cell(env, sample, &x, &sample)) {
+      ERL_NIF_TERM expect = crf_predict_labels(env, model, x);
+      ERL_NIF_TERM actual = crf_predict_labels(env, pruned, x);
+      ERL_NIF_TERM e;
+      ERL_NIF_TERM a;
+      while (enif_get_list_cell(env, expect, &e, &expect) &&
+             enif_get_list_cell(env, actual, &a, &actual)) {
+         agree += enif_is_identical(e, a);
+         total++;
+      }
+   }
+   return total > 0 ? (double)agree / total : 1.0;
+}
+/*-----------< FUNCTION: crf_predict_labels >--------------------------------
+// Purpose:    predicts the label sequence for a feature sequence
+// Parameters: env   - current erlang environment
+//             model - CRF model
+//             x     - feature sequence (list)
+// Returns:    the predicted label sequence (list)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf_predict_labels (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model,
+   ERL_NIF_TERM     x)
+{
+   crfsuite_dictionary_t* crf_attrs = NULL;
+   crfsuite_instance_t crf_instance;
+   ERL_NIF_TERM result;
+   crfsuite_instance_init(&crf_instance);
+   try {
       CHECKALLOC(model->crf->get_attrs(model->crf, &crf_attrs) == 0);
-      CHECKALLOC(model->crf->get_labels(model->crf, &crf_labels) == 0);
-      CHECKALLOC(model->crf->get_tagger(model->crf, &crf_tagger) == 0);
-      // transfer the sequence to the tagger
       erl2crf_predict_instance(env, x, crf_attrs, &crf_instance);
-      CHECKALLOC(crf_tagger->set(crf_tagger, &crf_instance) == 0);
+      const ERL_NIF_TERM* tuple;
+      int arity;
+      enif_get_tuple(
+         env,
+         crf_predict_instance(env, model, &crf_instance, NULL),
+         &arity,
+         &tuple);
+      result = tuple[0];
+   } catch (NifError& e) {
+      if (crf_attrs != NULL)
+         crf_attrs->release(crf_attrs);
+      crfsuite_instance_finish(&crf_instance);
+      throw;
+   }
+   crf_attrs->release(crf_attrs);
+   crfsuite_instance_finish(&crf_instance);
+   return result;
+}
+/*-----------< FUNCTION: crf_file_size >-------------------------------------
+// Purpose:    retrieves the size of a model file
+// Parameters: path - model file path
+// Returns:    the file size, in bytes
+---------------------------------------------------------------------------*/
+long crf_file_size (const char* path)
+{
+   struct stat info;
+   CHECK(stat(path, &info) == 0, "load_failed");
+   return (long)info.st_size;
+}
+/*-----------< FUNCTION: nif_crf_cache_stats >-------------------------------
+// Purpose:    retrieves the state score cache statistics of a CRF model
+// Parameters: model - reference to the CRF model
+// Returns:    map of the cache capacity, size, and hit/miss counts
+//             (all 0 if the model has no cache)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_cache_stats (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   CRF_MODEL* model = crf_model_resource(env, argv[0]);
+   if (model == NULL)
+      return enif_make_badarg(env);
+   // report the cache counters
+   CRF_CACHE_STATS stats;
+   crf_cache_stats(model->decoder ? model->decoder->cache : NULL, &stats);
+   const char* keys[] = { "capacity", "size", "hits", "misses" };
+   ERL_NIF_TERM values[] = {
+      enif_make_int(env, stats.capacity),
+      enif_make_int(env, stats.size),
+      enif_make_uint64(env, stats.hits),
+      enif_make_uint64(env, stats.misses)
+   };
+   ERL_NIF_TERM result = enif_make_new_map(env);
+   for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+      enif_make_map_put(
+         env,
+         result,
+         enif_make_atom(env, keys[i]),
+         values[i],
+         &result);
+   return result;
+}
+/*-----------< FUNCTION: crf_cache_capacity >--------------------------------
+// Purpose:    retrieves the state score cache capacity of a CRF model
+// Parameters: model - CRF model
+// Returns:    the maximum number of cached entries (0 if none)
+---------------------------------------------------------------------------*/
+int crf_cache_capacity (const CRF_MODEL* model)
+{
+   CRF_CACHE_STATS stats;
+   crf_cache_stats(model->decoder ? model->decoder->cache : NULL, &stats);
+   return stats.capacity;
+}
+/*-----------< FUNCTION: crf_model_resource >--------------------------------
+// Purpose:    retrieves the CRF model wrapped by an erlang resource
+// Parameters: env  - current erlang environment
+//             term - model resource reference
+// Returns:    pointer to the CRF model, or NULL if the term is not a model
+---------------------------------------------------------------------------*/
+CRF_MODEL* crf_model_resource (ErlNifEnv* env, ERL_NIF_TERM term)
+{
+   CRF_MODEL** resource = NULL;
+   if (!enif_get_resource(env, term, g_model_type, (void**)&resource))
+      return NULL;
+   return *resource;
+}
+/*-----------< FUNCTION: crf_predict_instance >------------------------------
+// Purpose:    predicts the label sequence for a crfsuite instance, using
+//             the native decoder if it was compiled for the model
+// Parameters: env      - current erlang environment
+//             model    - CRF model
+//             instance - crfsuite instance (attribute sequence) to tag
+//             shared   - attributes shared by every item, or NULL
+// Returns:    a tuple containing the predicted tag sequence (list) and the
+//             probability of the sequence
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf_predict_instance (
+   ErlNifEnv*             env,
+   const CRF_MODEL*       model,
+   crfsuite_instance_t*   instance,
+   const crfsuite_item_t* shared)
+{
+   int n = instance->num_items;
+   crfsuite_tagger_t* crf_tagger = NULL;
+   int* path = NULL;
+   ERL_NIF_TERM result;
+   try {
       // predict the target sequence (path) and its score/lognorm
-      path = nif_alloc<int>(n);
+      path = nif_alloc<int>(n + 1);
       double score;
       double lognorm;
-      CHECK(crf_tagger->viterbi(crf_tagger, path, &score) == 0,
-         "viterbi_failed");
-      CHECK(crf_tagger->lognorm(crf_tagger, &lognorm) == 0,
-         "lognorm_failed");
+      if (model->decoder != NULL)
+         crf_decoder_predict(
+            model->decoder,
+            instance,
+            shared,
+            path,
+            &score,
+            &lognorm);
+      else {
+         // the crfsuite tagger has no shared attribute support, so the
+         // resolved shared attributes are appended to each item
+         if (shared != NULL)
+            for (int i = 0; i < n; i++)
+               for (int c = 0; c < shared->num_contents; c++)
+                  crfsuite_item_append_attribute(
+                     &instance->items[i],
+                     &shared->contents[c]);
+         CHECKALLOC(model->crf->get_tagger(model->crf, &crf_tagger) == 0);
+         CHECKALLOC(crf_tagger->set(crf_tagger, instance) == 0);
+         CHECK(crf_tagger->viterbi(crf_tagger, path, &score) == 0,
+            "viterbi_failed");
+         CHECK(crf_tagger->lognorm(crf_tagger, &lognorm) == 0,
+            "lognorm_failed");
+      }
       CHECK(!isnan(score), "score_is_nan");
       CHECK(!isnan(lognorm), "lognorm_is_nan");
       // return the predicted sequence and its probability
       result = enif_make_tuple2(
          env,
-         crf2erl_labels(env, crf_labels, path, n),
+         crf2erl_labels(env, model, path, n),
          enif_make_double(env, exp(score - lognorm)));
    } catch (NifError& e) {
-      result = e.to_term(env);
+      if (crf_tagger != NULL)
+         crf_tagger->release(crf_tagger);
+      nif_free(path);
+      throw;
    }
    // clean up
-   if (crf_attrs != NULL)
-      crf_attrs->release(crf_attrs);
-   if (crf_labels != NULL)
-      crf_labels->release(crf_labels);
    if (crf_tagger != NULL)
       crf_tagger->release(crf_tagger);
-   crfsuite_instance_finish(&crf_instance);
    nif_free(path);
    return result;
 }
@@ -397,6 +916,92 @@ void nif_destruct_model (ErlNifEnv* env, void* object)
 {
    erl2crf_free_model(*(CRF_MODEL**)object);
 }
+/*-----------< FUNCTION: crf_train_nif >-------------------------------------
+// Purpose:    trains a CRF model resource from a training data source
+// Parameters: env     - current erlang environment
+//             argv    - nif arguments, passed to the data loader
+//             options - erlang CRF option map
+//             load    - training data loader
+// Returns:    reference to a trained CRF model resource
+//             throws a NifError on failure
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf_train_nif (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM  argv[],
+   const ERL_NIF_TERM& options,
+   CRF_DATA_LOADER     load)
+{
+   // train the CRF model
+   crfsuite_trainer_t* trainer  = NULL;
+   CRF_MODEL* model = NULL;
+   ERL_NIF_TERM result;
+   try {
+      // allocate and configure the model trainer
+      trainer = erl2crf_trainer(env, options);
+      erl2crf_params(env, options, trainer);
+      bool native = erl2crf_decoder(env, options);
+      // allocate a new model instance and file
+      model = nif_alloc<CRF_MODEL>();
+      close(crf_create_file(model->path));
+      // build the training data structure and train the model
+      crfsuite_data_t    train_data;
+      CRF_INSTANCE_INDEX index;
+      CRF_STOPPING       stopping;
+      try {
+         load(env, argv, &train_data, erl2crf_dedupe(env, options)
+            ? &index
+            : NULL);
+         erl2crf_stopping(env, options, &train_data, &stopping);
+         crf_train_model(
+            env,
+            options,
+            trainer,
+            &train_data,
+            &stopping,
+            model->path);
+         erl2crf_free_train_data(&train_data);
+      } catch (...) {
+         erl2crf_free_train_data(&train_data);
+         throw;
+      }
+      // load the CRF model from the model file
+      crf_load_model(model, native);
+      erl2crf_decode(env, options, model);
+      // create an erlang resource for the model
+      CRF_MODEL** resource = (CRF_MODEL**)CHECKALLOC(enif_alloc_resource(
+         g_model_type,
+         sizeof(CRF_MODEL*)));
+      *resource = model;
+      // relinquish the model resource to erlang
+      result = enif_make_resource(env, resource);
+      enif_release_resource(resource);
+   } catch (...) {
+      if (model != NULL)
+         erl2crf_free_model(model);
+      if (trainer != NULL)
+         trainer->release(trainer);
+      throw;
+   }
+   // clean up
+   trainer->release(trainer);
+   return result;
+}
+/*-----------< FUNCTION: crf_train_job >-------------------------------------
+// Purpose:    trains a CRF model from a training job
+// Parameters: env  - job erlang environment
+//             argv - training arguments (x, y, params)
+// Returns:    reference to a trained CRF model resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf_train_job (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[])
+{
+   try {
+      return crf_train_nif(env, argv, argv[2], &erl2crf_list_data);
+   } catch (std::bad_alloc&) {
+      throw NifError("alloc_failed");
+   }
+}
 /*-----------< FUNCTION: erl2crf_trainer >-----------------------------------
 // Purpose:    creates a initialized CRF trainer
 // Parameters: env     - current erlang environment
@@ -604,6 +1209,165 @@ void erl2crf_params (
       throw;
    }
 }
+/*-----------< FUNCTION: erl2crf_decoder >-----------------------------------
+// Purpose:    retrieves the decoder selection from an option map
+// Parameters: env     - current erlang environment
+//             options - erlang CRF option map
+// Returns:    true if the native decoder was requested
+//             false for the crfsuite decoder (the default)
+---------------------------------------------------------------------------*/
+bool erl2crf_decoder (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options)
+{
+   ERL_NIF_TERM key = enif_make_atom(env, "decoder");
+   ERL_NIF_TERM value;
+   if (!enif_get_map_value(env, options, key, &value))
+      return false;
+   if (enif_is_identical(value, enif_make_atom(env, "native")))
+      return true;
+   CHECK(enif_is_identical(value, enif_make_atom(env, "crfsuite")),
+      "invalid_decoder");
+   return false;
+}
+/*-----------< FUNCTION: erl2crf_dedupe >------------------------------------
+// Purpose:    retrieves the duplicate instance collapsing flag from an
+//             option map
+// Parameters: env     - current erlang environment
+//             options - erlang CRF option map
+// Returns:    true if duplicate training instances should be collapsed
+---------------------------------------------------------------------------*/
+bool erl2crf_dedupe (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options)
+{
+   ERL_NIF_TERM key = enif_make_atom(env, "dedupe?");
+   ERL_NIF_TERM value;
+   return enif_get_map_value(env, options, key, &value) &&
+      enif_is_identical(value, enif_make_atom(env, "true"));
+}
+/*-----------< FUNCTION: erl2crf_threads >-----------------------------------
+// Purpose:    retrieves the number of training threads from an option map
+// Parameters: env     - current erlang environment
+//             options - erlang CRF option map
+// Returns:    the number of threads (1 by default)
+---------------------------------------------------------------------------*/
+int erl2crf_threads (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options)
+{
+   ERL_NIF_TERM key = enif_make_atom(env, "threads");
+   ERL_NIF_TERM value;
+   int threads = 1;
+   if (enif_get_map_value(env, options, key, &value))
+      CHECK(enif_get_int(env, value, &threads) && threads > 0,
+         "invalid_threads");
+   return threads;
+}
+/*-----------< FUNCTION: erl2crf_stopping >----------------------------------
+// Purpose:    retrieves the early stopping options from an option map, and
+//             assigns the holdout instances
+//             the holdout is either a fraction of the training instances
+//             (selected by content hash, so that it is deterministic and
+//             duplicates stay together), or a tuple of feature/label
+//             sequence lists, which are appended to the training data
+// Parameters: env      - current erlang environment
+//             options  - erlang CRF option map
+//             data     - loaded training data
+//             stopping - return the early stopping options via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_stopping (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   crfsuite_data_t*    data,
+   CRF_STOPPING*       stopping)
+{
+   ERL_NIF_TERM value;
+   memset(stopping, 0, sizeof(*stopping));
+   stopping->holdout = -1;
+   stopping->period  = 1;
+   // retrieve the holdout set
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "holdout"),
+         &value) &&
+       !enif_is_identical(value, enif_make_atom(env, "none"))) {
+      const ERL_NIF_TERM* xy;
+      int    arity;
+      double fraction;
+      if (enif_get_double(env, value, &fraction)) {
+         CHECK(fraction > 0 && fraction < 1, "invalid_holdout");
+         crf_holdout_split(data, fraction);
+      } else {
+         CHECK(enif_get_tuple(env, value, &arity, &xy) && arity == 2,
+            "invalid_holdout");
+         erl2crf_append_data(env, xy[0], xy[1], CRF_HOLDOUT_GROUP, data, NULL);
+      }
+      stopping->holdout = CRF_HOLDOUT_GROUP;
+   }
+   // retrieve the evaluation/stopping rules
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "holdout_period"),
+         &value))
+      CHECK(enif_get_int(env, value, &stopping->period) && stopping->period > 0,
+         "invalid_holdout_period");
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "patience"),
+         &value))
+      CHECK(enif_get_int(env, value, &stopping->patience) &&
+            stopping->patience >= 0,
+         "invalid_patience");
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "holdout_metric"),
+         &value)) {
+      stopping->sequence = enif_is_identical(
+         value,
+         enif_make_atom(env, "sequence"));
+      CHECK(stopping->sequence ||
+            enif_is_identical(value, enif_make_atom(env, "token")),
+         "invalid_holdout_metric");
+   }
+   if (enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "max_seconds"),
+         &value) &&
+       !enif_is_identical(value, enif_make_atom(env, "infinity")))
+      CHECK(enif_get_double(env, value, &stopping->max_seconds) &&
+            stopping->max_seconds > 0,
+         "invalid_max_seconds");
+}
+/*-----------< FUNCTION: crf_holdout_split >---------------------------------
+// Purpose:    assigns a fraction of the training instances to the holdout
+//             group, by hashing their contents
+// Parameters: data     - training data to split
+//             fraction - expected holdout fraction, in (0, 1)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_holdout_split (crfsuite_data_t* data, double fraction)
+{
+   for (int n = 0; n < data->num_instances; n++) {
+      crfsuite_instance_t* instance = &data->instances[n];
+      // finalize the hash (murmur3 fmix64), so that its high bits are
+      // uniform, and map them to [0, 1)
+      uint64_t hash = crf_instance_hash(instance);
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ULL;
+      hash ^= hash >> 33;
+      if ((hash >> 11) * (1.0 / 9007199254740992.0) < fraction)
+         instance->group = CRF_HOLDOUT_GROUP;
+   }
+}
 /*-----------< FUNCTION: erl2crf_param_bool >--------------------------------
 // Purpose:    transfers an erlang boolean parameter to a CRF parameter
 // Parameters: erl_env    - current erlang environment
@@ -703,19 +1467,245 @@ void erl2crf_param_string(
    // copy it to crf parameters
    crf_params->set_string(crf_params, crf_name ?: erl_name, sz);
 }
+/*-----------< FUNCTION: erl2crf_list_data >---------------------------------
+// Purpose:    training data loader for lists of feature/label sequences
+// Parameters: erl_env  - current erlang environment
+//             argv     - nif arguments (x, y)
+//             crf_data - CRF data structure to populate
+//             index    - duplicate instance index (NULL to keep duplicates)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_list_data(
+   ErlNifEnv*          erl_env,
+   const ERL_NIF_TERM  argv[],
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index)
+{
+   erl2crf_train_data(erl_env, argv[0], argv[1], crf_data, index);
+}
+/*-----------< FUNCTION: erl2crf_file_data >---------------------------------
+// Purpose:    training data loader for crfsuite-format training files
+//             sequences are appended to the data structure as they are
+//             read, and attribute/label names are interned on the fly
+// Parameters: erl_env  - current erlang environment
+//             argv     - nif arguments (path)
+//             crf_data - CRF data structure to populate
+//             index    - duplicate instance index (NULL to keep duplicates)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_file_data(
+   ErlNifEnv*          erl_env,
+   const ERL_NIF_TERM  argv[],
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index)
+{
+   crfsuite_data_init(crf_data);
+   CHECKALLOC(crfsuite_create_instance(
+      "dictionary",
+      (void**)&crf_data->labels));
+   CHECKALLOC(crfsuite_create_instance(
+      "dictionary",
+      (void**)&crf_data->attrs));
+   // decode the file path
+   ErlNifBinary path_bin;
+   CHECK(enif_inspect_binary(erl_env, argv[0], &path_bin), "invalid_path");
+   char path[path_bin.size + 1];
+   memcpy(path, path_bin.data, path_bin.size);
+   path[path_bin.size] = 0;
+   // stream the file into the CRF data structure, one sequence at a time
+   FILE* file = CHECK(fopen(path, "r"), "invalid_path");
+   char* line = NULL;
+   size_t cb = 0;
+   crfsuite_instance_t crf_instance;
+   crfsuite_item_t crf_item;
+   crfsuite_instance_init(&crf_instance);
+   crfsuite_item_init(&crf_item);
+   try {
+      for (bool eof = false; !eof; ) {
+         ssize_t cch = getline(&line, &cb, file);
+         eof = cch < 0;
+         CHECK(!eof || !ferror(file), "invalid_file");
+         while (cch > 0 && (line[cch - 1] == '\n' || line[cch - 1] == '\r'))
+            line[--cch] = 0;
+         if (cch <= 0) {
+            // a blank line (or the end of the file) completes the sequence
+            if (crf_instance.num_items > 0)
+               crf_data_append(crf_data, &crf_instance, index);
+            crfsuite_instance_finish(&crf_instance);
+            crfsuite_instance_init(&crf_instance);
+         } else if (line[0] == '@') {
+            // sequence declaration
+            if (strncmp(line, "@weight:", 8) == 0) {
+               char* end = NULL;
+               crf_instance.weight = strtod(line + 8, &end);
+               CHECK(end != line + 8 && *end == 0, "invalid_weight");
+            }
+         } else {
+            // item line: the label followed by its attributes
+            // the label is split at the first tab, since strtok_r would
+            // skip an empty one; the attributes are tokenized with local
+            // state, as trainings may run concurrently
+            char* fields = strchr(line, '\t');
+            if (fields)
+               *fields++ = 0;
+            CHECK(*line, "invalid_record");
+            int lid = crf_data->labels->get(crf_data->labels, line);
+            char* save = NULL;
+            for (char* field = fields ? strtok_r(fields, "\t", &save) : NULL;
+                 field;
+                 field = strtok_r(NULL, "\t", &save))
+               crf_read_file_field(field, crf_data->attrs, &crf_item);
+            CHECKALLOC(crfsuite_instance_append(&crf_instance, &crf_item, lid) == 0);
+            crfsuite_item_finish(&crf_item);
+            crfsuite_item_init(&crf_item);
+         }
+      }
+   } catch (...) {
+      crfsuite_item_finish(&crf_item);
+      crfsuite_instance_finish(&crf_instance);
+      free(line);
+      fclose(file);
+      throw;
+   }
+   crfsuite_item_finish(&crf_item);
+   crfsuite_instance_finish(&crf_instance);
+   free(line);
+   fclose(file);
+}
+/*-----------< FUNCTION: crf_data_append >-----------------------------------
+// Purpose:    appends a training instance to the CRF data structure
+//             if an index is specified, an exact duplicate of a previous
+//             instance (same items, attribute values and labels) is
+//             collapsed into it by accumulating its weight, so that
+//             training scales with the number of unique sequences
+// Parameters: crf_data     - CRF data structure to update
+//             crf_instance - CRF instance to append (copied)
+//             index        - duplicate instance index (NULL for none)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_data_append(
+   crfsuite_data_t*     crf_data,
+   crfsuite_instance_t* crf_instance,
+   CRF_INSTANCE_INDEX*  index)
+{
+   if (index != NULL) {
+      uint64_t hash  = crf_instance_hash(crf_instance);
+      auto     range = index->equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+         crfsuite_instance_t* other = &crf_data->instances[it->second];
+         if (crf_instance_equal(other, crf_instance)) {
+            other->weight += crf_instance->weight;
+            return;
+         }
+      }
+      index->emplace(hash, crf_data->num_instances);
+   }
+   CHECKALLOC(crfsuite_data_append(crf_data, crf_instance) == 0);
+}
+/*-----------< FUNCTION: crf_instance_hash >---------------------------------
+// Purpose:    hashes the contents of a training instance (FNV-1a)
+// Parameters: crf_instance - CRF instance to hash
+// Returns:    64-bit hash of the items, attributes and labels
+---------------------------------------------------------------------------*/
+uint64_t crf_instance_hash(const crfsuite_instance_t* crf_instance)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   auto mix = [&hash](const void* data, size_t size) {
+      for (size_t i = 0; i < size; i++)
+         hash = (hash ^ ((const unsigned char*)data)[i]) * 1099511628211ULL;
+   };
+   mix(&crf_instance->num_items, sizeof(int));
+   mix(&crf_instance->group, sizeof(int));
+   for (int t = 0; t < crf_instance->num_items; t++) {
+      const crfsuite_item_t& item = crf_instance->items[t];
+      mix(&crf_instance->labels[t], sizeof(int));
+      mix(&item.num_contents, sizeof(int));
+      for (int c = 0; c < item.num_contents; c++) {
+         // normalize signed zeros, which compare equal
+         floatval_t value = item.contents[c].value == 0
+            ? 0
+            : item.contents[c].value;
+         mix(&item.contents[c].aid, sizeof(int));
+         mix(&value, sizeof(value));
+      }
+   }
+   return hash;
+}
+/*-----------< FUNCTION: crf_instance_equal >--------------------------------
+// Purpose:    compares the contents of two training instances
+//             (weights are not compared)
+// Parameters: a - first CRF instance
+//             b - second CRF instance
+// Returns:    true if the instances are identical, false otherwise
+---------------------------------------------------------------------------*/
+bool crf_instance_equal(
+   const crfsuite_instance_t* a,
+   const crfsuite_instance_t* b)
+{
+   if (a->num_items != b->num_items || a->group != b->group)
+      return false;
+   for (int t = 0; t < a->num_items; t++) {
+      const crfsuite_item_t& a_item = a->items[t];
+      const crfsuite_item_t& b_item = b->items[t];
+      if (a->labels[t] != b->labels[t] ||
+          a_item.num_contents != b_item.num_contents)
+         return false;
+      for (int c = 0; c < a_item.num_contents; c++)
+         if (a_item.contents[c].aid != b_item.contents[c].aid ||
+             a_item.contents[c].value != b_item.contents[c].value)
+            return false;
+   }
+   return true;
+}
+/*-----------< FUNCTION: crf_read_file_field >-------------------------------
+// Purpose:    parses an attribute field from a crfsuite-format training file
+// Parameters: field     - attribute field (name or name:value),
+//                         unescaped in place
+//             crf_attrs - CRF attribute dictionary
+//             crf_item  - CRF item to populate
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_read_file_field(
+   char*                  field,
+   crfsuite_dictionary_t* crf_attrs,
+   crfsuite_item_t*       crf_item)
+{
+   // unescape the attribute name, up to the first unescaped ':'
+   char*  src   = field;
+   char*  dst   = field;
+   double value = 1.0;
+   for ( ; *src && *src != ':'; src++)
+      *dst++ = (*src == '\\' && (src[1] == ':' || src[1] == '\\'))
+         ? *++src
+         : *src;
+   if (*src == ':') {
+      char* end = NULL;
+      value = strtod(src + 1, &end);
+      CHECK(end != src + 1 && *end == 0, "invalid_feature");
+   }
+   *dst = 0;
+   if (*field == 0)
+      return;
+   // intern the attribute name and add it to the item
+   crfsuite_attribute_t attr;
+   crfsuite_attribute_set(&attr, crf_attrs->get(crf_attrs, field), value);
+   CHECKALLOC(crfsuite_item_append_attribute(crf_item, &attr) == 0);
+}
 /*-----------< FUNCTION: erl2crf_train_data >--------------------------------
 // Purpose:    transfers a list of training examples to the CRF structure
 // Parameters: erl_env  - current erlang environment
 //             x        - list of feature sequences
 //             y        - list of label sequences
 //             crf_data - CRF data structure to populate
+//             index    - duplicate instance index (NULL to keep duplicates)
 // Returns:    none
 ---------------------------------------------------------------------------*/
 void erl2crf_train_data(
-   ErlNifEnv*       erl_env,
-   ERL_NIF_TERM     x,
-   ERL_NIF_TERM     y,
-   crfsuite_data_t* crf_data)
+   ErlNifEnv*          erl_env,
+   ERL_NIF_TERM        x,
+   ERL_NIF_TERM        y,
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index)
 {
    crfsuite_data_init(crf_data);
    CHECKALLOC(crfsuite_create_instance(
@@ -724,6 +1714,26 @@ void erl2crf_train_data(
    CHECKALLOC(crfsuite_create_instance(
       "dictionary",
       (void**)&crf_data->attrs));
+   erl2crf_append_data(erl_env, x, y, 0, crf_data, index);
+}
+/*-----------< FUNCTION: erl2crf_append_data >-------------------------------
+// Purpose:    appends a list of training examples to the CRF structure
+// Parameters: erl_env  - current erlang environment
+//             x        - list of feature sequences
+//             y        - list of label sequences
+//             group    - instance group (0 for training, or the holdout)
+//             crf_data - CRF data structure to update
+//             index    - duplicate instance index (NULL to keep duplicates)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_append_data(
+   ErlNifEnv*          erl_env,
+   ERL_NIF_TERM        x,
+   ERL_NIF_TERM        y,
+   int                 group,
+   crfsuite_data_t*    crf_data,
+   CRF_INSTANCE_INDEX* index)
+{
    // transfer each training example to the CRF data structure
    unsigned m;
    CHECK(enif_get_list_length(erl_env, x, &m), "invalid_x");
@@ -742,9 +1752,10 @@ void erl2crf_train_data(
             crf_data->attrs,
             crf_data->labels,
             &crf_instance);
-         CHECKALLOC(crfsuite_data_append(crf_data, &crf_instance) == 0);
+         crf_instance.group = group;
+         crf_data_append(crf_data, &crf_instance, index);
          crfsuite_instance_finish(&crf_instance);
-      } catch (NifError& e) {
+      } catch (...) {
          crfsuite_instance_finish(&crf_instance);
          throw;
       }
@@ -802,6 +1813,44 @@ void erl2crf_predict_instance(
       erl2crf_features(erl_env, x_i_head, crf_attrs, crf_instance, i, false);
    }
 }
+/*-----------< FUNCTION: erl2crf_shared_features >---------------------------
+// Purpose:    converts a shared (sequence-level) feature map to a crfsuite
+//             item, resolving the attribute ids once per sequence
+//             unseen feature names are ignored
+// Parameters: erl_env      - current erlang environment
+//             erl_features - feature map (string -> float)
+//             crf_attrs    - model attribute dictionary
+//             crf_item     - return the resolved attributes via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_shared_features(
+   ErlNifEnv*             erl_env,
+   const ERL_NIF_TERM&    erl_features,
+   crfsuite_dictionary_t* crf_attrs,
+   crfsuite_item_t*       crf_item)
+{
+   size_t n;
+   CHECK(enif_get_map_size(erl_env, erl_features, &n), "invalid_shared");
+   ErlNifMapIterator iterator;
+   CHECK(enif_map_iterator_create(
+         erl_env,
+         erl_features,
+         &iterator,
+         ERL_NIF_MAP_ITERATOR_FIRST),
+      "invalid_shared");
+   try {
+      for (int i = 0; i < (int)n; i++) {
+         ERL_NIF_TERM k, v;
+         CHECKALLOC(enif_map_iterator_get_pair(erl_env, &iterator, &k, &v));
+         erl2crf_feature(erl_env, k, v, crf_attrs, *crf_item, false);
+         enif_map_iterator_next(erl_env, &iterator);
+      }
+      enif_map_iterator_destroy(erl_env, &iterator);
+   } catch (...) {
+      enif_map_iterator_destroy(erl_env, &iterator);
+      throw;
+   }
+}
 /*-----------< FUNCTION: erl2crf_features >----------------------------------
 // Purpose:    transfers a feature map to a CRF item structure
 // Parameters: erl_env      - current erlang environment
@@ -935,8 +1984,374 @@ void erl2crf_free_model (CRF_MODEL* model)
       remove(model->path);
    if (model->crf)
       model->crf->release(model->crf);
+   crf_decoder_free(model->decoder);
+   if (model->label_env != NULL)
+      enif_free_env(model->label_env);
+   nif_free(model->label_terms);
    nif_free(model);
 }
+/*-----------< FUNCTION: erl2crf_decode >------------------------------------
+// Purpose:    applies the decoding options to a loaded CRF model
+//             transition constraints (:iob, or a list of disallowed
+//             {from, to} label transitions), beam decoding and the state
+//             score cache require the native decoder
+// Parameters: env     - current erlang environment
+//             options - erlang CRF option map
+//             model   - loaded CRF model
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2crf_decode (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   CRF_MODEL*          model)
+{
+   ERL_NIF_TERM value;
+   // retrieve the beam width (0 for exact decoding)
+   if (enif_get_map_value(env, options, enif_make_atom(env, "beam"), &value)) {
+      int beam = 0;
+      CHECK(enif_get_int(env, value, &beam) && beam >= 0, "invalid_beam");
+      CHECK(beam == 0 || model->decoder != NULL, "invalid_beam");
+      if (model->decoder != NULL)
+         model->decoder->beam = beam;
+   }
+   // retrieve the state score cache capacity (0 for no cache)
+   if (enif_get_map_value(env, options, enif_make_atom(env, "state_cache"), &value)) {
+      int capacity = 0;
+      CHECK(enif_get_int(env, value, &capacity) && capacity >= 0,
+         "invalid_state_cache");
+      CHECK(capacity == 0 || model->decoder != NULL, "invalid_state_cache");
+      if (capacity > 0) {
+         crf_cache_free(model->decoder->cache);
+         model->decoder->cache = NULL;
+         model->decoder->cache = crf_cache_create(
+            capacity,
+            model->decoder->stride);
+      }
+   }
+   // retrieve the transition constraints
+   if (!enif_get_map_value(env, options, enif_make_atom(env, "constraints"), &value))
+      return;
+   if (enif_is_identical(value, enif_make_atom(env, "none")))
+      return;
+   CHECK(model->decoder != NULL, "invalid_constraints");
+   int   L       = model->num_labels;
+   bool* allowed = nif_alloc<bool>(L * L + 1);
+   bool* start   = NULL;
+   try {
+      start = nif_alloc<bool>(L + 1);
+      int type;
+      if (enif_is_identical(value, enif_make_atom(env, "iob"))) {
+         type = CRF_CONSTRAINTS_IOB;
+         crf_iob_constraints(model, allowed, start);
+      } else {
+         CHECK(enif_is_list(env, value), "invalid_constraints");
+         type = CRF_CONSTRAINTS_LIST;
+         for (int i = 0; i < L * L; i++)
+            allowed[i] = true;
+         for (int j = 0; j < L; j++)
+            start[j] = true;
+         // disallow each listed transition, ignoring unknown labels
+         ERL_NIF_TERM head;
+         while (enif_get_list_cell(env, value, &head, &value)) {
+            const ERL_NIF_TERM* pair;
+            int arity;
+            CHECK(enif_get_tuple(env, head, &arity, &pair) && arity == 2,
+               "invalid_constraints");
+            int from = crf_label_id(env, model, pair[0]);
+            int to   = crf_label_id(env, model, pair[1]);
+            if (from >= 0 && to >= 0)
+               allowed[from * L + to] = false;
+         }
+      }
+      crf_decoder_constrain(model->decoder, type, allowed, start);
+   } catch (NifError& e) {
+      nif_free(allowed);
+      nif_free(start);
+      throw;
+   }
+   nif_free(allowed);
+   nif_free(start);
+}
+/*-----------< FUNCTION: crf_iob_constraints >-------------------------------
+// Purpose:    derives the legal transitions for IOB2 label names
+//             labels of the form b_<type>/i_<type> (or B-<type>/I-<type>)
+//             are tagged, and i_<type> may only follow b_<type> or
+//             i_<type>, and may not start a sequence
+// Parameters: model   - loaded CRF model
+//             allowed - return the L x L allowed transitions via here
+//             start   - return the L allowed start labels via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_iob_constraints (
+   const CRF_MODEL* model,
+   bool*            allowed,
+   bool*            start)
+{
+   int L = model->num_labels;
+   // parse the label prefixes/types
+   char*         prefixes = nif_alloc<char>(L + 1);
+   ErlNifBinary* types    = NULL;
+   try {
+      types = nif_alloc<ErlNifBinary>(L + 1);
+   } catch (NifError& e) {
+      nif_free(prefixes);
+      throw;
+   }
+   for (int i = 0; i < L; i++) {
+      ErlNifBinary label;
+      if (!enif_inspect_binary(model->label_env, model->label_terms[i], &label))
+         continue;
+      if (label.size > 2 && (label.data[1] == '_' || label.data[1] == '-')) {
+         char prefix = (char)tolower(label.data[0]);
+         if (prefix == 'b' || prefix == 'i') {
+            prefixes[i]   = prefix;
+            types[i].data = label.data + 2;
+            types[i].size = label.size - 2;
+         }
+      }
+   }
+   // an inside label must continue an entity of the same type
+   for (int j = 0; j < L; j++) {
+      start[j] = prefixes[j] != 'i';
+      for (int i = 0; i < L; i++)
+         allowed[i * L + j] = prefixes[j] != 'i' || (
+            prefixes[i] != 0 &&
+            types[i].size == types[j].size &&
+            memcmp(types[i].data, types[j].data, types[j].size) == 0);
+   }
+   nif_free(types);
+   nif_free(prefixes);
+}
+/*-----------< FUNCTION: crf_label_id >--------------------------------------
+// Purpose:    looks up a label identifier by name
+// Parameters: env   - current erlang environment
+//             model - loaded CRF model
+//             label - label name (string)
+// Returns:    the label identifier, or -1 if the label is unknown
+---------------------------------------------------------------------------*/
+int crf_label_id (
+   ErlNifEnv*          env,
+   const CRF_MODEL*    model,
+   const ERL_NIF_TERM& label)
+{
+   ErlNifBinary name;
+   CHECK(enif_inspect_binary(env, label, &name), "invalid_constraints");
+   for (int i = 0; i < model->num_labels; i++) {
+      ErlNifBinary other;
+      if (enif_inspect_binary(model->label_env, model->label_terms[i], &other) &&
+          other.size == name.size &&
+          memcmp(other.data, name.data, name.size) == 0)
+         return i;
+   }
+   return -1;
+}
+/*-----------< FUNCTION: crf2erl_constraints >-------------------------------
+// Purpose:    converts the transition constraints of a CRF model to
+//             their erlang option representation
+// Parameters: env   - current erlang environment
+//             model - CRF model
+// Returns:    :none, :iob, or a list of disallowed {from, to} transitions
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf2erl_constraints (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model)
+{
+   const CRF_DECODER* decoder = model->decoder;
+   if (decoder == NULL || decoder->constraints == CRF_CONSTRAINTS_NONE)
+      return enif_make_atom(env, "none");
+   if (decoder->constraints == CRF_CONSTRAINTS_IOB)
+      return enif_make_atom(env, "iob");
+   // list the transitions missing from the allowed target index
+   ERL_NIF_TERM list = enif_make_list(env, 0);
+   for (int i = model->num_labels - 1; i >= 0; i--) {
+      int k = decoder->next_offsets[i + 1] - 1;
+      for (int j = model->num_labels - 1; j >= 0; j--) {
+         if (k >= decoder->next_offsets[i] && decoder->next_labels[k] == j) {
+            k--;
+            continue;
+         }
+         list = enif_make_list_cell(
+            env,
+            enif_make_tuple2(
+               env,
+               enif_make_copy(env, model->label_terms[i]),
+               enif_make_copy(env, model->label_terms[j])),
+            list);
+      }
+   }
+   return list;
+}
+/*-----------< FUNCTION: crf2erl_decode >------------------------------------
+// Purpose:    converts the decoding options of a CRF model to their erlang
+//             option map representation, so that they can be applied to a
+//             derived (pruned/updated) model
+// Parameters: env   - current erlang environment
+//             model - CRF model
+// Returns:    map of the constraints, beam, and state_cache options
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM crf2erl_decode (
+   ErlNifEnv*       env,
+   const CRF_MODEL* model)
+{
+   const char* keys[] = { "constraints", "beam", "state_cache" };
+   ERL_NIF_TERM values[] = {
+      crf2erl_constraints(env, model),
+      enif_make_int(env, model->decoder ? model->decoder->beam : 0),
+      enif_make_int(env, crf_cache_capacity(model))
+   };
+   ERL_NIF_TERM options = enif_make_new_map(env);
+   for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+      CHECKALLOC(enif_make_map_put(
+         env,
+         options,
+         enif_make_atom(env, keys[i]),
+         values[i],
+         &options));
+   return options;
+}
+/*-----------< FUNCTION: crf_train_model >-----------------------------------
+// Purpose:    trains a CRF model and writes it to a model file
+//             multi-threaded L-BFGS training is used if more than one
+//             thread was requested (or within a training job, to report
+//             progress and cancel per iteration), otherwise the crfsuite
+//             trainer is used
+//             early stopping (holdout evaluation or a time budget) also
+//             requires the multi-threaded trainer
+// Parameters: env      - current erlang environment
+//             options  - erlang CRF option map
+//             trainer  - configured crfsuite trainer
+//             data     - training data
+//             stopping - early stopping options
+//             path     - model file path
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_model (
+   ErlNifEnv*          env,
+   const ERL_NIF_TERM& options,
+   crfsuite_trainer_t* trainer,
+   crfsuite_data_t*    data,
+   const CRF_STOPPING* stopping,
+   const char*         path)
+{
+   ERL_NIF_TERM algorithm;
+   ERL_NIF_TERM verbose;
+   int threads = erl2crf_threads(env, options);
+   CHECK(enif_get_map_value(
+         env,
+         options,
+         enif_make_atom(env, "algorithm"),
+         &algorithm),
+      "missing_algorithm");
+   bool is_verbose =
+      enif_get_map_value(env, options, enif_make_atom(env, "verbose"), &verbose) &&
+      enif_is_identical(verbose, enif_make_atom(env, "true"));
+   bool is_lbfgs = enif_is_identical(algorithm, enif_make_atom(env, "lbfgs"));
+   CHECK(is_lbfgs || stopping->holdout < 0, "invalid_holdout");
+   CHECK(is_lbfgs || stopping->max_seconds == 0, "invalid_max_seconds");
+   bool is_stopping = stopping->holdout >= 0 || stopping->max_seconds > 0;
+   if (is_lbfgs && (threads > 1 || nif_job_active() || is_stopping)) {
+      crfsuite_params_t* params = trainer->params(trainer);
+      try {
+         crf_train_lbfgs(
+            data,
+            params,
+            threads,
+            path,
+            is_verbose ? &message_callback : NULL,
+            stopping);
+      } catch (...) {
+         params->release(params);
+         throw;
+      }
+      params->release(params);
+   } else {
+      // parse job progress from the crfsuite log, forwarding to the
+      // console if requested
+      if (nif_job_active())
+         trainer->set_message_callback(
+            trainer,
+            is_verbose ? stderr : NULL,
+            &crf_job_callback);
+      CHECK(trainer->train(trainer, data, path, -1) == 0, "train_failed");
+      CHECK(!nif_job_cancelled(), "cancelled");
+   }
+}
+/*-----------< FUNCTION: crf_job_callback >----------------------------------
+// Purpose:    crfsuite log callback for training jobs, which reports the
+//             loss for each iteration/epoch as job progress
+// Parameters: instance - non-null to forward messages to the console
+//             format   - log message format string
+//             args     - log message arguments
+// Returns:    0
+---------------------------------------------------------------------------*/
+int crf_job_callback (void* instance, const char* format, va_list args)
+{
+   static thread_local int iteration = 0;
+   char message[256];
+   va_list copy;
+   va_copy(copy, args);
+   vsnprintf(message, sizeof(message), format, copy);
+   va_end(copy);
+   double loss = 0;
+   if (sscanf(message, "***** Iteration #%d", &iteration) != 1 &&
+       sscanf(message, "***** Epoch #%d", &iteration) != 1 &&
+       sscanf(message, "Loss: %lf", &loss) == 1)
+      nif_job_progress(iteration, loss);
+   if (instance != NULL)
+      message_callback(instance, format, args);
+   return 0;
+}
+/*-----------< FUNCTION: crf_load_model >------------------------------------
+// Purpose:    loads a CRF model from its model file
+// Parameters: model  - CRF model structure, with the model file path
+//             native - compile the native decoder for the model?
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_load_model (CRF_MODEL* model, bool native)
+{
+   CHECK(crfsuite_create_instance_from_file(
+         model->path,
+         (void**)&model->crf) == 0,
+      "load_failed");
+   crf_load_labels(model);
+   if (native)
+      model->decoder = crf_decoder_create(model->path);
+}
+/*-----------< FUNCTION: crf_load_labels >-----------------------------------
+// Purpose:    builds the label binaries for a loaded CRF model, so that
+//             predictions can return labels without allocating them
+// Parameters: model - CRF model structure, with the crfsuite model loaded
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_load_labels (CRF_MODEL* model)
+{
+   crfsuite_dictionary_t* crf_labels = NULL;
+   CHECKALLOC(model->crf->get_labels(model->crf, &crf_labels) == 0);
+   try {
+      model->label_env   = CHECKALLOC(enif_alloc_env());
+      model->num_labels  = crf_labels->num(crf_labels);
+      model->label_terms = nif_alloc<ERL_NIF_TERM>(model->num_labels);
+      for (int i = 0; i < model->num_labels; i++) {
+         // decode the label identifier
+         const char* label = NULL;
+         CHECKALLOC(crf_labels->to_string(crf_labels, i, &label) == 0);
+         // create an erlang string for the label
+         size_t length = strlen(label);
+         unsigned char* data = enif_make_new_binary(
+            model->label_env,
+            length,
+            &model->label_terms[i]);
+         if (data != NULL)
+            memcpy(data, label, length);
+         crf_labels->free(crf_labels, label);
+         CHECKALLOC(data);
+      }
+   } catch (NifError& e) {
+      crf_labels->release(crf_labels);
+      throw;
+   }
+   crf_labels->release(crf_labels);
+}
 /*-----------< FUNCTION: crf_create_file >-----------------------------------
 // Purpose:    generates a CRF model file name and opens it
 // Parameters: path - return the model file path via here
@@ -951,38 +2366,27 @@ int crf_create_file(char* path)
 }
 /*-----------< FUNCTION: crf2erl_labels >------------------------------------
 // Purpose:    converts a CRF label sequence to a list of strings
-// Parameters: erl_env    - current erlang environment
-//             crf_labels - CRF label dictionary
-//             crf_path   - list of CRF label identifiers for the sequence
-//             n          - number of labels in the sequence
+// Parameters: erl_env  - current erlang environment
+//             model    - CRF model, with its cached label binaries
+//             crf_path - list of CRF label identifiers for the sequence
+//             n        - number of labels in the sequence
 // Returns:    an erlang list of sequence label strings
 ---------------------------------------------------------------------------*/
 ERL_NIF_TERM crf2erl_labels(
-   ErlNifEnv*             erl_env,
-   crfsuite_dictionary_t* crf_labels,
-   int*                   crf_path,
-   int                    n)
+   ErlNifEnv*       erl_env,
+   const CRF_MODEL* model,
+   int*             crf_path,
+   int              n)
 {
    ERL_NIF_TERM list = enif_make_list(erl_env, 0);
    for (int i = n - 1; i >= 0; i--) {
-      // decode the sequence label identifier
-      const char* label = NULL;
-      CHECKALLOC(crf_labels->to_string(crf_labels, crf_path[i], &label) == 0);
-      try {
-         // create an erlang string for the label
-         ErlNifBinary head;
-         CHECKALLOC(enif_alloc_binary(strlen(label), &head));
-         memcpy(head.data, label, head.size);
-         // add the string to the list
-         list = enif_make_list_cell(
-            erl_env,
-            enif_make_binary(erl_env, &head),
-            list);
-         crf_labels->free(crf_labels, label);
-      } catch (NifError& e) {
-         crf_labels->free(crf_labels, label);
-         throw;
-      }
+      CHECK(crf_path[i] >= 0 && crf_path[i] < model->num_labels,
+         "invalid_label");
+      // copy the cached label string to the list
+      list = enif_make_list_cell(
+         erl_env,
+         enif_make_copy(erl_env, model->label_terms[crf_path[i]]),
+         list);
    }
    return list;
 }
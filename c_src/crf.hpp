@@ -0,0 +1,148 @@
+/****************************************************************************
+ *
+ * MODULE:  crf.hpp
+ * PURPOSE: shared crfsuite nif definitions
+ *
+ ***************************************************************************/
+#ifndef __CRF_HPP
+#define __CRF_HPP
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <limits.h>
+#include <stdint.h>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "deps/crfsuite/include/crfsuite.h"
+#include "penelope.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+// transition constraint types
+#define CRF_CONSTRAINTS_NONE 0   // all transitions are allowed
+#define CRF_CONSTRAINTS_IOB  1   // derived from IOB label names
+#define CRF_CONSTRAINTS_LIST 2   // explicit list of disallowed transitions
+// instance group of the training holdout set
+#define CRF_HOLDOUT_GROUP    1
+// online update rules
+#define CRF_UPDATE_PERCEPTRON 0  // structured perceptron
+#define CRF_UPDATE_PA         1  // passive-aggressive (PA-I)
+// bounded LRU cache of item state scores, see crf_cache.cpp
+typedef struct tagCrfStateCache CRF_STATE_CACHE;
+typedef struct tagCrfCacheStats {
+   int      capacity;             // maximum number of entries
+   int      size;                 // current number of entries
+   uint64_t hits;                 // number of lookup hits
+   uint64_t misses;               // number of lookup misses
+} CRF_CACHE_STATS;
+// native single-precision decoder, compiled from the crfsuite model weights
+// transitions are stored row-major by source label, with rows padded to
+// a multiple of the SIMD width, so that the scores for all target labels
+// can be loaded contiguously
+typedef struct tagCrfDecoder {
+   int    num_labels;             // number of labels (L)
+   int    num_attrs;              // number of attributes (A)
+   int    stride;                 // padded transition row length
+   float  trans_max;              // maximum transition weight
+   float* trans;                  // L x stride transition weights
+   float* exp_trans;              // L x stride exp(trans - trans_max)
+   int*   attr_offsets;           // A + 1 offsets into the state features
+   int*   state_labels;           // state feature target labels
+   float* state_weights;          // state feature weights
+   int    constraints;            // transition constraint type
+   float* start;                  // S start scores (0 or -inf if masked)
+   int*   next_offsets;           // L + 1 offsets into the allowed targets
+   int*   next_labels;            // allowed target labels, by source label
+   int    beam;                   // beam width (0 for exact decoding)
+   CRF_STATE_CACHE* cache;        // item state score cache (NULL if none)
+} CRF_DECODER;
+// label binaries are built once when the model is loaded, in a
+// process-independent environment, and copied into the caller's
+// environment by label id when returning predictions
+typedef struct tagCrfModel {
+   char              path[PATH_MAX + 1];
+   crfsuite_model_t* crf;
+   CRF_DECODER*      decoder;
+   ErlNifEnv*        label_env;   // label term environment
+   ERL_NIF_TERM*     label_terms; // label binaries, by label id
+   int               num_labels;  // number of labels
+} CRF_MODEL;
+// early stopping options for native L-BFGS training
+typedef struct tagCrfStopping {
+   int    holdout;                // holdout instance group (-1 for none)
+   int    period;                 // holdout evaluation period (iterations)
+   int    patience;               // evaluations without improvement
+                                  // before stopping (0 to never stop)
+   bool   sequence;               // sequence (vs token) accuracy?
+   double max_seconds;            // wall-clock budget (0 for none)
+} CRF_STOPPING;
+// model pruning statistics
+typedef struct tagCrfPruneStats {
+   int num_features;              // features in the source model
+   int num_attrs;                 // attributes in the source model
+   int pruned_features;           // features in the pruned model
+   int pruned_attrs;              // attributes in the pruned model
+} CRF_PRUNE_STATS;
+// online update parameters
+typedef struct tagCrfUpdateParams {
+   int    algorithm;              // update rule (CRF_UPDATE_*)
+   double c;                      // passive-aggressive step size cap
+   int    epochs;                 // maximum passes over the sequences
+} CRF_UPDATE_PARAMS;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+CRF_MODEL* crf_model_resource (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term);
+ERL_NIF_TERM crf_predict_instance (
+   ErlNifEnv*             env,
+   const CRF_MODEL*       model,
+   crfsuite_instance_t*   instance,
+   const crfsuite_item_t* shared);
+void crf_decoder_init ();
+CRF_DECODER* crf_decoder_create (
+   const char* path);
+void crf_decoder_free (
+   CRF_DECODER* decoder);
+void crf_decoder_constrain (
+   CRF_DECODER* decoder,
+   int          type,
+   const bool*  allowed,
+   const bool*  start);
+void crf_decoder_predict (
+   const CRF_DECODER*         decoder,
+   const crfsuite_instance_t* instance,
+   const crfsuite_item_t*     shared,
+   int*                       path,
+   double*                    score,
+   double*                    lognorm);
+void crf_train_lbfgs (
+   crfsuite_data_t*          data,
+   crfsuite_params_t*        params,
+   int                       threads,
+   const char*               path,
+   crfsuite_logging_callback callback,
+   const CRF_STOPPING*       stopping);
+CRF_STATE_CACHE* crf_cache_create (
+   int capacity,
+   int stride);
+void crf_cache_free (
+   CRF_STATE_CACHE* cache);
+bool crf_cache_lookup (
+   CRF_STATE_CACHE* cache,
+   uint64_t         key,
+   float*           row);
+void crf_cache_insert (
+   CRF_STATE_CACHE* cache,
+   uint64_t         key,
+   const float*     scores);
+void crf_cache_stats (
+   CRF_STATE_CACHE* cache,
+   CRF_CACHE_STATS* stats);
+void crf_prune_model (
+   const char*      source,
+   const char*      target,
+   double           threshold,
+   CRF_PRUNE_STATS* stats);
+void crf_update_model (
+   const char*              source,
+   const char*              target,
+   crfsuite_data_t*         data,
+   const CRF_UPDATE_PARAMS* params);
+#endif // __CRF_HPP
@@ -0,0 +1,280 @@
+/****************************************************************************
+ *
+ * MODULE:  crf_cache.cpp
+ * PURPOSE: state score cache for the native CRF decoder
+ *
+ * The state scores of a sequence position depend only on its attribute
+ * set, and frequent tokens (stop words, punctuation, common entities)
+ * recur with identical attribute sets across predictions. The cache maps
+ * a 64-bit hash of an item's attribute id/value list to its S state score
+ * vector, so that a hit replaces the feature weight accumulation for the
+ * item with a single vector copy. Entries are identified by the hash
+ * alone, since a 64-bit collision among the cached items is vanishingly
+ * unlikely.
+ *
+ * The cache is bounded, with least recently used eviction, and it is
+ * shared by all of the scheduler threads predicting with a model. To keep
+ * lock contention low, it is split into shards by key, each with its own
+ * mutex, LRU list and hash table. Entries are preallocated, so lookups
+ * and insertions never allocate.
+ *
+ * for abbreviated names:
+ * . S is the padded state score row stride
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <stdint.h>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define CRF_CACHE_SHARDS 16
+// cache entry, linked into its shard's LRU list and hash bucket chain
+typedef struct tagCrfCacheEntry {
+   uint64_t key;                  // attribute list hash
+   int      prev;                 // more recently used entry (-1 at head)
+   int      next;                 // less recently used entry (-1 at tail)
+   int      chain;                // next entry in the hash bucket (-1)
+} CRF_CACHE_ENTRY;
+// cache shard, an independently locked LRU cache
+typedef struct tagCrfCacheShard {
+   ErlNifMutex*     lock;         // shard mutex
+   int              capacity;     // maximum number of entries
+   int              size;         // current number of entries
+   int              head;         // most recently used entry (-1 if empty)
+   int              tail;         // least recently used entry (-1 if empty)
+   int              mask;         // hash bucket mask (buckets - 1)
+   int*             buckets;      // hash bucket chain heads (-1 if empty)
+   CRF_CACHE_ENTRY* entries;      // entry list
+   float*           scores;       // capacity x S state score vectors
+   uint64_t         hits;         // number of lookup hits
+   uint64_t         misses;       // number of lookup misses
+} CRF_CACHE_SHARD;
+typedef struct tagCrfStateCache {
+   int             stride;        // state score vector length (S)
+   int             num_shards;    // number of shards
+   CRF_CACHE_SHARD shards[CRF_CACHE_SHARDS];
+} CRF_STATE_CACHE;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static CRF_CACHE_SHARD* crf_cache_shard (
+   CRF_STATE_CACHE* cache,
+   uint64_t         key);
+static int crf_cache_find (
+   const CRF_CACHE_SHARD* shard,
+   uint64_t               key);
+static void crf_cache_unlink (
+   CRF_CACHE_SHARD* shard,
+   int              e);
+static void crf_cache_push (
+   CRF_CACHE_SHARD* shard,
+   int              e);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: crf_cache_create >----------------------------------
+// Purpose:    allocates a state score cache
+// Parameters: capacity - maximum number of cached score vectors (> 0)
+//             stride   - state score vector length
+// Returns:    pointer to the allocated cache
+---------------------------------------------------------------------------*/
+CRF_STATE_CACHE* crf_cache_create (int capacity, int stride)
+{
+   CRF_STATE_CACHE* cache = nif_alloc<CRF_STATE_CACHE>();
+   try {
+      cache->stride     = stride;
+      cache->num_shards = capacity < CRF_CACHE_SHARDS
+         ? capacity
+         : CRF_CACHE_SHARDS;
+      for (int s = 0; s < cache->num_shards; s++) {
+         CRF_CACHE_SHARD* shard = &cache->shards[s];
+         // divide the capacity among the shards, and size the hash table
+         // to a power of two at least twice the shard capacity
+         int buckets = 1;
+         shard->capacity = capacity / cache->num_shards +
+            (s < capacity % cache->num_shards ? 1 : 0);
+         CHECK((long)shard->capacity * stride < INT_MAX, "invalid_state_cache");
+         while (buckets < 2 * shard->capacity)
+            buckets *= 2;
+         shard->mask    = buckets - 1;
+         shard->head    = -1;
+         shard->tail    = -1;
+         shard->buckets = nif_alloc<int>(buckets);
+         shard->entries = nif_alloc<CRF_CACHE_ENTRY>(shard->capacity);
+         shard->scores  = nif_alloc<float>(shard->capacity * stride);
+         shard->lock    = CHECKALLOC(enif_mutex_create((char*)"crf_cache"));
+         for (int b = 0; b < buckets; b++)
+            shard->buckets[b] = -1;
+      }
+   } catch (NifError& e) {
+      crf_cache_free(cache);
+      throw;
+   }
+   return cache;
+}
+/*-----------< FUNCTION: crf_cache_free >------------------------------------
+// Purpose:    frees the memory associated with a state score cache
+// Parameters: cache - cache to free (NULL for none)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_cache_free (CRF_STATE_CACHE* cache)
+{
+   if (cache != NULL)
+      for (int s = 0; s < cache->num_shards; s++) {
+         CRF_CACHE_SHARD* shard = &cache->shards[s];
+         if (shard->lock != NULL)
+            enif_mutex_destroy(shard->lock);
+         nif_free(shard->buckets);
+         nif_free(shard->entries);
+         nif_free(shard->scores);
+      }
+   nif_free(cache);
+}
+/*-----------< FUNCTION: crf_cache_lookup >----------------------------------
+// Purpose:    adds the cached state scores for an attribute list to a
+//             state score row, if they are cached
+// Parameters: cache - state score cache
+//             key   - attribute list hash
+//             row   - S state score vector to accumulate
+// Returns:    true on a cache hit, false otherwise
+---------------------------------------------------------------------------*/
+bool crf_cache_lookup (CRF_STATE_CACHE* cache, uint64_t key, float* row)
+{
+   CRF_CACHE_SHARD* shard = crf_cache_shard(cache, key);
+   int S = cache->stride;
+   enif_mutex_lock(shard->lock);
+   int e = crf_cache_find(shard, key);
+   if (e >= 0) {
+      // move the entry to the front of the LRU list
+      crf_cache_unlink(shard, e);
+      crf_cache_push(shard, e);
+      const float* scores = shard->scores + (size_t)e * S;
+      for (int j = 0; j < S; j++)
+         row[j] += scores[j];
+      shard->hits++;
+   } else
+      shard->misses++;
+   enif_mutex_unlock(shard->lock);
+   return e >= 0;
+}
+/*-----------< FUNCTION: crf_cache_insert >----------------------------------
+// Purpose:    caches the state scores for an attribute list, evicting the
+//             least recently used entry in its shard if the shard is full
+// Parameters: cache  - state score cache
+//             key    - attribute list hash
+//             scores - S state score vector to cache
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_cache_insert (
+   CRF_STATE_CACHE* cache,
+   uint64_t         key,
+   const float*     scores)
+{
+   CRF_CACHE_SHARD* shard = crf_cache_shard(cache, key);
+   int S = cache->stride;
+   enif_mutex_lock(shard->lock);
+   // another thread may have cached the same scores since the lookup
+   if (crf_cache_find(shard, key) < 0) {
+      int e;
+      if (shard->size < shard->capacity)
+         e = shard->size++;
+      else {
+         // evict the least recently used entry from its bucket chain
+         e = shard->tail;
+         crf_cache_unlink(shard, e);
+         int* link = &shard->buckets[shard->entries[e].key & shard->mask];
+         while (*link != e)
+            link = &shard->entries[*link].chain;
+         *link = shard->entries[e].chain;
+      }
+      // link the new entry into its bucket and the LRU list
+      int b = (int)(key & shard->mask);
+      shard->entries[e].key   = key;
+      shard->entries[e].chain = shard->buckets[b];
+      shard->buckets[b]       = e;
+      crf_cache_push(shard, e);
+      memcpy(shard->scores + (size_t)e * S, scores, S * sizeof(float));
+   }
+   enif_mutex_unlock(shard->lock);
+}
+/*-----------< FUNCTION: crf_cache_stats >-----------------------------------
+// Purpose:    retrieves the cache usage counters
+// Parameters: cache - state score cache (NULL for none)
+//             stats - return the cache statistics via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_cache_stats (CRF_STATE_CACHE* cache, CRF_CACHE_STATS* stats)
+{
+   memset(stats, 0, sizeof(*stats));
+   if (cache != NULL)
+      for (int s = 0; s < cache->num_shards; s++) {
+         CRF_CACHE_SHARD* shard = &cache->shards[s];
+         enif_mutex_lock(shard->lock);
+         stats->capacity += shard->capacity;
+         stats->size     += shard->size;
+         stats->hits     += shard->hits;
+         stats->misses   += shard->misses;
+         enif_mutex_unlock(shard->lock);
+      }
+}
+/*-----------< FUNCTION: crf_cache_shard >-----------------------------------
+// Purpose:    selects the shard for a cache key
+//             the shard is selected by the high bits of the key, since the
+//             low bits select the hash bucket within the shard
+// Parameters: cache - state score cache
+//             key   - attribute list hash
+// Returns:    the key's shard
+---------------------------------------------------------------------------*/
+CRF_CACHE_SHARD* crf_cache_shard (CRF_STATE_CACHE* cache, uint64_t key)
+{
+   return &cache->shards[(key >> 48) % cache->num_shards];
+}
+/*-----------< FUNCTION: crf_cache_find >------------------------------------
+// Purpose:    finds the entry for a key in a shard's hash table
+// Parameters: shard - locked cache shard
+//             key   - attribute list hash
+// Returns:    the entry index, or -1 if the key is not cached
+---------------------------------------------------------------------------*/
+int crf_cache_find (const CRF_CACHE_SHARD* shard, uint64_t key)
+{
+   int e = shard->buckets[key & shard->mask];
+   while (e >= 0 && shard->entries[e].key != key)
+      e = shard->entries[e].chain;
+   return e;
+}
+/*-----------< FUNCTION: crf_cache_unlink >----------------------------------
+// Purpose:    removes an entry from a shard's LRU list
+// Parameters: shard - locked cache shard
+//             e     - entry index
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_cache_unlink (CRF_CACHE_SHARD* shard, int e)
+{
+   CRF_CACHE_ENTRY& entry = shard->entries[e];
+   if (entry.prev >= 0)
+      shard->entries[entry.prev].next = entry.next;
+   else
+      shard->head = entry.next;
+   if (entry.next >= 0)
+      shard->entries[entry.next].prev = entry.prev;
+   else
+      shard->tail = entry.prev;
+}
+/*-----------< FUNCTION: crf_cache_push >------------------------------------
+// Purpose:    inserts an entry at the front (most recently used end) of a
+//             shard's LRU list
+// Parameters: shard - locked cache shard
+//             e     - entry index
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_cache_push (CRF_CACHE_SHARD* shard, int e)
+{
+   CRF_CACHE_ENTRY& entry = shard->entries[e];
+   entry.prev = -1;
+   entry.next = shard->head;
+   if (shard->head >= 0)
+      shard->entries[shard->head].prev = e;
+   else
+      shard->tail = e;
+   shard->head = e;
+}
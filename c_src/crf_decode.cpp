@@ -0,0 +1,872 @@
+/****************************************************************************
+ *
+ * MODULE:  crf_decode.cpp
+ * PURPOSE: native single-precision CRF decoder
+ *
+ * The decoder compiles the weights of a trained crfsuite model into a
+ * float32 representation and reimplements the crfsuite viterbi and forward
+ * (partition function) algorithms over it. Transition rows are padded to the
+ * SIMD width, so that the inner loops over target labels can use contiguous
+ * vector loads. AVX2 kernels are selected at load time if the CPU supports
+ * them, with a portable scalar fallback.
+ *
+ * Transitions can be constrained (for example, to the legal IOB transitions),
+ * by masking the disallowed transition weights to -inf (and their
+ * exponentials to 0), so that the dense kernels can never select or sum
+ * them. Beam decoding restricts each step to the highest scoring source
+ * labels, and visits only their allowed targets, so that its cost is
+ * proportional to the beam width times the allowed out-degree, instead of
+ * L x L. The beam forward pass sums over the same pruned lattice, so the
+ * partition function (and sequence probability) is approximate.
+ *
+ * If the decoder has a state score cache, the scores of each item's
+ * attribute set are looked up by hash before accumulating them, and
+ * cached after a miss.
+ *
+ * for abbreviated names:
+ * . L is the number of labels
+ * . S is the padded row stride (L rounded up to the SIMD width)
+ * . T is the number of items in the sequence
+ * . i is a source (previous) label, j is a target (current) label
+ * . B is the beam width
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define CRF_DECODER_AVX2 1
+#  include <immintrin.h>
+#endif
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+extern "C" {
+#include "deps/crfsuite/lib/crf/src/crf1d.h"
+}
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define CRF_SIMD_WIDTH 8
+#ifdef CRF_DECODER_AVX2
+#  define AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+typedef void (*CRF_VITERBI_STEP)(
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   float*             next,
+   int*               back);
+typedef void (*CRF_FORWARD_STEP)(
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   float*             next);
+typedef void (*CRF_EXP)(
+   float* x,
+   int    n);
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void crf_decoder_state (
+   const CRF_DECODER*         decoder,
+   const crfsuite_instance_t* instance,
+   const crfsuite_item_t*     shared,
+   float*                     state,
+   float*                     scores);
+static void crf_decoder_item (
+   const CRF_DECODER*     decoder,
+   const crfsuite_item_t& item,
+   float*                 row,
+   float*                 scores);
+static void crf_decoder_accumulate (
+   const CRF_DECODER*     decoder,
+   const crfsuite_item_t& item,
+   float*                 row);
+static uint64_t crf_decoder_key (
+   const crfsuite_item_t& item);
+static double crf_decoder_viterbi (
+   const CRF_DECODER* decoder,
+   const float*       state,
+   int                T,
+   int*               back,
+   float*             work,
+   int*               index,
+   int*               path);
+static double crf_decoder_forward (
+   const CRF_DECODER* decoder,
+   const float*       state,
+   int                T,
+   float*             work,
+   int*               index);
+static void crf_beam_select (
+   const float* scores,
+   int          L,
+   int          B,
+   int*         index);
+static void crf_viterbi_step_beam (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   const int*         index,
+   float*             next,
+   int*               back);
+static void crf_forward_step_beam (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   const int*         index,
+   float*             next);
+static void crf_viterbi_step_scalar (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   float*             next,
+   int*               back);
+static void crf_forward_step_scalar (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   float*             next);
+static void crf_exp_scalar (
+   float* x,
+   int    n);
+#ifdef CRF_DECODER_AVX2
+AVX2_TARGET static void crf_viterbi_step_avx2 (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   float*             next,
+   int*               back);
+AVX2_TARGET static void crf_forward_step_avx2 (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   float*             next);
+AVX2_TARGET static void crf_exp_avx2 (
+   float* x,
+   int    n);
+#endif
+/*-------------------[        Module Variables         ]-------------------*/
+static CRF_VITERBI_STEP g_viterbi_step = &crf_viterbi_step_scalar;
+static CRF_FORWARD_STEP g_forward_step = &crf_forward_step_scalar;
+static CRF_EXP          g_exp          = &crf_exp_scalar;
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: crf_decoder_init >----------------------------------
+// Purpose:    selects the decoder kernels supported by the current CPU
+// Parameters: none
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_init ()
+{
+#ifdef CRF_DECODER_AVX2
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      g_viterbi_step = &crf_viterbi_step_avx2;
+      g_forward_step = &crf_forward_step_avx2;
+      g_exp          = &crf_exp_avx2;
+   }
+#endif
+}
+/*-----------< FUNCTION: crf_decoder_create >--------------------------------
+// Purpose:    compiles a crfsuite model file into a native decoder
+// Parameters: path - path to the crfsuite model file
+// Returns:    pointer to the allocated decoder
+---------------------------------------------------------------------------*/
+CRF_DECODER* crf_decoder_create (const char* path)
+{
+   crf1dm_t* crf = CHECK(crf1dm_new(path), "load_failed");
+   CRF_DECODER* decoder = NULL;
+   try {
+      decoder = nif_alloc<CRF_DECODER>();
+      int L = decoder->num_labels = crf1dm_get_num_labels(crf);
+      int A = decoder->num_attrs  = crf1dm_get_num_attrs(crf);
+      int S = decoder->stride     =
+         (L + CRF_SIMD_WIDTH - 1) / CRF_SIMD_WIDTH * CRF_SIMD_WIDTH;
+      // load the transition matrix, leaving padding/missing weights at 0
+      decoder->trans     = nif_alloc<float>(L * S + 1);
+      decoder->exp_trans = nif_alloc<float>(L * S + 1);
+      for (int i = 0; i < L; i++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_labelref(crf, i, &refs) == 0, "load_failed");
+         for (int k = 0; k < refs.num_features; k++) {
+            crf1dm_feature_t feature;
+            int fid = crf1dm_get_featureid(&refs, k);
+            CHECK(crf1dm_get_feature(crf, fid, &feature) == 0, "load_failed");
+            decoder->trans[i * S + feature.dst] = (float)feature.weight;
+         }
+      }
+      // precompute the shifted transition exponentials for the forward
+      // algorithm, so that every exp_trans value is in [0, 1]
+      decoder->trans_max = -FLT_MAX;
+      for (int i = 0; i < L; i++)
+         for (int j = 0; j < L; j++)
+            decoder->trans_max = fmaxf(decoder->trans_max, decoder->trans[i * S + j]);
+      for (int i = 0; i < L; i++)
+         for (int j = 0; j < L; j++)
+            decoder->exp_trans[i * S + j] =
+               expf(decoder->trans[i * S + j] - decoder->trans_max);
+      // load the state features as a sparse attribute -> label matrix
+      decoder->attr_offsets = nif_alloc<int>(A + 1);
+      for (int a = 0; a < A; a++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_attrref(crf, a, &refs) == 0, "load_failed");
+         decoder->attr_offsets[a + 1] =
+            decoder->attr_offsets[a] + refs.num_features;
+      }
+      int K = decoder->attr_offsets[A];
+      decoder->state_labels  = nif_alloc<int>(K + 1);
+      decoder->state_weights = nif_alloc<float>(K + 1);
+      for (int a = 0; a < A; a++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_attrref(crf, a, &refs) == 0, "load_failed");
+         for (int k = 0; k < refs.num_features; k++) {
+            crf1dm_feature_t feature;
+            int fid = crf1dm_get_featureid(&refs, k);
+            CHECK(crf1dm_get_feature(crf, fid, &feature) == 0, "load_failed");
+            decoder->state_labels[decoder->attr_offsets[a] + k]  = feature.dst;
+            decoder->state_weights[decoder->attr_offsets[a] + k] =
+               (float)feature.weight;
+         }
+      }
+   } catch (NifError& e) {
+      crf1dm_close(crf);
+      crf_decoder_free(decoder);
+      throw;
+   }
+   crf1dm_close(crf);
+   return decoder;
+}
+/*-----------< FUNCTION: crf_decoder_free >----------------------------------
+// Purpose:    frees the memory associated with a native decoder
+// Parameters: decoder - decoder to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_free (CRF_DECODER* decoder)
+{
+   if (decoder != NULL) {
+      nif_free(decoder->trans);
+      nif_free(decoder->exp_trans);
+      nif_free(decoder->attr_offsets);
+      nif_free(decoder->state_labels);
+      nif_free(decoder->state_weights);
+      nif_free(decoder->start);
+      nif_free(decoder->next_offsets);
+      nif_free(decoder->next_labels);
+      crf_cache_free(decoder->cache);
+   }
+   nif_free(decoder);
+}
+/*-----------< FUNCTION: crf_decoder_constrain >-----------------------------
+// Purpose:    applies a transition constraint mask to a native decoder
+//             disallowed transitions are masked out of the dense transition
+//             matrices, and the allowed targets of each source label are
+//             indexed for beam decoding
+// Parameters: decoder - decoder to constrain
+//             type    - constraint type (CRF_CONSTRAINTS_*)
+//             allowed - L x L allowed transition matrix (source, target)
+//             start   - L allowed start labels
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_constrain (
+   CRF_DECODER* decoder,
+   int          type,
+   const bool*  allowed,
+   const bool*  start)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   int K = 0;
+   for (int i = 0; i < L * L; i++)
+      if (allowed[i])
+         K++;
+   // index the allowed targets of each source label
+   int*   next_offsets = nif_alloc<int>(L + 1);
+   int*   next_labels  = NULL;
+   float* start_scores = NULL;
+   try {
+      next_labels  = nif_alloc<int>(K + 1);
+      start_scores = nif_alloc<float>(S);
+   } catch (NifError& e) {
+      nif_free(next_offsets);
+      nif_free(next_labels);
+      throw;
+   }
+   for (int i = 0; i < L; i++) {
+      next_offsets[i + 1] = next_offsets[i];
+      for (int j = 0; j < L; j++)
+         if (allowed[i * L + j])
+            next_labels[next_offsets[i + 1]++] = j;
+   }
+   for (int j = 0; j < L; j++)
+      start_scores[j] = start[j] ? 0 : -INFINITY;
+   nif_free(decoder->next_offsets);
+   nif_free(decoder->next_labels);
+   nif_free(decoder->start);
+   decoder->constraints  = type;
+   decoder->next_offsets = next_offsets;
+   decoder->next_labels  = next_labels;
+   decoder->start        = start_scores;
+   // mask the disallowed transitions, and shift the exponentials by the
+   // maximum allowed transition weight
+   decoder->trans_max = -FLT_MAX;
+   for (int i = 0; i < L; i++)
+      for (int j = 0; j < L; j++)
+         if (allowed[i * L + j])
+            decoder->trans_max = fmaxf(decoder->trans_max, decoder->trans[i * S + j]);
+         else
+            decoder->trans[i * S + j] = -INFINITY;
+   for (int i = 0; i < L; i++)
+      for (int j = 0; j < L; j++)
+         decoder->exp_trans[i * S + j] = allowed[i * L + j] ?
+            expf(decoder->trans[i * S + j] - decoder->trans_max) : 0;
+}
+/*-----------< FUNCTION: crf_decoder_predict >-------------------------------
+// Purpose:    predicts the most likely label sequence for an instance
+// Parameters: decoder  - native decoder
+//             instance - crfsuite instance (attribute sequence) to tag
+//             shared   - attributes shared by every item in the sequence,
+//                        or NULL
+//             path     - return the label sequence via here
+//             score    - return the path score via here
+//             lognorm  - return the log of the partition function via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_predict (
+   const CRF_DECODER*         decoder,
+   const crfsuite_instance_t* instance,
+   const crfsuite_item_t*     shared,
+   int*                       path,
+   double*                    score,
+   double*                    lognorm)
+{
+   int S = decoder->stride;
+   int T = instance->num_items;
+   float* state = nif_alloc<float>(T * S + 3 * S + 1);
+   int*   back  = NULL;
+   try {
+      back = nif_alloc<int>(T * S + S + 1);
+   } catch (NifError& e) {
+      nif_free(state);
+      throw;
+   }
+   float* work  = state + T * S;
+   int*   index = back + T * S;
+   crf_decoder_state(decoder, instance, shared, state, work);
+   *score   = crf_decoder_viterbi(decoder, state, T, back, work, index, path);
+   *lognorm = crf_decoder_forward(decoder, state, T, work, index);
+   // the pruned beam lattice may exclude paths that were counted in the
+   // viterbi search, so bound the sequence probability by 1
+   if (*lognorm < *score)
+      *lognorm = *score;
+   nif_free(back);
+   nif_free(state);
+}
+/*-----------< FUNCTION: crf_decoder_state >---------------------------------
+// Purpose:    computes the state score matrix for an instance
+//             the shared attribute scores are computed once, and broadcast
+//             to every position before adding the item attribute scores
+// Parameters: decoder  - native decoder
+//             instance - crfsuite instance (attribute sequence)
+//             shared   - attributes shared by every item, or NULL
+//             state    - T x S state score matrix, zero-initialized
+//                        (constrained start labels are masked to -inf)
+//             scores   - S item score scratch vector
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_state (
+   const CRF_DECODER*         decoder,
+   const crfsuite_instance_t* instance,
+   const crfsuite_item_t*     shared,
+   float*                     state,
+   float*                     scores)
+{
+   int S = decoder->stride;
+   int T = instance->num_items;
+   if (shared != NULL && shared->num_contents > 0 && T > 0) {
+      crf_decoder_item(decoder, *shared, state, scores);
+      for (int t = 1; t < T; t++)
+         memcpy(state + t * S, state, S * sizeof(float));
+   }
+   for (int t = 0; t < T; t++)
+      crf_decoder_item(decoder, instance->items[t], state + t * S, scores);
+   if (decoder->start != NULL && T > 0)
+      for (int j = 0; j < decoder->num_labels; j++)
+         state[j] += decoder->start[j];
+}
+/*-----------< FUNCTION: crf_decoder_item >----------------------------------
+// Purpose:    accumulates the state scores for the attributes of an item,
+//             through the state score cache if the decoder has one
+// Parameters: decoder - native decoder
+//             item    - crfsuite item (attribute set)
+//             row     - S state score vector to accumulate
+//             scores  - S item score scratch vector, for caching
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_item (
+   const CRF_DECODER*     decoder,
+   const crfsuite_item_t& item,
+   float*                 row,
+   float*                 scores)
+{
+   int S = decoder->stride;
+   if (decoder->cache == NULL || item.num_contents == 0) {
+      crf_decoder_accumulate(decoder, item, row);
+      return;
+   }
+   uint64_t key = crf_decoder_key(item);
+   if (crf_cache_lookup(decoder->cache, key, row))
+      return;
+   // score the item on its own, so that the scores can be cached
+   memset(scores, 0, S * sizeof(float));
+   crf_decoder_accumulate(decoder, item, scores);
+   crf_cache_insert(decoder->cache, key, scores);
+   for (int j = 0; j < S; j++)
+      row[j] += scores[j];
+}
+/*-----------< FUNCTION: crf_decoder_accumulate >----------------------------
+// Purpose:    accumulates the feature weights for the attributes of an item
+// Parameters: decoder - native decoder
+//             item    - crfsuite item (attribute set)
+//             row     - S state score vector to accumulate
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_decoder_accumulate (
+   const CRF_DECODER*     decoder,
+   const crfsuite_item_t& item,
+   float*                 row)
+{
+   for (int c = 0; c < item.num_contents; c++) {
+      int   a     = item.contents[c].aid;
+      float value = (float)item.contents[c].value;
+      if (a < 0 || a >= decoder->num_attrs)
+         continue;
+      for (int k = decoder->attr_offsets[a];
+               k < decoder->attr_offsets[a + 1];
+               k++)
+         row[decoder->state_labels[k]] += decoder->state_weights[k] * value;
+   }
+}
+/*-----------< FUNCTION: crf_decoder_key >-----------------------------------
+// Purpose:    hashes the attribute id/value list of an item (FNV-1a)
+// Parameters: item - crfsuite item (attribute set)
+// Returns:    64-bit state score cache key
+---------------------------------------------------------------------------*/
+uint64_t crf_decoder_key (const crfsuite_item_t& item)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   for (int c = 0; c < item.num_contents; c++) {
+      const crfsuite_attribute_t& attr = item.contents[c];
+      // normalize signed zeros, which score the same
+      floatval_t value = attr.value == 0 ? 0 : attr.value;
+      const unsigned char* data = (const unsigned char*)&attr.aid;
+      for (size_t i = 0; i < sizeof(attr.aid); i++)
+         hash = (hash ^ data[i]) * 1099511628211ULL;
+      data = (const unsigned char*)&value;
+      for (size_t i = 0; i < sizeof(value); i++)
+         hash = (hash ^ data[i]) * 1099511628211ULL;
+   }
+   return hash;
+}
+/*-----------< FUNCTION: crf_decoder_viterbi >-------------------------------
+// Purpose:    finds the maximum scoring label sequence
+// Parameters: decoder - native decoder
+//             state   - T x S state score matrix
+//             T       - sequence length
+//             back    - T x S back pointer scratch matrix
+//             work    - 3 x S scratch vector
+//             index   - S beam index scratch vector
+//             path    - return the label sequence via here
+// Returns:    the score of the label sequence
+---------------------------------------------------------------------------*/
+double crf_decoder_viterbi (
+   const CRF_DECODER* decoder,
+   const float*       state,
+   int                T,
+   int*               back,
+   float*             work,
+   int*               index,
+   int*               path)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   int B = decoder->beam;
+   if (T == 0)
+      return 0;
+   // run the forward max-product recursion, over the full label set or
+   // the beam of best scoring source labels at each step
+   float* prev = work;
+   float* next = work + S;
+   memcpy(prev, state, S * sizeof(float));
+   for (int t = 1; t < T; t++) {
+      if (B > 0 && B < L) {
+         crf_beam_select(prev, L, B, index);
+         crf_viterbi_step_beam(decoder, prev, state + t * S, index, next, back + t * S);
+      } else
+         g_viterbi_step(decoder, prev, state + t * S, next, back + t * S);
+      float* swap = prev; prev = next; next = swap;
+   }
+   // select the best final label and follow the back pointers
+   int   argmax = 0;
+   float max    = -FLT_MAX;
+   for (int j = 0; j < L; j++)
+      if (max < prev[j]) {
+         max    = prev[j];
+         argmax = j;
+      }
+   path[T - 1] = argmax;
+   for (int t = T - 1; t > 0; t--)
+      path[t - 1] = back[t * S + path[t]];
+   // rescore the path in double precision for the sequence probability
+   double score = state[path[0]];
+   for (int t = 1; t < T; t++)
+      score += state[t * S + path[t]] +
+         decoder->trans[path[t - 1] * S + path[t]];
+   return score;
+}
+/*-----------< FUNCTION: crf_decoder_forward >-------------------------------
+// Purpose:    computes the log partition function using the scaled
+//             forward algorithm
+//             state scores are shifted by their max at each position and
+//             transitions by their global max, so that the exponentials
+//             cannot overflow in single precision
+// Parameters: decoder - native decoder
+//             state   - T x S state score matrix
+//             T       - sequence length
+//             work    - 3 x S scratch vector
+//             index   - S beam index scratch vector
+// Returns:    log of the partition function (NaN on underflow)
+---------------------------------------------------------------------------*/
+double crf_decoder_forward (
+   const CRF_DECODER* decoder,
+   const float*       state,
+   int                T,
+   float*             work,
+   int*               index)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   int B = decoder->beam;
+   float* prev      = work;
+   float* next      = work + S;
+   float* exp_state = work + 2 * S;
+   double lognorm   = 0;
+   for (int t = 0; t < T; t++) {
+      // exponentiate the shifted state scores
+      const float* row = state + t * S;
+      float max = -FLT_MAX;
+      for (int j = 0; j < L; j++)
+         max = fmaxf(max, row[j]);
+      for (int j = 0; j < S; j++)
+         exp_state[j] = row[j] - max;
+      g_exp(exp_state, S);
+      // accumulate the incoming transitions
+      if (t == 0)
+         memcpy(next, exp_state, S * sizeof(float));
+      else if (B > 0 && B < L) {
+         crf_beam_select(prev, L, B, index);
+         crf_forward_step_beam(decoder, prev, exp_state, index, next);
+      } else
+         g_forward_step(decoder, prev, exp_state, next);
+      // rescale the alpha vector to sum to 1
+      double sum = 0;
+      for (int j = 0; j < L; j++)
+         sum += next[j];
+      if (!(sum > 0))
+         return NAN;
+      float scale = (float)(1.0 / sum);
+      for (int j = 0; j < L; j++)
+         next[j] *= scale;
+      lognorm += log(sum) + max + (t > 0 ? decoder->trans_max : 0);
+      float* swap = prev; prev = next; next = swap;
+   }
+   return lognorm;
+}
+/*-----------< FUNCTION: crf_viterbi_step_scalar >---------------------------
+// Purpose:    computes a single viterbi recursion step (portable)
+//             next[j] = state[j] + max_i(prev[i] + trans[i][j])
+// Parameters: decoder - native decoder
+//             prev    - previous position scores
+//             state   - current position state scores
+//             next    - return the current position scores via here
+//             back    - return the back pointers via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_viterbi_step_scalar (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   float*             next,
+   int*               back)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < L; j++) {
+      float max    = -FLT_MAX;
+      int   argmax = 0;
+      for (int i = 0; i < L; i++) {
+         float score = prev[i] + decoder->trans[i * S + j];
+         if (max < score) {
+            max    = score;
+            argmax = i;
+         }
+      }
+      next[j] = max + state[j];
+      back[j] = argmax;
+   }
+}
+/*-----------< FUNCTION: crf_forward_step_scalar >---------------------------
+// Purpose:    computes a single forward recursion step (portable)
+//             next[j] = exp_state[j] * sum_i(prev[i] * exp_trans[i][j])
+// Parameters: decoder   - native decoder
+//             prev      - previous position alpha vector
+//             exp_state - current position exponentiated state scores
+//             next      - return the current position alpha vector via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_forward_step_scalar (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   float*             next)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < L; j++)
+      next[j] = 0;
+   for (int i = 0; i < L; i++) {
+      const float* row = decoder->exp_trans + i * S;
+      for (int j = 0; j < L; j++)
+         next[j] += prev[i] * row[j];
+   }
+   for (int j = 0; j < L; j++)
+      next[j] *= exp_state[j];
+}
+/*-----------< FUNCTION: crf_exp_scalar >------------------------------------
+// Purpose:    computes x = exp(x) in place (portable)
+// Parameters: x - vector to exponentiate
+//             n - vector length
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_exp_scalar (float* x, int n)
+{
+   for (int i = 0; i < n; i++)
+      x[i] = expf(x[i]);
+}
+/*-----------< FUNCTION: crf_beam_select >-----------------------------------
+// Purpose:    selects the beam of highest scoring labels at a position,
+//             in linear time (the beam is not sorted)
+// Parameters: scores - label scores
+//             L      - number of labels
+//             B      - beam width (< L)
+//             index  - return the beam label indexes via here (first B)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_beam_select (const float* scores, int L, int B, int* index)
+{
+   for (int i = 0; i < L; i++)
+      index[i] = i;
+   std::nth_element(
+      index,
+      index + B,
+      index + L,
+      [scores](int a, int b) {
+         return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+      });
+}
+/*-----------< FUNCTION: crf_viterbi_step_beam >-----------------------------
+// Purpose:    computes a single viterbi recursion step over a beam of
+//             source labels and their allowed targets
+//             next[j] = state[j] + max_{i in beam}(prev[i] + trans[i][j])
+// Parameters: decoder - native decoder
+//             prev    - previous position scores
+//             state   - current position state scores
+//             index   - beam source labels
+//             next    - return the current position scores via here
+//                       (-inf for targets unreachable from the beam)
+//             back    - return the back pointers via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_viterbi_step_beam (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   const int*         index,
+   float*             next,
+   int*               back)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < L; j++) {
+      next[j] = -INFINITY;
+      back[j] = 0;
+   }
+   for (int b = 0; b < decoder->beam; b++) {
+      int          i   = index[b];
+      const float* row = decoder->trans + i * S;
+      if (decoder->next_offsets != NULL) {
+         for (int k = decoder->next_offsets[i]; k < decoder->next_offsets[i + 1]; k++) {
+            int   j     = decoder->next_labels[k];
+            float score = prev[i] + row[j];
+            if (next[j] < score || (next[j] == score && i < back[j])) {
+               next[j] = score;
+               back[j] = i;
+            }
+         }
+      } else {
+         for (int j = 0; j < L; j++) {
+            float score = prev[i] + row[j];
+            if (next[j] < score || (next[j] == score && i < back[j])) {
+               next[j] = score;
+               back[j] = i;
+            }
+         }
+      }
+   }
+   for (int j = 0; j < L; j++)
+      next[j] += state[j];
+}
+/*-----------< FUNCTION: crf_forward_step_beam >-----------------------------
+// Purpose:    computes a single forward recursion step over a beam of
+//             source labels and their allowed targets
+//             next[j] = exp_state[j] * sum_{i in beam}(prev[i] * exp_trans[i][j])
+// Parameters: decoder   - native decoder
+//             prev      - previous position alpha vector
+//             exp_state - current position exponentiated state scores
+//             index     - beam source labels
+//             next      - return the current position alpha vector via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_forward_step_beam (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   const int*         index,
+   float*             next)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < S; j++)
+      next[j] = 0;
+   for (int b = 0; b < decoder->beam; b++) {
+      int          i   = index[b];
+      const float* row = decoder->exp_trans + i * S;
+      if (decoder->next_offsets != NULL) {
+         for (int k = decoder->next_offsets[i]; k < decoder->next_offsets[i + 1]; k++) {
+            int j = decoder->next_labels[k];
+            next[j] += prev[i] * row[j];
+         }
+      } else {
+         for (int j = 0; j < L; j++)
+            next[j] += prev[i] * row[j];
+      }
+   }
+   for (int j = 0; j < L; j++)
+      next[j] *= exp_state[j];
+}
+#ifdef CRF_DECODER_AVX2
+/*-----------< FUNCTION: crf_viterbi_step_avx2 >-----------------------------
+// Purpose:    computes a single viterbi recursion step (AVX2)
+//             vectorized across 8 target labels at a time, with the
+//             argmax tracked by blending the source label index
+// Parameters: decoder - native decoder
+//             prev    - previous position scores
+//             state   - current position state scores
+//             next    - return the current position scores via here
+//             back    - return the back pointers via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_viterbi_step_avx2 (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       state,
+   float*             next,
+   int*               back)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < S; j += CRF_SIMD_WIDTH) {
+      __m256 max    = _mm256_set1_ps(-FLT_MAX);
+      __m256 argmax = _mm256_setzero_ps();
+      for (int i = 0; i < L; i++) {
+         __m256 score = _mm256_add_ps(
+            _mm256_set1_ps(prev[i]),
+            _mm256_loadu_ps(decoder->trans + i * S + j));
+         // strict comparison keeps the first maximum, as crfsuite does
+         __m256 mask = _mm256_cmp_ps(score, max, _CMP_GT_OQ);
+         max    = _mm256_blendv_ps(max, score, mask);
+         argmax = _mm256_blendv_ps(
+            argmax,
+            _mm256_castsi256_ps(_mm256_set1_epi32(i)),
+            mask);
+      }
+      _mm256_storeu_ps(next + j, _mm256_add_ps(max, _mm256_loadu_ps(state + j)));
+      _mm256_storeu_si256((__m256i*)(back + j), _mm256_castps_si256(argmax));
+   }
+}
+/*-----------< FUNCTION: crf_forward_step_avx2 >-----------------------------
+// Purpose:    computes a single forward recursion step (AVX2)
+// Parameters: decoder   - native decoder
+//             prev      - previous position alpha vector
+//             exp_state - current position exponentiated state scores
+//             next      - return the current position alpha vector via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_forward_step_avx2 (
+   const CRF_DECODER* decoder,
+   const float*       prev,
+   const float*       exp_state,
+   float*             next)
+{
+   int L = decoder->num_labels;
+   int S = decoder->stride;
+   for (int j = 0; j < S; j += CRF_SIMD_WIDTH) {
+      __m256 sum = _mm256_setzero_ps();
+      for (int i = 0; i < L; i++)
+         sum = _mm256_fmadd_ps(
+            _mm256_set1_ps(prev[i]),
+            _mm256_loadu_ps(decoder->exp_trans + i * S + j),
+            sum);
+      _mm256_storeu_ps(next + j, _mm256_mul_ps(sum, _mm256_loadu_ps(exp_state + j)));
+   }
+}
+/*-----------< FUNCTION: crf_exp_avx2 >--------------------------------------
+// Purpose:    computes x = exp(x) in place (AVX2)
+//             uses the cephes range reduction and polynomial approximation
+//             (relative error ~1e-7), with the input clamped to the
+//             representable single-precision range
+// Parameters: x - vector to exponentiate
+//             n - vector length (a multiple of the SIMD width)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_exp_avx2 (float* x, int n)
+{
+   const __m256 hi    = _mm256_set1_ps(88.3762626647949f);
+   const __m256 lo    = _mm256_set1_ps(-88.3762626647949f);
+   const __m256 log2e = _mm256_set1_ps(1.44269504088896341f);
+   const __m256 ln2hi = _mm256_set1_ps(0.693359375f);
+   const __m256 ln2lo = _mm256_set1_ps(-2.12194440e-4f);
+   const __m256 half  = _mm256_set1_ps(0.5f);
+   const __m256 one   = _mm256_set1_ps(1.0f);
+   for (int i = 0; i < n; i += CRF_SIMD_WIDTH) {
+      __m256 v = _mm256_loadu_ps(x + i);
+      v = _mm256_max_ps(_mm256_min_ps(v, hi), lo);
+      // exp(v) = 2^k * exp(r), k = round(v / ln2), r = v - k * ln2
+      __m256 k = _mm256_floor_ps(_mm256_fmadd_ps(v, log2e, half));
+      v = _mm256_fnmadd_ps(k, ln2hi, v);
+      v = _mm256_fnmadd_ps(k, ln2lo, v);
+      // exp(r) ~= 1 + r + r^2 * p(r)
+      __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+      p = _mm256_fmadd_ps(p, v, _mm256_set1_ps(1.3981999507e-3f));
+      p = _mm256_fmadd_ps(p, v, _mm256_set1_ps(8.3334519073e-3f));
+      p = _mm256_fmadd_ps(p, v, _mm256_set1_ps(4.1665795894e-2f));
+      p = _mm256_fmadd_ps(p, v, _mm256_set1_ps(1.6666665459e-1f));
+      p = _mm256_fmadd_ps(p, v, _mm256_set1_ps(5.0000001201e-1f));
+      p = _mm256_fmadd_ps(p, _mm256_mul_ps(v, v), _mm256_add_ps(v, one));
+      // scale by 2^k via the float exponent bits
+      __m256i e = _mm256_cvttps_epi32(k);
+      e = _mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23);
+      _mm256_storeu_ps(x + i, _mm256_mul_ps(p, _mm256_castsi256_ps(e)));
+   }
+}
+#endif
@@ -0,0 +1,245 @@
+/****************************************************************************
+ *
+ * MODULE:  crf_prune.cpp
+ * PURPOSE: crfsuite model pruning/compaction
+ *
+ * A trained model (particularly with L1 regularization) may carry many
+ * features whose weights are zero or negligible, and every attribute that
+ * was seen during training, whether or not it still has any features.
+ * Pruning rewrites the model file with only the features whose weight
+ * magnitudes reach a threshold, drops the attributes left without state
+ * features, and renumbers the remaining attributes and features densely,
+ * which shrinks both the model and its attribute dictionary.
+ *
+ * for abbreviated names:
+ * . L is the number of labels
+ * . A is the number of attributes
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <math.h>
+#include <vector>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+extern "C" {
+#include "deps/crfsuite/lib/crf/src/crf1d.h"
+}
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void crf_prune_refs (
+   crf1dm_t*                      reader,
+   feature_refs_t*                source,
+   double                         threshold,
+   int                            attr,
+   std::vector<crf1dm_feature_t>* features,
+   feature_refs_t*                target);
+static void crf_prune_write (
+   crf1dm_t*                            reader,
+   const char*                          path,
+   const std::vector<crf1dm_feature_t>& features,
+   feature_refs_t*                      label_refs,
+   feature_refs_t*                      attr_refs,
+   const int*                           amap);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: crf_prune_model >-----------------------------------
+// Purpose:    writes a pruned copy of a crfsuite model file
+//             features with zero weight or a weight magnitude below the
+//             threshold are removed, along with the attributes that no
+//             longer have any state features; the labels are unchanged
+// Parameters: source    - source model file path
+//             target    - pruned model file path
+//             threshold - minimum feature weight magnitude to keep
+//             stats     - return the feature/attribute counts via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_prune_model (
+   const char*      source,
+   const char*      target,
+   double           threshold,
+   CRF_PRUNE_STATS* stats)
+{
+   crf1dm_t*       reader     = CHECK(crf1dm_new(source), "load_failed");
+   feature_refs_t* label_refs = NULL;
+   feature_refs_t* attr_refs  = NULL;
+   int*            amap       = NULL;
+   int L = crf1dm_get_num_labels(reader);
+   int A = crf1dm_get_num_attrs(reader);
+   memset(stats, 0, sizeof(*stats));
+   try {
+      std::vector<crf1dm_feature_t> features;
+      label_refs = nif_alloc<feature_refs_t>(L + 1);
+      attr_refs  = nif_alloc<feature_refs_t>(A + 1);
+      amap       = nif_alloc<int>(A + 1);
+      // keep the transition features above the threshold
+      for (int l = 0; l < L; l++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_labelref(reader, l, &refs) == 0, "load_failed");
+         stats->num_features += refs.num_features;
+         crf_prune_refs(
+            reader,
+            &refs,
+            threshold,
+            -1,
+            &features,
+            &label_refs[l]);
+      }
+      // keep the state features above the threshold, and renumber the
+      // attributes that still have any
+      int num_attrs = 0;
+      for (int a = 0; a < A; a++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_attrref(reader, a, &refs) == 0, "load_failed");
+         stats->num_features += refs.num_features;
+         crf_prune_refs(
+            reader,
+            &refs,
+            threshold,
+            num_attrs,
+            &features,
+            &attr_refs[num_attrs]);
+         if (attr_refs[num_attrs].num_features > 0)
+            amap[a] = num_attrs++;
+         else {
+            nif_free(attr_refs[num_attrs].fids);
+            attr_refs[num_attrs].fids = NULL;
+            amap[a] = -1;
+         }
+      }
+      stats->num_attrs       = A;
+      stats->pruned_attrs    = num_attrs;
+      stats->pruned_features = (int)features.size();
+      // write the compacted model
+      crf_prune_write(reader, target, features, label_refs, attr_refs, amap);
+   } catch (NifError& e) {
+      for (int l = 0; label_refs != NULL && l < L; l++)
+         nif_free(label_refs[l].fids);
+      for (int a = 0; attr_refs != NULL && a < A; a++)
+         nif_free(attr_refs[a].fids);
+      nif_free(label_refs);
+      nif_free(attr_refs);
+      nif_free(amap);
+      crf1dm_close(reader);
+      throw;
+   }
+   for (int l = 0; l < L; l++)
+      nif_free(label_refs[l].fids);
+   for (int a = 0; a < A; a++)
+      nif_free(attr_refs[a].fids);
+   nif_free(label_refs);
+   nif_free(attr_refs);
+   nif_free(amap);
+   crf1dm_close(reader);
+}
+/*-----------< FUNCTION: crf_prune_refs >------------------------------------
+// Purpose:    filters a feature reference list by weight, appending the
+//             surviving features to the pruned feature list
+// Parameters: reader    - source model reader
+//             source    - source feature references
+//             threshold - minimum feature weight magnitude to keep
+//             attr      - renumbered attribute id for state features
+//                         (-1 for transition features)
+//             features  - pruned feature list to update
+//             target    - return the pruned feature references via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_prune_refs (
+   crf1dm_t*                      reader,
+   feature_refs_t*                source,
+   double                         threshold,
+   int                            attr,
+   std::vector<crf1dm_feature_t>* features,
+   feature_refs_t*                target)
+{
+   target->num_features = 0;
+   target->fids = nif_alloc<int>(source->num_features + 1);
+   for (int k = 0; k < source->num_features; k++) {
+      crf1dm_feature_t feature;
+      int fid = crf1dm_get_featureid(source, k);
+      CHECK(crf1dm_get_feature(reader, fid, &feature) == 0, "load_failed");
+      if (feature.weight == 0 || fabs(feature.weight) < threshold)
+         continue;
+      if (attr >= 0)
+         feature.src = attr;
+      target->fids[target->num_features++] = (int)features->size();
+      features->push_back(feature);
+   }
+}
+/*-----------< FUNCTION: crf_prune_write >-----------------------------------
+// Purpose:    writes a pruned crfsuite model file
+// Parameters: reader     - source model reader (for labels/attributes)
+//             path       - pruned model file path
+//             features   - pruned features
+//             label_refs - L pruned transition feature references
+//             attr_refs  - pruned state feature references, by new
+//                          attribute id
+//             amap       - A source -> pruned attribute id map
+//                          (-1 if removed)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_prune_write (
+   crf1dm_t*                            reader,
+   const char*                          path,
+   const std::vector<crf1dm_feature_t>& features,
+   feature_refs_t*                      label_refs,
+   feature_refs_t*                      attr_refs,
+   const int*                           amap)
+{
+   int L = crf1dm_get_num_labels(reader);
+   int A = crf1dm_get_num_attrs(reader);
+   int K = (int)features.size();
+   int* fmap = nif_alloc<int>(K + 1);
+   crf1dmw_t* writer = NULL;
+   try {
+      writer = CHECK(crf1mmw(path), "store_failed");
+      // the pruned feature ids are already dense
+      for (int k = 0; k < K; k++)
+         fmap[k] = k;
+      CHECK(crf1dmw_open_features(writer) == 0, "store_failed");
+      for (int k = 0; k < K; k++)
+         CHECK(crf1dmw_put_feature(writer, k, &features[k]) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_features(writer) == 0, "store_failed");
+      // write the label dictionary
+      CHECK(crf1dmw_open_labels(writer, L) == 0, "store_failed");
+      for (int l = 0; l < L; l++)
+         CHECK(crf1dmw_put_label(writer, l, crf1dm_to_label(reader, l)) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_labels(writer) == 0, "store_failed");
+      // write the surviving attribute dictionary
+      int num_attrs = 0;
+      for (int a = 0; a < A; a++)
+         num_attrs += amap[a] >= 0;
+      CHECK(crf1dmw_open_attrs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < A; a++)
+         if (amap[a] >= 0)
+            CHECK(crf1dmw_put_attr(
+                  writer,
+                  amap[a],
+                  crf1dm_to_attr(reader, a)) == 0,
+               "store_failed");
+      CHECK(crf1dmw_close_attrs(writer) == 0, "store_failed");
+      // write the feature references
+      CHECK(crf1dmw_open_labelrefs(writer, L + 2) == 0, "store_failed");
+      for (int l = 0; l < L; l++)
+         CHECK(crf1dmw_put_labelref(writer, l, &label_refs[l], fmap) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_labelrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_open_attrrefs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < num_attrs; a++)
+         CHECK(crf1dmw_put_attrref(writer, a, &attr_refs[a], fmap) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_attrrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_close(writer) == 0, "store_failed");
+      writer = NULL;
+   } catch (NifError& e) {
+      if (writer != NULL)
+         crf1dmw_close(writer);
+      nif_free(fmap);
+      throw;
+   }
+   nif_free(fmap);
+}
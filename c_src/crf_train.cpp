@@ -0,0 +1,791 @@
+/****************************************************************************
+ *
+ * MODULE:  crf_train.cpp
+ * PURPOSE: multi-threaded L-BFGS training for crfsuite models
+ *
+ * This module mirrors the crfsuite crf1d L-BFGS trainer, but evaluates the
+ * objective and gradients in parallel. Training instances are split into
+ * contiguous shards (balanced by item count), and each shard is evaluated
+ * on its own thread, with a private forward-backward context and model
+ * expectation buffer. The shard results are reduced in shard order before
+ * each L-BFGS step, so that training is deterministic for a fixed number
+ * of threads.
+ *
+ * Training can also be stopped early, based on the accuracy of a holdout
+ * group of instances (excluded from training) or a wall-clock budget.
+ * The holdout set is decoded with the current weights every few
+ * iterations, and the best scoring weights are the ones saved.
+ *
+ * for abbreviated names:
+ * . L is the number of labels
+ * . A is the number of attributes
+ * . K is the number of features
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <math.h>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+#include "job.hpp"
+extern "C" {
+#include "deps/crfsuite/lib/crf/src/crf1d.h"
+#include "deps/liblbfgs/include/lbfgs.h"
+}
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+struct tagCrfTrainer;
+// training shard, a contiguous range of instances evaluated by one thread
+typedef struct tagCrfShard {
+   struct tagCrfTrainer* trainer;   // owning trainer
+   int                   begin;     // first instance index
+   int                   end;       // instance index upper bound (exclusive)
+   crf1d_context_t*      ctx;       // forward-backward context
+   floatval_t*           g;         // K model expectations
+   floatval_t            logl;      // log likelihood of the shard
+   const floatval_t*     w;         // K feature weights being evaluated
+   ErlNifTid             tid;       // evaluation thread
+   bool                  threaded;  // evaluating on a separate thread?
+} CRF_SHARD;
+// parallel L-BFGS trainer state
+typedef struct tagCrfTrainer {
+   crfsuite_data_t*          data;          // training data
+   int                       num_labels;    // L
+   int                       num_attrs;     // A
+   int                       num_features;  // K
+   crf1df_feature_t*         features;      // K generated features
+   feature_refs_t*           attr_refs;     // A attribute -> feature refs
+   feature_refs_t*           trans_refs;    // L label -> transition refs
+   int                       num_shards;    // number of shards/threads
+   CRF_SHARD*                shards;        // instance shards
+   floatval_t                c2;            // L2 regularization coefficient
+   floatval_t*               best_w;        // last accepted feature weights
+   crfsuite_logging_callback callback;      // verbose message callback
+   ErlNifTime                timestamp;     // last iteration timestamp
+   ErlNifTime                start;         // training start timestamp
+   dataset_t                 train;         // training instances
+   dataset_t                 holdout;       // holdout instances
+   const CRF_STOPPING*       stopping;      // early stopping options
+   int*                      path;          // holdout viterbi labels
+   floatval_t*               stop_w;        // best holdout feature weights
+   double                    stop_score;    // best holdout accuracy
+   int                       stop_k;        // iteration of the best weights
+   int                       stale;         // evaluations since improving
+   int                       iteration;     // last completed iteration
+   int                       evaluated;     // last evaluated iteration
+} CRF_TRAINER;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void crf_train_features (
+   CRF_TRAINER*       trainer,
+   crfsuite_params_t* params);
+static void crf_train_shards (
+   CRF_TRAINER* trainer,
+   int          threads);
+static void crf_train_optimize (
+   CRF_TRAINER*       trainer,
+   crfsuite_params_t* params,
+   floatval_t*        w);
+static void crf_train_save (
+   CRF_TRAINER*      trainer,
+   const floatval_t* w,
+   const char*       path);
+static void crf_train_free (
+   CRF_TRAINER* trainer);
+static bool crf_train_stop (
+   CRF_TRAINER*      trainer,
+   const floatval_t* w,
+   int               k);
+static double crf_train_holdout (
+   CRF_TRAINER*      trainer,
+   const floatval_t* w);
+static lbfgsfloatval_t crf_train_evaluate (
+   void*                  instance,
+   const lbfgsfloatval_t* x,
+   lbfgsfloatval_t*       g,
+   const int              n,
+   const lbfgsfloatval_t  step);
+static int crf_train_progress (
+   void*                  instance,
+   const lbfgsfloatval_t* x,
+   const lbfgsfloatval_t* g,
+   const lbfgsfloatval_t  fx,
+   const lbfgsfloatval_t  xnorm,
+   const lbfgsfloatval_t  gnorm,
+   const lbfgsfloatval_t  step,
+   int                    n,
+   int                    k,
+   int                    ls);
+static void* crf_train_shard (
+   void* arg);
+static void crf_train_log (
+   CRF_TRAINER* trainer,
+   const char*  format,
+   ...);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: crf_train_lbfgs >-----------------------------------
+// Purpose:    trains a crf1d model using multi-threaded L-BFGS and writes
+//             it to a crfsuite model file
+// Parameters: data     - training data, with attribute/label dictionaries
+//             params   - crfsuite L-BFGS trainer parameters
+//             threads  - number of gradient evaluation threads
+//             path     - model file path
+//             callback - verbose message callback (NULL for none)
+//             stopping - early stopping options
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_lbfgs (
+   crfsuite_data_t*          data,
+   crfsuite_params_t*        params,
+   int                       threads,
+   const char*               path,
+   crfsuite_logging_callback callback,
+   const CRF_STOPPING*       stopping)
+{
+   CRF_TRAINER trainer; memset(&trainer, 0, sizeof(trainer));
+   floatval_t* w = NULL;
+   try {
+      trainer.data     = data;
+      trainer.callback = callback;
+      trainer.stopping = stopping;
+      // split off the holdout instances, if any
+      dataset_init_trainset(&trainer.train, data, stopping->holdout);
+      if (stopping->holdout >= 0) {
+         dataset_init_testset(&trainer.holdout, data, stopping->holdout);
+         CHECK(trainer.train.num_instances > 0, "invalid_holdout");
+      }
+      // generate the model features and partition the data
+      crf_train_features(&trainer, params);
+      crf_train_shards(&trainer, threads);
+      // optimize the feature weights and save the model
+      w = nif_alloc<floatval_t>(trainer.num_features + 1);
+      crf_train_optimize(&trainer, params, w);
+      crf_train_save(&trainer, w, path);
+   } catch (NifError& e) {
+      nif_free(w);
+      crf_train_free(&trainer);
+      throw;
+   }
+   nif_free(w);
+   crf_train_free(&trainer);
+}
+/*-----------< FUNCTION: crf_train_features >--------------------------------
+// Purpose:    generates the state/transition features for the training
+//             data, using the crfsuite feature parameters
+// Parameters: trainer - trainer to initialize
+//             params  - crfsuite trainer parameters
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_features (CRF_TRAINER* trainer, crfsuite_params_t* params)
+{
+   crfsuite_data_t* data = trainer->data;
+   int        all_states      = 0;
+   int        all_transitions = 0;
+   floatval_t min_freq        = 0;
+   params->get_int(params, "feature.possible_states", &all_states);
+   params->get_int(params, "feature.possible_transitions", &all_transitions);
+   params->get_float(params, "feature.minfreq", &min_freq);
+   trainer->num_labels = data->labels->num(data->labels);
+   trainer->num_attrs  = data->attrs->num(data->attrs);
+   // generate the features over the training instances
+   trainer->features = crf1df_generate(
+      &trainer->num_features,
+      &trainer->train,
+      trainer->num_labels,
+      trainer->num_attrs,
+      all_states,
+      all_transitions,
+      min_freq,
+      trainer->callback,
+      NULL);
+   CHECKALLOC(trainer->features);
+   // index the features by attribute and source label
+   CHECKALLOC(crf1df_init_references(
+      &trainer->attr_refs,
+      &trainer->trans_refs,
+      trainer->features,
+      trainer->num_features,
+      trainer->num_attrs,
+      trainer->num_labels) == 0);
+   crf_train_log(
+      trainer,
+      "Number of features: %d\n",
+      trainer->num_features);
+}
+/*-----------< FUNCTION: crf_train_shards >----------------------------------
+// Purpose:    partitions the training instances into contiguous shards of
+//             roughly equal item counts, and allocates the per-shard
+//             evaluation state
+// Parameters: trainer - trainer to initialize
+//             threads - requested number of shards/threads
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_shards (CRF_TRAINER* trainer, int threads)
+{
+   crfsuite_data_t* data = trainer->data;
+   int N = trainer->train.num_instances;
+   // count the items to balance, and the maximum sequence length
+   // (including the holdout instances, which are decoded by shard 0)
+   long total = 0;
+   int  cap   = 1;
+   for (int n = 0; n < N; n++)
+      total += dataset_get(&trainer->train, n)->num_items;
+   for (int n = 0; n < data->num_instances; n++)
+      cap = data->instances[n].num_items > cap
+         ? data->instances[n].num_items
+         : cap;
+   trainer->num_shards = threads < 1 ? 1 : (threads > N && N > 0 ? N : threads);
+   trainer->shards     = nif_alloc<CRF_SHARD>(trainer->num_shards);
+   // assign each shard the instances up to its share of the items
+   long items = 0;
+   int  n     = 0;
+   for (int s = 0; s < trainer->num_shards; s++) {
+      CRF_SHARD* shard = &trainer->shards[s];
+      long bound = total * (s + 1) / trainer->num_shards;
+      shard->trainer = trainer;
+      shard->begin   = n;
+      while (n < N && (items < bound || s == trainer->num_shards - 1))
+         items += dataset_get(&trainer->train, n++)->num_items;
+      shard->end = n;
+      shard->ctx = CHECKALLOC(crf1dc_new(
+         CTXF_VITERBI | CTXF_MARGINALS,
+         trainer->num_labels,
+         cap));
+      shard->g   = nif_alloc<floatval_t>(trainer->num_features + 1);
+   }
+   if (trainer->holdout.num_instances > 0)
+      trainer->path = nif_alloc<int>(cap);
+}
+/*-----------< FUNCTION: crf_train_optimize >--------------------------------
+// Purpose:    runs the L-BFGS optimizer, with the same parameterization as
+//             the crfsuite lbfgs trainer
+// Parameters: trainer - initialized trainer
+//             params  - crfsuite trainer parameters
+//             w       - return the optimized feature weights via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_optimize (
+   CRF_TRAINER*       trainer,
+   crfsuite_params_t* params,
+   floatval_t*        w)
+{
+   lbfgs_parameter_t lbfgs_params;
+   lbfgs_parameter_init(&lbfgs_params);
+   // retrieve the optimizer parameters
+   floatval_t c1 = 0;
+   char* linesearch = NULL;
+   params->get_float(params, "c1", &c1);
+   params->get_float(params, "c2", &trainer->c2);
+   params->get_int(params, "num_memories", &lbfgs_params.m);
+   params->get_int(params, "max_iterations", &lbfgs_params.max_iterations);
+   params->get_float(params, "epsilon", &lbfgs_params.epsilon);
+   params->get_int(params, "period", &lbfgs_params.past);
+   params->get_float(params, "delta", &lbfgs_params.delta);
+   params->get_int(params, "max_linesearch", &lbfgs_params.max_linesearch);
+   params->get_string(params, "linesearch", &linesearch);
+   if (linesearch != NULL && strcmp(linesearch, "Backtracking") == 0)
+      lbfgs_params.linesearch = LBFGS_LINESEARCH_BACKTRACKING;
+   else if (linesearch != NULL && strcmp(linesearch, "StrongBacktracking") == 0)
+      lbfgs_params.linesearch = LBFGS_LINESEARCH_BACKTRACKING_STRONG_WOLFE;
+   else
+      lbfgs_params.linesearch = LBFGS_LINESEARCH_MORETHUENTE;
+   if (linesearch != NULL)
+      params->free(params, linesearch);
+   // L1 regularization uses OWL-QN, which requires backtracking
+   if (c1 > 0) {
+      lbfgs_params.orthantwise_c = c1;
+      lbfgs_params.linesearch    = LBFGS_LINESEARCH_BACKTRACKING;
+   }
+   // run the optimizer, starting from zero weights
+   // as with crfsuite, keep the weights from the last completed iteration
+   // if the optimizer terminates early (line search failure, etc.)
+   trainer->best_w    = nif_alloc<floatval_t>(trainer->num_features + 1);
+   trainer->timestamp = enif_monotonic_time(ERL_NIF_USEC);
+   trainer->start     = trainer->timestamp;
+   if (trainer->holdout.num_instances > 0) {
+      trainer->stop_w     = nif_alloc<floatval_t>(trainer->num_features + 1);
+      trainer->stop_score = -1;
+   }
+   lbfgsfloatval_t fx = 0;
+   int result = lbfgs(
+      trainer->num_features,
+      w,
+      &fx,
+      &crf_train_evaluate,
+      &crf_train_progress,
+      trainer,
+      &lbfgs_params);
+   CHECK(result != LBFGSERR_OUTOFMEMORY, "enomem");
+   CHECK(result != LBFGSERR_CANCELED, "cancelled");
+   crf_train_log(trainer, "L-BFGS terminated with code %d\n", result);
+   memcpy(w, trainer->best_w, trainer->num_features * sizeof(floatval_t));
+   // with a holdout set, keep the best scoring weights instead, evaluating
+   // the final weights if they were not already
+   if (trainer->stop_w != NULL && trainer->iteration > 0) {
+      if (trainer->evaluated != trainer->iteration) {
+         double score = crf_train_holdout(trainer, w);
+         if (score > trainer->stop_score) {
+            memcpy(trainer->stop_w, w, trainer->num_features * sizeof(floatval_t));
+            trainer->stop_score = score;
+            trainer->stop_k     = trainer->iteration;
+         }
+      }
+      memcpy(w, trainer->stop_w, trainer->num_features * sizeof(floatval_t));
+      crf_train_log(
+         trainer,
+         "Using the weights from iteration #%d (holdout accuracy: %f)\n",
+         trainer->stop_k,
+         trainer->stop_score);
+   }
+}
+/*-----------< FUNCTION: crf_train_save >------------------------------------
+// Purpose:    writes the trained model to a crfsuite model file,
+//             omitting zero-weight features and unreferenced attributes
+// Parameters: trainer - trained model state
+//             w       - feature weights
+//             path    - model file path
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_save (
+   CRF_TRAINER*      trainer,
+   const floatval_t* w,
+   const char*       path)
+{
+   crfsuite_dictionary_t* labels = trainer->data->labels;
+   crfsuite_dictionary_t* attrs  = trainer->data->attrs;
+   int L = trainer->num_labels;
+   int A = trainer->num_attrs;
+   int K = trainer->num_features;
+   int* fmap = NULL;
+   int* amap = NULL;
+   crf1dmw_t* writer = NULL;
+   try {
+      fmap   = nif_alloc<int>(K + 1);
+      amap   = nif_alloc<int>(A + 1);
+      writer = CHECK(crf1mmw(path), "store_failed");
+      // map the active features and attributes to new identifiers
+      for (int k = 0; k < K; k++)
+         fmap[k] = -1;
+      for (int a = 0; a < A; a++)
+         amap[a] = -1;
+      int num_features = 0;
+      int num_attrs    = 0;
+      CHECK(crf1dmw_open_features(writer) == 0, "store_failed");
+      for (int k = 0; k < K; k++) {
+         const crf1df_feature_t& f = trainer->features[k];
+         if (w[k] == 0)
+            continue;
+         if (f.type == FT_STATE && amap[f.src] < 0)
+            amap[f.src] = num_attrs++;
+         crf1dm_feature_t feature;
+         feature.type   = f.type;
+         feature.src    = f.type == FT_STATE ? amap[f.src] : f.src;
+         feature.dst    = f.dst;
+         feature.weight = w[k];
+         fmap[k] = num_features++;
+         CHECK(crf1dmw_put_feature(writer, fmap[k], &feature) == 0,
+            "store_failed");
+      }
+      CHECK(crf1dmw_close_features(writer) == 0, "store_failed");
+      // write the label dictionary
+      CHECK(crf1dmw_open_labels(writer, L) == 0, "store_failed");
+      for (int l = 0; l < L; l++) {
+         const char* label = NULL;
+         CHECKALLOC(labels->to_string(labels, l, &label) == 0);
+         int result = crf1dmw_put_label(writer, l, label);
+         labels->free(labels, label);
+         CHECK(result == 0, "store_failed");
+      }
+      CHECK(crf1dmw_close_labels(writer) == 0, "store_failed");
+      // write the active attribute dictionary
+      CHECK(crf1dmw_open_attrs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < A; a++) {
+         if (amap[a] < 0)
+            continue;
+         const char* attr = NULL;
+         CHECKALLOC(attrs->to_string(attrs, a, &attr) == 0);
+         int result = crf1dmw_put_attr(writer, amap[a], attr);
+         attrs->free(attrs, attr);
+         CHECK(result == 0, "store_failed");
+      }
+      CHECK(crf1dmw_close_attrs(writer) == 0, "store_failed");
+      // write the feature references
+      CHECK(crf1dmw_open_labelrefs(writer, L + 2) == 0, "store_failed");
+      for (int l = 0; l < L; l++)
+         CHECK(crf1dmw_put_labelref(writer, l, &trainer->trans_refs[l], fmap) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_labelrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_open_attrrefs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < A; a++)
+         if (amap[a] >= 0)
+            CHECK(crf1dmw_put_attrref(
+                  writer,
+                  amap[a],
+                  &trainer->attr_refs[a],
+                  fmap) == 0,
+               "store_failed");
+      CHECK(crf1dmw_close_attrrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_close(writer) == 0, "store_failed");
+      writer = NULL;
+   } catch (NifError& e) {
+      if (writer != NULL)
+         crf1dmw_close(writer);
+      nif_free(amap);
+      nif_free(fmap);
+      throw;
+   }
+   nif_free(amap);
+   nif_free(fmap);
+}
+/*-----------< FUNCTION: crf_train_free >------------------------------------
+// Purpose:    frees the memory associated with a trainer
+// Parameters: trainer - trainer to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_free (CRF_TRAINER* trainer)
+{
+   if (trainer->shards != NULL)
+      for (int s = 0; s < trainer->num_shards; s++) {
+         if (trainer->shards[s].ctx != NULL)
+            crf1dc_delete(trainer->shards[s].ctx);
+         nif_free(trainer->shards[s].g);
+      }
+   nif_free(trainer->shards);
+   if (trainer->attr_refs != NULL)
+      for (int a = 0; a < trainer->num_attrs; a++)
+         free(trainer->attr_refs[a].fids);
+   free(trainer->attr_refs);
+   if (trainer->trans_refs != NULL)
+      for (int l = 0; l < trainer->num_labels; l++)
+         free(trainer->trans_refs[l].fids);
+   free(trainer->trans_refs);
+   free(trainer->features);
+   nif_free(trainer->best_w);
+   nif_free(trainer->stop_w);
+   nif_free(trainer->path);
+   dataset_finish(&trainer->train);
+   dataset_finish(&trainer->holdout);
+}
+/*-----------< FUNCTION: crf_train_stop >------------------------------------
+// Purpose:    applies the early stopping rules after an iteration
+//             the holdout set is evaluated every period iterations, and
+//             the best scoring weights are retained
+// Parameters: trainer - trainer
+//             w       - current feature weights
+//             k       - iteration number
+// Returns:    true to stop training, false to continue
+---------------------------------------------------------------------------*/
+bool crf_train_stop (CRF_TRAINER* trainer, const floatval_t* w, int k)
+{
+   const CRF_STOPPING* stopping = trainer->stopping;
+   trainer->iteration = k;
+   // evaluate the holdout set periodically
+   if (trainer->stop_w != NULL && k % stopping->period == 0) {
+      double score = crf_train_holdout(trainer, w);
+      trainer->evaluated = k;
+      if (score > trainer->stop_score) {
+         memcpy(trainer->stop_w, w, trainer->num_features * sizeof(floatval_t));
+         trainer->stop_score = score;
+         trainer->stop_k     = k;
+         trainer->stale      = 0;
+      } else
+         trainer->stale++;
+      crf_train_log(
+         trainer,
+         "Holdout accuracy: %f (best: %f at iteration #%d)\n",
+         score,
+         trainer->stop_score,
+         trainer->stop_k);
+      if (stopping->patience > 0 && trainer->stale >= stopping->patience) {
+         crf_train_log(
+            trainer,
+            "Stopping: no holdout improvement in %d evaluations\n",
+            trainer->stale);
+         return true;
+      }
+   }
+   // enforce the wall-clock budget
+   double elapsed =
+      (enif_monotonic_time(ERL_NIF_USEC) - trainer->start) / 1e6;
+   if (stopping->max_seconds > 0 && elapsed >= stopping->max_seconds) {
+      crf_train_log(
+         trainer,
+         "Stopping: time budget of %.3f seconds exceeded\n",
+         stopping->max_seconds);
+      return true;
+   }
+   return false;
+}
+/*-----------< FUNCTION: crf_train_holdout >---------------------------------
+// Purpose:    computes the viterbi labeling accuracy of the holdout set
+//             (weighted by the instance weights), using the first shard's
+//             context
+// Parameters: trainer - trainer
+//             w       - feature weights to evaluate
+// Returns:    the token or sequence accuracy, in [0, 1]
+---------------------------------------------------------------------------*/
+double crf_train_holdout (CRF_TRAINER* trainer, const floatval_t* w)
+{
+   const crf1df_feature_t* features = trainer->features;
+   crf1d_context_t*        ctx      = trainer->shards[0].ctx;
+   int L = trainer->num_labels;
+   double correct = 0;
+   double total   = 0;
+   // load the transition scores
+   crf1dc_reset(ctx, RF_TRANS);
+   for (int i = 0; i < L; i++) {
+      const feature_refs_t& refs = trainer->trans_refs[i];
+      for (int r = 0; r < refs.num_features; r++) {
+         int fid = refs.fids[r];
+         ctx->trans[i * L + features[fid].dst] = w[fid];
+      }
+   }
+   for (int n = 0; n < trainer->holdout.num_instances; n++) {
+      const crfsuite_instance_t& instance =
+         *dataset_get(&trainer->holdout, n);
+      int T = instance.num_items;
+      if (T == 0)
+         continue;
+      // compute the state scores and decode the instance
+      crf1dc_set_num_items(ctx, T);
+      crf1dc_reset(ctx, RF_STATE);
+      for (int t = 0; t < T; t++) {
+         const crfsuite_item_t& item = instance.items[t];
+         floatval_t* state = ctx->state + t * L;
+         for (int c = 0; c < item.num_contents; c++) {
+            const feature_refs_t& refs = trainer->attr_refs[item.contents[c].aid];
+            for (int r = 0; r < refs.num_features; r++) {
+               int fid = refs.fids[r];
+               state[features[fid].dst] += w[fid] * item.contents[c].value;
+            }
+         }
+      }
+      crf1dc_viterbi(ctx, trainer->path);
+      int matches = 0;
+      for (int t = 0; t < T; t++)
+         matches += trainer->path[t] == instance.labels[t];
+      if (trainer->stopping->sequence) {
+         correct += instance.weight * (matches == T);
+         total   += instance.weight;
+      } else {
+         correct += instance.weight * matches;
+         total   += instance.weight * T;
+      }
+   }
+   return total > 0 ? correct / total : 1.0;
+}
+/*-----------< FUNCTION: crf_train_evaluate >--------------------------------
+// Purpose:    L-BFGS callback for computing the objective and gradients
+//             the shards are evaluated concurrently, and then reduced in
+//             shard order
+// Parameters: instance - trainer
+//             x        - current feature weights
+//             g        - return the gradients via here
+//             n        - number of features
+//             step     - current line search step
+// Returns:    the objective (negative log likelihood + L2 penalty)
+---------------------------------------------------------------------------*/
+lbfgsfloatval_t crf_train_evaluate (
+   void*                  instance,
+   const lbfgsfloatval_t* x,
+   lbfgsfloatval_t*       g,
+   const int              n,
+   const lbfgsfloatval_t  step)
+{
+   CRF_TRAINER* trainer = (CRF_TRAINER*)instance;
+   // evaluate the first shard on this thread and the rest on new threads,
+   // falling back to this thread if a thread cannot be created
+   for (int s = 0; s < trainer->num_shards; s++)
+      trainer->shards[s].w = x;
+   for (int s = 1; s < trainer->num_shards; s++) {
+      CRF_SHARD* shard = &trainer->shards[s];
+      shard->threaded = enif_thread_create(
+         (char*)"crf_train",
+         &shard->tid,
+         &crf_train_shard,
+         shard,
+         NULL) == 0;
+   }
+   crf_train_shard(&trainer->shards[0]);
+   for (int s = 1; s < trainer->num_shards; s++) {
+      CRF_SHARD* shard = &trainer->shards[s];
+      if (shard->threaded)
+         enif_thread_join(shard->tid, NULL);
+      else
+         crf_train_shard(shard);
+   }
+   // reduce the shard likelihoods and model expectations,
+   // starting from the observation expectations
+   lbfgsfloatval_t f = 0;
+   for (int k = 0; k < n; k++)
+      g[k] = -trainer->features[k].freq;
+   for (int s = 0; s < trainer->num_shards; s++) {
+      const CRF_SHARD* shard = &trainer->shards[s];
+      f -= shard->logl;
+      for (int k = 0; k < n; k++)
+         g[k] += shard->g[k];
+   }
+   // apply L2 regularization
+   if (trainer->c2 > 0) {
+      lbfgsfloatval_t norm = 0;
+      for (int k = 0; k < n; k++) {
+         g[k] += 2 * trainer->c2 * x[k];
+         norm += x[k] * x[k];
+      }
+      f += trainer->c2 * norm;
+   }
+   return f;
+}
+/*-----------< FUNCTION: crf_train_progress >--------------------------------
+// Purpose:    L-BFGS callback for iteration progress
+// Parameters: instance - trainer
+//             x        - current feature weights
+//             g        - current gradients
+//             fx       - current objective
+//             xnorm    - feature weight norm
+//             gnorm    - gradient norm
+//             step     - line search step
+//             n        - number of features
+//             k        - iteration number
+//             ls       - number of line search evaluations
+// Returns:    0 to continue optimization
+//             LBFGS_STOP if an early stopping rule was met
+//             LBFGSERR_CANCELED if the training job was cancelled
+---------------------------------------------------------------------------*/
+int crf_train_progress (
+   void*                  instance,
+   const lbfgsfloatval_t* x,
+   const lbfgsfloatval_t* g,
+   const lbfgsfloatval_t  fx,
+   const lbfgsfloatval_t  xnorm,
+   const lbfgsfloatval_t  gnorm,
+   const lbfgsfloatval_t  step,
+   int                    n,
+   int                    k,
+   int                    ls)
+{
+   CRF_TRAINER* trainer = (CRF_TRAINER*)instance;
+   memcpy(trainer->best_w, x, n * sizeof(floatval_t));
+   ErlNifTime timestamp = enif_monotonic_time(ERL_NIF_USEC);
+   int active = 0;
+   for (int i = 0; i < n; i++)
+      if (x[i] != 0)
+         active++;
+   crf_train_log(
+      trainer,
+      "***** Iteration #%d *****\n"
+      "Loss: %f\n"
+      "Feature norm: %f\n"
+      "Error norm: %f\n"
+      "Active features: %d\n"
+      "Line search trials: %d\n"
+      "Line search step: %f\n"
+      "Seconds required for this iteration: %.3f\n",
+      k,
+      fx,
+      xnorm,
+      gnorm,
+      active,
+      ls,
+      step,
+      (timestamp - trainer->timestamp) / 1e6);
+   trainer->timestamp = timestamp;
+   // report progress to the training job, if any
+   nif_job_progress(k, fx);
+   if (nif_job_cancelled())
+      return LBFGSERR_CANCELED;
+   return crf_train_stop(trainer, x, k) ? LBFGS_STOP : 0;
+}
+/*-----------< FUNCTION: crf_train_shard >-----------------------------------
+// Purpose:    computes the log likelihood and model expectations for the
+//             instances in a shard (thread entry point)
+// Parameters: arg - shard to evaluate
+// Returns:    NULL
+---------------------------------------------------------------------------*/
+void* crf_train_shard (void* arg)
+{
+   CRF_SHARD*             shard   = (CRF_SHARD*)arg;
+   const CRF_TRAINER*     trainer = shard->trainer;
+   const crf1df_feature_t* features = trainer->features;
+   crf1d_context_t*       ctx     = shard->ctx;
+   const floatval_t*      w       = shard->w;
+   floatval_t*            g       = shard->g;
+   int L = trainer->num_labels;
+   memset(g, 0, trainer->num_features * sizeof(floatval_t));
+   shard->logl = 0;
+   // compute the transition scores, which are independent of the instance
+   crf1dc_reset(ctx, RF_TRANS);
+   for (int i = 0; i < L; i++) {
+      const feature_refs_t& refs = trainer->trans_refs[i];
+      for (int r = 0; r < refs.num_features; r++) {
+         int fid = refs.fids[r];
+         ctx->trans[i * L + features[fid].dst] = w[fid];
+      }
+   }
+   crf1dc_exp_transition(ctx);
+   for (int n = shard->begin; n < shard->end; n++) {
+      const crfsuite_instance_t& instance =
+         trainer->data->instances[trainer->train.perm[n]];
+      int T = instance.num_items;
+      if (T == 0)
+         continue;
+      // compute the state scores and run forward-backward
+      crf1dc_set_num_items(ctx, T);
+      crf1dc_reset(ctx, RF_STATE);
+      for (int t = 0; t < T; t++) {
+         const crfsuite_item_t& item = instance.items[t];
+         floatval_t* state = ctx->state + t * L;
+         for (int c = 0; c < item.num_contents; c++) {
+            const feature_refs_t& refs = trainer->attr_refs[item.contents[c].aid];
+            for (int r = 0; r < refs.num_features; r++) {
+               int fid = refs.fids[r];
+               state[features[fid].dst] += w[fid] * item.contents[c].value;
+            }
+         }
+      }
+      crf1dc_exp_state(ctx);
+      crf1dc_alpha_score(ctx);
+      crf1dc_beta_score(ctx);
+      crf1dc_marginals(ctx);
+      shard->logl += instance.weight *
+         (crf1dc_score(ctx, instance.labels) - crf1dc_lognorm(ctx));
+      // accumulate the model expectations for states and transitions
+      for (int t = 0; t < T; t++) {
+         const crfsuite_item_t& item = instance.items[t];
+         const floatval_t* prob = ctx->mexp_state + t * L;
+         for (int c = 0; c < item.num_contents; c++) {
+            const feature_refs_t& refs = trainer->attr_refs[item.contents[c].aid];
+            floatval_t scale = item.contents[c].value * instance.weight;
+            for (int r = 0; r < refs.num_features; r++) {
+               int fid = refs.fids[r];
+               g[fid] += prob[features[fid].dst] * scale;
+            }
+         }
+      }
+      for (int i = 0; i < L; i++) {
+         const feature_refs_t& refs = trainer->trans_refs[i];
+         const floatval_t* prob = ctx->mexp_trans + i * L;
+         for (int r = 0; r < refs.num_features; r++) {
+            int fid = refs.fids[r];
+            g[fid] += prob[features[fid].dst] * instance.weight;
+         }
+      }
+   }
+   return NULL;
+}
+/*-----------< FUNCTION: crf_train_log >-------------------------------------
+// Purpose:    writes a verbose training message
+// Parameters: trainer - trainer, with the message callback
+//             format  - printf-style format string
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_train_log (CRF_TRAINER* trainer, const char* format, ...)
+{
+   if (trainer->callback != NULL) {
+      va_list args;
+      va_start(args, format);
+      trainer->callback(NULL, format, args);
+      va_end(args);
+   }
+}
@@ -0,0 +1,506 @@
+/****************************************************************************
+ *
+ * MODULE:  crf_update.cpp
+ * PURPOSE: online updates of trained crfsuite models
+ *
+ * An update loads the weights of a trained model into memory, applies
+ * online structured perceptron or passive-aggressive steps for a batch of
+ * labeled sequences, and writes the updated weights to a new model file,
+ * leaving the source model untouched. Each sequence is viterbi-decoded
+ * with the current weights, and if the decoded labels differ from the
+ * expected labels, the weights move by the difference between the
+ * feature vectors of the expected and decoded label sequences. Attributes
+ * and labels that are not yet in the model are added to it on the fly.
+ *
+ * for abbreviated names:
+ * . L is the number of labels
+ * . A is the number of attributes
+ * . T is the number of items in a sequence
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <float.h>
+#include <math.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+extern "C" {
+#include "deps/crfsuite/lib/crf/src/crf1d.h"
+}
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+// state feature weights of an attribute, as (label, weight) pairs
+typedef std::vector<std::pair<int, double> > CRF_STATE_ROW;
+// in-memory crf1d model weights
+typedef struct tagCrfOnline {
+   std::vector<std::string>             labels;    // label names
+   std::unordered_map<std::string, int> label_ids; // label name -> id
+   std::vector<std::string>             attrs;     // attribute names
+   std::unordered_map<std::string, int> attr_ids;  // attribute name -> id
+   std::vector<CRF_STATE_ROW>           state;     // A state feature rows
+   std::vector<double>                  trans;     // L x L transitions
+} CRF_ONLINE;
+// sparse weight difference, keyed by state feature (attribute << 32 |
+// label) or transition (source * L + target)
+typedef std::unordered_map<uint64_t, double> CRF_DELTA;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void crf_online_load (
+   const char* path,
+   CRF_ONLINE* model);
+static void crf_online_save (
+   const CRF_ONLINE& model,
+   const char*       path);
+static int crf_online_label (
+   CRF_ONLINE* model,
+   const char* name);
+static int crf_online_attr (
+   CRF_ONLINE* model,
+   const char* name);
+static std::vector<int> crf_online_map (
+   crfsuite_dictionary_t* dictionary,
+   CRF_ONLINE*            model,
+   int                    (*intern)(CRF_ONLINE*, const char*));
+static bool crf_online_step (
+   CRF_ONLINE*                model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   const std::vector<int>&    lmap,
+   const CRF_UPDATE_PARAMS*   params);
+static double crf_online_viterbi (
+   const CRF_ONLINE&          model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   int*                       path);
+static double crf_online_score (
+   const CRF_ONLINE&          model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   const int*                 path);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: crf_update_model >----------------------------------
+// Purpose:    applies online updates to a crfsuite model, writing the
+//             updated model to a new model file
+// Parameters: source - source model file path
+//             target - updated model file path
+//             data   - labeled update sequences, with their own
+//                      attribute/label dictionaries
+//             params - update parameters
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_update_model (
+   const char*              source,
+   const char*              target,
+   crfsuite_data_t*         data,
+   const CRF_UPDATE_PARAMS* params)
+{
+   CRF_ONLINE model;
+   crf_online_load(source, &model);
+   // intern the update attributes/labels into the model
+   std::vector<int> amap = crf_online_map(data->attrs, &model, crf_online_attr);
+   std::vector<int> lmap = crf_online_map(data->labels, &model, crf_online_label);
+   // apply an update step per sequence and epoch, in order
+   for (int e = 0; e < params->epochs; e++) {
+      int updates = 0;
+      for (int n = 0; n < data->num_instances; n++)
+         updates += crf_online_step(
+            &model,
+            data->instances[n],
+            amap,
+            lmap,
+            params);
+      if (updates == 0)
+         break;
+   }
+   crf_online_save(model, target);
+}
+/*-----------< FUNCTION: crf_online_load >-----------------------------------
+// Purpose:    loads the weights of a crfsuite model file into memory
+// Parameters: path  - model file path
+//             model - return the model weights via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_online_load (const char* path, CRF_ONLINE* model)
+{
+   crf1dm_t* crf = CHECK(crf1dm_new(path), "load_failed");
+   try {
+      int L = crf1dm_get_num_labels(crf);
+      int A = crf1dm_get_num_attrs(crf);
+      for (int l = 0; l < L; l++)
+         crf_online_label(model, crf1dm_to_label(crf, l));
+      for (int a = 0; a < A; a++)
+         crf_online_attr(model, crf1dm_to_attr(crf, a));
+      CHECK((int)model->labels.size() == L, "load_failed");
+      CHECK((int)model->attrs.size() == A, "load_failed");
+      // load the transition weights
+      for (int i = 0; i < L; i++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_labelref(crf, i, &refs) == 0, "load_failed");
+         for (int k = 0; k < refs.num_features; k++) {
+            crf1dm_feature_t feature;
+            int fid = crf1dm_get_featureid(&refs, k);
+            CHECK(crf1dm_get_feature(crf, fid, &feature) == 0, "load_failed");
+            model->trans[i * L + feature.dst] = feature.weight;
+         }
+      }
+      // load the state weights
+      for (int a = 0; a < A; a++) {
+         feature_refs_t refs;
+         CHECK(crf1dm_get_attrref(crf, a, &refs) == 0, "load_failed");
+         for (int k = 0; k < refs.num_features; k++) {
+            crf1dm_feature_t feature;
+            int fid = crf1dm_get_featureid(&refs, k);
+            CHECK(crf1dm_get_feature(crf, fid, &feature) == 0, "load_failed");
+            model->state[a].push_back(
+               std::make_pair(feature.dst, feature.weight));
+         }
+      }
+   } catch (NifError& e) {
+      crf1dm_close(crf);
+      throw;
+   }
+   crf1dm_close(crf);
+}
+/*-----------< FUNCTION: crf_online_save >-----------------------------------
+// Purpose:    writes in-memory model weights to a crfsuite model file,
+//             omitting zero-weight features and attributes without any
+//             state features
+// Parameters: model - model weights
+//             path  - model file path
+// Returns:    none
+---------------------------------------------------------------------------*/
+void crf_online_save (const CRF_ONLINE& model, const char* path)
+{
+   int L = (int)model.labels.size();
+   int A = (int)model.attrs.size();
+   std::vector<crf1dm_feature_t> features;
+   std::vector<std::vector<int> > label_fids(L);
+   std::vector<std::vector<int> > attr_fids;
+   std::vector<int>               attr_names;
+   // number the nonzero transition features, then the state features of
+   // the attributes that have any
+   for (int i = 0; i < L; i++)
+      for (int j = 0; j < L; j++)
+         if (model.trans[i * L + j] != 0) {
+            crf1dm_feature_t feature;
+            feature.type   = FT_TRANS;
+            feature.src    = i;
+            feature.dst    = j;
+            feature.weight = model.trans[i * L + j];
+            label_fids[i].push_back((int)features.size());
+            features.push_back(feature);
+         }
+   for (int a = 0; a < A; a++) {
+      std::vector<int> fids;
+      for (const auto& weight : model.state[a])
+         if (weight.second != 0) {
+            crf1dm_feature_t feature;
+            feature.type   = FT_STATE;
+            feature.src    = (int)attr_fids.size();
+            feature.dst    = weight.first;
+            feature.weight = weight.second;
+            fids.push_back((int)features.size());
+            features.push_back(feature);
+         }
+      if (!fids.empty()) {
+         attr_fids.push_back(fids);
+         attr_names.push_back(a);
+      }
+   }
+   int K = (int)features.size();
+   std::vector<int> fmap(K + 1);
+   for (int k = 0; k < K; k++)
+      fmap[k] = k;
+   // write the model file
+   crf1dmw_t* writer = NULL;
+   try {
+      writer = CHECK(crf1mmw(path), "store_failed");
+      CHECK(crf1dmw_open_features(writer) == 0, "store_failed");
+      for (int k = 0; k < K; k++)
+         CHECK(crf1dmw_put_feature(writer, k, &features[k]) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_features(writer) == 0, "store_failed");
+      CHECK(crf1dmw_open_labels(writer, L) == 0, "store_failed");
+      for (int l = 0; l < L; l++)
+         CHECK(crf1dmw_put_label(writer, l, model.labels[l].c_str()) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_labels(writer) == 0, "store_failed");
+      int num_attrs = (int)attr_names.size();
+      CHECK(crf1dmw_open_attrs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < num_attrs; a++)
+         CHECK(crf1dmw_put_attr(
+               writer,
+               a,
+               model.attrs[attr_names[a]].c_str()) == 0,
+            "store_failed");
+      CHECK(crf1dmw_close_attrs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_open_labelrefs(writer, L + 2) == 0, "store_failed");
+      for (int l = 0; l < L; l++) {
+         feature_refs_t refs;
+         refs.num_features = (int)label_fids[l].size();
+         refs.fids         = label_fids[l].data();
+         CHECK(crf1dmw_put_labelref(writer, l, &refs, fmap.data()) == 0,
+            "store_failed");
+      }
+      CHECK(crf1dmw_close_labelrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_open_attrrefs(writer, num_attrs) == 0, "store_failed");
+      for (int a = 0; a < num_attrs; a++) {
+         feature_refs_t refs;
+         refs.num_features = (int)attr_fids[a].size();
+         refs.fids         = attr_fids[a].data();
+         CHECK(crf1dmw_put_attrref(writer, a, &refs, fmap.data()) == 0,
+            "store_failed");
+      }
+      CHECK(crf1dmw_close_attrrefs(writer) == 0, "store_failed");
+      CHECK(crf1dmw_close(writer) == 0, "store_failed");
+      writer = NULL;
+   } catch (NifError& e) {
+      if (writer != NULL)
+         crf1dmw_close(writer);
+      throw;
+   }
+}
+/*-----------< FUNCTION: crf_online_label >----------------------------------
+// Purpose:    interns a label name, adding it to the model if necessary
+//             (with zero transition weights)
+// Parameters: model - model weights
+//             name  - label name
+// Returns:    the label identifier
+---------------------------------------------------------------------------*/
+int crf_online_label (CRF_ONLINE* model, const char* name)
+{
+   CHECK(name != NULL, "load_failed");
+   auto found = model->label_ids.find(name);
+   if (found != model->label_ids.end())
+      return found->second;
+   // grow the transition matrix by a row and column
+   int L = (int)model->labels.size();
+   std::vector<double> trans((L + 1) * (L + 1));
+   for (int i = 0; i < L; i++)
+      for (int j = 0; j < L; j++)
+         trans[i * (L + 1) + j] = model->trans[i * L + j];
+   model->trans.swap(trans);
+   model->labels.push_back(name);
+   model->label_ids[name] = L;
+   return L;
+}
+/*-----------< FUNCTION: crf_online_attr >-----------------------------------
+// Purpose:    interns an attribute name, adding it to the model (without
+//             any state features) if necessary
+// Parameters: model - model weights
+//             name  - attribute name
+// Returns:    the attribute identifier
+---------------------------------------------------------------------------*/
+int crf_online_attr (CRF_ONLINE* model, const char* name)
+{
+   CHECK(name != NULL, "load_failed");
+   auto found = model->attr_ids.find(name);
+   if (found != model->attr_ids.end())
+      return found->second;
+   int a = (int)model->attrs.size();
+   model->attrs.push_back(name);
+   model->attr_ids[name] = a;
+   model->state.push_back(CRF_STATE_ROW());
+   return a;
+}
+/*-----------< FUNCTION: crf_online_map >------------------------------------
+// Purpose:    maps the identifiers of an update data dictionary to model
+//             identifiers, interning any new names into the model
+// Parameters: dictionary - update attribute/label dictionary
+//             model      - model weights
+//             intern     - model interning function (attribute/label)
+// Returns:    the dictionary -> model identifier map
+---------------------------------------------------------------------------*/
+std::vector<int> crf_online_map (
+   crfsuite_dictionary_t* dictionary,
+   CRF_ONLINE*            model,
+   int                    (*intern)(CRF_ONLINE*, const char*))
+{
+   std::vector<int> map(dictionary->num(dictionary));
+   for (int i = 0; i < (int)map.size(); i++) {
+      const char* name = NULL;
+      CHECKALLOC(dictionary->to_string(dictionary, i, &name) == 0);
+      try {
+         map[i] = intern(model, name);
+      } catch (NifError& e) {
+         dictionary->free(dictionary, name);
+         throw;
+      }
+      dictionary->free(dictionary, name);
+   }
+   return map;
+}
+/*-----------< FUNCTION: crf_online_step >-----------------------------------
+// Purpose:    applies an online update step for a labeled sequence
+//             the weights move by tau times the difference between the
+//             feature vectors of the expected and decoded label sequences,
+//             where tau is the instance weight (perceptron), or the
+//             smallest step that separates the expected sequence by a
+//             margin of sqrt(number of label errors), capped by c times
+//             the instance weight (passive-aggressive, PA-I)
+// Parameters: model    - model weights to update
+//             instance - update sequence, with update dictionary ids
+//             amap     - update -> model attribute id map
+//             lmap     - update -> model label id map
+//             params   - update parameters
+// Returns:    true if the weights were updated, false otherwise
+---------------------------------------------------------------------------*/
+bool crf_online_step (
+   CRF_ONLINE*                model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   const std::vector<int>&    lmap,
+   const CRF_UPDATE_PARAMS*   params)
+{
+   int L = (int)model->labels.size();
+   int T = instance.num_items;
+   if (T == 0)
+      return false;
+   // decode the sequence with the current weights
+   std::vector<int> expect(T);
+   std::vector<int> decode(T);
+   for (int t = 0; t < T; t++)
+      expect[t] = lmap[instance.labels[t]];
+   double decode_score =
+      crf_online_viterbi(*model, instance, amap, decode.data());
+   int errors = 0;
+   for (int t = 0; t < T; t++)
+      errors += decode[t] != expect[t];
+   if (errors == 0)
+      return false;
+   // accumulate the feature vector difference
+   CRF_DELTA state;
+   CRF_DELTA trans;
+   for (int t = 0; t < T; t++) {
+      if (decode[t] != expect[t]) {
+         const crfsuite_item_t& item = instance.items[t];
+         for (int c = 0; c < item.num_contents; c++) {
+            uint64_t a = (uint64_t)amap[item.contents[c].aid] << 32;
+            state[a | expect[t]] += item.contents[c].value;
+            state[a | decode[t]] -= item.contents[c].value;
+         }
+      }
+      if (t > 0) {
+         trans[expect[t - 1] * L + expect[t]] += 1;
+         trans[decode[t - 1] * L + decode[t]] -= 1;
+      }
+   }
+   double norm = 0;
+   for (const auto& delta : state)
+      norm += delta.second * delta.second;
+   for (const auto& delta : trans)
+      norm += delta.second * delta.second;
+   if (norm == 0)
+      return false;
+   // compute the step size
+   double tau = instance.weight;
+   if (params->algorithm == CRF_UPDATE_PA) {
+      double expect_score =
+         crf_online_score(*model, instance, amap, expect.data());
+      double loss = decode_score - expect_score + sqrt((double)errors);
+      tau = fmin(params->c * instance.weight, loss / norm);
+      if (!(tau > 0))
+         return false;
+   }
+   // apply the update
+   for (const auto& delta : state) {
+      if (delta.second == 0)
+         continue;
+      CRF_STATE_ROW& row   = model->state[delta.first >> 32];
+      int            label = (int)(delta.first & 0xFFFFFFFF);
+      auto weight = row.begin();
+      while (weight != row.end() && weight->first != label)
+         ++weight;
+      if (weight == row.end())
+         row.push_back(std::make_pair(label, tau * delta.second));
+      else
+         weight->second += tau * delta.second;
+   }
+   for (const auto& delta : trans)
+      model->trans[delta.first] += tau * delta.second;
+   return true;
+}
+/*-----------< FUNCTION: crf_online_viterbi >--------------------------------
+// Purpose:    finds the maximum scoring label sequence for an update
+//             sequence with the current weights
+// Parameters: model    - model weights
+//             instance - update sequence
+//             amap     - update -> model attribute id map
+//             path     - return the T label sequence via here
+// Returns:    the score of the label sequence
+---------------------------------------------------------------------------*/
+double crf_online_viterbi (
+   const CRF_ONLINE&          model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   int*                       path)
+{
+   int L = (int)model.labels.size();
+   int T = instance.num_items;
+   std::vector<double> score(T * L);
+   std::vector<int>    back(T * L);
+   // compute the state scores
+   for (int t = 0; t < T; t++) {
+      const crfsuite_item_t& item = instance.items[t];
+      for (int c = 0; c < item.num_contents; c++)
+         for (const auto& weight : model.state[amap[item.contents[c].aid]])
+            score[t * L + weight.first] +=
+               weight.second * item.contents[c].value;
+   }
+   // run the max-product recursion, keeping the first maximum
+   for (int t = 1; t < T; t++)
+      for (int j = 0; j < L; j++) {
+         double max    = -DBL_MAX;
+         int    argmax = 0;
+         for (int i = 0; i < L; i++) {
+            double s = score[(t - 1) * L + i] + model.trans[i * L + j];
+            if (max < s) {
+               max    = s;
+               argmax = i;
+            }
+         }
+         score[t * L + j] += max;
+         back[t * L + j]   = argmax;
+      }
+   // select the best final label and follow the back pointers
+   int argmax = 0;
+   for (int j = 1; j < L; j++)
+      if (score[(T - 1) * L + argmax] < score[(T - 1) * L + j])
+         argmax = j;
+   path[T - 1] = argmax;
+   for (int t = T - 1; t > 0; t--)
+      path[t - 1] = back[t * L + path[t]];
+   return score[(T - 1) * L + argmax];
+}
+/*-----------< FUNCTION: crf_online_score >----------------------------------
+// Purpose:    scores a label sequence for an update sequence with the
+//             current weights
+// Parameters: model    - model weights
+//             instance - update sequence
+//             amap     - update -> model attribute id map
+//             path     - T label sequence to score
+// Returns:    the score of the label sequence
+---------------------------------------------------------------------------*/
+double crf_online_score (
+   const CRF_ONLINE&          model,
+   const crfsuite_instance_t& instance,
+   const std::vector<int>&    amap,
+   const int*                 path)
+{
+   int L = (int)model.labels.size();
+   double score = 0;
+   for (int t = 0; t < instance.num_items; t++) {
+      const crfsuite_item_t& item = instance.items[t];
+      for (int c = 0; c < item.num_contents; c++)
+         for (const auto& weight : model.state[amap[item.contents[c].aid]])
+            if (weight.first == path[t])
+               score += weight.second * item.contents[c].value;
+      if (t > 0)
+         score += model.trans[path[t - 1] * L + path[t]];
+   }
+   return score;
+}
@@ -19,43 +19,131 @@ extern int nif_blas_init (ErlNifEnv* env);
 extern int nif_lin_init  (ErlNifEnv* env);
 extern int nif_svm_init  (ErlNifEnv* env);
 extern int nif_crf_init  (ErlNifEnv* env);
+extern int nif_w2v_init  (ErlNifEnv* env);
+extern int nif_job_init  (ErlNifEnv* env);
+extern void nif_job_unload (ErlNifEnv* env);
 /*-------------------[        Module Variables         ]-------------------*/
 /*-------------------[        Module Prototypes        ]-------------------*/
 DECLARE_NIF(blas_sscal);
 DECLARE_NIF(blas_saxpy);
+DECLARE_NIF(blas_mean);
+DECLARE_NIF(blas_weighted_sum);
+DECLARE_NIF(blas_from_list);
+DECLARE_NIF(blas_to_list);
+DECLARE_NIF(blas_fill);
+DECLARE_NIF(blas_slice);
+DECLARE_NIF(blas_concat);
+DECLARE_NIF(blas_sdot);
+DECLARE_NIF(blas_snrm2);
+DECLARE_NIF(blas_sgemv);
+DECLARE_NIF(blas_sgemm);
+DECLARE_NIF(blas_cosine);
+DECLARE_NIF(blas_acc_new);
+DECLARE_NIF(blas_acc_axpy);
+DECLARE_NIF(blas_acc_scale);
+DECLARE_NIF(blas_acc_add_many);
+DECLARE_NIF(blas_acc_read);
+DECLARE_NIF(blas_acc_freeze);
 DECLARE_NIF(lin_train);
+DECLARE_NIF(lin_train_async);
 DECLARE_NIF(lin_export);
 DECLARE_NIF(lin_compile);
 DECLARE_NIF(lin_predict_class);
 DECLARE_NIF(lin_predict_probability);
+DECLARE_NIF(lin_learner);
+DECLARE_NIF(lin_partial_fit);
+DECLARE_NIF(lin_snapshot);
 DECLARE_NIF(svm_train);
+DECLARE_NIF(svm_train_async);
 DECLARE_NIF(svm_export);
 DECLARE_NIF(svm_compile);
 DECLARE_NIF(svm_predict_class);
 DECLARE_NIF(svm_predict_probability);
 DECLARE_NIF(crf_train);
+DECLARE_NIF(crf_train_file);
+DECLARE_NIF(crf_train_async);
 DECLARE_NIF(crf_export);
 DECLARE_NIF(crf_compile);
 DECLARE_NIF(crf_predict);
+DECLARE_NIF(crf_predict_pos);
+DECLARE_NIF(crf_prune);
+DECLARE_NIF(crf_cache_stats);
+DECLARE_NIF(crf_update);
+DECLARE_NIF(w2v_create);
+DECLARE_NIF(w2v_insert);
+DECLARE_NIF(w2v_close);
+DECLARE_NIF(w2v_compile);
+DECLARE_NIF(w2v_open);
+DECLARE_NIF(w2v_info);
+DECLARE_NIF(w2v_lookup);
+DECLARE_NIF(w2v_fetch);
+DECLARE_NIF(w2v_mean_batch);
+DECLARE_NIF(w2v_build_graph);
+DECLARE_NIF(w2v_open_graph);
+DECLARE_NIF(w2v_nearest);
+DECLARE_NIF(job_cancel);
 /*-------------------[         Implementation          ]-------------------*/
 // nif function table
 static ErlNifFunc nif_map[] = {
    EXPORT_NIF(blas_sscal, 2),
    EXPORT_NIF(blas_saxpy, 3),
+   EXPORT_NIF(blas_mean, 1),
+   EXPORT_NIF(blas_weighted_sum, 2),
+   EXPORT_NIF(blas_from_list, 1),
+   EXPORT_NIF(blas_to_list, 1),
+   EXPORT_NIF(blas_fill, 2),
+   EXPORT_NIF(blas_slice, 3),
+   EXPORT_NIF(blas_concat, 1),
+   EXPORT_NIF(blas_sdot, 2),
+   EXPORT_NIF(blas_snrm2, 1),
+   EXPORT_NIF(blas_sgemv, 6),
+   EXPORT_NIF(blas_sgemm, 8),
+   EXPORT_NIF(blas_cosine, 2),
+   EXPORT_NIF(blas_acc_new, 1),
+   EXPORT_NIF(blas_acc_axpy, 3),
+   EXPORT_NIF(blas_acc_scale, 2),
+   EXPORT_NIF(blas_acc_add_many, 2),
+   EXPORT_NIF(blas_acc_read, 1),
+   EXPORT_NIF(blas_acc_freeze, 1),
    EXPORT_NIF(lin_train, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(lin_train_async, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
    EXPORT_NIF(lin_export, 1),
    EXPORT_NIF(lin_compile, 1),
    EXPORT_NIF(lin_predict_class, 2),
    EXPORT_NIF(lin_predict_probability, 2),
+   EXPORT_NIF(lin_learner, 1),
+   EXPORT_NIF(lin_partial_fit, 4, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(lin_snapshot, 1),
    EXPORT_NIF(svm_train, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(svm_train_async, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
    EXPORT_NIF(svm_export, 1),
    EXPORT_NIF(svm_compile, 1),
    EXPORT_NIF(svm_predict_class, 2),
    EXPORT_NIF(svm_predict_probability, 2),
    EXPORT_NIF(crf_train, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(crf_train_file, 2, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(crf_train_async, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
    EXPORT_NIF(crf_export, 1),
    EXPORT_NIF(crf_compile, 1),
    EXPORT_NIF(crf_predict, 2),
+   EXPORT_NIF(crf_predict, 3),
+   EXPORT_NIF(crf_predict_pos, 2),
+   EXPORT_NIF(crf_prune, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(crf_cache_stats, 1),
+   EXPORT_NIF(crf_update, 4, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(w2v_create, 4, ERL_NIF_DIRTY_JOB_IO_BOUND),
+   EXPORT_NIF(w2v_insert, 4),
+   EXPORT_NIF(w2v_close, 1, ERL_NIF_DIRTY_JOB_IO_BOUND),
+   EXPORT_NIF(w2v_compile, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(w2v_open, 1, ERL_NIF_DIRTY_JOB_IO_BOUND),
+   EXPORT_NIF(w2v_info, 1),
+   EXPORT_NIF(w2v_lookup, 2),
+   EXPORT_NIF(w2v_fetch, 2),
+   EXPORT_NIF(w2v_mean_batch, 3),
+   EXPORT_NIF(w2v_build_graph, 3, ERL_NIF_DIRTY_JOB_CPU_BOUND),
+   EXPORT_NIF(w2v_open_graph, 2, ERL_NIF_DIRTY_JOB_IO_BOUND),
+   EXPORT_NIF(w2v_nearest, 4),
+   EXPORT_NIF(job_cancel, 1),
 };
 /*-----------< FUNCTION: nif_loaded >----------------------------------------
 // Purpose:    nif onload callback
@@ -76,8 +164,23 @@ static int nif_loaded (ErlNifEnv* env, void** priv_data, ERL_NIF_TERM state)
       return 3;
    if (!nif_crf_init(env))
       return 4;
+   if (!nif_w2v_init(env))
+      return 5;
+   if (!nif_job_init(env))
+      return 6;
    return 0;
 }
+/*-----------< FUNCTION: nif_unloaded >--------------------------------------
+// Purpose:    nif unload callback
+//             waits for any running jobs, which execute library code
+// Parameters: env       - erlang environment
+//             priv_data - private state
+// Returns:    none
+---------------------------------------------------------------------------*/
+static void nif_unloaded (ErlNifEnv* env, void* priv_data)
+{
+   nif_job_unload(env);
+}
 // nif entry point
 ERL_NIF_INIT(
    Elixir.Penelope.NIF,
@@ -85,4 +188,4 @@ ERL_NIF_INIT(
    &nif_loaded,
    NULL,
    NULL,
-   NULL);
+   &nif_unloaded);
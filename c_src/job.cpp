@@ -0,0 +1,345 @@
+/****************************************************************************
+ *
+ * MODULE:  job.cpp
+ * PURPOSE: asynchronous nif jobs
+ *
+ * A job runs a long-running nif body (such as model training) on its own
+ * native thread, instead of occupying a dirty scheduler. The job is owned
+ * by an erlang resource, and it reports to the calling process by message:
+ *
+ *    {:penelope_job, job, {:progress, iteration, objective, elapsed}}
+ *    {:penelope_job, job, {:ok, result}}
+ *    {:penelope_job, job, {:error, reason}}
+ *
+ * Cancellation is cooperative: the job body polls nif_job_cancelled at
+ * points where it can stop cleanly.
+ *
+ * Job threads are erlang threads, which must all be joined before the
+ * library is unloaded. Every job thread is registered until it is joined:
+ * completed threads are joined when the next job starts, and unloading the
+ * library cancels any running jobs and joins their threads, so that no job
+ * outlives the library code it runs.
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <math.h>
+#include <list>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "job.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+// job thread stack size, in kilowords (8MB)
+#define NIF_JOB_STACK_SIZE (8 * 1024 / (int)sizeof(void*))
+typedef struct tagNifJob {
+   struct tagNifJob** resource;               // owning erlang resource
+   ErlNifPid          owner;                  // process to notify
+   ErlNifEnv*         env;                    // job argument environment
+   int                argc;                   // number of job arguments
+   ERL_NIF_TERM       argv[NIF_JOB_MAX_ARGS]; // job arguments
+   NIF_JOB_FUNC       func;                   // job body
+   ErlNifTime         start;                  // start time (usec)
+   int                cancelled;              // cancellation flag (atomic)
+} NIF_JOB;
+// registered job thread
+typedef struct tagNifJobThread {
+   ErlNifTid tid;                             // erlang thread id
+   NIF_JOB*  job;                             // running job (NULL if done)
+} NIF_JOB_THREAD;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+static ErlNifResourceType* g_job_type = NULL;
+// job thread registry, guarded by the job lock
+static ErlNifMutex*              g_job_lock = NULL;
+static std::list<NIF_JOB_THREAD> g_job_threads;
+// the job running on the current thread, if any
+static thread_local NIF_JOB* g_job = NULL;
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void nif_destruct_job (
+   ErlNifEnv* env,
+   void*      object);
+static void* nif_job_run (
+   void* arg);
+static void nif_job_send (
+   NIF_JOB*     job,
+   ErlNifEnv*   env,
+   ERL_NIF_TERM event);
+static void nif_job_join (
+   std::list<NIF_JOB_THREAD>* threads);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: nif_job_init >--------------------------------------
+// Purpose:    job module initialization
+// Parameters: env - erlang environment
+// Returns:    1 if successful
+//             0 otherwise
+---------------------------------------------------------------------------*/
+int nif_job_init (ErlNifEnv* env)
+{
+   // register the job resource type
+   ErlNifResourceFlags flags = ERL_NIF_RT_CREATE;
+   g_job_type = enif_open_resource_type(
+      env,
+      NULL,
+      "job",
+      &nif_destruct_job,
+      flags,
+      &flags);
+   if (!g_job_type)
+      return 0;
+   g_job_lock = enif_mutex_create((char*)"penelope_job");
+   if (!g_job_lock)
+      return 0;
+   return 1;
+}
+/*-----------< FUNCTION: nif_job_unload >------------------------------------
+// Purpose:    job module cleanup, when the library is unloaded
+//             cancels all running jobs, and waits for their threads
+// Parameters: env - erlang environment
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_job_unload (ErlNifEnv* env)
+{
+   if (g_job_lock == NULL)
+      return;
+   std::list<NIF_JOB_THREAD> threads;
+   enif_mutex_lock(g_job_lock);
+   for (NIF_JOB_THREAD& thread : g_job_threads)
+      if (thread.job != NULL)
+         __atomic_store_n(&thread.job->cancelled, 1, __ATOMIC_RELEASE);
+   threads.swap(g_job_threads);
+   enif_mutex_unlock(g_job_lock);
+   nif_job_join(&threads);
+   enif_mutex_destroy(g_job_lock);
+   g_job_lock = NULL;
+}
+/*-----------< FUNCTION: nif_job_cancel >------------------------------------
+// Purpose:    requests cancellation of a running job
+//             the job stops at its next cancellation point, and then
+//             reports {:error, :cancelled}
+// Parameters: job - job resource reference
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_job_cancel (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   NIF_JOB** resource = NULL;
+   if (!enif_get_resource(env, argv[0], g_job_type, (void**)&resource))
+      return enif_make_badarg(env);
+   __atomic_store_n(&(*resource)->cancelled, 1, __ATOMIC_RELEASE);
+   return enif_make_atom(env, "ok");
+}
+/*-----------< FUNCTION: nif_job_start >-------------------------------------
+// Purpose:    starts a new job on a native thread
+// Parameters: env  - current erlang environment
+//             argc - number of job arguments
+//             argv - job arguments, copied to the job
+//             func - job body
+// Returns:    reference to the job resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_job_start (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[],
+   NIF_JOB_FUNC       func)
+{
+   NIF_JOB*  job      = NULL;
+   NIF_JOB** resource = NULL;
+   ERL_NIF_TERM result;
+   try {
+      CHECK(argc <= NIF_JOB_MAX_ARGS, "invalid_job");
+      // copy the job arguments to a process-independent environment
+      job = nif_alloc<NIF_JOB>();
+      job->env = CHECKALLOC(enif_alloc_env());
+      job->argc = argc;
+      for (int i = 0; i < argc; i++)
+         job->argv[i] = enif_make_copy(job->env, argv[i]);
+      job->func  = func;
+      job->start = enif_monotonic_time(ERL_NIF_USEC);
+      CHECKALLOC(enif_self(env, &job->owner));
+      // create the job resource, which owns the job from here on
+      resource = (NIF_JOB**)CHECKALLOC(enif_alloc_resource(
+         g_job_type,
+         sizeof(NIF_JOB*)));
+      *resource = job;
+      job->resource = resource;
+      // start a registered job thread, which keeps the resource alive
+      // until it completes (the registry lock is held until the thread
+      // is registered, so that it cannot complete unregistered)
+      // completed job threads are joined here, instead of by the job
+      // owner, so that a scheduler thread never waits on a running job
+      std::list<NIF_JOB_THREAD> thread(1);
+      thread.front().job = job;
+      std::list<NIF_JOB_THREAD> done;
+      ErlNifThreadOpts* opts = CHECKALLOC(enif_thread_opts_create(
+         (char*)"penelope_job"));
+      opts->suggested_stack_size = NIF_JOB_STACK_SIZE;
+      enif_keep_resource(resource);
+      enif_mutex_lock(g_job_lock);
+      int error = enif_thread_create(
+         (char*)"penelope_job",
+         &thread.front().tid,
+         &nif_job_run,
+         job,
+         opts);
+      if (error == 0)
+         g_job_threads.splice(g_job_threads.end(), thread);
+      for (auto it = g_job_threads.begin(); it != g_job_threads.end(); ) {
+         auto next = std::next(it);
+         if (it->job == NULL)
+            done.splice(done.end(), g_job_threads, it);
+         it = next;
+      }
+      enif_mutex_unlock(g_job_lock);
+      enif_thread_opts_destroy(opts);
+      nif_job_join(&done);
+      if (error != 0) {
+         enif_release_resource(resource);
+         throw NifError("thread_failed");
+      }
+      // relinquish the job resource to erlang
+      result = enif_make_resource(env, resource);
+      enif_release_resource(resource);
+   } catch (NifError& e) {
+      if (resource != NULL)
+         enif_release_resource(resource);
+      else if (job != NULL) {
+         if (job->env != NULL)
+            enif_free_env(job->env);
+         nif_free(job);
+      }
+      result = e.to_term(env);
+   }
+   return result;
+}
+/*-----------< FUNCTION: nif_job_active >------------------------------------
+// Purpose:    indicates whether the current thread is running a job
+// Parameters: none
+// Returns:    true if running within a job, false otherwise
+---------------------------------------------------------------------------*/
+bool nif_job_active ()
+{
+   return g_job != NULL;
+}
+/*-----------< FUNCTION: nif_job_cancelled >---------------------------------
+// Purpose:    indicates whether the job on the current thread has been
+//             cancelled
+// Parameters: none
+// Returns:    true if the current job was cancelled, false otherwise
+---------------------------------------------------------------------------*/
+bool nif_job_cancelled ()
+{
+   return g_job != NULL &&
+      __atomic_load_n(&g_job->cancelled, __ATOMIC_ACQUIRE) != 0;
+}
+/*-----------< FUNCTION: nif_job_progress >----------------------------------
+// Purpose:    reports progress for the job on the current thread, if any
+// Parameters: iteration - current iteration number
+//             objective - current objective value
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_job_progress (int iteration, double objective)
+{
+   if (g_job == NULL || !isfinite(objective))
+      return;
+   ErlNifEnv* env = enif_alloc_env();
+   if (env != NULL) {
+      double elapsed =
+         (enif_monotonic_time(ERL_NIF_USEC) - g_job->start) / 1e6;
+      nif_job_send(
+         g_job,
+         env,
+         enif_make_tuple4(
+            env,
+            enif_make_atom(env, "progress"),
+            enif_make_int(env, iteration),
+            enif_make_double(env, objective),
+            enif_make_double(env, elapsed)));
+      enif_free_env(env);
+   }
+}
+/*-----------< FUNCTION: nif_destruct_job >----------------------------------
+// Purpose:    frees the memory associated with a job resource
+// Parameters: env    - current erlang environment
+//             object - job resource reference to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_job (ErlNifEnv* env, void* object)
+{
+   NIF_JOB* job = *(NIF_JOB**)object;
+   if (job != NULL) {
+      if (job->env != NULL)
+         enif_free_env(job->env);
+      nif_free(job);
+   }
+}
+/*-----------< FUNCTION: nif_job_run >---------------------------------------
+// Purpose:    job thread entry point
+// Parameters: arg - job to run
+// Returns:    NULL
+---------------------------------------------------------------------------*/
+void* nif_job_run (void* arg)
+{
+   NIF_JOB*   job = (NIF_JOB*)arg;
+   ErlNifEnv* env = enif_alloc_env();
+   g_job = job;
+   // run the job body and report its result
+   ERL_NIF_TERM event;
+   try {
+      ERL_NIF_TERM result = job->func(job->env, job->argv);
+      CHECK(!nif_job_cancelled(), "cancelled");
+      event = enif_make_tuple2(
+         env,
+         enif_make_atom(env, "ok"),
+         enif_make_copy(env, result));
+   } catch (NifError& e) {
+      event = enif_make_tuple2(
+         env,
+         enif_make_atom(env, "error"),
+         enif_make_atom(env, e.code()));
+   }
+   nif_job_send(job, env, event);
+   g_job = NULL;
+   // mark the job thread complete, for joining
+   enif_mutex_lock(g_job_lock);
+   for (NIF_JOB_THREAD& thread : g_job_threads)
+      if (thread.job == job)
+         thread.job = NULL;
+   enif_mutex_unlock(g_job_lock);
+   // release the job arguments/result and the job itself
+   enif_free_env(env);
+   enif_clear_env(job->env);
+   enif_release_resource(job->resource);
+   return NULL;
+}
+/*-----------< FUNCTION: nif_job_send >--------------------------------------
+// Purpose:    sends a job event to the job owner
+// Parameters: job   - job sending the event
+//             env   - message environment
+//             event - event term
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_job_send (NIF_JOB* job, ErlNifEnv* env, ERL_NIF_TERM event)
+{
+   enif_send(
+      NULL,
+      &job->owner,
+      env,
+      enif_make_tuple3(
+         env,
+         enif_make_atom(env, "penelope_job"),
+         enif_make_resource(env, job->resource),
+         event));
+}
+/*-----------< FUNCTION: nif_job_join >--------------------------------------
+// Purpose:    waits for a list of unregistered job threads to exit
+// Parameters: threads - job threads to join
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_job_join (std::list<NIF_JOB_THREAD>* threads)
+{
+   for (NIF_JOB_THREAD& thread : *threads)
+      enif_thread_join(thread.tid, NULL);
+   threads->clear();
+}
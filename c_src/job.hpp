@@ -0,0 +1,33 @@
+/****************************************************************************
+ *
+ * MODULE:  job.hpp
+ * PURPOSE: asynchronous nif job definitions
+ *
+ ***************************************************************************/
+#ifndef __JOB_HPP
+#define __JOB_HPP
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "penelope.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define NIF_JOB_MAX_ARGS 4
+// job body, which runs on the job thread with the arguments copied to a
+// process-independent environment, and returns its result in that
+// environment (or throws a NifError)
+typedef ERL_NIF_TERM (*NIF_JOB_FUNC)(
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[]);
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+ERL_NIF_TERM nif_job_start (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[],
+   NIF_JOB_FUNC       func);
+bool nif_job_active ();
+bool nif_job_cancelled ();
+void nif_job_progress (
+   int    iteration,
+   double objective);
+#endif // __JOB_HPP
@@ -14,15 +14,25 @@
  * calibrated probabilites for SVM models, using Platt scaling. Binary Platt
  * scaling is extended to OVR multiclass using simple normalization.
  *
+ * Models can also be learned online, with one-vs-rest logistic or hinge
+ * loss SGD and per-weight AdaGrad step sizes. The learner's weights are
+ * mutable and shared by all callers without locking (hogwild), so
+ * concurrent partial fits may occasionally overwrite each other's updates
+ * to the same weight, which SGD tolerates for sparse-ish updates. Weights
+ * are accessed with relaxed atomic loads/stores, so updates are never
+ * torn. A snapshot copies the learner's weights into an immutable liblinear
+ * model, for prediction and export.
+ *
  * see https://github.com/cjlin1/liblinear for details
  *
  ***************************************************************************/
 /*-------------------[       Pre Include Defines       ]-------------------*/
 /*-------------------[      Library Include Files      ]-------------------*/
 #include <math.h>
+#include <stdlib.h>
 /*-------------------[      Project Include Files      ]-------------------*/
 #include "deps/liblinear/linear.h"
-#include "penelope.hpp"
+#include "job.hpp"
 /*-------------------[      Macros/Constants/Types     ]-------------------*/
 // extend the linear model structure to include an optional calibration model
 typedef struct tag_model : model {
@@ -32,11 +42,29 @@ typedef struct tag_model : model {
 typedef struct problem      LINEAR_PROBLEM;
 typedef struct feature_node LINEAR_NODE;
 typedef struct parameter    LINEAR_PARAM;
+// online learner loss functions
+#define LIN_LOSS_LOG   0          // logistic regression
+#define LIN_LOSS_HINGE 1          // linear SVM
+// online SGD learner, with lock-free shared weights
+typedef struct tagLinLearner {
+   int     loss;                  // loss function (LIN_LOSS_*)
+   int     nr_class;              // number of classes (k)
+   int     nr_feature;            // number of features (n)
+   double  bias;                  // intercept feature (-1 for none)
+   double  eta;                   // base learning rate
+   double  lambda;                // L2 regularization strength
+   double* w;                     // weights, in liblinear layout
+   double* g;                     // AdaGrad squared gradient sums
+} LIN_LEARNER;
 /*-------------------[        Global Variables         ]-------------------*/
 /*-------------------[        Global Prototypes        ]-------------------*/
 /*-------------------[        Module Variables         ]-------------------*/
 static ErlNifResourceType* g_model_type = NULL;
+static ErlNifResourceType* g_learner_type = NULL;
 /*-------------------[        Module Prototypes        ]-------------------*/
+static ERL_NIF_TERM lin_train (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[]);
 static bool erl2lin_must_calibrate (
    ErlNifEnv*    env,
    ERL_NIF_TERM  options,
@@ -96,6 +124,22 @@ static double lin_calibrate_predict (
    double decision,
    double prob_a,
    double prob_b);
+static void nif_destruct_learner (
+   ErlNifEnv* env,
+   void*      object);
+static LIN_LEARNER* erl2lin_learner (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM params);
+static void erl2lin_free_learner (
+   LIN_LEARNER* learner);
+static void lin_learner_step (
+   LIN_LEARNER* learner,
+   const float* x,
+   int          y);
+static void lin_learner_update (
+   LIN_LEARNER* learner,
+   int          index,
+   double       gradient);
 /*-------------------[         Implementation          ]-------------------*/
 /*-----------< FUNCTION: nif_lin_init >--------------------------------------
 // Purpose:    linear module initialization
@@ -117,7 +161,17 @@ int nif_lin_init (ErlNifEnv* env)
       &flags);
    if (!g_model_type)
       return 0;
-   // suppress liblinear debug output
+   // register the online learner resource type
+   g_learner_type = enif_open_resource_type(
+      env,
+      NULL,
+      "lin_learner",
+      &nif_destruct_learner,
+      flags,
+      &flags);
+   if (!g_learner_type)
+      return 0;
+   // suppress liblinear debug output, other than job progress
    set_print_string_function(&lin_print);
    return 1;
 }
@@ -141,6 +195,46 @@ ERL_NIF_TERM nif_lin_train (
    if (!enif_is_map(env, argv[2]))
       return enif_make_badarg(env);
    // train the linear model
+   try {
+      return lin_train(env, argv);
+   } catch (NifError& e) {
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_lin_train_async >-------------------------------
+// Purpose:    trains a linear model on a background job thread
+//             progress is reported for the primal (trust region) solvers,
+//             and cancellation takes effect when the solver returns
+// Parameters: x      - list of feature vectors (floats)
+//             y      - list of target labels (integer)
+//             params - map of linear parameters
+// Returns:    reference to the training job resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_lin_train_async (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   if (!enif_is_list(env, argv[0]))
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[1]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[2]))
+      return enif_make_badarg(env);
+   // start the training job
+   return nif_job_start(env, argc, argv, &lin_train);
+}
+/*-----------< FUNCTION: lin_train >-----------------------------------------
+// Purpose:    trains a linear model
+// Parameters: env  - current erlang environment
+//             argv - training arguments (x, y, params)
+// Returns:    reference to a trained linear model resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM lin_train (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[])
+{
    LINEAR_PROBLEM problem; memset(&problem, 0, sizeof(LINEAR_PROBLEM));
    LINEAR_PARAM   params;  memset(&params, 0, sizeof(LINEAR_PARAM));
    model*         linear   = NULL;
@@ -150,6 +244,8 @@ ERL_NIF_TERM nif_lin_train (
    double*        prob_l   = NULL;
    LINEAR_MODEL** resource = NULL;
    ERL_NIF_TERM result;
+   NifError error;
+   bool failed = false;
    try {
       // extract training parameters and feature/target vectors
       erl2lin_problem(env, argv[0], argv[1], argv[2], &problem);
@@ -159,6 +255,7 @@ ERL_NIF_TERM nif_lin_train (
          throw NifError(errors);
       // train the prediction model
       linear = CHECKALLOC(train(&problem, &params));
+      CHECK(!nif_job_cancelled(), "cancelled");
       // train the calibration model
       if (erl2lin_must_calibrate(env, argv[2], params)) {
          int model_count = linear->nr_class == 2 ? 1 : linear->nr_class;
@@ -195,7 +292,8 @@ ERL_NIF_TERM nif_lin_train (
    } catch (NifError& e) {
       if (resource && *resource)
          erl2lin_free_model((LINEAR_MODEL*)*resource);
-      result = e.to_term(env);
+      error  = e;
+      failed = true;
    }
    // free the model using the liblinear allocator
    if (linear != NULL)
@@ -209,6 +307,8 @@ ERL_NIF_TERM nif_lin_train (
    // release the training parameters
    erl2lin_free_problem(&problem);
    erl2lin_free_params(&params);
+   if (failed)
+      throw error;
    return result;
 }
 /*-----------< FUNCTION: nif_lin_export >------------------------------------
@@ -366,6 +466,166 @@ ERL_NIF_TERM nif_lin_predict_probability (
    nif_free(features);
    return result;
 }
+/*-----------< FUNCTION: nif_lin_learner >-----------------------------------
+// Purpose:    creates an online linear learner, with zero weights
+// Parameters: params - map of learner parameters
+// Returns:    reference to the mutable learner resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_lin_learner (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   if (!enif_is_map(env, argv[0]))
+      return enif_make_badarg(env);
+   LIN_LEARNER* learner = NULL;
+   try {
+      learner = erl2lin_learner(env, argv[0]);
+      // create an erlang resource to wrap the learner
+      LIN_LEARNER** resource = (LIN_LEARNER**)enif_alloc_resource(
+         g_learner_type,
+         sizeof(LIN_LEARNER*));
+      CHECKALLOC(resource);
+      *resource = learner;
+      ERL_NIF_TERM result = enif_make_resource(env, resource);
+      // relinquish the resource to erlang
+      enif_release_resource(resource);
+      return result;
+   } catch (NifError& e) {
+      erl2lin_free_learner(learner);
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_lin_partial_fit >-------------------------------
+// Purpose:    updates an online linear learner with a batch of samples,
+//             taking an SGD step per sample
+//             the learner's weights are updated in place, concurrently
+//             with any other partial fits on the learner
+// Parameters: learner - reference to the online learner
+//             x       - list of feature vectors (floats)
+//             y       - list of target labels (integer)
+//             options - map of partial fit options
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_lin_partial_fit (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   LIN_LEARNER** resource = NULL;
+   if (!enif_get_resource(env, argv[0], g_learner_type, (void**)&resource))
+      return enif_make_badarg(env);
+   LIN_LEARNER* learner = *resource;
+   if (!enif_is_list(env, argv[1]))
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[2]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[3]))
+      return enif_make_badarg(env);
+   try {
+      ERL_NIF_TERM value;
+      ERL_NIF_TERM x;
+      ERL_NIF_TERM y;
+      ERL_NIF_TERM head;
+      ErlNifBinary vector;
+      int          cls;
+      // decode the number of passes over the batch
+      int epochs = 1;
+      ERL_NIF_TERM key = enif_make_atom(env, "epochs");
+      if (enif_get_map_value(env, argv[3], key, &value))
+         CHECK(enif_get_int(env, value, &epochs) && epochs > 0,
+            "invalid_epochs");
+      // validate the batch before updating any weights
+      unsigned m = 0;
+      unsigned count = 0;
+      CHECK(enif_get_list_length(env, argv[1], &m), "invalid_features");
+      CHECK(enif_get_list_length(env, argv[2], &count), "invalid_targets");
+      CHECK(m == count, "mismatched_targets");
+      x = argv[1];
+      y = argv[2];
+      for (unsigned i = 0; i < m; i++) {
+         CHECK(enif_get_list_cell(env, x, &head, &x), "missing_features");
+         CHECK(enif_inspect_binary(env, head, &vector) &&
+               vector.size == learner->nr_feature * sizeof(float),
+            "invalid_features");
+         CHECK(enif_get_list_cell(env, y, &head, &y), "missing_target");
+         CHECK(enif_get_int(env, head, &cls) &&
+               cls >= 0 && cls < learner->nr_class,
+            "invalid_target");
+      }
+      // take a step per sample, in order
+      for (int e = 0; e < epochs; e++) {
+         x = argv[1];
+         y = argv[2];
+         for (unsigned i = 0; i < m; i++) {
+            enif_get_list_cell(env, x, &head, &x);
+            enif_inspect_binary(env, head, &vector);
+            enif_get_list_cell(env, y, &head, &y);
+            enif_get_int(env, head, &cls);
+            lin_learner_step(learner, (const float*)vector.data, cls);
+         }
+      }
+      return enif_make_atom(env, "ok");
+   } catch (NifError& e) {
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_lin_snapshot >----------------------------------
+// Purpose:    copies the current weights of an online learner into an
+//             immutable linear model, for prediction/export
+//             logistic learners produce an l2r_lr model (with
+//             probabilities), and hinge learners an l2r_l1loss_svc_dual
+//             model
+// Parameters: learner - reference to the online learner
+// Returns:    reference to a linear model resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_lin_snapshot (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   LIN_LEARNER** source = NULL;
+   if (!enif_get_resource(env, argv[0], g_learner_type, (void**)&source))
+      return enif_make_badarg(env);
+   LIN_LEARNER* learner = *source;
+   LINEAR_MODEL* model = NULL;
+   try {
+      // copy the learner's weights into a new model
+      model = nif_alloc<LINEAR_MODEL>();
+      model->param.solver_type = learner->loss == LIN_LOSS_LOG
+         ? L2R_LR
+         : L2R_L1LOSS_SVC_DUAL;
+      model->nr_class   = learner->nr_class;
+      model->nr_feature = learner->nr_feature;
+      model->bias       = learner->bias;
+      model->label      = nif_alloc<int>(learner->nr_class);
+      for (int i = 0; i < learner->nr_class; i++)
+         model->label[i] = i;
+      int model_count = learner->nr_class == 2 ? 1 : learner->nr_class;
+      int weight_count = learner->bias >= 0
+         ? learner->nr_feature + 1
+         : learner->nr_feature;
+      model->w = nif_alloc<double>(model_count * weight_count);
+      for (int i = 0; i < model_count * weight_count; i++)
+         __atomic_load(&learner->w[i], &model->w[i], __ATOMIC_RELAXED);
+      // create an erlang resource to wrap the model
+      LINEAR_MODEL** resource = (LINEAR_MODEL**)enif_alloc_resource(
+         g_model_type,
+         sizeof(LINEAR_MODEL*));
+      CHECKALLOC(resource);
+      *resource = model;
+      ERL_NIF_TERM result = enif_make_resource(env, resource);
+      // relinquish the resource to erlang
+      enif_release_resource(resource);
+      return result;
+   } catch (NifError& e) {
+      erl2lin_free_model(model);
+      return e.to_term(env);
+   }
+}
 /*-----------< FUNCTION: nif_destruct_model >--------------------------------
 // Purpose:    frees the memory associated with a linear model resource
 // Parameters: env    - current erlang environment
@@ -912,11 +1172,26 @@ void erl2lin_free_model (LINEAR_MODEL* model)
 }
 /*-----------< FUNCTION: lin_print >-----------------------------------------
 // Purpose:    liblinear debug output callback
+//             debug output is suppressed, but solver iterations are
+//             reported to the current training job, if any
 // Parameters: message - message to display
 // Returns:    none
 ---------------------------------------------------------------------------*/
 void lin_print (const char* message) {
-   // suppress debug output
+   static thread_local int iteration = 0;
+   if (!nif_job_active())
+      return;
+   // primal (trust region newton) solvers report each iteration,
+   // while dual solvers report the iteration count and objective at the end
+   const char* objective = NULL;
+   double value = 0;
+   if (sscanf(message, "iter %d", &iteration) == 1) {
+      if ((objective = strstr(message, " f ")) != NULL)
+         nif_job_progress(iteration, strtod(objective + 3, NULL));
+   } else if (sscanf(message, "Objective value = %lf", &value) == 1)
+      nif_job_progress(iteration, value);
+   else
+      sscanf(message, "optimization finished, #iter = %d", &iteration);
 }
 /*-----------< FUNCTION: lin_calibrate_train >-------------------------------
 // Purpose:    calibrates decision outputs to class probabilities using
@@ -1061,3 +1336,154 @@ double lin_calibrate_predict (
    else
       return 1.0/(1+exp(fApB)) ;
 }
+/*-----------< FUNCTION: nif_destruct_learner >------------------------------
+// Purpose:    frees the memory associated with an online learner resource
+// Parameters: env    - current erlang environment
+//             object - learner resource reference to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_learner (ErlNifEnv* env, void* object)
+{
+   erl2lin_free_learner(*(LIN_LEARNER**)object);
+}
+/*-----------< FUNCTION: erl2lin_learner >-----------------------------------
+// Purpose:    constructs an online learner from a parameter map
+// Parameters: env    - current erlang environment
+//             params - learner parameter map
+// Returns:    pointer to the allocated learner, with zero weights
+---------------------------------------------------------------------------*/
+LIN_LEARNER* erl2lin_learner (ErlNifEnv* env, ERL_NIF_TERM params)
+{
+   LIN_LEARNER* learner = nif_alloc<LIN_LEARNER>();
+   try {
+      ERL_NIF_TERM key;
+      ERL_NIF_TERM value;
+      // decode loss function
+      key = enif_make_atom(env, "loss");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_loss");
+      if (enif_is_identical(value, enif_make_atom(env, "log")))
+         learner->loss = LIN_LOSS_LOG;
+      else if (enif_is_identical(value, enif_make_atom(env, "hinge")))
+         learner->loss = LIN_LOSS_HINGE;
+      else
+         throw NifError("invalid_loss");
+      // decode model dimensions
+      key = enif_make_atom(env, "classes");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_classes");
+      CHECK(enif_get_int(env, value, &learner->nr_class) &&
+            learner->nr_class >= 2,
+         "invalid_classes");
+      key = enif_make_atom(env, "features");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_features");
+      CHECK(enif_get_int(env, value, &learner->nr_feature) &&
+            learner->nr_feature > 0,
+         "invalid_features");
+      key = enif_make_atom(env, "bias");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_bias");
+      CHECK(enif_get_double(env, value, &learner->bias), "invalid_bias");
+      // decode step size/regularization
+      key = enif_make_atom(env, "eta");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_eta");
+      CHECK(enif_get_double(env, value, &learner->eta) && learner->eta > 0,
+         "invalid_eta");
+      key = enif_make_atom(env, "lambda");
+      CHECK(enif_get_map_value(env, params, key, &value), "missing_lambda");
+      CHECK(enif_get_double(env, value, &learner->lambda) &&
+            learner->lambda >= 0,
+         "invalid_lambda");
+      // allocate the weights
+      int model_count = learner->nr_class == 2 ? 1 : learner->nr_class;
+      int weight_count = learner->bias >= 0
+         ? learner->nr_feature + 1
+         : learner->nr_feature;
+      learner->w = nif_alloc<double>(model_count * weight_count);
+      learner->g = nif_alloc<double>(model_count * weight_count);
+      return learner;
+   } catch (NifError& e) {
+      erl2lin_free_learner(learner);
+      throw;
+   }
+}
+/*-----------< FUNCTION: erl2lin_free_learner >------------------------------
+// Purpose:    frees the memory associated with an online learner
+// Parameters: learner - learner to free (NULL for none)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2lin_free_learner (LIN_LEARNER* learner)
+{
+   if (learner != NULL) {
+      nif_free(learner->w);
+      nif_free(learner->g);
+   }
+   nif_free(learner);
+}
+/*-----------< FUNCTION: lin_learner_step >----------------------------------
+// Purpose:    takes an SGD step for a single sample
+//             each one-vs-rest model (a single model for binary problems,
+//             positive for the first class, as in liblinear) descends the
+//             logistic or hinge loss gradient, with L2 regularization
+//             applied lazily to the weights of the nonzero features only
+// Parameters: learner - online learner to update
+//             x       - n feature vector
+//             y       - target class index
+// Returns:    none
+---------------------------------------------------------------------------*/
+void lin_learner_step (LIN_LEARNER* learner, const float* x, int y)
+{
+   int k = learner->nr_class == 2 ? 1 : learner->nr_class;
+   int n = learner->nr_feature;
+   for (int i = 0; i < k; i++) {
+      // compute the decision value of the model
+      double t = y == i ? 1 : -1;
+      double d = 0;
+      double w;
+      for (int j = 0; j < n; j++)
+         if (x[j] != 0) {
+            __atomic_load(&learner->w[j * k + i], &w, __ATOMIC_RELAXED);
+            d += w * x[j];
+         }
+      if (learner->bias >= 0) {
+         __atomic_load(&learner->w[n * k + i], &w, __ATOMIC_RELAXED);
+         d += w * learner->bias;
+      }
+      // compute the loss derivative with respect to the decision value
+      double margin = t * d;
+      double dloss = learner->loss == LIN_LOSS_LOG
+         ? -t / (1 + exp(margin))
+         : (margin < 1 ? -t : 0);
+      // update the weights of the nonzero features and the intercept
+      for (int j = 0; j < n; j++)
+         if (x[j] != 0) {
+            __atomic_load(&learner->w[j * k + i], &w, __ATOMIC_RELAXED);
+            lin_learner_update(
+               learner,
+               j * k + i,
+               dloss * x[j] + learner->lambda * w);
+         }
+      if (learner->bias >= 0)
+         lin_learner_update(learner, n * k + i, dloss * learner->bias);
+   }
+}
+/*-----------< FUNCTION: lin_learner_update >--------------------------------
+// Purpose:    applies an AdaGrad step to a single learner weight
+//             the weight and its squared gradient sum are updated with
+//             relaxed atomic loads/stores, so a concurrent update to the
+//             same weight may be lost, but never torn
+// Parameters: learner  - online learner to update
+//             index    - weight index
+//             gradient - loss gradient with respect to the weight
+// Returns:    none
+---------------------------------------------------------------------------*/
+void lin_learner_update (LIN_LEARNER* learner, int index, double gradient)
+{
+   if (gradient == 0)
+      return;
+   double g;
+   double w;
+   __atomic_load(&learner->g[index], &g, __ATOMIC_RELAXED);
+   __atomic_load(&learner->w[index], &w, __ATOMIC_RELAXED);
+   g += gradient * gradient;
+   w -= learner->eta * gradient / sqrt(g);
+   __atomic_store(&learner->g[index], &g, __ATOMIC_RELAXED);
+   __atomic_store(&learner->w[index], &w, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,675 @@
+/****************************************************************************
+ *
+ * MODULE:  pos.cpp
+ * PURPOSE: native part-of-speech featurizer for CRF tagging
+ *
+ * This module mirrors Penelope.ML.Text.POSFeaturizer, combined with the CRF
+ * tagger's feature naming, but generates the attribute names for each token
+ * into a reusable buffer and resolves them against the CRF model's attribute
+ * dictionary directly, so that a sentence is featurized and tagged in a
+ * single pass, without building any erlang feature maps.
+ *
+ * The attributes generated for the token at position p are:
+ * . has_hyphen-<bool>, has_digit-<bool>, has_cap-<bool>
+ * . pre_<i>-<first i graphemes>, suff_<i>-<last i graphemes>, for i in 1..4
+ * . tok_<k>-<token at p + k>, for k in -2..2 (empty outside the sentence)
+ *
+ * Character classes follow the (non-unicode) elixir regular expressions
+ * used by the featurizer, which match bytes as latin-1 characters. Affixes
+ * are split on extended grapheme cluster boundaries, following the rules of
+ * Unicode Standard Annex #29 (GB3-GB999) over the Unicode 14
+ * Grapheme_Cluster_Break and Extended_Pictographic properties, as with
+ * String.graphemes. Invalid UTF-8 bytes are single graphemes, as with
+ * String.slice.
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <string>
+#include <vector>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "crf.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define POS_MAX_AFFIX  4
+#define POS_MAX_WINDOW 2
+// grapheme cluster break classes (UAX #29), plus the Extended_Pictographic
+// property and invalid UTF-8 bytes
+#define POS_GCB_XX      0
+#define POS_GCB_CR      1
+#define POS_GCB_LF      2
+#define POS_GCB_CN      3
+#define POS_GCB_EX      4
+#define POS_GCB_ZWJ     5
+#define POS_GCB_RI      6
+#define POS_GCB_PP      7
+#define POS_GCB_SM      8
+#define POS_GCB_L       9
+#define POS_GCB_V       10
+#define POS_GCB_T       11
+#define POS_GCB_LV      12
+#define POS_GCB_LVT     13
+#define POS_GCB_XP      14
+#define POS_GCB_INVALID 15
+typedef struct tagPosGcbRange {
+   int first;
+   int last;
+   int type;
+} POS_GCB_RANGE;
+typedef struct tagPosGcbState {
+   int  prev;
+   int  regional;
+   bool pictographic;
+   bool joined;
+} POS_GCB_STATE;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+// sorted, disjoint code point ranges of each break class other than XX,
+// generated from the Unicode 14 character database (the precomposed hangul
+// syllables, LV and LVT, are classified arithmetically)
+static const POS_GCB_RANGE g_gcb_ranges[] = {
+   { 0x00000, 0x00009, POS_GCB_CN }, { 0x0000A, 0x0000A, POS_GCB_LF },
+   { 0x0000B, 0x0000C, POS_GCB_CN }, { 0x0000D, 0x0000D, POS_GCB_CR },
+   { 0x0000E, 0x0001F, POS_GCB_CN }, { 0x0007F, 0x0009F, POS_GCB_CN },
+   { 0x000A9, 0x000A9, POS_GCB_XP }, { 0x000AD, 0x000AD, POS_GCB_CN },
+   { 0x000AE, 0x000AE, POS_GCB_XP }, { 0x00300, 0x0036F, POS_GCB_EX },
+   { 0x00483, 0x00489, POS_GCB_EX }, { 0x00591, 0x005BD, POS_GCB_EX },
+   { 0x005BF, 0x005BF, POS_GCB_EX }, { 0x005C1, 0x005C2, POS_GCB_EX },
+   { 0x005C4, 0x005C5, POS_GCB_EX }, { 0x005C7, 0x005C7, POS_GCB_EX },
+   { 0x00600, 0x00605, POS_GCB_PP }, { 0x00610, 0x0061A, POS_GCB_EX },
+   { 0x0061C, 0x0061C, POS_GCB_CN }, { 0x0064B, 0x0065F, POS_GCB_EX },
+   { 0x00670, 0x00670, POS_GCB_EX }, { 0x006D6, 0x006DC, POS_GCB_EX },
+   { 0x006DD, 0x006DD, POS_GCB_PP }, { 0x006DF, 0x006E4, POS_GCB_EX },
+   { 0x006E7, 0x006E8, POS_GCB_EX }, { 0x006EA, 0x006ED, POS_GCB_EX },
+   { 0x0070F, 0x0070F, POS_GCB_PP }, { 0x00711, 0x00711, POS_GCB_EX },
+   { 0x00730, 0x0074A, POS_GCB_EX }, { 0x007A6, 0x007B0, POS_GCB_EX },
+   { 0x007EB, 0x007F3, POS_GCB_EX }, { 0x007FD, 0x007FD, POS_GCB_EX },
+   { 0x00816, 0x00819, POS_GCB_EX }, { 0x0081B, 0x00823, POS_GCB_EX },
+   { 0x00825, 0x00827, POS_GCB_EX }, { 0x00829, 0x0082D, POS_GCB_EX },
+   { 0x00859, 0x0085B, POS_GCB_EX }, { 0x00890, 0x00891, POS_GCB_PP },
+   { 0x00898, 0x0089F, POS_GCB_EX }, { 0x008CA, 0x008E1, POS_GCB_EX },
+   { 0x008E2, 0x008E2, POS_GCB_PP }, { 0x008E3, 0x00902, POS_GCB_EX },
+   { 0x00903, 0x00903, POS_GCB_SM }, { 0x0093A, 0x0093A, POS_GCB_EX },
+   { 0x0093B, 0x0093B, POS_GCB_SM }, { 0x0093C, 0x0093C, POS_GCB_EX },
+   { 0x0093E, 0x00940, POS_GCB_SM }, { 0x00941, 0x00948, POS_GCB_EX },
+   { 0x00949, 0x0094C, POS_GCB_SM }, { 0x0094D, 0x0094D, POS_GCB_EX },
+   { 0x0094E, 0x0094F, POS_GCB_SM }, { 0x00951, 0x00957, POS_GCB_EX },
+   { 0x00962, 0x00963, POS_GCB_EX }, { 0x00981, 0x00981, POS_GCB_EX },
+   { 0x00982, 0x00983, POS_GCB_SM }, { 0x009BC, 0x009BC, POS_GCB_EX },
+   { 0x009BE, 0x009BE, POS_GCB_EX }, { 0x009BF, 0x009C0, POS_GCB_SM },
+   { 0x009C1, 0x009C4, POS_GCB_EX }, { 0x009C7, 0x009C8, POS_GCB_SM },
+   { 0x009CB, 0x009CC, POS_GCB_SM }, { 0x009CD, 0x009CD, POS_GCB_EX },
+   { 0x009D7, 0x009D7, POS_GCB_EX }, { 0x009E2, 0x009E3, POS_GCB_EX },
+   { 0x009FE, 0x009FE, POS_GCB_EX }, { 0x00A01, 0x00A02, POS_GCB_EX },
+   { 0x00A03, 0x00A03, POS_GCB_SM }, { 0x00A3C, 0x00A3C, POS_GCB_EX },
+   { 0x00A3E, 0x00A40, POS_GCB_SM }, { 0x00A41, 0x00A42, POS_GCB_EX },
+   { 0x00A47, 0x00A48, POS_GCB_EX }, { 0x00A4B, 0x00A4D, POS_GCB_EX },
+   { 0x00A51, 0x00A51, POS_GCB_EX }, { 0x00A70, 0x00A71, POS_GCB_EX },
+   { 0x00A75, 0x00A75, POS_GCB_EX }, { 0x00A81, 0x00A82, POS_GCB_EX },
+   { 0x00A83, 0x00A83, POS_GCB_SM }, { 0x00ABC, 0x00ABC, POS_GCB_EX },
+   { 0x00ABE, 0x00AC0, POS_GCB_SM }, { 0x00AC1, 0x00AC5, POS_GCB_EX },
+   { 0x00AC7, 0x00AC8, POS_GCB_EX }, { 0x00AC9, 0x00AC9, POS_GCB_SM },
+   { 0x00ACB, 0x00ACC, POS_GCB_SM }, { 0x00ACD, 0x00ACD, POS_GCB_EX },
+   { 0x00AE2, 0x00AE3, POS_GCB_EX }, { 0x00AFA, 0x00AFF, POS_GCB_EX },
+   { 0x00B01, 0x00B01, POS_GCB_EX }, { 0x00B02, 0x00B03, POS_GCB_SM },
+   { 0x00B3C, 0x00B3C, POS_GCB_EX }, { 0x00B3E, 0x00B3F, POS_GCB_EX },
+   { 0x00B40, 0x00B40, POS_GCB_SM }, { 0x00B41, 0x00B44, POS_GCB_EX },
+   { 0x00B47, 0x00B48, POS_GCB_SM }, { 0x00B4B, 0x00B4C, POS_GCB_SM },
+   { 0x00B4D, 0x00B4D, POS_GCB_EX }, { 0x00B55, 0x00B57, POS_GCB_EX },
+   { 0x00B62, 0x00B63, POS_GCB_EX }, { 0x00B82, 0x00B82, POS_GCB_EX },
+   { 0x00BBE, 0x00BBE, POS_GCB_EX }, { 0x00BBF, 0x00BBF, POS_GCB_SM },
+   { 0x00BC0, 0x00BC0, POS_GCB_EX }, { 0x00BC1, 0x00BC2, POS_GCB_SM },
+   { 0x00BC6, 0x00BC8, POS_GCB_SM }, { 0x00BCA, 0x00BCC, POS_GCB_SM },
+   { 0x00BCD, 0x00BCD, POS_GCB_EX }, { 0x00BD7, 0x00BD7, POS_GCB_EX },
+   { 0x00C00, 0x00C00, POS_GCB_EX }, { 0x00C01, 0x00C03, POS_GCB_SM },
+   { 0x00C04, 0x00C04, POS_GCB_EX }, { 0x00C3C, 0x00C3C, POS_GCB_EX },
+   { 0x00C3E, 0x00C40, POS_GCB_EX }, { 0x00C41, 0x00C44, POS_GCB_SM },
+   { 0x00C46, 0x00C48, POS_GCB_EX }, { 0x00C4A, 0x00C4D, POS_GCB_EX },
+   { 0x00C55, 0x00C56, POS_GCB_EX }, { 0x00C62, 0x00C63, POS_GCB_EX },
+   { 0x00C81, 0x00C81, POS_GCB_EX }, { 0x00C82, 0x00C83, POS_GCB_SM },
+   { 0x00CBC, 0x00CBC, POS_GCB_EX }, { 0x00CBE, 0x00CBE, POS_GCB_SM },
+   { 0x00CBF, 0x00CBF, POS_GCB_EX }, { 0x00CC0, 0x00CC1, POS_GCB_SM },
+   { 0x00CC2, 0x00CC2, POS_GCB_EX }, { 0x00CC3, 0x00CC4, POS_GCB_SM },
+   { 0x00CC6, 0x00CC6, POS_GCB_EX }, { 0x00CC7, 0x00CC8, POS_GCB_SM },
+   { 0x00CCA, 0x00CCB, POS_GCB_SM }, { 0x00CCC, 0x00CCD, POS_GCB_EX },
+   { 0x00CD5, 0x00CD6, POS_GCB_EX }, { 0x00CE2, 0x00CE3, POS_GCB_EX },
+   { 0x00D00, 0x00D01, POS_GCB_EX }, { 0x00D02, 0x00D03, POS_GCB_SM },
+   { 0x00D3B, 0x00D3C, POS_GCB_EX }, { 0x00D3E, 0x00D3E, POS_GCB_EX },
+   { 0x00D3F, 0x00D40, POS_GCB_SM }, { 0x00D41, 0x00D44, POS_GCB_EX },
+   { 0x00D46, 0x00D48, POS_GCB_SM }, { 0x00D4A, 0x00D4C, POS_GCB_SM },
+   { 0x00D4D, 0x00D4D, POS_GCB_EX }, { 0x00D4E, 0x00D4E, POS_GCB_PP },
+   { 0x00D57, 0x00D57, POS_GCB_EX }, { 0x00D62, 0x00D63, POS_GCB_EX },
+   { 0x00D81, 0x00D81, POS_GCB_EX }, { 0x00D82, 0x00D83, POS_GCB_SM },
+   { 0x00DCA, 0x00DCA, POS_GCB_EX }, { 0x00DCF, 0x00DCF, POS_GCB_EX },
+   { 0x00DD0, 0x00DD1, POS_GCB_SM }, { 0x00DD2, 0x00DD4, POS_GCB_EX },
+   { 0x00DD6, 0x00DD6, POS_GCB_EX }, { 0x00DD8, 0x00DDE, POS_GCB_SM },
+   { 0x00DDF, 0x00DDF, POS_GCB_EX }, { 0x00DF2, 0x00DF3, POS_GCB_SM },
+   { 0x00E31, 0x00E31, POS_GCB_EX }, { 0x00E33, 0x00E33, POS_GCB_SM },
+   { 0x00E34, 0x00E3A, POS_GCB_EX }, { 0x00E47, 0x00E4E, POS_GCB_EX },
+   { 0x00EB1, 0x00EB1, POS_GCB_EX }, { 0x00EB3, 0x00EB3, POS_GCB_SM },
+   { 0x00EB4, 0x00EBC, POS_GCB_EX }, { 0x00EC8, 0x00ECD, POS_GCB_EX },
+   { 0x00F18, 0x00F19, POS_GCB_EX }, { 0x00F35, 0x00F35, POS_GCB_EX },
+   { 0x00F37, 0x00F37, POS_GCB_EX }, { 0x00F39, 0x00F39, POS_GCB_EX },
+   { 0x00F3E, 0x00F3F, POS_GCB_SM }, { 0x00F71, 0x00F7E, POS_GCB_EX },
+   { 0x00F7F, 0x00F7F, POS_GCB_SM }, { 0x00F80, 0x00F84, POS_GCB_EX },
+   { 0x00F86, 0x00F87, POS_GCB_EX }, { 0x00F8D, 0x00F97, POS_GCB_EX },
+   { 0x00F99, 0x00FBC, POS_GCB_EX }, { 0x00FC6, 0x00FC6, POS_GCB_EX },
+   { 0x0102D, 0x01030, POS_GCB_EX }, { 0x01031, 0x01031, POS_GCB_SM },
+   { 0x01032, 0x01037, POS_GCB_EX }, { 0x01039, 0x0103A, POS_GCB_EX },
+   { 0x0103B, 0x0103C, POS_GCB_SM }, { 0x0103D, 0x0103E, POS_GCB_EX },
+   { 0x01056, 0x01057, POS_GCB_SM }, { 0x01058, 0x01059, POS_GCB_EX },
+   { 0x0105E, 0x01060, POS_GCB_EX }, { 0x01071, 0x01074, POS_GCB_EX },
+   { 0x01082, 0x01082, POS_GCB_EX }, { 0x01084, 0x01084, POS_GCB_SM },
+   { 0x01085, 0x01086, POS_GCB_EX }, { 0x0108D, 0x0108D, POS_GCB_EX },
+   { 0x0109D, 0x0109D, POS_GCB_EX }, { 0x01100, 0x0115F, POS_GCB_L },
+   { 0x01160, 0x011A7, POS_GCB_V }, { 0x011A8, 0x011FF, POS_GCB_T },
+   { 0x0135D, 0x0135F, POS_GCB_EX }, { 0x01712, 0x01714, POS_GCB_EX },
+   { 0x01715, 0x01715, POS_GCB_SM }, { 0x01732, 0x01733, POS_GCB_EX },
+   { 0x01734, 0x01734, POS_GCB_SM }, { 0x01752, 0x01753, POS_GCB_EX },
+   { 0x01772, 0x01773, POS_GCB_EX }, { 0x017B4, 0x017B5, POS_GCB_EX },
+   { 0x017B6, 0x017B6, POS_GCB_SM }, { 0x017B7, 0x017BD, POS_GCB_EX },
+   { 0x017BE, 0x017C5, POS_GCB_SM }, { 0x017C6, 0x017C6, POS_GCB_EX },
+   { 0x017C7, 0x017C8, POS_GCB_SM }, { 0x017C9, 0x017D3, POS_GCB_EX },
+   { 0x017DD, 0x017DD, POS_GCB_EX }, { 0x0180B, 0x0180D, POS_GCB_EX },
+   { 0x0180E, 0x0180E, POS_GCB_CN }, { 0x0180F, 0x0180F, POS_GCB_EX },
+   { 0x01885, 0x01886, POS_GCB_EX }, { 0x018A9, 0x018A9, POS_GCB_EX },
+   { 0x01920, 0x01922, POS_GCB_EX }, { 0x01923, 0x01926, POS_GCB_SM },
+   { 0x01927, 0x01928, POS_GCB_EX }, { 0x01929, 0x0192B, POS_GCB_SM },
+   { 0x01930, 0x01931, POS_GCB_SM }, { 0x01932, 0x01932, POS_GCB_EX },
+   { 0x01933, 0x01938, POS_GCB_SM }, { 0x01939, 0x0193B, POS_GCB_EX },
+   { 0x01A17, 0x01A18, POS_GCB_EX }, { 0x01A19, 0x01A1A, POS_GCB_SM },
+   { 0x01A1B, 0x01A1B, POS_GCB_EX }, { 0x01A55, 0x01A55, POS_GCB_SM },
+   { 0x01A56, 0x01A56, POS_GCB_EX }, { 0x01A57, 0x01A57, POS_GCB_SM },
+   { 0x01A58, 0x01A5E, POS_GCB_EX }, { 0x01A60, 0x01A60, POS_GCB_EX },
+   { 0x01A62, 0x01A62, POS_GCB_EX }, { 0x01A65, 0x01A6C, POS_GCB_EX },
+   { 0x01A6D, 0x01A72, POS_GCB_SM }, { 0x01A73, 0x01A7C, POS_GCB_EX },
+   { 0x01A7F, 0x01A7F, POS_GCB_EX }, { 0x01AB0, 0x01ACE, POS_GCB_EX },
+   { 0x01B00, 0x01B03, POS_GCB_EX }, { 0x01B04, 0x01B04, POS_GCB_SM },
+   { 0x01B34, 0x01B3A, POS_GCB_EX }, { 0x01B3B, 0x01B3B, POS_GCB_SM },
+   { 0x01B3C, 0x01B3C, POS_GCB_EX }, { 0x01B3D, 0x01B41, POS_GCB_SM },
+   { 0x01B42, 0x01B42, POS_GCB_EX }, { 0x01B43, 0x01B44, POS_GCB_SM },
+   { 0x01B6B, 0x01B73, POS_GCB_EX }, { 0x01B80, 0x01B81, POS_GCB_EX },
+   { 0x01B82, 0x01B82, POS_GCB_SM }, { 0x01BA1, 0x01BA1, POS_GCB_SM },
+   { 0x01BA2, 0x01BA5, POS_GCB_EX }, { 0x01BA6, 0x01BA7, POS_GCB_SM },
+   { 0x01BA8, 0x01BA9, POS_GCB_EX }, { 0x01BAA, 0x01BAA, POS_GCB_SM },
+   { 0x01BAB, 0x01BAD, POS_GCB_EX }, { 0x01BE6, 0x01BE6, POS_GCB_EX },
+   { 0x01BE7, 0x01BE7, POS_GCB_SM }, { 0x01BE8, 0x01BE9, POS_GCB_EX },
+   { 0x01BEA, 0x01BEC, POS_GCB_SM }, { 0x01BED, 0x01BED, POS_GCB_EX },
+   { 0x01BEE, 0x01BEE, POS_GCB_SM }, { 0x01BEF, 0x01BF1, POS_GCB_EX },
+   { 0x01BF2, 0x01BF3, POS_GCB_SM }, { 0x01C24, 0x01C2B, POS_GCB_SM },
+   { 0x01C2C, 0x01C33, POS_GCB_EX }, { 0x01C34, 0x01C35, POS_GCB_SM },
+   { 0x01C36, 0x01C37, POS_GCB_EX }, { 0x01CD0, 0x01CD2, POS_GCB_EX },
+   { 0x01CD4, 0x01CE0, POS_GCB_EX }, { 0x01CE1, 0x01CE1, POS_GCB_SM },
+   { 0x01CE2, 0x01CE8, POS_GCB_EX }, { 0x01CED, 0x01CED, POS_GCB_EX },
+   { 0x01CF4, 0x01CF4, POS_GCB_EX }, { 0x01CF7, 0x01CF7, POS_GCB_SM },
+   { 0x01CF8, 0x01CF9, POS_GCB_EX }, { 0x01DC0, 0x01DFF, POS_GCB_EX },
+   { 0x0200B, 0x0200B, POS_GCB_CN }, { 0x0200C, 0x0200C, POS_GCB_EX },
+   { 0x0200D, 0x0200D, POS_GCB_ZWJ }, { 0x0200E, 0x0200F, POS_GCB_CN },
+   { 0x02028, 0x0202E, POS_GCB_CN }, { 0x0203C, 0x0203C, POS_GCB_XP },
+   { 0x02049, 0x02049, POS_GCB_XP }, { 0x02060, 0x0206F, POS_GCB_CN },
+   { 0x020D0, 0x020F0, POS_GCB_EX }, { 0x02122, 0x02122, POS_GCB_XP },
+   { 0x02139, 0x02139, POS_GCB_XP }, { 0x02194, 0x02199, POS_GCB_XP },
+   { 0x021A9, 0x021AA, POS_GCB_XP }, { 0x0231A, 0x0231B, POS_GCB_XP },
+   { 0x02328, 0x02328, POS_GCB_XP }, { 0x02388, 0x02388, POS_GCB_XP },
+   { 0x023CF, 0x023CF, POS_GCB_XP }, { 0x023E9, 0x023F3, POS_GCB_XP },
+   { 0x023F8, 0x023FA, POS_GCB_XP }, { 0x024C2, 0x024C2, POS_GCB_XP },
+   { 0x025AA, 0x025AB, POS_GCB_XP }, { 0x025B6, 0x025B6, POS_GCB_XP },
+   { 0x025C0, 0x025C0, POS_GCB_XP }, { 0x025FB, 0x025FE, POS_GCB_XP },
+   { 0x02600, 0x02605, POS_GCB_XP }, { 0x02607, 0x02612, POS_GCB_XP },
+   { 0x02614, 0x02685, POS_GCB_XP }, { 0x02690, 0x02705, POS_GCB_XP },
+   { 0x02708, 0x02712, POS_GCB_XP }, { 0x02714, 0x02714, POS_GCB_XP },
+   { 0x02716, 0x02716, POS_GCB_XP }, { 0x0271D, 0x0271D, POS_GCB_XP },
+   { 0x02721, 0x02721, POS_GCB_XP }, { 0x02728, 0x02728, POS_GCB_XP },
+   { 0x02733, 0x02734, POS_GCB_XP }, { 0x02744, 0x02744, POS_GCB_XP },
+   { 0x02747, 0x02747, POS_GCB_XP }, { 0x0274C, 0x0274C, POS_GCB_XP },
+   { 0x0274E, 0x0274E, POS_GCB_XP }, { 0x02753, 0x02755, POS_GCB_XP },
+   { 0x02757, 0x02757, POS_GCB_XP }, { 0x02763, 0x02767, POS_GCB_XP },
+   { 0x02795, 0x02797, POS_GCB_XP }, { 0x027A1, 0x027A1, POS_GCB_XP },
+   { 0x027B0, 0x027B0, POS_GCB_XP }, { 0x027BF, 0x027BF, POS_GCB_XP },
+   { 0x02934, 0x02935, POS_GCB_XP }, { 0x02B05, 0x02B07, POS_GCB_XP },
+   { 0x02B1B, 0x02B1C, POS_GCB_XP }, { 0x02B50, 0x02B50, POS_GCB_XP },
+   { 0x02B55, 0x02B55, POS_GCB_XP }, { 0x02CEF, 0x02CF1, POS_GCB_EX },
+   { 0x02D7F, 0x02D7F, POS_GCB_EX }, { 0x02DE0, 0x02DFF, POS_GCB_EX },
+   { 0x0302A, 0x0302F, POS_GCB_EX }, { 0x03030, 0x03030, POS_GCB_XP },
+   { 0x0303D, 0x0303D, POS_GCB_XP }, { 0x03099, 0x0309A, POS_GCB_EX },
+   { 0x03297, 0x03297, POS_GCB_XP }, { 0x03299, 0x03299, POS_GCB_XP },
+   { 0x0A66F, 0x0A672, POS_GCB_EX }, { 0x0A674, 0x0A67D, POS_GCB_EX },
+   { 0x0A69E, 0x0A69F, POS_GCB_EX }, { 0x0A6F0, 0x0A6F1, POS_GCB_EX },
+   { 0x0A802, 0x0A802, POS_GCB_EX }, { 0x0A806, 0x0A806, POS_GCB_EX },
+   { 0x0A80B, 0x0A80B, POS_GCB_EX }, { 0x0A823, 0x0A824, POS_GCB_SM },
+   { 0x0A825, 0x0A826, POS_GCB_EX }, { 0x0A827, 0x0A827, POS_GCB_SM },
+   { 0x0A82C, 0x0A82C, POS_GCB_EX }, { 0x0A880, 0x0A881, POS_GCB_SM },
+   { 0x0A8B4, 0x0A8C3, POS_GCB_SM }, { 0x0A8C4, 0x0A8C5, POS_GCB_EX },
+   { 0x0A8E0, 0x0A8F1, POS_GCB_EX }, { 0x0A8FF, 0x0A8FF, POS_GCB_EX },
+   { 0x0A926, 0x0A92D, POS_GCB_EX }, { 0x0A947, 0x0A951, POS_GCB_EX },
+   { 0x0A952, 0x0A953, POS_GCB_SM }, { 0x0A960, 0x0A97C, POS_GCB_L },
+   { 0x0A980, 0x0A982, POS_GCB_EX }, { 0x0A983, 0x0A983, POS_GCB_SM },
+   { 0x0A9B3, 0x0A9B3, POS_GCB_EX }, { 0x0A9B4, 0x0A9B5, POS_GCB_SM },
+   { 0x0A9B6, 0x0A9B9, POS_GCB_EX }, { 0x0A9BA, 0x0A9BB, POS_GCB_SM },
+   { 0x0A9BC, 0x0A9BD, POS_GCB_EX }, { 0x0A9BE, 0x0A9C0, POS_GCB_SM },
+   { 0x0A9E5, 0x0A9E5, POS_GCB_EX }, { 0x0AA29, 0x0AA2E, POS_GCB_EX },
+   { 0x0AA2F, 0x0AA30, POS_GCB_SM }, { 0x0AA31, 0x0AA32, POS_GCB_EX },
+   { 0x0AA33, 0x0AA34, POS_GCB_SM }, { 0x0AA35, 0x0AA36, POS_GCB_EX },
+   { 0x0AA43, 0x0AA43, POS_GCB_EX }, { 0x0AA4C, 0x0AA4C, POS_GCB_EX },
+   { 0x0AA4D, 0x0AA4D, POS_GCB_SM }, { 0x0AA7C, 0x0AA7C, POS_GCB_EX },
+   { 0x0AAB0, 0x0AAB0, POS_GCB_EX }, { 0x0AAB2, 0x0AAB4, POS_GCB_EX },
+   { 0x0AAB7, 0x0AAB8, POS_GCB_EX }, { 0x0AABE, 0x0AABF, POS_GCB_EX },
+   { 0x0AAC1, 0x0AAC1, POS_GCB_EX }, { 0x0AAEB, 0x0AAEB, POS_GCB_SM },
+   { 0x0AAEC, 0x0AAED, POS_GCB_EX }, { 0x0AAEE, 0x0AAEF, POS_GCB_SM },
+   { 0x0AAF5, 0x0AAF5, POS_GCB_SM }, { 0x0AAF6, 0x0AAF6, POS_GCB_EX },
+   { 0x0ABE3, 0x0ABE4, POS_GCB_SM }, { 0x0ABE5, 0x0ABE5, POS_GCB_EX },
+   { 0x0ABE6, 0x0ABE7, POS_GCB_SM }, { 0x0ABE8, 0x0ABE8, POS_GCB_EX },
+   { 0x0ABE9, 0x0ABEA, POS_GCB_SM }, { 0x0ABEC, 0x0ABEC, POS_GCB_SM },
+   { 0x0ABED, 0x0ABED, POS_GCB_EX }, { 0x0D7B0, 0x0D7C6, POS_GCB_V },
+   { 0x0D7CB, 0x0D7FB, POS_GCB_T }, { 0x0FB1E, 0x0FB1E, POS_GCB_EX },
+   { 0x0FE00, 0x0FE0F, POS_GCB_EX }, { 0x0FE20, 0x0FE2F, POS_GCB_EX },
+   { 0x0FEFF, 0x0FEFF, POS_GCB_CN }, { 0x0FF9E, 0x0FF9F, POS_GCB_EX },
+   { 0x0FFF0, 0x0FFFB, POS_GCB_CN }, { 0x101FD, 0x101FD, POS_GCB_EX },
+   { 0x102E0, 0x102E0, POS_GCB_EX }, { 0x10376, 0x1037A, POS_GCB_EX },
+   { 0x10A01, 0x10A03, POS_GCB_EX }, { 0x10A05, 0x10A06, POS_GCB_EX },
+   { 0x10A0C, 0x10A0F, POS_GCB_EX }, { 0x10A38, 0x10A3A, POS_GCB_EX },
+   { 0x10A3F, 0x10A3F, POS_GCB_EX }, { 0x10AE5, 0x10AE6, POS_GCB_EX },
+   { 0x10D24, 0x10D27, POS_GCB_EX }, { 0x10EAB, 0x10EAC, POS_GCB_EX },
+   { 0x10F46, 0x10F50, POS_GCB_EX }, { 0x10F82, 0x10F85, POS_GCB_EX },
+   { 0x11000, 0x11000, POS_GCB_SM }, { 0x11001, 0x11001, POS_GCB_EX },
+   { 0x11002, 0x11002, POS_GCB_SM }, { 0x11038, 0x11046, POS_GCB_EX },
+   { 0x11070, 0x11070, POS_GCB_EX }, { 0x11073, 0x11074, POS_GCB_EX },
+   { 0x1107F, 0x11081, POS_GCB_EX }, { 0x11082, 0x11082, POS_GCB_SM },
+   { 0x110B0, 0x110B2, POS_GCB_SM }, { 0x110B3, 0x110B6, POS_GCB_EX },
+   { 0x110B7, 0x110B8, POS_GCB_SM }, { 0x110B9, 0x110BA, POS_GCB_EX },
+   { 0x110BD, 0x110BD, POS_GCB_PP }, { 0x110C2, 0x110C2, POS_GCB_EX },
+   { 0x110CD, 0x110CD, POS_GCB_PP }, { 0x11100, 0x11102, POS_GCB_EX },
+   { 0x11127, 0x1112B, POS_GCB_EX }, { 0x1112C, 0x1112C, POS_GCB_SM },
+   { 0x1112D, 0x11134, POS_GCB_EX }, { 0x11145, 0x11146, POS_GCB_SM },
+   { 0x11173, 0x11173, POS_GCB_EX }, { 0x11180, 0x11181, POS_GCB_EX },
+   { 0x11182, 0x11182, POS_GCB_SM }, { 0x111B3, 0x111B5, POS_GCB_SM },
+   { 0x111B6, 0x111BE, POS_GCB_EX }, { 0x111BF, 0x111C0, POS_GCB_SM },
+   { 0x111C2, 0x111C3, POS_GCB_PP }, { 0x111C9, 0x111CC, POS_GCB_EX },
+   { 0x111CE, 0x111CE, POS_GCB_SM }, { 0x111CF, 0x111CF, POS_GCB_EX },
+   { 0x1122C, 0x1122E, POS_GCB_SM }, { 0x1122F, 0x11231, POS_GCB_EX },
+   { 0x11232, 0x11233, POS_GCB_SM }, { 0x11234, 0x11234, POS_GCB_EX },
+   { 0x11235, 0x11235, POS_GCB_SM }, { 0x11236, 0x11237, POS_GCB_EX },
+   { 0x1123E, 0x1123E, POS_GCB_EX }, { 0x112DF, 0x112DF, POS_GCB_EX },
+   { 0x112E0, 0x112E2, POS_GCB_SM }, { 0x112E3, 0x112EA, POS_GCB_EX },
+   { 0x11300, 0x11301, POS_GCB_EX }, { 0x11302, 0x11303, POS_GCB_SM },
+   { 0x1133B, 0x1133C, POS_GCB_EX }, { 0x1133E, 0x1133E, POS_GCB_EX },
+   { 0x1133F, 0x1133F, POS_GCB_SM }, { 0x11340, 0x11340, POS_GCB_EX },
+   { 0x11341, 0x11344, POS_GCB_SM }, { 0x11347, 0x11348, POS_GCB_SM },
+   { 0x1134B, 0x1134D, POS_GCB_SM }, { 0x11357, 0x11357, POS_GCB_EX },
+   { 0x11362, 0x11363, POS_GCB_SM }, { 0x11366, 0x1136C, POS_GCB_EX },
+   { 0x11370, 0x11374, POS_GCB_EX }, { 0x11435, 0x11437, POS_GCB_SM },
+   { 0x11438, 0x1143F, POS_GCB_EX }, { 0x11440, 0x11441, POS_GCB_SM },
+   { 0x11442, 0x11444, POS_GCB_EX }, { 0x11445, 0x11445, POS_GCB_SM },
+   { 0x11446, 0x11446, POS_GCB_EX }, { 0x1145E, 0x1145E, POS_GCB_EX },
+   { 0x114B0, 0x114B0, POS_GCB_EX }, { 0x114B1, 0x114B2, POS_GCB_SM },
+   { 0x114B3, 0x114B8, POS_GCB_EX }, { 0x114B9, 0x114B9, POS_GCB_SM },
+   { 0x114BA, 0x114BA, POS_GCB_EX }, { 0x114BB, 0x114BC, POS_GCB_SM },
+   { 0x114BD, 0x114BD, POS_GCB_EX }, { 0x114BE, 0x114BE, POS_GCB_SM },
+   { 0x114BF, 0x114C0, POS_GCB_EX }, { 0x114C1, 0x114C1, POS_GCB_SM },
+   { 0x114C2, 0x114C3, POS_GCB_EX }, { 0x115AF, 0x115AF, POS_GCB_EX },
+   { 0x115B0, 0x115B1, POS_GCB_SM }, { 0x115B2, 0x115B5, POS_GCB_EX },
+   { 0x115B8, 0x115BB, POS_GCB_SM }, { 0x115BC, 0x115BD, POS_GCB_EX },
+   { 0x115BE, 0x115BE, POS_GCB_SM }, { 0x115BF, 0x115C0, POS_GCB_EX },
+   { 0x115DC, 0x115DD, POS_GCB_EX }, { 0x11630, 0x11632, POS_GCB_SM },
+   { 0x11633, 0x1163A, POS_GCB_EX }, { 0x1163B, 0x1163C, POS_GCB_SM },
+   { 0x1163D, 0x1163D, POS_GCB_EX }, { 0x1163E, 0x1163E, POS_GCB_SM },
+   { 0x1163F, 0x11640, POS_GCB_EX }, { 0x116AB, 0x116AB, POS_GCB_EX },
+   { 0x116AC, 0x116AC, POS_GCB_SM }, { 0x116AD, 0x116AD, POS_GCB_EX },
+   { 0x116AE, 0x116AF, POS_GCB_SM }, { 0x116B0, 0x116B5, POS_GCB_EX },
+   { 0x116B6, 0x116B6, POS_GCB_SM }, { 0x116B7, 0x116B7, POS_GCB_EX },
+   { 0x1171D, 0x1171F, POS_GCB_EX }, { 0x11722, 0x11725, POS_GCB_EX },
+   { 0x11726, 0x11726, POS_GCB_SM }, { 0x11727, 0x1172B, POS_GCB_EX },
+   { 0x1182C, 0x1182E, POS_GCB_SM }, { 0x1182F, 0x11837, POS_GCB_EX },
+   { 0x11838, 0x11838, POS_GCB_SM }, { 0x11839, 0x1183A, POS_GCB_EX },
+   { 0x11930, 0x11930, POS_GCB_EX }, { 0x11931, 0x11935, POS_GCB_SM },
+   { 0x11937, 0x11938, POS_GCB_SM }, { 0x1193B, 0x1193C, POS_GCB_EX },
+   { 0x1193D, 0x1193D, POS_GCB_SM }, { 0x1193E, 0x1193E, POS_GCB_EX },
+   { 0x1193F, 0x1193F, POS_GCB_PP }, { 0x11940, 0x11940, POS_GCB_SM },
+   { 0x11941, 0x11941, POS_GCB_PP }, { 0x11942, 0x11942, POS_GCB_SM },
+   { 0x11943, 0x11943, POS_GCB_EX }, { 0x119D1, 0x119D3, POS_GCB_SM },
+   { 0x119D4, 0x119D7, POS_GCB_EX }, { 0x119DA, 0x119DB, POS_GCB_EX },
+   { 0x119DC, 0x119DF, POS_GCB_SM }, { 0x119E0, 0x119E0, POS_GCB_EX },
+   { 0x119E4, 0x119E4, POS_GCB_SM }, { 0x11A01, 0x11A0A, POS_GCB_EX },
+   { 0x11A33, 0x11A38, POS_GCB_EX }, { 0x11A39, 0x11A39, POS_GCB_SM },
+   { 0x11A3A, 0x11A3A, POS_GCB_PP }, { 0x11A3B, 0x11A3E, POS_GCB_EX },
+   { 0x11A47, 0x11A47, POS_GCB_EX }, { 0x11A51, 0x11A56, POS_GCB_EX },
+   { 0x11A57, 0x11A58, POS_GCB_SM }, { 0x11A59, 0x11A5B, POS_GCB_EX },
+   { 0x11A84, 0x11A89, POS_GCB_PP }, { 0x11A8A, 0x11A96, POS_GCB_EX },
+   { 0x11A97, 0x11A97, POS_GCB_SM }, { 0x11A98, 0x11A99, POS_GCB_EX },
+   { 0x11C2F, 0x11C2F, POS_GCB_SM }, { 0x11C30, 0x11C36, POS_GCB_EX },
+   { 0x11C38, 0x11C3D, POS_GCB_EX }, { 0x11C3E, 0x11C3E, POS_GCB_SM },
+   { 0x11C3F, 0x11C3F, POS_GCB_EX }, { 0x11C92, 0x11CA7, POS_GCB_EX },
+   { 0x11CA9, 0x11CA9, POS_GCB_SM }, { 0x11CAA, 0x11CB0, POS_GCB_EX },
+   { 0x11CB1, 0x11CB1, POS_GCB_SM }, { 0x11CB2, 0x11CB3, POS_GCB_EX },
+   { 0x11CB4, 0x11CB4, POS_GCB_SM }, { 0x11CB5, 0x11CB6, POS_GCB_EX },
+   { 0x11D31, 0x11D36, POS_GCB_EX }, { 0x11D3A, 0x11D3A, POS_GCB_EX },
+   { 0x11D3C, 0x11D3D, POS_GCB_EX }, { 0x11D3F, 0x11D45, POS_GCB_EX },
+   { 0x11D46, 0x11D46, POS_GCB_PP }, { 0x11D47, 0x11D47, POS_GCB_EX },
+   { 0x11D8A, 0x11D8E, POS_GCB_SM }, { 0x11D90, 0x11D91, POS_GCB_EX },
+   { 0x11D93, 0x11D94, POS_GCB_SM }, { 0x11D95, 0x11D95, POS_GCB_EX },
+   { 0x11D96, 0x11D96, POS_GCB_SM }, { 0x11D97, 0x11D97, POS_GCB_EX },
+   { 0x11EF3, 0x11EF4, POS_GCB_EX }, { 0x11EF5, 0x11EF6, POS_GCB_SM },
+   { 0x13430, 0x13438, POS_GCB_CN }, { 0x16AF0, 0x16AF4, POS_GCB_EX },
+   { 0x16B30, 0x16B36, POS_GCB_EX }, { 0x16F4F, 0x16F4F, POS_GCB_EX },
+   { 0x16F51, 0x16F87, POS_GCB_SM }, { 0x16F8F, 0x16F92, POS_GCB_EX },
+   { 0x16FE4, 0x16FE4, POS_GCB_EX }, { 0x16FF0, 0x16FF1, POS_GCB_SM },
+   { 0x1BC9D, 0x1BC9E, POS_GCB_EX }, { 0x1BCA0, 0x1BCA3, POS_GCB_CN },
+   { 0x1CF00, 0x1CF2D, POS_GCB_EX }, { 0x1CF30, 0x1CF46, POS_GCB_EX },
+   { 0x1D165, 0x1D165, POS_GCB_EX }, { 0x1D166, 0x1D166, POS_GCB_SM },
+   { 0x1D167, 0x1D169, POS_GCB_EX }, { 0x1D16D, 0x1D16D, POS_GCB_SM },
+   { 0x1D16E, 0x1D172, POS_GCB_EX }, { 0x1D173, 0x1D17A, POS_GCB_CN },
+   { 0x1D17B, 0x1D182, POS_GCB_EX }, { 0x1D185, 0x1D18B, POS_GCB_EX },
+   { 0x1D1AA, 0x1D1AD, POS_GCB_EX }, { 0x1D242, 0x1D244, POS_GCB_EX },
+   { 0x1DA00, 0x1DA36, POS_GCB_EX }, { 0x1DA3B, 0x1DA6C, POS_GCB_EX },
+   { 0x1DA75, 0x1DA75, POS_GCB_EX }, { 0x1DA84, 0x1DA84, POS_GCB_EX },
+   { 0x1DA9B, 0x1DA9F, POS_GCB_EX }, { 0x1DAA1, 0x1DAAF, POS_GCB_EX },
+   { 0x1E000, 0x1E006, POS_GCB_EX }, { 0x1E008, 0x1E018, POS_GCB_EX },
+   { 0x1E01B, 0x1E021, POS_GCB_EX }, { 0x1E023, 0x1E024, POS_GCB_EX },
+   { 0x1E026, 0x1E02A, POS_GCB_EX }, { 0x1E130, 0x1E136, POS_GCB_EX },
+   { 0x1E2AE, 0x1E2AE, POS_GCB_EX }, { 0x1E2EC, 0x1E2EF, POS_GCB_EX },
+   { 0x1E8D0, 0x1E8D6, POS_GCB_EX }, { 0x1E944, 0x1E94A, POS_GCB_EX },
+   { 0x1F000, 0x1F0FF, POS_GCB_XP }, { 0x1F10D, 0x1F10F, POS_GCB_XP },
+   { 0x1F12F, 0x1F12F, POS_GCB_XP }, { 0x1F16C, 0x1F171, POS_GCB_XP },
+   { 0x1F17E, 0x1F17F, POS_GCB_XP }, { 0x1F18E, 0x1F18E, POS_GCB_XP },
+   { 0x1F191, 0x1F19A, POS_GCB_XP }, { 0x1F1AD, 0x1F1E5, POS_GCB_XP },
+   { 0x1F1E6, 0x1F1FF, POS_GCB_RI }, { 0x1F201, 0x1F20F, POS_GCB_XP },
+   { 0x1F21A, 0x1F21A, POS_GCB_XP }, { 0x1F22F, 0x1F22F, POS_GCB_XP },
+   { 0x1F232, 0x1F23A, POS_GCB_XP }, { 0x1F23C, 0x1F23F, POS_GCB_XP },
+   { 0x1F249, 0x1F3FA, POS_GCB_XP }, { 0x1F3FB, 0x1F3FF, POS_GCB_EX },
+   { 0x1F400, 0x1F53D, POS_GCB_XP }, { 0x1F546, 0x1F64F, POS_GCB_XP },
+   { 0x1F680, 0x1F6FF, POS_GCB_XP }, { 0x1F774, 0x1F77F, POS_GCB_XP },
+   { 0x1F7D5, 0x1F7FF, POS_GCB_XP }, { 0x1F80C, 0x1F80F, POS_GCB_XP },
+   { 0x1F848, 0x1F84F, POS_GCB_XP }, { 0x1F85A, 0x1F85F, POS_GCB_XP },
+   { 0x1F888, 0x1F88F, POS_GCB_XP }, { 0x1F8AE, 0x1F8FF, POS_GCB_XP },
+   { 0x1F90C, 0x1F93A, POS_GCB_XP }, { 0x1F93C, 0x1F945, POS_GCB_XP },
+   { 0x1F947, 0x1FAFF, POS_GCB_XP }, { 0x1FC00, 0x1FFFD, POS_GCB_XP },
+   { 0xE0000, 0xE001F, POS_GCB_CN }, { 0xE0020, 0xE007F, POS_GCB_EX },
+   { 0xE0080, 0xE00FF, POS_GCB_CN }, { 0xE0100, 0xE01EF, POS_GCB_EX },
+   { 0xE01F0, 0xE0FFF, POS_GCB_CN }
+};
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void pos_featurize (
+   crfsuite_dictionary_t* attrs,
+   const ErlNifBinary*    tokens,
+   int                    n,
+   crfsuite_instance_t*   instance);
+static void pos_attribute (
+   crfsuite_dictionary_t* attrs,
+   const std::string&     name,
+   crfsuite_item_t*       item);
+static void pos_graphemes (
+   const ErlNifBinary& token,
+   std::vector<int>*   bounds);
+static int pos_decode (
+   const unsigned char* data,
+   int                  size,
+   int*                 length);
+static int pos_break_type (
+   int cp);
+static bool pos_is_break (
+   POS_GCB_STATE* state,
+   int            next);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: nif_crf_predict_pos >-------------------------------
+// Purpose:    featurizes a token sequence for POS tagging and predicts its
+//             tags with a CRF model, in a single call
+// Parameters: model  - reference to the trained CRF model
+//             tokens - token sequence (list of strings)
+// Returns:    a tuple containing the predicted tag sequence (list) and the
+//             probability of sequence
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_crf_predict_pos (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   CRF_MODEL* model = crf_model_resource(env, argv[0]);
+   if (model == NULL)
+      return enif_make_badarg(env);
+   unsigned n;
+   if (!enif_get_list_length(env, argv[1], &n))
+      return enif_make_badarg(env);
+   // featurize the tokens and predict the tag sequence
+   crfsuite_dictionary_t* attrs  = NULL;
+   ErlNifBinary*          tokens = NULL;
+   crfsuite_instance_t    instance;
+   ERL_NIF_TERM result;
+   try {
+      crfsuite_instance_init(&instance);
+      // retrieve the token strings
+      tokens = nif_alloc<ErlNifBinary>(n + 1);
+      ERL_NIF_TERM list = argv[1];
+      ERL_NIF_TERM head;
+      for (int i = 0; i < (int)n; i++) {
+         CHECK(enif_get_list_cell(env, list, &head, &list), "invalid_tokens");
+         CHECK(enif_inspect_binary(env, head, &tokens[i]), "invalid_token");
+      }
+      // resolve the token attributes against the model dictionary
+      CHECKALLOC(model->crf->get_attrs(model->crf, &attrs) == 0);
+      crfsuite_instance_init_n(&instance, n);
+      pos_featurize(attrs, tokens, n, &instance);
+      result = crf_predict_instance(env, model, &instance, NULL);
+   } catch (NifError& e) {
+      result = e.to_term(env);
+   }
+   // clean up
+   if (attrs != NULL)
+      attrs->release(attrs);
+   crfsuite_instance_finish(&instance);
+   nif_free(tokens);
+   return result;
+}
+/*-----------< FUNCTION: pos_featurize >-------------------------------------
+// Purpose:    generates the POS attributes for each token in a sequence
+// Parameters: attrs    - model attribute dictionary
+//             tokens   - token strings
+//             n        - number of tokens
+//             instance - crfsuite instance (n items) to populate
+// Returns:    none
+---------------------------------------------------------------------------*/
+void pos_featurize (
+   crfsuite_dictionary_t* attrs,
+   const ErlNifBinary*    tokens,
+   int                    n,
+   crfsuite_instance_t*   instance)
+{
+   std::string      name;
+   std::vector<int> bounds;
+   for (int p = 0; p < n; p++) {
+      const ErlNifBinary& token = tokens[p];
+      const char*         data  = (const char*)token.data;
+      crfsuite_item_t*    item  = &instance->items[p];
+      // character class features
+      bool hyphen = false;
+      bool digit  = false;
+      bool cap    = false;
+      for (size_t i = 0; i < token.size; i++) {
+         unsigned char c = token.data[i];
+         hyphen = hyphen || c == '-';
+         digit  = digit || (c >= '0' && c <= '9');
+         cap    = cap || (c >= 'A' && c <= 'Z') ||
+            (c >= 0xC0 && c <= 0xDE && c != 0xD7);
+      }
+      pos_attribute(attrs, hyphen ? "has_hyphen-true" : "has_hyphen-false", item);
+      pos_attribute(attrs, digit ? "has_digit-true" : "has_digit-false", item);
+      pos_attribute(attrs, cap ? "has_cap-true" : "has_cap-false", item);
+      // prefix/suffix features
+      pos_graphemes(token, &bounds);
+      int count = (int)bounds.size() - 1;
+      for (int i = 1; i <= POS_MAX_AFFIX; i++) {
+         int g = i < count ? i : count;
+         name.assign("pre_");
+         name.append(1, (char)('0' + i));
+         name.append(1, '-');
+         name.append(data, bounds[g]);
+         pos_attribute(attrs, name, item);
+         name.assign("suff_");
+         name.append(1, (char)('0' + i));
+         name.append(1, '-');
+         name.append(data + bounds[count - g], token.size - bounds[count - g]);
+         pos_attribute(attrs, name, item);
+      }
+      // token window features
+      for (int k = -POS_MAX_WINDOW; k <= POS_MAX_WINDOW; k++) {
+         name.assign("tok_");
+         name.append(std::to_string(k));
+         name.append(1, '-');
+         if (p + k >= 0 && p + k < n)
+            name.append((const char*)tokens[p + k].data, tokens[p + k].size);
+         pos_attribute(attrs, name, item);
+      }
+   }
+}
+/*-----------< FUNCTION: pos_attribute >-------------------------------------
+// Purpose:    appends an attribute to an item, if it is known to the model
+// Parameters: attrs - model attribute dictionary
+//             name  - attribute name
+//             item  - crfsuite item to update
+// Returns:    none
+---------------------------------------------------------------------------*/
+void pos_attribute (
+   crfsuite_dictionary_t* attrs,
+   const std::string&     name,
+   crfsuite_item_t*       item)
+{
+   int aid = attrs->to_id(attrs, name.c_str());
+   if (aid >= 0) {
+      crfsuite_attribute_t attr;
+      crfsuite_attribute_set(&attr, aid, 1.0);
+      CHECKALLOC(crfsuite_item_append_attribute(item, &attr) == 0);
+   }
+}
+/*-----------< FUNCTION: pos_graphemes >-------------------------------------
+// Purpose:    finds the extended grapheme cluster boundaries in a token
+// Parameters: token  - UTF-8 token string
+//             bounds - return the byte offsets of the grapheme boundaries
+//                      via here, including 0 and the token size
+// Returns:    none
+---------------------------------------------------------------------------*/
+void pos_graphemes (const ErlNifBinary& token, std::vector<int>* bounds)
+{
+   const unsigned char* data = token.data;
+   int size = (int)token.size;
+   bounds->clear();
+   bounds->push_back(0);
+   POS_GCB_STATE state = { POS_GCB_CN, 0, false, false };
+   int pos = 0;
+   while (pos < size) {
+      int length;
+      int cp = pos_decode(data + pos, size - pos, &length);
+      int type = cp >= 0 ? pos_break_type(cp) : POS_GCB_INVALID;
+      if (pos_is_break(&state, type) && pos > 0)
+         bounds->push_back(pos);
+      pos += length;
+   }
+   if (size > 0)
+      bounds->push_back(size);
+}
+/*-----------< FUNCTION: pos_decode >----------------------------------------
+// Purpose:    decodes a UTF-8 code point
+// Parameters: data   - UTF-8 bytes
+//             size   - number of bytes available (> 0)
+//             length - return the encoded length via here
+//                      (1 for an invalid byte)
+// Returns:    the code point, or -1 if the encoding is invalid
+---------------------------------------------------------------------------*/
+int pos_decode (const unsigned char* data, int size, int* length)
+{
+   unsigned char c = data[0];
+   int n, cp, min;
+   if (c < 0x80) {
+      *length = 1;
+      return c;
+   } else if (c >= 0xC2 && c <= 0xDF) {
+      n = 2; cp = c & 0x1F; min = 0x80;
+   } else if (c >= 0xE0 && c <= 0xEF) {
+      n = 3; cp = c & 0x0F; min = 0x800;
+   } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 4; cp = c & 0x07; min = 0x10000;
+   } else {
+      *length = 1;
+      return -1;
+   }
+   *length = 1;
+   if (size < n)
+      return -1;
+   for (int i = 1; i < n; i++) {
+      if ((data[i] & 0xC0) != 0x80)
+         return -1;
+      cp = (cp << 6) | (data[i] & 0x3F);
+   }
+   if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+      return -1;
+   *length = n;
+   return cp;
+}
+/*-----------< FUNCTION: pos_break_type >-----------------------------------
+// Purpose:    classifies a code point for grapheme segmentation
+// Parameters: cp - code point
+// Returns:    the code point's grapheme cluster break class (POS_GCB_*)
+---------------------------------------------------------------------------*/
+int pos_break_type (int cp)
+{
+   // hangul syllables alternate one LV syllable with 27 LVT syllables
+   if (cp >= 0xAC00 && cp <= 0xD7A3)
+      return (cp - 0xAC00) % 28 == 0 ? POS_GCB_LV : POS_GCB_LVT;
+   int lo = 0;
+   int hi = (int)(sizeof(g_gcb_ranges) / sizeof(g_gcb_ranges[0])) - 1;
+   while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      if (cp < g_gcb_ranges[mid].first)
+         hi = mid - 1;
+      else if (cp > g_gcb_ranges[mid].last)
+         lo = mid + 1;
+      else
+         return g_gcb_ranges[mid].type;
+   }
+   return POS_GCB_XX;
+}
+/*-----------< FUNCTION: pos_is_break >--------------------------------------
+// Purpose:    applies the UAX #29 grapheme cluster boundary rules between
+//             the preceding code point and the next one
+// Parameters: state - segmentation state, updated for the next code point
+//             next  - break class of the next code point
+// Returns:    true if a grapheme boundary precedes the next code point,
+//             false otherwise
+---------------------------------------------------------------------------*/
+bool pos_is_break (POS_GCB_STATE* state, int next)
+{
+   int prev = state->prev;
+   bool result;
+   if (prev == POS_GCB_INVALID || next == POS_GCB_INVALID)
+      result = true;
+   else if (prev == POS_GCB_CR && next == POS_GCB_LF)
+      result = false;                                       // GB3
+   else if (prev == POS_GCB_CR || prev == POS_GCB_LF || prev == POS_GCB_CN)
+      result = true;                                        // GB4
+   else if (next == POS_GCB_CR || next == POS_GCB_LF || next == POS_GCB_CN)
+      result = true;                                        // GB5
+   else if (prev == POS_GCB_L && (next == POS_GCB_L || next == POS_GCB_V ||
+                                  next == POS_GCB_LV || next == POS_GCB_LVT))
+      result = false;                                       // GB6
+   else if ((prev == POS_GCB_LV || prev == POS_GCB_V) &&
+            (next == POS_GCB_V || next == POS_GCB_T))
+      result = false;                                       // GB7
+   else if ((prev == POS_GCB_LVT || prev == POS_GCB_T) && next == POS_GCB_T)
+      result = false;                                       // GB8
+   else if (next == POS_GCB_EX || next == POS_GCB_ZWJ || next == POS_GCB_SM)
+      result = false;                                       // GB9, GB9a
+   else if (prev == POS_GCB_PP)
+      result = false;                                       // GB9b
+   else if (prev == POS_GCB_ZWJ && next == POS_GCB_XP && state->joined)
+      result = false;                                       // GB11
+   else if (prev == POS_GCB_RI && next == POS_GCB_RI)
+      result = state->regional % 2 == 0;                    // GB12, GB13
+   else
+      result = true;                                        // GB999
+   // track emoji zwj sequences (XP EX* ZWJ) and regional indicator runs
+   state->joined = next == POS_GCB_ZWJ && state->pictographic;
+   state->pictographic = next == POS_GCB_XP ||
+                         (next == POS_GCB_EX && state->pictographic);
+   state->regional = next == POS_GCB_RI ? state->regional + 1 : 0;
+   state->prev = next;
+   return result;
+}
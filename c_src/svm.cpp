@@ -17,7 +17,7 @@
 /*-------------------[      Library Include Files      ]-------------------*/
 /*-------------------[      Project Include Files      ]-------------------*/
 #include "deps/libsvm/svm.h"
-#include "penelope.hpp"
+#include "job.hpp"
 /*-------------------[      Macros/Constants/Types     ]-------------------*/
 typedef struct svm_problem   SVM_PROBLEM;
 typedef struct svm_model     SVM_MODEL;
@@ -28,6 +28,9 @@ typedef struct svm_parameter SVM_PARAM;
 /*-------------------[        Module Variables         ]-------------------*/
 static ErlNifResourceType* g_model_type = NULL;
 /*-------------------[        Module Prototypes        ]-------------------*/
+static ERL_NIF_TERM svm_train_model (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[]);
 static void erl2svm_problem (ErlNifEnv* env,
    ERL_NIF_TERM x,
    ERL_NIF_TERM y,
@@ -88,7 +91,7 @@ int nif_svm_init (ErlNifEnv* env)
       &flags);
    if (!g_model_type)
       return 0;
-   // suppress libsvm debug output
+   // suppress libsvm debug output, other than job progress
    svm_set_print_string_function(&svm_print);
    return 1;
 }
@@ -112,11 +115,53 @@ ERL_NIF_TERM nif_svm_train (
    if (!enif_is_map(env, argv[2]))
       return enif_make_badarg(env);
    // train the SVM model
+   try {
+      return svm_train_model(env, argv);
+   } catch (NifError& e) {
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_svm_train_async >-------------------------------
+// Purpose:    trains an SVM model on a background job thread
+//             progress is reported as each binary subproblem is solved,
+//             and cancellation takes effect when the solver returns
+// Parameters: x      - list of feature vectors (floats)
+//             y      - list of target labels (integer)
+//             params - map of SVM parameters
+// Returns:    reference to the training job resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_svm_train_async (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   // validate parameters
+   if (!enif_is_list(env, argv[0]))
+      return enif_make_badarg(env);
+   if (!enif_is_list(env, argv[1]))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[2]))
+      return enif_make_badarg(env);
+   // start the training job
+   return nif_job_start(env, argc, argv, &svm_train_model);
+}
+/*-----------< FUNCTION: svm_train_model >-----------------------------------
+// Purpose:    trains an SVM model
+// Parameters: env  - current erlang environment
+//             argv - training arguments (x, y, params)
+// Returns:    reference to a trained SVM model resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM svm_train_model (
+   ErlNifEnv*         env,
+   const ERL_NIF_TERM argv[])
+{
    SVM_PROBLEM problem; memset(&problem, 0, sizeof(SVM_PROBLEM));
    SVM_PARAM   params;  memset(&params, 0, sizeof(SVM_PARAM));
    SVM_MODEL*  model    = NULL;
    SVM_MODEL** resource = NULL;
    ERL_NIF_TERM result;
+   NifError error;
+   bool failed = false;
    try {
       // extract training parameters and feature/target vectors
       erl2svm_problem(env, argv[0], argv[1], &problem);
@@ -125,7 +170,8 @@ ERL_NIF_TERM nif_svm_train (
       if (errors)
          throw NifError(errors);
       // train the model
-      model = svm_train(&problem, &params);
+      model = CHECKALLOC(svm_train(&problem, &params));
+      CHECK(!nif_job_cancelled(), "cancelled");
       // create an erlang resource to wrap the model
       CHECKALLOC(resource = (SVM_MODEL**)enif_alloc_resource(
          g_model_type,
@@ -137,7 +183,8 @@ ERL_NIF_TERM nif_svm_train (
    } catch (NifError& e) {
       if (resource && *resource)
          erl2svm_free_model((SVM_MODEL*)*resource);
-      result = e.to_term(env);
+      error  = e;
+      failed = true;
    }
    // free the model using the libsvm allocator
    if (model != NULL)
@@ -145,6 +192,8 @@ ERL_NIF_TERM nif_svm_train (
    // release the training parameters
    erl2svm_free_problem(&problem);
    erl2svm_free_params(&params);
+   if (failed)
+      throw error;
    return result;
 }
 /*-----------< FUNCTION: nif_svm_export >------------------------------------
@@ -800,9 +849,20 @@ void erl2svm_free_model (SVM_MODEL* model)
 }
 /*-----------< FUNCTION: svm_print >-----------------------------------------
 // Purpose:    libsvm debug output callback
+//             debug output is suppressed, but solver iterations are
+//             reported to the current training job, if any
 // Parameters: message - message to display
 // Returns:    none
 ---------------------------------------------------------------------------*/
 void svm_print (const char* message) {
-   // suppress debug output
+   static thread_local int iteration = 0;
+   if (!nif_job_active())
+      return;
+   // the solver reports the iteration count and objective value at the
+   // end of each binary subproblem
+   double value = 0;
+   if (sscanf(message, "obj = %lf", &value) == 1)
+      nif_job_progress(iteration, value);
+   else
+      sscanf(message, "optimization finished, #iter = %d", &iteration);
 }
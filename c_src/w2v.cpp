@@ -0,0 +1,1451 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v.cpp
+ * PURPOSE: nifs for the memory-mapped word vector store
+ *
+ * A word vector store is a single immutable file, which is mapped
+ * read-only into memory and shared by all scheduler threads. The file
+ * contains the following sections (in native byte order), each aligned to
+ * W2V_ALIGN bytes:
+ * . header:  format version, counts and section offsets
+ * . matrix:  (count + 1 + buckets) x vector_size matrix, one row per
+ *            entry, followed by a zero row for missing terms and any
+ *            subword rows
+ * . codebook: product quantization centroids (pq encoding only)
+ * . entries: term string reference and id per entry, in row order
+ * . terms:   open-addressing (linear probing) hash table of entry
+ *            numbers (entry + 1, 0 if empty), keyed by FNV-1a term hash
+ * . ids:     id -> entry table, sorted by id
+ * . strings: the store name, followed by the entry terms
+ *
+ * Lookups return resource binaries that point directly into the mapping,
+ * so float32 vectors and terms are never copied or decoded. The mapping is
+ * released once the store and all binaries referencing it have been
+ * garbage collected. The matrix may instead be quantized (f16, int8 or
+ * pq, see w2v_quant.cpp), in which case vectors are decoded into new
+ * binaries on lookup, and vector means are accumulated directly from the
+ * quantized rows.
+ *
+ * Stores compiled from fastText models also contain the models' subword
+ * rows, from which vectors are computed for missing terms on lookup, see
+ * w2v_subword.cpp.
+ *
+ * Stores may be indexed for nearest neighbor searches by a separate
+ * similarity graph file, which references the store, see w2v_graph.cpp.
+ *
+ * Stores are built by a writer, which appends each vector to the matrix
+ * as it is inserted, and writes the remaining sections when it is closed.
+ * The header is written last, so an incomplete store is never opened.
+ * A later insert of a term or id replaces any earlier one. Source files in
+ * the word2vec text and binary formats, and fastText models, are compiled
+ * natively, see w2v_compile.cpp.
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "w2v.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+// exact searches and mean batches over at least this many weights (roughly
+// a millisecond of work) are rescheduled onto a dirty CPU scheduler
+#define W2V_DIRTY_WORK (1L << 20)
+// missing term handling, for vector means
+#define W2V_OOV_ZERO 0            // missing terms count as zero vectors
+#define W2V_OOV_SKIP 1            // missing terms are skipped
+#define W2V_OOV_HASH 2            // missing terms are hashed to a bucket
+#define W2V_OOV_SUBWORD 3         // missing terms use their subword vectors
+// vector mean pooling options
+typedef struct tagW2vPooling {
+   int      oov;                  // missing term handling (W2V_OOV_*)
+} W2V_POOLING;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+static ErlNifResourceType* g_writer_type = NULL;
+static ErlNifResourceType* g_store_type = NULL;
+static ErlNifResourceType* g_graph_type = NULL;
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void nif_destruct_writer (
+   ErlNifEnv* env,
+   void*      object);
+static void nif_destruct_store (
+   ErlNifEnv* env,
+   void*      object);
+static ERL_NIF_TERM w2v_mean_batch_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static bool w2v_mean_terms (
+   ErlNifEnv*         env,
+   const W2V_STORE*   store,
+   const W2V_POOLING* pooling,
+   ERL_NIF_TERM       terms,
+   float*             mean);
+static void nif_destruct_graph (
+   ErlNifEnv* env,
+   void*      object);
+static ERL_NIF_TERM w2v_nearest_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[]);
+static void w2v_nearest_source (
+   ErlNifEnv*        env,
+   ERL_NIF_TERM      term,
+   const W2V_STORE** store,
+   const W2V_GRAPH** graph);
+static void w2v_write_finish (
+   W2V_WRITER* writer);
+static void w2v_map (
+   const char* path,
+   W2V_STORE*  store);
+static const W2V_ENTRY* w2v_find_id (
+   const W2V_STORE* store,
+   uint32_t         id);
+static uint64_t w2v_hash (
+   const char* term,
+   size_t      length);
+static void erl2w2v_options (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM options,
+   W2V_WRITER*  writer);
+static bool erl2w2v_pooling (
+   ErlNifEnv*       env,
+   ERL_NIF_TERM     options,
+   const W2V_STORE* store,
+   W2V_POOLING*     pooling);
+static ERL_NIF_TERM w2v2erl_encoding (
+   ErlNifEnv* env,
+   uint32_t   encoding);
+static void erl2w2v_path (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term,
+   char*        path,
+   size_t       size);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: nif_w2v_init >--------------------------------------
+// Purpose:    word vector module initialization
+// Parameters: env - erlang environment
+// Returns:    1 if successful
+//             0 otherwise
+---------------------------------------------------------------------------*/
+int nif_w2v_init (ErlNifEnv* env)
+{
+   // register the store writer resource type
+   ErlNifResourceFlags flags = ERL_NIF_RT_CREATE;
+   g_writer_type = enif_open_resource_type(
+      env,
+      NULL,
+      "w2v_writer",
+      &nif_destruct_writer,
+      flags,
+      &flags);
+   if (!g_writer_type)
+      return 0;
+   // register the memory-mapped store resource type
+   g_store_type = enif_open_resource_type(
+      env,
+      NULL,
+      "w2v_store",
+      &nif_destruct_store,
+      flags,
+      &flags);
+   if (!g_store_type)
+      return 0;
+   // register the similarity graph resource type
+   g_graph_type = enif_open_resource_type(
+      env,
+      NULL,
+      "w2v_graph",
+      &nif_destruct_graph,
+      flags,
+      &flags);
+   if (!g_graph_type)
+      return 0;
+   return 1;
+}
+/*-----------< FUNCTION: nif_w2v_create >------------------------------------
+// Purpose:    creates a new word vector store file, for writing
+// Parameters: path        - path to the store file (string)
+//             name        - store name (string)
+//             vector_size - number of floats per vector (integer)
+//             options     - map of store options
+//                           encoding:  :f32, :f16, :int8 or :pq
+//                           subspaces: number of PQ subspaces
+//                           threads:   number of quantization threads
+// Returns:    reference to the store writer resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_create (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   ErlNifBinary name;
+   unsigned vector_size;
+   // validate parameters
+   if (!enif_inspect_binary(env, argv[1], &name))
+      return enif_make_badarg(env);
+   if (!enif_get_uint(env, argv[2], &vector_size) || vector_size == 0)
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[3]))
+      return enif_make_badarg(env);
+   W2V_WRITER** resource = NULL;
+   try {
+      char path[PATH_MAX + 1];
+      erl2w2v_path(env, argv[0], path, sizeof(path));
+      // create an erlang resource to wrap the writer
+      resource = (W2V_WRITER**)enif_alloc_resource(
+         g_writer_type,
+         sizeof(W2V_WRITER*));
+      CHECKALLOC(resource);
+      *resource = NULL;
+      W2V_WRITER* writer = *resource = new W2V_WRITER();
+      writer->lock = CHECKALLOC(enif_mutex_create((char*)"w2v_writer"));
+      writer->vector_size = vector_size;
+      erl2w2v_options(env, argv[3], writer);
+      writer->name_length = name.size;
+      writer->strings.assign((const char*)name.data, name.size);
+      // reserve the header, which is written when the store is closed
+      writer->file = CHECK(fopen(path, "w+b"), "open_failed");
+      W2V_HEADER header;
+      memset(&header, 0, sizeof(header));
+      uint64_t offset = 0;
+      w2v_write_section(writer->file, &header, sizeof(header), &offset);
+      ERL_NIF_TERM result = enif_make_resource(env, resource);
+      // relinquish the resource to erlang
+      enif_release_resource(resource);
+      return result;
+   } catch (NifError& e) {
+      if (resource)
+         enif_release_resource(resource);
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      if (resource)
+         enif_release_resource(resource);
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_insert >------------------------------------
+// Purpose:    appends a word vector to a store writer
+// Parameters: writer - reference to the store writer
+//             term   - word to insert (string)
+//             id     - term id (positive integer)
+//             vector - word vector (binary float vector)
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_insert (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_WRITER** resource = NULL;
+   ErlNifBinary term;
+   unsigned id;
+   ErlNifBinary vector;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_writer_type, (void**)&resource))
+      return enif_make_badarg(env);
+   W2V_WRITER* writer = *resource;
+   if (!enif_inspect_binary(env, argv[1], &term))
+      return enif_make_badarg(env);
+   if (!enif_get_uint(env, argv[2], &id) || id == 0)
+      return enif_make_badarg(env);
+   if (!enif_inspect_binary(env, argv[3], &vector))
+      return enif_make_badarg(env);
+   if (vector.size != writer->vector_size * sizeof(float))
+      return enif_make_badarg(env);
+   enif_mutex_lock(writer->lock);
+   try {
+      CHECK(writer->file, "writer_closed");
+      w2v_write_entry(
+         writer,
+         (const char*)term.data,
+         term.size,
+         id,
+         (const float*)vector.data);
+      enif_mutex_unlock(writer->lock);
+      return enif_make_atom(env, "ok");
+   } catch (NifError& e) {
+      enif_mutex_unlock(writer->lock);
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      enif_mutex_unlock(writer->lock);
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_close >-------------------------------------
+// Purpose:    writes the remaining sections of a store and closes its file
+// Parameters: writer - reference to the store writer
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_close (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_WRITER** resource = NULL;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_writer_type, (void**)&resource))
+      return enif_make_badarg(env);
+   W2V_WRITER* writer = *resource;
+   enif_mutex_lock(writer->lock);
+   try {
+      CHECK(writer->file, "writer_closed");
+      try {
+         w2v_write_finish(writer);
+      } catch (...) {
+         fclose(writer->file);
+         writer->file = NULL;
+         throw;
+      }
+      int closed = fclose(writer->file);
+      writer->file = NULL;
+      CHECK(closed == 0, "write_failed");
+      enif_mutex_unlock(writer->lock);
+      return enif_make_atom(env, "ok");
+   } catch (NifError& e) {
+      enif_mutex_unlock(writer->lock);
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      enif_mutex_unlock(writer->lock);
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_compile >-----------------------------------
+// Purpose:    appends the word vectors of a source file to a store writer
+//             each vector's id is its 1-based position in the source file
+// Parameters: writer  - reference to the store writer
+//             path    - path to the source file (string)
+//             options - map of compile options
+//                       format:  :text, :binary or :fasttext
+//                       threads: number of text parsing threads
+// Returns:    the number of vectors appended
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_compile (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_WRITER** resource = NULL;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_writer_type, (void**)&resource))
+      return enif_make_badarg(env);
+   W2V_WRITER* writer = *resource;
+   if (!enif_is_map(env, argv[2]))
+      return enif_make_badarg(env);
+   enif_mutex_lock(writer->lock);
+   try {
+      char path[PATH_MAX + 1];
+      erl2w2v_path(env, argv[1], path, sizeof(path));
+      ERL_NIF_TERM value;
+      int format = W2V_FORMAT_TEXT;
+      if (enif_get_map_value(
+            env,
+            argv[2],
+            enif_make_atom(env, "format"),
+            &value)) {
+         if (enif_is_identical(value, enif_make_atom(env, "binary")))
+            format = W2V_FORMAT_BINARY;
+         else if (enif_is_identical(value, enif_make_atom(env, "fasttext")))
+            format = W2V_FORMAT_FASTTEXT;
+         else
+            CHECK(enif_is_identical(value, enif_make_atom(env, "text")),
+               "invalid_format");
+      }
+      int threads = 1;
+      if (enif_get_map_value(
+            env,
+            argv[2],
+            enif_make_atom(env, "threads"),
+            &value))
+         CHECK(enif_get_int(env, value, &threads) && threads > 0,
+            "invalid_threads");
+      CHECK(writer->file, "writer_closed");
+      uint32_t count = w2v_compile(writer, path, format, threads);
+      enif_mutex_unlock(writer->lock);
+      return enif_make_uint(env, count);
+   } catch (NifError& e) {
+      enif_mutex_unlock(writer->lock);
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      enif_mutex_unlock(writer->lock);
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_open >--------------------------------------
+// Purpose:    maps a word vector store file into memory
+// Parameters: path - path to the store file (string)
+// Returns:    reference to the store resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_open (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   try {
+      char path[PATH_MAX + 1];
+      erl2w2v_path(env, argv[0], path, sizeof(path));
+      // create an erlang resource to wrap the mapping
+      store = (W2V_STORE*)enif_alloc_resource(
+         g_store_type,
+         sizeof(W2V_STORE));
+      CHECKALLOC(store);
+      memset(store, 0, sizeof(*store));
+      w2v_map(path, store);
+      ERL_NIF_TERM result = enif_make_resource(env, store);
+      // relinquish the resource to erlang
+      enif_release_resource(store);
+      return result;
+   } catch (NifError& e) {
+      if (store)
+         enif_release_resource(store);
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_info >--------------------------------------
+// Purpose:    retrieves the metadata of a word vector store
+// Parameters: store - reference to the store
+// Returns:    map of store metadata (name, vector_size, count, encoding,
+//             error, subwords)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_info (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   const W2V_HEADER* header = store->header;
+   ERL_NIF_TERM result = enif_make_new_map(env);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "name"),
+      enif_make_resource_binary(
+         env,
+         store,
+         store->strings,
+         header->name_length),
+      &result);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "vector_size"),
+      enif_make_uint(env, header->vector_size),
+      &result);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "count"),
+      enif_make_uint(env, header->id_count),
+      &result);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "encoding"),
+      w2v2erl_encoding(env, header->encoding),
+      &result);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "error"),
+      enif_make_double(env, header->error),
+      &result);
+   enif_make_map_put(
+      env,
+      result,
+      enif_make_atom(env, "subwords"),
+      enif_make_uint(env, header->buckets),
+      &result);
+   return result;
+}
+/*-----------< FUNCTION: nif_w2v_lookup >------------------------------------
+// Purpose:    searches for a term in a word vector store
+// Parameters: store - reference to the store
+//             term  - word to search (string)
+// Returns:    {id, vector} if found
+//             {0, subword vector} otherwise, if the store has subwords
+//             {0, zero vector} otherwise
+//             a float32 vector binary references the store mapping
+//             directly, and a quantized or subword vector is decoded into
+//             a new binary
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_lookup (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   ErlNifBinary term;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   if (!enif_inspect_binary(env, argv[1], &term))
+      return enif_make_badarg(env);
+   const W2V_HEADER* header = store->header;
+   const W2V_ENTRY* entry = w2v_find_term(
+      store,
+      (const char*)term.data,
+      term.size);
+   // missing terms map to the trailing zero row
+   size_t row = entry ? entry - store->entries : header->count;
+   size_t size = header->vector_size * sizeof(float);
+   ERL_NIF_TERM vector;
+   if (header->encoding == W2V_ENCODING_F32 &&
+       (entry || header->buckets == 0))
+      vector = enif_make_resource_binary(
+         env,
+         store,
+         store->matrix + row * store->row_size,
+         size);
+   else {
+      ErlNifBinary decoded;
+      if (!enif_alloc_binary(size, &decoded))
+         return NifError("alloc_failed").to_term(env);
+      memset(decoded.data, 0, size);
+      try {
+         if (entry)
+            w2v_decode_row(store, row, 1, (float*)decoded.data);
+         else
+            w2v_subword_vector(
+               store,
+               (const char*)term.data,
+               term.size,
+               1,
+               (float*)decoded.data);
+      } catch (std::bad_alloc&) {
+         enif_release_binary(&decoded);
+         return NifError("alloc_failed").to_term(env);
+      }
+      vector = enif_make_binary(env, &decoded);
+   }
+   return enif_make_tuple2(
+      env,
+      enif_make_uint(env, entry ? entry->id : 0),
+      vector);
+}
+/*-----------< FUNCTION: nif_w2v_mean_batch >-------------------------------
+// Purpose:    computes the mean vector of each of a list of documents
+//             terms are looked up, their rows accumulated (directly from
+//             quantized rows) and pooled in a single pass per document
+//             large batches are rescheduled onto a dirty CPU scheduler
+// Parameters: store     - reference to the store
+//             documents - list of documents, each a list of words
+//             options   - map of pooling options
+//                         oov:     handling of missing terms
+//                                  :zero - counted as zero vectors
+//                                  :skip - omitted from the mean
+//                                  :hash - replaced by the subword
+//                                          bucket row selected by term
+//                                          hash (the store must have
+//                                          subwords)
+//                                  :subword - replaced by the mean of
+//                                          their subword rows (zeros if
+//                                          the store has no subwords)
+// Returns:    the document means, as a packed row-major matrix, one row
+//             per document (zeros for a document with no terms pooled)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_mean_batch (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   W2V_POOLING pooling;
+   // validate parameters, counting the terms to estimate the work
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   if (!erl2w2v_pooling(env, argv[2], store, &pooling))
+      return enif_make_badarg(env);
+   long terms = 0;
+   ERL_NIF_TERM document;
+   ERL_NIF_TERM documents = argv[1];
+   while (enif_get_list_cell(env, documents, &document, &documents)) {
+      unsigned length;
+      if (!enif_get_list_length(env, document, &length))
+         return enif_make_badarg(env);
+      terms += length;
+   }
+   if (!enif_is_empty_list(env, documents))
+      return enif_make_badarg(env);
+   if (terms * store->header->vector_size < W2V_DIRTY_WORK)
+      return w2v_mean_batch_run(env, argc, argv);
+   return enif_schedule_nif(
+      env,
+      "w2v_mean_batch",
+      ERL_NIF_DIRTY_JOB_CPU_BOUND,
+      &w2v_mean_batch_run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: w2v_mean_batch_run >--------------------------------
+// Purpose:    runs a validated document mean batch
+// Parameters: see nif_w2v_mean_batch
+// Returns:    see nif_w2v_mean_batch
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM w2v_mean_batch_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   W2V_POOLING pooling;
+   unsigned count;
+   enif_get_resource(env, argv[0], g_store_type, (void**)&store);
+   erl2w2v_pooling(env, argv[2], store, &pooling);
+   enif_get_list_length(env, argv[1], &count);
+   uint32_t d = store->header->vector_size;
+   ErlNifBinary matrix;
+   if (!enif_alloc_binary((size_t)count * d * sizeof(float), &matrix))
+      return NifError("alloc_failed").to_term(env);
+   memset(matrix.data, 0, matrix.size);
+   float* mean = (float*)matrix.data;
+   ERL_NIF_TERM document;
+   ERL_NIF_TERM documents = argv[1];
+   try {
+      while (enif_get_list_cell(env, documents, &document, &documents)) {
+         if (!w2v_mean_terms(env, store, &pooling, document, mean)) {
+            enif_release_binary(&matrix);
+            return enif_make_badarg(env);
+         }
+         mean += d;
+      }
+   } catch (std::bad_alloc&) {
+      enif_release_binary(&matrix);
+      return NifError("alloc_failed").to_term(env);
+   }
+   return enif_make_binary(env, &matrix);
+}
+/*-----------< FUNCTION: nif_w2v_fetch >-------------------------------------
+// Purpose:    retrieves a term by its id
+// Parameters: store - reference to the store
+//             id    - term id (integer)
+// Returns:    the term string if found, nil otherwise
+//             the term binary references the store mapping, no copy
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_fetch (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   unsigned id;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   if (!enif_get_uint(env, argv[1], &id))
+      return enif_make_badarg(env);
+   const W2V_ENTRY* entry = w2v_find_id(store, id);
+   if (!entry)
+      return enif_make_atom(env, "nil");
+   return enif_make_resource_binary(
+      env,
+      store,
+      store->strings + entry->term,
+      entry->length);
+}
+/*-----------< FUNCTION: nif_w2v_build_graph >-------------------------------
+// Purpose:    builds the similarity graph of a word vector store, for
+//             nearest neighbor searches
+// Parameters: store   - reference to the store
+//             path    - path to the graph file to create (string)
+//             options - map of graph options
+//                       links:   HNSW links per node (0 for exact search)
+//                       ef:      HNSW construction candidate list size
+//                       threads: number of build threads
+// Returns:    :ok
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_build_graph (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   if (!enif_is_map(env, argv[2]))
+      return enif_make_badarg(env);
+   try {
+      char path[PATH_MAX + 1];
+      erl2w2v_path(env, argv[1], path, sizeof(path));
+      ERL_NIF_TERM value;
+      unsigned links = 0;
+      if (enif_get_map_value(env, argv[2], enif_make_atom(env, "links"),
+            &value))
+         CHECK(enif_get_uint(env, value, &links) && links <= W2V_GRAPH_LINKS,
+            "invalid_links");
+      unsigned ef = 0;
+      if (enif_get_map_value(env, argv[2], enif_make_atom(env, "ef"),
+            &value))
+         CHECK(enif_get_uint(env, value, &ef), "invalid_ef");
+      int threads = 1;
+      if (enif_get_map_value(env, argv[2], enif_make_atom(env, "threads"),
+            &value))
+         CHECK(enif_get_int(env, value, &threads) && threads > 0,
+            "invalid_threads");
+      w2v_graph_build(store, path, links, ef, threads);
+      return enif_make_atom(env, "ok");
+   } catch (NifError& e) {
+      return e.to_term(env);
+   } catch (std::bad_alloc&) {
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_open_graph >--------------------------------
+// Purpose:    maps the similarity graph file of a word vector store
+// Parameters: store - reference to the store
+//             path  - path to the graph file (string)
+// Returns:    reference to the graph resource
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_open_graph (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   W2V_STORE* store = NULL;
+   W2V_GRAPH* graph = NULL;
+   // validate parameters
+   if (!enif_get_resource(env, argv[0], g_store_type, (void**)&store))
+      return enif_make_badarg(env);
+   try {
+      char path[PATH_MAX + 1];
+      erl2w2v_path(env, argv[1], path, sizeof(path));
+      // create an erlang resource to wrap the mapping, which keeps the
+      // store mapped for as long as the graph is referenced
+      graph = (W2V_GRAPH*)enif_alloc_resource(
+         g_graph_type,
+         sizeof(W2V_GRAPH));
+      CHECKALLOC(graph);
+      memset(graph, 0, sizeof(*graph));
+      enif_keep_resource(store);
+      graph->store = store;
+      w2v_graph_map(path, graph);
+      ERL_NIF_TERM result = enif_make_resource(env, graph);
+      // relinquish the resource to erlang
+      enif_release_resource(graph);
+      return result;
+   } catch (NifError& e) {
+      if (graph)
+         enif_release_resource(graph);
+      return e.to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_w2v_nearest >-----------------------------------
+// Purpose:    finds the terms whose vectors are most similar (by cosine
+//             similarity) to a query term or vector
+//             exact searches of large stores are rescheduled onto a dirty
+//             CPU scheduler
+// Parameters: source - reference to the store, or to its graph
+//             query  - a term in the store, whose vector is the query
+//                      (and which is omitted from the results), or
+//                      otherwise a query vector (binary float vector),
+//                      or otherwise a term whose subword vector is the
+//                      query
+//             k      - maximum number of terms to return (integer)
+//             ef     - HNSW search candidate list size (integer)
+// Returns:    list of {term, id, similarity}, most similar first
+//             (empty if the query is neither a term, a vector, nor a
+//             term with subwords)
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM nif_w2v_nearest (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   const W2V_STORE* store = NULL;
+   const W2V_GRAPH* graph = NULL;
+   unsigned k, ef;
+   // validate parameters
+   w2v_nearest_source(env, argv[0], &store, &graph);
+   if (!store)
+      return enif_make_badarg(env);
+   if (!enif_is_binary(env, argv[1]))
+      return enif_make_badarg(env);
+   if (!enif_get_uint(env, argv[2], &k))
+      return enif_make_badarg(env);
+   if (!enif_get_uint(env, argv[3], &ef))
+      return enif_make_badarg(env);
+   const W2V_HEADER* header = store->header;
+   long work = (long)header->count * header->vector_size;
+   if ((graph && graph->header->links > 0) || work < W2V_DIRTY_WORK)
+      return w2v_nearest_run(env, argc, argv);
+   return enif_schedule_nif(
+      env,
+      "w2v_nearest",
+      ERL_NIF_DIRTY_JOB_CPU_BOUND,
+      &w2v_nearest_run,
+      argc,
+      argv);
+}
+/*-----------< FUNCTION: w2v_nearest_run >-----------------------------------
+// Purpose:    runs a validated nearest term search
+// Parameters: see nif_w2v_nearest
+// Returns:    see nif_w2v_nearest
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM w2v_nearest_run (
+   ErlNifEnv*         env,
+   int                argc,
+   const ERL_NIF_TERM argv[])
+{
+   const W2V_STORE* store = NULL;
+   const W2V_GRAPH* graph = NULL;
+   ErlNifBinary query;
+   unsigned k, ef;
+   w2v_nearest_source(env, argv[0], &store, &graph);
+   enif_inspect_binary(env, argv[1], &query);
+   enif_get_uint(env, argv[2], &k);
+   enif_get_uint(env, argv[3], &ef);
+   const W2V_HEADER* header = store->header;
+   try {
+      // resolve the query vector
+      std::vector<float> vector(header->vector_size, 0);
+      const W2V_ENTRY* entry = w2v_find_term(
+         store,
+         (const char*)query.data,
+         query.size);
+      int64_t exclude = -1;
+      if (entry) {
+         exclude = entry - store->entries;
+         w2v_decode_row(store, exclude, 1, vector.data());
+      } else if (query.size == vector.size() * sizeof(float))
+         memcpy(vector.data(), query.data, query.size);
+      else if (!w2v_subword_vector(
+            store,
+            (const char*)query.data,
+            query.size,
+            1,
+            vector.data()))
+         return enif_make_list(env, 0);
+      std::vector<W2V_MATCH> matches;
+      w2v_graph_search(store, graph, vector.data(), k, ef, exclude, &matches);
+      // convert the matches to a list, in order
+      ERL_NIF_TERM result = enif_make_list(env, 0);
+      for (size_t i = matches.size(); i > 0; i--) {
+         const W2V_ENTRY* match = store->entries + matches[i - 1].row;
+         result = enif_make_list_cell(
+            env,
+            enif_make_tuple3(
+               env,
+               enif_make_resource_binary(
+                  env,
+                  (void*)store,
+                  store->strings + match->term,
+                  match->length),
+               enif_make_uint(env, match->id),
+               enif_make_double(env, matches[i - 1].similarity)),
+            result);
+      }
+      return result;
+   } catch (std::bad_alloc&) {
+      return NifError("alloc_failed").to_term(env);
+   }
+}
+/*-----------< FUNCTION: nif_destruct_writer >-------------------------------
+// Purpose:    frees the memory associated with a store writer
+//             an unclosed store file is left without a valid header
+// Parameters: env    - current erlang environment
+//             object - writer resource reference to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_writer (ErlNifEnv* env, void* object)
+{
+   W2V_WRITER* writer = *(W2V_WRITER**)object;
+   if (writer) {
+      if (writer->file)
+         fclose(writer->file);
+      if (writer->source)
+         munmap(writer->source, writer->source_size);
+      if (writer->lock)
+         enif_mutex_destroy(writer->lock);
+      delete writer;
+   }
+}
+/*-----------< FUNCTION: nif_destruct_store >--------------------------------
+// Purpose:    unmaps a word vector store
+// Parameters: env    - current erlang environment
+//             object - store resource reference to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_store (ErlNifEnv* env, void* object)
+{
+   W2V_STORE* store = (W2V_STORE*)object;
+   if (store->base)
+      munmap(store->base, store->size);
+}
+/*-----------< FUNCTION: w2v_mean_terms >------------------------------------
+// Purpose:    computes the mean vector of a list of terms
+// Parameters: env     - current erlang environment
+//             store   - store containing the term vectors
+//             pooling - pooling options
+//             terms   - list of words (strings)
+//             mean    - return the mean vector (zeroed) via here
+// Returns:    true if successful, false if a term is not a string
+---------------------------------------------------------------------------*/
+bool w2v_mean_terms (
+   ErlNifEnv*         env,
+   const W2V_STORE*   store,
+   const W2V_POOLING* pooling,
+   ERL_NIF_TERM       terms,
+   float*             mean)
+{
+   // accumulate the term rows, then scale the sum by the term count
+   uint32_t count = 0;
+   ERL_NIF_TERM head;
+   ErlNifBinary term;
+   while (enif_get_list_cell(env, terms, &head, &terms)) {
+      if (!enif_inspect_binary(env, head, &term))
+         return false;
+      const W2V_ENTRY* entry = w2v_find_term(
+         store,
+         (const char*)term.data,
+         term.size);
+      if (entry)
+         w2v_decode_row(store, entry - store->entries, 1, mean);
+      else if (pooling->oov == W2V_OOV_SKIP)
+         continue;
+      else if (pooling->oov == W2V_OOV_HASH)
+         // the subword rows follow the missing term row
+         w2v_decode_row(
+            store,
+            store->header->count + 1 +
+               w2v_hash((const char*)term.data, term.size) %
+                  store->header->buckets,
+            1,
+            mean);
+      else if (pooling->oov == W2V_OOV_SUBWORD)
+         w2v_subword_vector(
+            store,
+            (const char*)term.data,
+            term.size,
+            1,
+            mean);
+      count++;
+   }
+   if (count > 1)
+      for (uint32_t i = 0; i < store->header->vector_size; i++)
+         mean[i] /= count;
+   return true;
+}
+/*-----------< FUNCTION: nif_destruct_graph >--------------------------------
+// Purpose:    unmaps a similarity graph, and releases its store
+// Parameters: env    - current erlang environment
+//             object - graph resource reference to free
+// Returns:    none
+---------------------------------------------------------------------------*/
+void nif_destruct_graph (ErlNifEnv* env, void* object)
+{
+   W2V_GRAPH* graph = (W2V_GRAPH*)object;
+   if (graph->base)
+      munmap(graph->base, graph->size);
+   if (graph->store)
+      enif_release_resource(graph->store);
+}
+/*-----------< FUNCTION: w2v_nearest_source >--------------------------------
+// Purpose:    retrieves the store and graph to search
+// Parameters: env   - current erlang environment
+//             term  - store or graph reference
+//             store - return the store (NULL if invalid) via here
+//             graph - return the graph (NULL for a store) via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_nearest_source (
+   ErlNifEnv*        env,
+   ERL_NIF_TERM      term,
+   const W2V_STORE** store,
+   const W2V_GRAPH** graph)
+{
+   W2V_STORE* s = NULL;
+   W2V_GRAPH* g = NULL;
+   if (enif_get_resource(env, term, g_graph_type, (void**)&g))
+      s = g->store;
+   else if (!enif_get_resource(env, term, g_store_type, (void**)&s))
+      s = NULL;
+   *store = s;
+   *graph = g;
+}
+/*-----------< FUNCTION: w2v_write_entry >-----------------------------------
+// Purpose:    appends an entry to a store writer
+//             the caller must hold the writer's lock
+// Parameters: writer - store writer to append
+//             term   - entry term
+//             length - term length
+//             id     - entry id (> 0)
+//             vector - entry vector (vector_size floats)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_write_entry (
+   W2V_WRITER*  writer,
+   const char*  term,
+   size_t       length,
+   uint32_t     id,
+   const float* vector)
+{
+   CHECK(writer->entries.size() < UINT32_MAX - 1, "store_full");
+   CHECK(length <= UINT32_MAX, "invalid_term");
+   // append the vector to the matrix and the term to the strings
+   CHECK(
+      fwrite(vector, sizeof(float), writer->vector_size, writer->file) ==
+         writer->vector_size,
+      "write_failed");
+   W2V_ENTRY entry = { writer->strings.size(), (uint32_t)length, id };
+   writer->entries.push_back(entry);
+   writer->strings.append(term, length);
+}
+/*-----------< FUNCTION: w2v_write_finish >----------------------------------
+// Purpose:    writes the trailing sections and header of a store file
+//             the file is positioned at the end of the vector matrix
+// Parameters: writer - store writer to finish
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_write_finish (W2V_WRITER* writer)
+{
+   const std::vector<W2V_ENTRY>& entries = writer->entries;
+   const std::string& strings = writer->strings;
+   uint32_t count = entries.size();
+   W2V_HEADER header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, W2V_MAGIC, sizeof(header.magic));
+   header.version = W2V_VERSION;
+   header.vector_size = writer->vector_size;
+   header.count = count;
+   header.name_length = writer->name_length;
+   header.encoding = writer->encoding;
+   header.subspaces = writer->subspaces;
+   header.buckets = writer->buckets;
+   header.minn = writer->minn;
+   header.maxn = writer->maxn;
+   header.matrix = W2V_ROUND(sizeof(header));
+   // append the zero row for missing terms, followed by the subword rows
+   size_t row_size = writer->vector_size * sizeof(float);
+   std::vector<float> zeros(writer->vector_size, 0);
+   CHECK(fwrite(zeros.data(), row_size, 1, writer->file) == 1,
+      "write_failed");
+   if (writer->buckets > 0)
+      CHECK(
+         fwrite(writer->subwords, row_size, writer->buckets, writer->file) ==
+            writer->buckets,
+         "write_failed");
+   uint64_t offset = header.matrix +
+      ((uint64_t)count + 1 + writer->buckets) * row_size;
+   if (header.encoding == W2V_ENCODING_F32)
+      w2v_write_section(writer->file, NULL, 0, &offset);
+   else
+      w2v_quantize(writer, &header, &offset);
+   header.entries = offset;
+   w2v_write_section(
+      writer->file,
+      entries.data(),
+      entries.size() * sizeof(W2V_ENTRY),
+      &offset);
+   // build the term hash table, with a load factor of at most 1/2
+   // later entries replace earlier ones with the same term
+   header.slots = 2;
+   while (header.slots < 2 * (uint64_t)count)
+      header.slots *= 2;
+   std::vector<uint32_t> terms(header.slots, 0);
+   for (uint32_t i = 0; i < count; i++) {
+      const W2V_ENTRY& entry = entries[i];
+      const char* term = strings.data() + entry.term;
+      uint32_t slot = w2v_hash(term, entry.length) & (header.slots - 1);
+      for ( ; terms[slot]; slot = (slot + 1) & (header.slots - 1)) {
+         const W2V_ENTRY& other = entries[terms[slot] - 1];
+         if (other.length == entry.length &&
+             memcmp(strings.data() + other.term, term, entry.length) == 0)
+            break;
+      }
+      terms[slot] = i + 1;
+   }
+   header.terms = W2V_ROUND(offset);
+   w2v_write_section(
+      writer->file,
+      terms.data(),
+      terms.size() * sizeof(uint32_t),
+      &offset);
+   // build the id table, keeping the last entry for each id
+   std::vector<W2V_ID> ids(count);
+   for (uint32_t i = 0; i < count; i++) {
+      ids[i].id = entries[i].id;
+      ids[i].entry = i;
+   }
+   std::stable_sort(
+      ids.begin(),
+      ids.end(),
+      [](const W2V_ID& a, const W2V_ID& b) { return a.id < b.id; });
+   uint32_t id_count = 0;
+   for (uint32_t i = 0; i < count; i++) {
+      if (id_count > 0 && ids[id_count - 1].id == ids[i].id)
+         id_count--;
+      ids[id_count++] = ids[i];
+   }
+   header.id_count = id_count;
+   header.ids = W2V_ROUND(offset);
+   w2v_write_section(
+      writer->file,
+      ids.data(),
+      id_count * sizeof(W2V_ID),
+      &offset);
+   header.strings = W2V_ROUND(offset);
+   header.string_size = strings.size();
+   w2v_write_section(writer->file, strings.data(), strings.size(), &offset);
+   // discard any float32 rows left past the end of a quantized store
+   CHECK(fflush(writer->file) == 0, "write_failed");
+   CHECK(ftruncate(fileno(writer->file), offset) == 0, "write_failed");
+   // write the header last, to mark the store as complete
+   CHECK(fseeko(writer->file, 0, SEEK_SET) == 0, "write_failed");
+   offset = 0;
+   w2v_write_section(writer->file, &header, sizeof(header), &offset);
+   CHECK(fflush(writer->file) == 0, "write_failed");
+}
+/*-----------< FUNCTION: w2v_write_section >---------------------------------
+// Purpose:    writes a store file section, padded to W2V_ALIGN bytes
+// Parameters: file   - store file to write
+//             data   - section data
+//             size   - section length, in bytes
+//             offset - current file offset, updated on return
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_write_section (
+   FILE*       file,
+   const void* data,
+   size_t      size,
+   uint64_t*   offset)
+{
+   static const char zeros[W2V_ALIGN] = { 0 };
+   if (size > 0)
+      CHECK(fwrite(data, size, 1, file) == 1, "write_failed");
+   size_t padding = W2V_ROUND(*offset + size) - (*offset + size);
+   if (padding > 0)
+      CHECK(fwrite(zeros, padding, 1, file) == 1, "write_failed");
+   *offset = W2V_ROUND(*offset + size);
+}
+/*-----------< FUNCTION: w2v_map >-------------------------------------------
+// Purpose:    maps and validates a store file
+// Parameters: path  - path to the store file
+//             store - return the mapped store via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_map (const char* path, W2V_STORE* store)
+{
+   // map the entire file read-only, shared by all schedulers
+   int fd = open(path, O_RDONLY);
+   CHECK(fd != -1, "open_failed");
+   struct stat info;
+   void* base = MAP_FAILED;
+   if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(W2V_HEADER))
+      base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   CHECK(base != MAP_FAILED, "open_failed");
+   store->base = base;
+   store->size = info.st_size;
+   // word lookups are random, so disable readahead
+   madvise(base, store->size, MADV_RANDOM);
+   // validate the header and section bounds
+   const char* data = (const char*)base;
+   const W2V_HEADER* header = store->header = (const W2V_HEADER*)data;
+   uint64_t size = store->size;
+   uint64_t rows = (uint64_t)header->count + 1 + header->buckets;
+   CHECK(memcmp(header->magic, W2V_MAGIC, sizeof(header->magic)) == 0,
+      "invalid_store");
+   CHECK(header->version == W2V_VERSION, "invalid_version");
+   CHECK(header->vector_size > 0 &&
+      header->slots > header->count &&
+      (header->slots & (header->slots - 1)) == 0 &&
+      header->id_count <= header->count &&
+      header->name_length <= header->string_size,
+      "invalid_store");
+   CHECK(header->encoding <= W2V_ENCODING_PQ, "invalid_store");
+   CHECK(header->buckets == 0 ||
+      (header->maxn > 0 && header->minn <= header->maxn),
+      "invalid_store");
+   CHECK(header->encoding != W2V_ENCODING_PQ ||
+      (header->subspaces > 0 && header->vector_size % header->subspaces == 0),
+      "invalid_store");
+   store->row_size = w2v_row_size(
+      header->encoding,
+      header->vector_size,
+      header->subspaces);
+   CHECK(header->matrix <= size &&
+      rows * store->row_size <= size - header->matrix,
+      "invalid_store");
+   if (header->encoding == W2V_ENCODING_PQ) {
+      uint64_t codebook = (uint64_t)W2V_PQ_CENTROIDS * header->vector_size;
+      CHECK(header->codebook <= size &&
+         codebook * sizeof(float) <= size - header->codebook,
+         "invalid_store");
+      store->codebook = (const float*)(data + header->codebook);
+   }
+   CHECK(header->entries <= size &&
+      header->count * sizeof(W2V_ENTRY) <= size - header->entries,
+      "invalid_store");
+   CHECK(header->terms <= size &&
+      header->slots * sizeof(uint32_t) <= size - header->terms,
+      "invalid_store");
+   CHECK(header->ids <= size &&
+      header->id_count * sizeof(W2V_ID) <= size - header->ids,
+      "invalid_store");
+   CHECK(header->strings <= size &&
+      header->string_size <= size - header->strings,
+      "invalid_store");
+   store->matrix = data + header->matrix;
+   store->entries = (const W2V_ENTRY*)(data + header->entries);
+   store->terms = (const uint32_t*)(data + header->terms);
+   store->ids = (const W2V_ID*)(data + header->ids);
+   store->strings = data + header->strings;
+   // validate the entry term references
+   for (uint32_t i = 0; i < header->count; i++) {
+      const W2V_ENTRY& entry = store->entries[i];
+      CHECK(entry.term <= header->string_size &&
+         entry.length <= header->string_size - entry.term,
+         "invalid_store");
+   }
+}
+/*-----------< FUNCTION: w2v_decode_row >------------------------------------
+// Purpose:    accumulates a scaled, decoded matrix row into a vector
+//             the missing term row decodes to zeros
+// Parameters: store  - store containing the row
+//             row    - matrix row to decode
+//             weight - row scale factor
+//             vector - accumulate the scaled row here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_decode_row (
+   const W2V_STORE* store,
+   size_t           row,
+   float            weight,
+   float*           vector)
+{
+   const W2V_HEADER* header = store->header;
+   const char* data = store->matrix + row * store->row_size;
+   uint32_t d = header->vector_size;
+   if (row == header->count)
+      return;
+   switch (header->encoding) {
+      case W2V_ENCODING_F32: {
+         const float* weights = (const float*)data;
+         for (uint32_t i = 0; i < d; i++)
+            vector[i] += weight * weights[i];
+         break;
+      }
+      case W2V_ENCODING_F16: {
+         const uint16_t* weights = (const uint16_t*)data;
+         for (uint32_t i = 0; i < d; i++)
+            vector[i] += weight * w2v_half_to_float(weights[i]);
+         break;
+      }
+      case W2V_ENCODING_INT8: {
+         const int8_t* weights = (const int8_t*)(data + sizeof(float));
+         float scale = weight * *(const float*)data;
+         for (uint32_t i = 0; i < d; i++)
+            vector[i] += scale * weights[i];
+         break;
+      }
+      case W2V_ENCODING_PQ: {
+         // each code selects a centroid of its subspace's codebook
+         uint32_t D = d / header->subspaces;
+         const uint8_t* codes = (const uint8_t*)data;
+         for (uint32_t s = 0; s < header->subspaces; s++) {
+            const float* centroid = store->codebook +
+               ((size_t)s * W2V_PQ_CENTROIDS + codes[s]) * D;
+            for (uint32_t j = 0; j < D; j++)
+               vector[s * D + j] += weight * centroid[j];
+         }
+         break;
+      }
+   }
+}
+/*-----------< FUNCTION: w2v_find_term >-------------------------------------
+// Purpose:    searches the term hash table of a store
+// Parameters: store  - store to search
+//             term   - term to find
+//             length - term length
+// Returns:    pointer to the term's entry if found, NULL otherwise
+---------------------------------------------------------------------------*/
+const W2V_ENTRY* w2v_find_term (
+   const W2V_STORE* store,
+   const char*      term,
+   size_t           length)
+{
+   const W2V_HEADER* header = store->header;
+   uint32_t mask = header->slots - 1;
+   uint32_t slot = w2v_hash(term, length) & mask;
+   // the load factor is at most 1/2, so the probe always hits an empty slot
+   for (uint32_t i = 0; i < header->slots; i++) {
+      uint32_t e = store->terms[slot];
+      if (e == 0 || e > header->count)
+         return NULL;
+      const W2V_ENTRY* entry = &store->entries[e - 1];
+      if (entry->length == length &&
+          memcmp(store->strings + entry->term, term, length) == 0)
+         return entry;
+      slot = (slot + 1) & mask;
+   }
+   return NULL;
+}
+/*-----------< FUNCTION: w2v_find_id >---------------------------------------
+// Purpose:    searches the id table of a store
+// Parameters: store - store to search
+//             id    - term id to find
+// Returns:    pointer to the id's entry if found, NULL otherwise
+---------------------------------------------------------------------------*/
+const W2V_ENTRY* w2v_find_id (const W2V_STORE* store, uint32_t id)
+{
+   const W2V_HEADER* header = store->header;
+   const W2V_ID* begin = store->ids;
+   const W2V_ID* end = store->ids + header->id_count;
+   const W2V_ID* found = std::lower_bound(
+      begin,
+      end,
+      id,
+      [](const W2V_ID& a, uint32_t b) { return a.id < b; });
+   if (found == end || found->id != id || found->entry >= header->count)
+      return NULL;
+   return &store->entries[found->entry];
+}
+/*-----------< FUNCTION: w2v_hash >------------------------------------------
+// Purpose:    hashes a term (64-bit FNV-1a)
+// Parameters: term   - term to hash
+//             length - term length
+// Returns:    the term hash
+---------------------------------------------------------------------------*/
+uint64_t w2v_hash (const char* term, size_t length)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   for (size_t i = 0; i < length; i++) {
+      hash ^= (unsigned char)term[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+/*-----------< FUNCTION: erl2w2v_options >-----------------------------------
+// Purpose:    retrieves the store options of a writer from an option map
+// Parameters: env     - current erlang environment
+//             options - store option map
+//             writer  - store writer, with its vector size set
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2w2v_options (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM options,
+   W2V_WRITER*  writer)
+{
+   ERL_NIF_TERM value;
+   writer->encoding = W2V_ENCODING_F32;
+   writer->subspaces = 0;
+   writer->threads = 1;
+   if (enif_get_map_value(env, options, enif_make_atom(env, "encoding"),
+         &value)) {
+      static const uint32_t encodings[] = {
+         W2V_ENCODING_F32,
+         W2V_ENCODING_F16,
+         W2V_ENCODING_INT8,
+         W2V_ENCODING_PQ
+      };
+      bool found = false;
+      for (uint32_t encoding : encodings)
+         if (enif_is_identical(value, w2v2erl_encoding(env, encoding))) {
+            writer->encoding = encoding;
+            found = true;
+         }
+      CHECK(found, "invalid_encoding");
+   }
+   // an int8 row (scale + weights) must fit within a float32 row,
+   // so that the matrix can be quantized in place
+   if (writer->encoding == W2V_ENCODING_INT8)
+      CHECK(writer->vector_size > 1, "invalid_encoding");
+   if (writer->encoding == W2V_ENCODING_PQ) {
+      writer->subspaces = writer->vector_size;
+      if (enif_get_map_value(env, options, enif_make_atom(env, "subspaces"),
+            &value))
+         CHECK(enif_get_uint(env, value, &writer->subspaces) &&
+            writer->subspaces > 0 &&
+            writer->vector_size % writer->subspaces == 0,
+            "invalid_subspaces");
+   }
+   if (enif_get_map_value(env, options, enif_make_atom(env, "threads"),
+         &value))
+      CHECK(enif_get_int(env, value, &writer->threads) &&
+         writer->threads > 0,
+         "invalid_threads");
+}
+/*-----------< FUNCTION: erl2w2v_pooling >-----------------------------------
+// Purpose:    retrieves vector mean pooling options from an option map
+// Parameters: env     - current erlang environment
+//             options - pooling option map
+//             store   - store to pool
+//             pooling - return the pooling options via here
+// Returns:    true if the options are valid, false otherwise
+---------------------------------------------------------------------------*/
+bool erl2w2v_pooling (
+   ErlNifEnv*       env,
+   ERL_NIF_TERM     options,
+   const W2V_STORE* store,
+   W2V_POOLING*     pooling)
+{
+   ERL_NIF_TERM value;
+   pooling->oov = W2V_OOV_ZERO;
+   if (!enif_is_map(env, options))
+      return false;
+   if (enif_get_map_value(env, options, enif_make_atom(env, "oov"), &value)) {
+      if (enif_is_identical(value, enif_make_atom(env, "skip")))
+         pooling->oov = W2V_OOV_SKIP;
+      else if (enif_is_identical(value, enif_make_atom(env, "hash")) &&
+               store->header->buckets > 0)
+         pooling->oov = W2V_OOV_HASH;
+      else if (enif_is_identical(value, enif_make_atom(env, "subword")))
+         pooling->oov = W2V_OOV_SUBWORD;
+      else if (!enif_is_identical(value, enif_make_atom(env, "zero")))
+         return false;
+   }
+   return true;
+}
+/*-----------< FUNCTION: w2v2erl_encoding >----------------------------------
+// Purpose:    converts a matrix encoding to an erlang atom
+// Parameters: env      - current erlang environment
+//             encoding - matrix encoding (W2V_ENCODING_*)
+// Returns:    the encoding atom
+---------------------------------------------------------------------------*/
+ERL_NIF_TERM w2v2erl_encoding (ErlNifEnv* env, uint32_t encoding)
+{
+   switch (encoding) {
+      case W2V_ENCODING_F16:
+         return enif_make_atom(env, "f16");
+      case W2V_ENCODING_INT8:
+         return enif_make_atom(env, "int8");
+      case W2V_ENCODING_PQ:
+         return enif_make_atom(env, "pq");
+      default:
+         return enif_make_atom(env, "f32");
+   }
+}
+/*-----------< FUNCTION: erl2w2v_path >--------------------------------------
+// Purpose:    converts an erlang string to a null-terminated file path
+// Parameters: env  - current erlang environment
+//             term - erlang path string
+//             path - return the path via here
+//             size - path buffer size
+// Returns:    none
+---------------------------------------------------------------------------*/
+void erl2w2v_path (
+   ErlNifEnv*   env,
+   ERL_NIF_TERM term,
+   char*        path,
+   size_t       size)
+{
+   ErlNifBinary binary;
+   CHECK(enif_inspect_binary(env, term, &binary), "invalid_path");
+   CHECK(binary.size < size, "invalid_path");
+   CHECK(memchr(binary.data, 0, binary.size) == NULL, "invalid_path");
+   memcpy(path, binary.data, binary.size);
+   path[binary.size] = 0;
+}
@@ -0,0 +1,200 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v.hpp
+ * PURPOSE: shared word vector store nif definitions
+ *
+ ***************************************************************************/
+#ifndef __W2V_HPP
+#define __W2V_HPP
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <stdint.h>
+#include <string>
+#include <vector>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "penelope.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define W2V_MAGIC   "PW2V"
+#define W2V_VERSION 3
+#define W2V_ALIGN   64
+#define W2V_ROUND(x) (((x) + W2V_ALIGN - 1) & ~(uint64_t)(W2V_ALIGN - 1))
+// store file header
+typedef struct tagW2vHeader {
+   char     magic[4];             // W2V_MAGIC
+   uint32_t version;              // W2V_VERSION
+   uint32_t vector_size;          // number of floats per vector
+   uint32_t count;                // number of entries (matrix rows)
+   uint32_t slots;                // term hash table size (power of 2)
+   uint32_t id_count;             // number of unique ids
+   uint32_t name_length;          // store name length, at strings[0]
+   uint32_t encoding;             // vector matrix encoding (W2V_ENCODING_*)
+   uint32_t subspaces;            // product quantization subspaces
+   float    error;                // relative quantization error (RMS)
+   uint32_t buckets;              // number of subword rows (0 if none)
+   uint32_t minn;                 // minimum subword length, in characters
+   uint32_t maxn;                 // maximum subword length, in characters
+   uint32_t reserved;             // (zero)
+   uint64_t matrix;               // vector matrix offset
+   uint64_t codebook;             // product quantization codebook offset
+   uint64_t entries;              // entry table offset
+   uint64_t terms;                // term hash table offset
+   uint64_t ids;                  // id table offset
+   uint64_t strings;              // string table offset
+   uint64_t string_size;          // string table length
+} W2V_HEADER;
+// vector matrix encodings
+#define W2V_ENCODING_F32  0       // float32 weights
+#define W2V_ENCODING_F16  1       // IEEE half precision weights
+#define W2V_ENCODING_INT8 2       // float32 scale, followed by int8 weights
+#define W2V_ENCODING_PQ   3       // product quantization, 1 byte/subspace
+#define W2V_PQ_CENTROIDS  256     // product quantization codebook size
+#define W2V_GRAPH_MAGIC   "PW2G"
+#define W2V_GRAPH_VERSION 1
+#define W2V_GRAPH_LINKS   1024    // maximum HNSW links per upper layer node
+// word vector source file formats
+#define W2V_FORMAT_TEXT     0     // word2vec/GloVe text format
+#define W2V_FORMAT_BINARY   1     // original word2vec binary (.bin) format
+#define W2V_FORMAT_FASTTEXT 2     // fastText binary model (.bin) format
+// store entry, one per matrix row
+typedef struct tagW2vEntry {
+   uint64_t term;                 // term offset, within the string table
+   uint32_t length;               // term length
+   uint32_t id;                   // term id (> 0)
+} W2V_ENTRY;
+// id table record
+typedef struct tagW2vId {
+   uint32_t id;                   // term id
+   uint32_t entry;                // entry number
+} W2V_ID;
+// memory-mapped store
+typedef struct tagW2vStore {
+   void*             base;        // mapping base address
+   size_t            size;        // mapping length
+   const W2V_HEADER* header;      // file header
+   const char*       matrix;      // vector matrix
+   size_t            row_size;    // matrix row size, in bytes
+   const float*      codebook;    // PQ centroids (M x K x D)
+   const W2V_ENTRY*  entries;     // entry table
+   const uint32_t*   terms;       // term hash table
+   const W2V_ID*     ids;         // id table
+   const char*       strings;     // string table
+} W2V_STORE;
+// similarity graph file header
+typedef struct tagW2vGraphHeader {
+   char     magic[4];             // W2V_GRAPH_MAGIC
+   uint32_t version;              // W2V_GRAPH_VERSION
+   uint64_t store_size;           // size of the indexed store file
+   uint32_t count;                // number of store rows
+   uint32_t vector_size;          // store vector size
+   uint32_t links;                // HNSW links per upper layer (0 = exact)
+   uint32_t levels;               // number of HNSW layers
+   uint32_t entry;                // HNSW entry point row
+   uint32_t reserved;             // (zero)
+   uint64_t norms;                // inverse row norm table offset
+   uint64_t nodes;                // node adjacency offset table offset
+   uint64_t adjacency;            // adjacency list table offset
+   uint64_t adjacency_size;       // adjacency list table length (uint32s)
+} W2V_GRAPH_HEADER;
+// memory-mapped similarity graph
+typedef struct tagW2vGraph {
+   W2V_STORE*              store;     // indexed store (resource kept)
+   void*                   base;      // mapping base address
+   size_t                  size;      // mapping length
+   const W2V_GRAPH_HEADER* header;    // file header
+   const float*            norms;     // inverse row norms (0 if not indexed)
+   const uint64_t*         nodes;     // row -> adjacency offset (count + 1)
+   const uint32_t*         adjacency; // adjacency lists
+} W2V_GRAPH;
+// nearest neighbor search result
+typedef struct tagW2vMatch {
+   uint32_t row;                  // matrix row
+   float    similarity;           // cosine similarity to the query
+} W2V_MATCH;
+// store writer
+typedef struct tagW2vWriter {
+   ErlNifMutex*           lock;         // writer mutex
+   FILE*                  file;         // store file (NULL once closed)
+   uint32_t               vector_size;  // number of floats per vector
+   uint32_t               name_length;  // store name length
+   uint32_t               encoding;     // matrix encoding, applied on close
+   uint32_t               subspaces;    // product quantization subspaces
+   int                    threads;      // number of quantization threads
+   std::vector<W2V_ENTRY> entries;      // inserted entries, in row order
+   std::string            strings;      // name + inserted terms
+   void*                  source;       // subword source mapping (or NULL)
+   size_t                 source_size;  // subword source mapping length
+   const char*            subwords;     // float32 subword rows, in source
+   uint32_t               buckets;      // number of subword rows
+   uint32_t               minn;         // minimum subword length
+   uint32_t               maxn;         // maximum subword length
+} W2V_WRITER;
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+void w2v_write_entry (
+   W2V_WRITER*  writer,
+   const char*  term,
+   size_t       length,
+   uint32_t     id,
+   const float* vector);
+void w2v_decode_row (
+   const W2V_STORE* store,
+   size_t           row,
+   float            weight,
+   float*           vector);
+const W2V_ENTRY* w2v_find_term (
+   const W2V_STORE* store,
+   const char*      term,
+   size_t           length);
+void w2v_write_section (
+   FILE*       file,
+   const void* data,
+   size_t      size,
+   uint64_t*   offset);
+size_t w2v_row_size (
+   uint32_t encoding,
+   uint32_t vector_size,
+   uint32_t subspaces);
+void w2v_quantize (
+   W2V_WRITER* writer,
+   W2V_HEADER* header,
+   uint64_t*   offset);
+uint16_t w2v_float_to_half (
+   float value);
+float w2v_half_to_float (
+   uint16_t value);
+void w2v_graph_build (
+   const W2V_STORE* store,
+   const char*      path,
+   uint32_t         links,
+   uint32_t         ef,
+   int              threads);
+void w2v_graph_map (
+   const char* path,
+   W2V_GRAPH*  graph);
+void w2v_graph_search (
+   const W2V_STORE*        store,
+   const W2V_GRAPH*        graph,
+   const float*            query,
+   uint32_t                k,
+   uint32_t                ef,
+   int64_t                 exclude,
+   std::vector<W2V_MATCH>* matches);
+void w2v_subword_buckets (
+   const char*            term,
+   size_t                 length,
+   uint32_t               minn,
+   uint32_t               maxn,
+   uint32_t               buckets,
+   std::vector<uint32_t>* result);
+bool w2v_subword_vector (
+   const W2V_STORE* store,
+   const char*      term,
+   size_t           length,
+   float            weight,
+   float*           vector);
+uint32_t w2v_compile (
+   W2V_WRITER* writer,
+   const char* path,
+   int         format,
+   int         threads);
+#endif // __W2V_HPP
@@ -0,0 +1,759 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v_compile.cpp
+ * PURPOSE: native word vector source file compiler
+ *
+ * Source files are memory-mapped and parsed directly into a store writer.
+ * Each vector's id is its 1-based position within the source file.
+ *
+ * Text files contain one vector per line ("<term> <weight> ..."), which may
+ * be preceded by a "<count> <dimensions>" header line (word2vec). Text is
+ * parsed in contiguous, line-aligned chunks, one per thread. Each thread
+ * first counts the vectors in its chunk, which determines the matrix rows
+ * of every chunk, and then parses its chunk, writing its vectors directly
+ * into their rows of the store file. The terms are appended to the writer
+ * in source order, once all threads have completed. Weights are parsed
+ * with a fast path for up to 19 significant digits and small exponents,
+ * falling back to strtod for anything else.
+ *
+ * Binary files contain a "<count> <dimensions>" header line, followed by
+ * "<term> " and the raw float32 weights (in native byte order) of each
+ * vector. Records can't be located without a sequential scan, and their
+ * weights need no parsing, so binary files are copied on a single thread.
+ *
+ * fastText binary models contain the training arguments, the dictionary
+ * (null-terminated words), and an input matrix of nwords word rows
+ * followed by the subword bucket rows. As in fastText, the vector of each
+ * word is the mean of its word row and the rows of its subwords. The
+ * source file remains mapped by the writer, and its subword rows are
+ * copied into the store when the writer is closed. Quantized and pruned
+ * models are not supported.
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <new>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "w2v.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define W2V_CHUNK_MIN  (1L << 20)  // minimum text chunk size, in bytes
+#define W2V_BATCH_ROWS 1024        // rows written per text chunk write
+#define W2V_FASTTEXT_MAGIC   793712314  // fastText model file signature
+#define W2V_FASTTEXT_VERSION 12         // latest fastText model version
+#define W2V_FASTTEXT_EOS     "</s>"     // fastText end of sentence word
+#define W2V_FASTTEXT_SUP     3          // fastText supervised model type
+// fastText model arguments, as stored in a model file
+typedef struct tagW2vFastTextArgs {
+   int32_t dim;                          // vector size
+   int32_t ws;                           // context window size
+   int32_t epoch;                        // training epochs
+   int32_t min_count;                    // minimum word count
+   int32_t neg;                          // negative samples
+   int32_t word_ngrams;                  // word n-gram length
+   int32_t loss;                         // loss function
+   int32_t model;                        // model type
+   int32_t bucket;                       // number of subword buckets
+   int32_t minn;                         // minimum subword length
+   int32_t maxn;                         // maximum subword length
+   int32_t lr_update_rate;               // learning rate update rate
+   double  t;                            // sampling threshold
+} W2V_FASTTEXT_ARGS;
+// text parsing chunk, a contiguous range of lines parsed by one thread
+typedef struct tagW2vChunk {
+   const char*            base;          // source mapping base address
+   const char*            begin;         // first line of the chunk
+   const char*            end;           // end of the chunk's last line
+   int                    fd;            // store file descriptor
+   uint32_t               vector_size;   // number of floats per vector
+   uint64_t               offset;        // file offset of the chunk's rows
+   uint32_t               count;         // number of vectors in the chunk
+   std::vector<W2V_ENTRY> entries;       // terms (offsets into the source)
+   char                   error[64];     // error code ("" if successful)
+   void (*task)(tagW2vChunk*);           // current chunk task
+   ErlNifTid              tid;           // task thread
+   bool                   threaded;      // running on a separate thread?
+} W2V_CHUNK;
+typedef void (*W2V_CHUNK_TASK)(W2V_CHUNK*);
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+// exactly representable powers of 10, for the fast float parser
+static const double g_pow10[] = {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+/*-------------------[        Module Prototypes        ]-------------------*/
+static uint32_t w2v_compile_text (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size,
+   int         threads);
+static uint32_t w2v_compile_binary (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size);
+static uint32_t w2v_compile_fasttext (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size);
+static void w2v_read_field (
+   const char** p,
+   const char*  end,
+   void*        value,
+   size_t       size);
+static void w2v_run_chunks (
+   std::vector<W2V_CHUNK>& chunks,
+   W2V_CHUNK_TASK          task);
+static void* w2v_chunk_thread (
+   void* arg);
+static void w2v_count_chunk (
+   W2V_CHUNK* chunk);
+static void w2v_parse_chunk (
+   W2V_CHUNK* chunk);
+static bool w2v_next_line (
+   const char** next,
+   const char*  end,
+   const char** line,
+   const char** line_end);
+static bool w2v_parse_header (
+   const char* line,
+   const char* end,
+   uint64_t*   count,
+   uint64_t*   dimensions);
+static const char* w2v_parse_uint (
+   const char* p,
+   const char* end,
+   uint64_t*   value);
+static const char* w2v_parse_float (
+   const char* p,
+   const char* end,
+   float*      value);
+static inline bool w2v_is_space (
+   char c);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: w2v_compile >---------------------------------------
+// Purpose:    appends the word vectors of a source file to a store writer
+//             the caller must hold the writer's lock
+// Parameters: writer  - store writer to append
+//             path    - path to the source file
+//             format  - source file format (W2V_FORMAT_*)
+//             threads - number of text parsing threads
+// Returns:    the number of vectors appended
+---------------------------------------------------------------------------*/
+uint32_t w2v_compile (
+   W2V_WRITER* writer,
+   const char* path,
+   int         format,
+   int         threads)
+{
+   // map the source file, which is read (mostly) sequentially,
+   // except for the subword rows of a fastText model
+   int fd = open(path, O_RDONLY);
+   CHECK(fd != -1, "open_failed");
+   struct stat info;
+   if (fstat(fd, &info) != 0) {
+      close(fd);
+      throw NifError("open_failed");
+   }
+   if (info.st_size == 0) {
+      close(fd);
+      return 0;
+   }
+   void* base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   CHECK(base != MAP_FAILED, "open_failed");
+   madvise(
+      base,
+      info.st_size,
+      format == W2V_FORMAT_FASTTEXT ? MADV_NORMAL : MADV_SEQUENTIAL);
+   try {
+      uint32_t count;
+      if (format == W2V_FORMAT_FASTTEXT)
+         count = w2v_compile_fasttext(
+            writer,
+            (const char*)base,
+            info.st_size);
+      else if (format == W2V_FORMAT_BINARY)
+         count = w2v_compile_binary(writer, (const char*)base, info.st_size);
+      else
+         count = w2v_compile_text(
+            writer,
+            (const char*)base,
+            info.st_size,
+            threads);
+      // the writer retains a fastText model's mapping, for its subwords
+      if (writer->source != base)
+         munmap(base, info.st_size);
+      return count;
+   } catch (...) {
+      munmap(base, info.st_size);
+      throw;
+   }
+}
+/*-----------< FUNCTION: w2v_compile_text >----------------------------------
+// Purpose:    appends the word vectors of a text source file to a writer
+// Parameters: writer  - store writer to append
+//             base    - source file contents
+//             size    - source file length
+//             threads - number of parsing threads
+// Returns:    the number of vectors appended
+---------------------------------------------------------------------------*/
+uint32_t w2v_compile_text (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size,
+   int         threads)
+{
+   const char* end = base + size;
+   const char* data = base;
+   // skip the word2vec header line, if present
+   // a vector line has vector_size + 1 fields, so a header line
+   // can only be identified for vectors of more than 1 dimension
+   const char* next = base;
+   const char* line;
+   const char* line_end;
+   uint64_t count;
+   uint64_t dimensions;
+   if (writer->vector_size > 1 &&
+       w2v_next_line(&next, end, &line, &line_end) &&
+       w2v_parse_header(line, line_end, &count, &dimensions)) {
+      CHECK(dimensions == writer->vector_size, "invalid_vector_size");
+      data = next;
+   }
+   // split the text into line-aligned chunks, one per thread
+   size_t length = end - data;
+   size_t num_chunks = std::max<size_t>(
+      1,
+      std::min<size_t>(threads, length / W2V_CHUNK_MIN));
+   std::vector<W2V_CHUNK> chunks(num_chunks);
+   const char* begin = data;
+   for (size_t c = 0; c < num_chunks; c++) {
+      W2V_CHUNK* chunk = &chunks[c];
+      chunk->base = base;
+      chunk->begin = begin;
+      chunk->end = end;
+      if (c < num_chunks - 1) {
+         const char* split = data + length * (c + 1) / num_chunks;
+         if (split < begin)
+            split = begin;
+         const char* newline = (const char*)memchr(split, '\n', end - split);
+         chunk->end = newline ? newline + 1 : end;
+      }
+      chunk->vector_size = writer->vector_size;
+      chunk->error[0] = 0;
+      begin = chunk->end;
+   }
+   // count the vectors in each chunk, to assign their matrix rows
+   w2v_run_chunks(chunks, &w2v_count_chunk);
+   CHECK(fflush(writer->file) == 0, "write_failed");
+   off_t origin = ftello(writer->file);
+   CHECK(origin != -1, "write_failed");
+   uint64_t row_size = writer->vector_size * sizeof(float);
+   uint64_t total = 0;
+   for (size_t c = 0; c < num_chunks; c++) {
+      chunks[c].fd = fileno(writer->file);
+      chunks[c].offset = origin + total * row_size;
+      total += chunks[c].count;
+   }
+   CHECK(writer->entries.size() + total < UINT32_MAX - 1, "store_full");
+   // parse the chunks into their rows of the store file
+   // on failure, rewind the file to discard any rows already written
+   try {
+      w2v_run_chunks(chunks, &w2v_parse_chunk);
+      for (size_t c = 0; c < num_chunks; c++)
+         CHECK(chunks[c].error[0] == 0, chunks[c].error);
+      CHECK(
+         fseeko(writer->file, origin + total * row_size, SEEK_SET) == 0,
+         "write_failed");
+      // append the chunk terms in source order
+      uint32_t id = 0;
+      writer->entries.reserve(writer->entries.size() + total);
+      for (size_t c = 0; c < num_chunks; c++) {
+         for (const W2V_ENTRY& term : chunks[c].entries) {
+            W2V_ENTRY entry = {
+               writer->strings.size(),
+               term.length,
+               ++id
+            };
+            writer->entries.push_back(entry);
+            writer->strings.append(base + term.term, term.length);
+         }
+      }
+   } catch (...) {
+      fseeko(writer->file, origin, SEEK_SET);
+      throw;
+   }
+   return total;
+}
+/*-----------< FUNCTION: w2v_compile_binary >--------------------------------
+// Purpose:    appends the word vectors of a binary source file to a writer
+// Parameters: writer - store writer to append
+//             base   - source file contents
+//             size   - source file length
+// Returns:    the number of vectors appended
+---------------------------------------------------------------------------*/
+uint32_t w2v_compile_binary (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size)
+{
+   const char* end = base + size;
+   const char* next = base;
+   const char* line;
+   const char* line_end;
+   uint64_t count;
+   uint64_t dimensions;
+   // parse the header line
+   CHECK(w2v_next_line(&next, end, &line, &line_end), "invalid_header");
+   CHECK(w2v_parse_header(line, line_end, &count, &dimensions),
+      "invalid_header");
+   CHECK(dimensions == writer->vector_size, "invalid_vector_size");
+   CHECK(writer->entries.size() + count < UINT32_MAX - 1, "store_full");
+   // copy each record, aligning its weights to the row buffer
+   size_t row_size = writer->vector_size * sizeof(float);
+   std::vector<float> row(writer->vector_size);
+   const char* p = next;
+   for (uint32_t i = 0; i < count; i++) {
+      while (p < end && w2v_is_space(*p))
+         p++;
+      const char* term = p;
+      p = (const char*)memchr(p, ' ', end - p);
+      CHECK(p && p > term, "invalid_record");
+      size_t length = p++ - term;
+      CHECK((size_t)(end - p) >= row_size, "invalid_record");
+      memcpy(row.data(), p, row_size);
+      p += row_size;
+      w2v_write_entry(writer, term, length, i + 1, row.data());
+   }
+   return count;
+}
+/*-----------< FUNCTION: w2v_compile_fasttext >------------------------------
+// Purpose:    appends the word vectors of a fastText model to a writer,
+//             which retains the model's mapping for its subword rows
+// Parameters: writer - store writer to append
+//             base   - source file contents
+//             size   - source file length
+// Returns:    the number of vectors appended
+---------------------------------------------------------------------------*/
+uint32_t w2v_compile_fasttext (
+   W2V_WRITER* writer,
+   const char* base,
+   size_t      size)
+{
+   const char* end = base + size;
+   const char* p = base;
+   // parse the signature and model arguments
+   int32_t magic;
+   int32_t version;
+   W2V_FASTTEXT_ARGS args;
+   w2v_read_field(&p, end, &magic, sizeof(magic));
+   CHECK(magic == W2V_FASTTEXT_MAGIC, "invalid_header");
+   w2v_read_field(&p, end, &version, sizeof(version));
+   CHECK(version > 0 && version <= W2V_FASTTEXT_VERSION, "invalid_version");
+   w2v_read_field(&p, end, &args, sizeof(args));
+   CHECK(args.dim == (int32_t)writer->vector_size, "invalid_vector_size");
+   CHECK(args.bucket >= 0 && args.minn >= 0 && args.maxn >= 0,
+      "invalid_header");
+   // older supervised models did not use subwords
+   if (version < W2V_FASTTEXT_VERSION && args.model == W2V_FASTTEXT_SUP)
+      args.maxn = 0;
+   // parse the dictionary, whose words precede its labels
+   int32_t words;
+   int32_t nwords;
+   int32_t nlabels;
+   int64_t ntokens;
+   int64_t pruned;
+   w2v_read_field(&p, end, &words, sizeof(words));
+   w2v_read_field(&p, end, &nwords, sizeof(nwords));
+   w2v_read_field(&p, end, &nlabels, sizeof(nlabels));
+   w2v_read_field(&p, end, &ntokens, sizeof(ntokens));
+   w2v_read_field(&p, end, &pruned, sizeof(pruned));
+   CHECK(nwords >= 0 && nlabels >= 0 && nwords <= words, "invalid_header");
+   CHECK(pruned <= 0, "unsupported_model");
+   CHECK(writer->entries.size() + nwords < UINT32_MAX - 1, "store_full");
+   bool subwords = args.bucket > 0 && args.maxn > 0 && pruned < 0;
+   CHECK(!subwords || args.minn <= args.maxn, "invalid_header");
+   CHECK(!subwords || writer->buckets == 0, "duplicate_subwords");
+   std::vector<W2V_ENTRY> terms(nwords);
+   for (int32_t i = 0; i < words; i++) {
+      const char* word = p;
+      p = (const char*)memchr(p, 0, end - p);
+      CHECK(p, "invalid_record");
+      size_t length = p++ - word;
+      int64_t count;
+      int8_t type;
+      w2v_read_field(&p, end, &count, sizeof(count));
+      w2v_read_field(&p, end, &type, sizeof(type));
+      if (i < nwords) {
+         terms[i].term = word - base;
+         terms[i].length = length;
+      }
+   }
+   // locate the input matrix, which must not be quantized
+   uint8_t quantized;
+   int64_t rows;
+   int64_t columns;
+   w2v_read_field(&p, end, &quantized, sizeof(quantized));
+   CHECK(!quantized, "unsupported_model");
+   w2v_read_field(&p, end, &rows, sizeof(rows));
+   w2v_read_field(&p, end, &columns, sizeof(columns));
+   CHECK(columns == args.dim && rows == (int64_t)nwords + args.bucket,
+      "invalid_header");
+   size_t row_size = writer->vector_size * sizeof(float);
+   CHECK((uint64_t)(end - p) / row_size >= (uint64_t)rows, "invalid_record");
+   const char* matrix = p;
+   // average each word row with its subword rows, aligning each row
+   // to the row buffer
+   uint32_t d = writer->vector_size;
+   std::vector<float> row(d);
+   std::vector<float> vector(d);
+   std::vector<uint32_t> buckets;
+   for (int32_t i = 0; i < nwords; i++) {
+      const char* term = base + terms[i].term;
+      size_t length = terms[i].length;
+      bool eos = length == strlen(W2V_FASTTEXT_EOS) &&
+         memcmp(term, W2V_FASTTEXT_EOS, length) == 0;
+      buckets.clear();
+      if (subwords && !eos)
+         w2v_subword_buckets(
+            term,
+            length,
+            args.minn,
+            args.maxn,
+            args.bucket,
+            &buckets);
+      memcpy(vector.data(), matrix + (size_t)i * row_size, row_size);
+      for (uint32_t bucket : buckets) {
+         memcpy(
+            row.data(),
+            matrix + ((size_t)nwords + bucket) * row_size,
+            row_size);
+         for (uint32_t j = 0; j < d; j++)
+            vector[j] += row[j];
+      }
+      float scale = 1.0f / (buckets.size() + 1);
+      for (uint32_t j = 0; j < d; j++)
+         vector[j] *= scale;
+      w2v_write_entry(writer, term, length, i + 1, vector.data());
+   }
+   if (subwords) {
+      writer->source = (void*)base;
+      writer->source_size = size;
+      writer->subwords = matrix + (size_t)nwords * row_size;
+      writer->buckets = args.bucket;
+      writer->minn = args.minn;
+      writer->maxn = args.maxn;
+   }
+   return nwords;
+}
+/*-----------< FUNCTION: w2v_read_field >------------------------------------
+// Purpose:    reads a fixed-size field of a binary source file
+// Parameters: p     - current file position, updated on return
+//             end   - end of the file
+//             value - return the field value via here
+//             size  - field size, in bytes
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_read_field (
+   const char** p,
+   const char*  end,
+   void*        value,
+   size_t       size)
+{
+   CHECK((size_t)(end - *p) >= size, "invalid_header");
+   memcpy(value, *p, size);
+   *p += size;
+}
+/*-----------< FUNCTION: w2v_run_chunks >------------------------------------
+// Purpose:    runs a task on each text chunk, in parallel
+//             the first chunk runs on this thread and the rest on new
+//             threads, falling back to this thread if a thread cannot be
+//             created
+// Parameters: chunks - text chunks to process
+//             task   - chunk task to run
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_run_chunks (std::vector<W2V_CHUNK>& chunks, W2V_CHUNK_TASK task)
+{
+   for (size_t c = 0; c < chunks.size(); c++)
+      chunks[c].task = task;
+   for (size_t c = 1; c < chunks.size(); c++) {
+      W2V_CHUNK* chunk = &chunks[c];
+      chunk->threaded = enif_thread_create(
+         (char*)"w2v_compile",
+         &chunk->tid,
+         &w2v_chunk_thread,
+         chunk,
+         NULL) == 0;
+   }
+   w2v_chunk_thread(&chunks[0]);
+   for (size_t c = 1; c < chunks.size(); c++) {
+      W2V_CHUNK* chunk = &chunks[c];
+      if (chunk->threaded)
+         enif_thread_join(chunk->tid, NULL);
+      else
+         w2v_chunk_thread(chunk);
+   }
+}
+/*-----------< FUNCTION: w2v_chunk_thread >----------------------------------
+// Purpose:    chunk task thread entry point
+//             task errors are recorded in the chunk
+// Parameters: arg - the chunk to process
+// Returns:    NULL
+---------------------------------------------------------------------------*/
+void* w2v_chunk_thread (void* arg)
+{
+   W2V_CHUNK* chunk = (W2V_CHUNK*)arg;
+   if (chunk->error[0] == 0) {
+      try {
+         chunk->task(chunk);
+      } catch (NifError& e) {
+         strncpy(chunk->error, e.code(), sizeof(chunk->error) - 1);
+         chunk->error[sizeof(chunk->error) - 1] = 0;
+      } catch (std::bad_alloc&) {
+         strcpy(chunk->error, "alloc_failed");
+      }
+   }
+   return NULL;
+}
+/*-----------< FUNCTION: w2v_count_chunk >-----------------------------------
+// Purpose:    counts the vector lines in a text chunk
+// Parameters: chunk - the chunk to count
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_count_chunk (W2V_CHUNK* chunk)
+{
+   const char* next = chunk->begin;
+   const char* line;
+   const char* line_end;
+   uint64_t count = 0;
+   while (w2v_next_line(&next, chunk->end, &line, &line_end))
+      count++;
+   CHECK(count < UINT32_MAX, "store_full");
+   chunk->count = count;
+}
+/*-----------< FUNCTION: w2v_parse_chunk >-----------------------------------
+// Purpose:    parses the vector lines of a text chunk, writing the vectors
+//             into the chunk's rows of the store file
+// Parameters: chunk - the chunk to parse
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_parse_chunk (W2V_CHUNK* chunk)
+{
+   const char* next = chunk->begin;
+   const char* line;
+   const char* line_end;
+   uint32_t n = chunk->vector_size;
+   size_t row_size = n * sizeof(float);
+   std::vector<float> batch((size_t)W2V_BATCH_ROWS * n);
+   uint64_t offset = chunk->offset;
+   uint32_t rows = 0;
+   chunk->entries.reserve(chunk->count);
+   while (w2v_next_line(&next, chunk->end, &line, &line_end)) {
+      CHECK(chunk->entries.size() < chunk->count, "invalid_record");
+      // parse the term, up to the first space
+      const char* p = (const char*)memchr(line, ' ', line_end - line);
+      CHECK(p && p > line, "invalid_record");
+      W2V_ENTRY entry = {
+         (uint64_t)(line - chunk->base),
+         (uint32_t)(p - line),
+         0
+      };
+      chunk->entries.push_back(entry);
+      // parse the weights, which must fill the row exactly
+      float* row = &batch[(size_t)rows * n];
+      for (uint32_t i = 0; i < n; i++) {
+         while (p < line_end && w2v_is_space(*p))
+            p++;
+         CHECK(p < line_end, "invalid_vector_size");
+         p = CHECK(w2v_parse_float(p, line_end, &row[i]), "invalid_weight");
+         CHECK(p == line_end || w2v_is_space(*p), "invalid_weight");
+      }
+      while (p < line_end && w2v_is_space(*p))
+         p++;
+      CHECK(p == line_end, "invalid_vector_size");
+      // flush full batches to the store file
+      if (++rows == W2V_BATCH_ROWS) {
+         CHECK(
+            pwrite(chunk->fd, batch.data(), rows * row_size, offset) ==
+               (ssize_t)(rows * row_size),
+            "write_failed");
+         offset += rows * row_size;
+         rows = 0;
+      }
+   }
+   if (rows > 0)
+      CHECK(
+         pwrite(chunk->fd, batch.data(), rows * row_size, offset) ==
+            (ssize_t)(rows * row_size),
+         "write_failed");
+   CHECK(chunk->entries.size() == chunk->count, "invalid_record");
+}
+/*-----------< FUNCTION: w2v_next_line >-------------------------------------
+// Purpose:    retrieves the next nonblank text line
+// Parameters: next     - current text position, updated on return
+//             end      - end of the text
+//             line     - return the start of the line via here
+//             line_end - return the end of the line (excluding trailing
+//                        whitespace) via here
+// Returns:    true if a line was found, false at the end of the text
+---------------------------------------------------------------------------*/
+bool w2v_next_line (
+   const char** next,
+   const char*  end,
+   const char** line,
+   const char** line_end)
+{
+   while (*next < end) {
+      const char* start = *next;
+      const char* newline = (const char*)memchr(start, '\n', end - start);
+      const char* stop = newline ? newline : end;
+      *next = newline ? newline + 1 : end;
+      while (stop > start && w2v_is_space(stop[-1]))
+         stop--;
+      if (stop > start) {
+         *line = start;
+         *line_end = stop;
+         return true;
+      }
+   }
+   return false;
+}
+/*-----------< FUNCTION: w2v_parse_header >----------------------------------
+// Purpose:    parses a word2vec header line ("<count> <dimensions>")
+// Parameters: line       - start of the line
+//             end        - end of the line
+//             count      - return the vector count via here
+//             dimensions - return the vector size via here
+// Returns:    true if the line is a header line, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_parse_header (
+   const char* line,
+   const char* end,
+   uint64_t*   count,
+   uint64_t*   dimensions)
+{
+   const char* p = w2v_parse_uint(line, end, count);
+   if (!p || p == end || *p != ' ')
+      return false;
+   while (p < end && *p == ' ')
+      p++;
+   p = w2v_parse_uint(p, end, dimensions);
+   return p == end;
+}
+/*-----------< FUNCTION: w2v_parse_uint >------------------------------------
+// Purpose:    parses an unsigned decimal integer
+// Parameters: p     - start of the integer
+//             end   - end of the text
+//             value - return the parsed value via here
+// Returns:    pointer past the integer if successful, NULL otherwise
+---------------------------------------------------------------------------*/
+const char* w2v_parse_uint (const char* p, const char* end, uint64_t* value)
+{
+   const char* start = p;
+   *value = 0;
+   for ( ; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (*value > (UINT64_MAX - 9) / 10)
+         return NULL;
+      *value = *value * 10 + (*p - '0');
+   }
+   return p > start ? p : NULL;
+}
+/*-----------< FUNCTION: w2v_parse_float >-----------------------------------
+// Purpose:    parses a decimal floating point number
+//             numbers with up to 19 significant digits and a decimal
+//             exponent within +/-22 are computed exactly in double
+//             precision and rounded, others are parsed with strtod
+// Parameters: p     - start of the number
+//             end   - end of the text
+//             value - return the parsed value via here
+// Returns:    pointer past the number if successful, NULL otherwise
+---------------------------------------------------------------------------*/
+const char* w2v_parse_float (const char* p, const char* end, float* value)
+{
+   const char* start = p;
+   bool negative = false;
+   if (p < end && (*p == '-' || *p == '+'))
+      negative = *p++ == '-';
+   // accumulate the significant digits into an integer mantissa
+   uint64_t mantissa = 0;
+   int digits = 0;
+   int exponent = 0;
+   bool valid = false;
+   bool exact = true;
+   for ( ; p < end && *p >= '0' && *p <= '9'; p++) {
+      valid = true;
+      if (digits < 19) {
+         mantissa = mantissa * 10 + (*p - '0');
+         digits += mantissa > 0;
+      } else {
+         exponent++;
+         exact = false;
+      }
+   }
+   if (p < end && *p == '.') {
+      for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+         valid = true;
+         if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa > 0;
+            exponent--;
+         } else
+            exact = false;
+      }
+   }
+   if (valid && p < end && (*p == 'e' || *p == 'E')) {
+      const char* q = p + 1;
+      bool negate = false;
+      if (q < end && (*q == '-' || *q == '+'))
+         negate = *q++ == '-';
+      uint64_t e;
+      q = w2v_parse_uint(q, end, &e);
+      if (q && e < 1000) {
+         exponent += negate ? -(int)e : (int)e;
+         p = q;
+      } else
+         exact = false;
+   }
+   // fast path, exact in double precision
+   if (valid && exact && mantissa < (1ULL << 53) &&
+       exponent >= -22 && exponent <= 22) {
+      double result = (double)mantissa;
+      result = exponent < 0 ?
+         result / g_pow10[-exponent] :
+         result * g_pow10[exponent];
+      *value = (float)(negative ? -result : result);
+      return p;
+   }
+   // slow path, copy the token for strtod
+   char token[128];
+   const char* stop = start;
+   while (stop < end && !w2v_is_space(*stop))
+      stop++;
+   size_t length = stop - start;
+   if (length == 0 || length >= sizeof(token))
+      return NULL;
+   memcpy(token, start, length);
+   token[length] = 0;
+   char* parsed = NULL;
+   double result = strtod(token, &parsed);
+   if (parsed == token)
+      return NULL;
+   *value = (float)result;
+   return start + (parsed - token);
+}
+/*-----------< FUNCTION: w2v_is_space >--------------------------------------
+// Purpose:    checks for a whitespace field separator
+// Parameters: c - character to check
+// Returns:    true if c is whitespace, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_is_space (char c)
+{
+   return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
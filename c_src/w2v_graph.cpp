@@ -0,0 +1,1012 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v_graph.cpp
+ * PURPOSE: nearest neighbor search over word vector stores
+ *
+ * Words are ranked by the cosine similarity of their vectors to a query
+ * vector, either exactly, by scoring every row of the store matrix with
+ * blocked BLAS sgemv calls, or approximately, by searching a hierarchical
+ * navigable small world (HNSW) graph over the rows.
+ *
+ * A similarity graph is built from an existing store, and is saved to its
+ * own immutable file, which is mapped read-only like the store. The file
+ * contains the following sections, each aligned to W2V_ALIGN bytes:
+ * . header:    format version, indexed store shape, HNSW parameters
+ * . norms:     the inverse norm of each matrix row (0 for rows that were
+ *              replaced by a later insert, which are never returned)
+ * . nodes:     row -> adjacency offset (count + 1 entries), HNSW only
+ * . adjacency: each node's neighbor lists, from layer 0 up to its level,
+ *              as a neighbor count followed by a fixed number of slots
+ *              (2M on layer 0, M above)
+ * A graph built with M = 0 contains only the norms, which still speed up
+ * exact searches.
+ *
+ * The graph is built by inserting rows in parallel, roughly in row order.
+ * Each node's neighbor lists are guarded by one of a set of striped locks,
+ * which are only held while a list is copied or updated, and never nested.
+ * Quantized stores are searched by decoding each visited row.
+ *
+ * for abbreviated names:
+ * . d is the vector size
+ * . M is the number of links per upper layer node
+ * . ef is the size of the HNSW dynamic candidate list
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#ifdef __APPLE__
+#  include <Accelerate/Accelerate.h>
+#else
+#  include <cblas.h>
+#endif
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <new>
+#include <unordered_set>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "w2v.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define W2V_GRAPH_LOCKS     4096  // striped node locks
+#define W2V_GRAPH_LEVELS    16    // maximum number of HNSW layers
+#define W2V_GRAPH_BLOCK     1024  // rows scored per exact search block
+#define W2V_GRAPH_BATCH     64    // rows claimed at once by build threads
+// graph under construction, shared by all build threads
+typedef struct tagW2vBuilder {
+   const W2V_STORE*      store;         // indexed store
+   W2V_GRAPH             graph;         // views of the tables below
+   W2V_GRAPH_HEADER      header;        // graph file header
+   std::vector<float>    norms;         // inverse row norms
+   std::vector<uint64_t> nodes;         // row -> adjacency offset
+   std::vector<uint32_t> adjacency;     // adjacency lists
+   uint32_t              ef;            // construction candidate list size
+   uint32_t              next;          // next unclaimed row (atomic)
+   int                   top;           // entry point level (-1 if empty)
+   ErlNifMutex*          lock;          // entry point lock
+   ErlNifMutex*          locks[W2V_GRAPH_LOCKS]; // node locks, by row
+} W2V_BUILDER;
+// search state, one per searching thread
+typedef struct tagW2vSearch {
+   const W2V_STORE*             store;   // searched store
+   const W2V_GRAPH*             graph;   // similarity graph
+   W2V_BUILDER*                 builder; // graph builder (NULL if mapped)
+   std::vector<float>           query;   // normalized query vector
+   std::vector<float>           left;    // decoded row buffer
+   std::vector<float>           right;   // decoded row buffer
+   std::vector<uint32_t>        marks;   // row visit marks (builder only)
+   uint32_t                     mark;    // current visit mark
+   std::unordered_set<uint32_t> visited; // visited rows (queries only)
+   std::vector<W2V_MATCH>       heap;    // candidate heap
+   std::vector<W2V_MATCH>       found;   // layer search results
+   std::vector<uint32_t>        links;   // neighbor list copy
+} W2V_SEARCH;
+// graph build task, run by one thread
+typedef struct tagW2vBuildTask {
+   W2V_BUILDER* builder;                // shared builder
+   void (*run)(W2V_BUILDER*, W2V_SEARCH*); // task function
+   bool         failed;                 // allocation failed?
+   ErlNifTid    tid;                    // task thread
+   bool         threaded;               // running on a separate thread?
+} W2V_BUILD_TASK;
+typedef void (*W2V_BUILD_FN)(W2V_BUILDER*, W2V_SEARCH*);
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void w2v_graph_run (
+   W2V_BUILDER* builder,
+   W2V_BUILD_FN run,
+   int          threads);
+static void* w2v_graph_thread (
+   void* arg);
+static void w2v_graph_norms (
+   W2V_BUILDER* builder,
+   W2V_SEARCH*  search);
+static void w2v_graph_inserts (
+   W2V_BUILDER* builder,
+   W2V_SEARCH*  search);
+static void w2v_graph_insert (
+   W2V_BUILDER* builder,
+   W2V_SEARCH*  search,
+   uint32_t     row);
+static void w2v_graph_link (
+   W2V_BUILDER* builder,
+   W2V_SEARCH*  search,
+   uint32_t     node,
+   uint32_t     row,
+   int          level);
+static void w2v_graph_select (
+   W2V_SEARCH*             search,
+   std::vector<W2V_MATCH>* candidates,
+   uint32_t                max);
+static void w2v_graph_exact (
+   W2V_SEARCH* search,
+   uint32_t    k,
+   int64_t     exclude);
+static uint32_t w2v_graph_greedy (
+   W2V_SEARCH* search,
+   uint32_t    entry,
+   int         top,
+   int         bottom);
+static void w2v_graph_layer (
+   W2V_SEARCH* search,
+   uint32_t    entry,
+   uint32_t    ef,
+   int         level);
+static bool w2v_graph_visit (
+   W2V_SEARCH* search,
+   uint32_t    row);
+static const uint32_t* w2v_graph_neighbors (
+   W2V_SEARCH* search,
+   uint32_t    row,
+   int         level);
+static int w2v_graph_level (
+   const W2V_GRAPH* graph,
+   uint32_t         row);
+static uint32_t* w2v_graph_list (
+   const W2V_GRAPH* graph,
+   uint32_t         row,
+   int              level);
+static float w2v_graph_similarity (
+   W2V_SEARCH* search,
+   uint32_t    row);
+static float w2v_graph_pair (
+   W2V_SEARCH* search,
+   uint32_t    a,
+   uint32_t    b);
+static const float* w2v_graph_row (
+   const W2V_STORE* store,
+   uint32_t         row,
+   float*           buffer);
+static bool w2v_graph_live (
+   const W2V_STORE* store,
+   uint32_t         row);
+static bool w2v_match_less (
+   const W2V_MATCH& a,
+   const W2V_MATCH& b);
+static bool w2v_match_greater (
+   const W2V_MATCH& a,
+   const W2V_MATCH& b);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: w2v_graph_build >-----------------------------------
+// Purpose:    builds the similarity graph of a word vector store, and
+//             saves it to a file
+// Parameters: store   - store to index
+//             path    - path to the graph file to create
+//             links   - HNSW links per upper layer node (M), or 0 to only
+//                       record the row norms for exact search
+//             ef      - HNSW construction candidate list size
+//             threads - number of build threads
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_build (
+   const W2V_STORE* store,
+   const char*      path,
+   uint32_t         links,
+   uint32_t         ef,
+   int              threads)
+{
+   const W2V_HEADER* header = store->header;
+   uint32_t count = header->count;
+   W2V_BUILDER* builder = new W2V_BUILDER();
+   FILE* file = NULL;
+   builder->store = store;
+   builder->ef = std::max(ef, links);
+   builder->top = -1;
+   memset(&builder->header, 0, sizeof(builder->header));
+   memcpy(
+      builder->header.magic,
+      W2V_GRAPH_MAGIC,
+      sizeof(builder->header.magic));
+   builder->header.version = W2V_GRAPH_VERSION;
+   builder->header.store_size = store->size;
+   builder->header.count = count;
+   builder->header.vector_size = header->vector_size;
+   builder->header.links = links;
+   try {
+      builder->lock = CHECKALLOC(enif_mutex_create((char*)"w2v_graph"));
+      for (int i = 0; i < W2V_GRAPH_LOCKS; i++)
+         builder->locks[i] = CHECKALLOC(
+            enif_mutex_create((char*)"w2v_graph_node"));
+      // compute the inverse row norms (zero for replaced rows)
+      builder->norms.resize(count);
+      builder->graph.store = (W2V_STORE*)store;
+      builder->graph.header = &builder->header;
+      builder->graph.norms = builder->norms.data();
+      w2v_graph_run(builder, &w2v_graph_norms, threads);
+      if (links > 0) {
+         // draw each node's level from an exponential distribution, with a
+         // fixed per-row seed, and lay out its neighbor lists
+         double scale = 1.0 / log(std::max<uint32_t>(links, 2));
+         builder->nodes.resize((size_t)count + 1);
+         for (uint32_t row = 0; row < count; row++) {
+            size_t size = 0;
+            if (w2v_graph_live(store, row)) {
+               uint64_t seed = (row + 1) * 0x9E3779B97F4A7C15ull;
+               seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+               seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+               seed ^= seed >> 31;
+               double u = ((seed >> 11) + 0.5) / 9007199254740992.0;
+               int level = std::min<int>(
+                  (int)(-log(u) * scale),
+                  W2V_GRAPH_LEVELS - 1);
+               size = (1 + 2 * links) + (size_t)level * (1 + links);
+               builder->header.levels = std::max<uint32_t>(
+                  builder->header.levels,
+                  level + 1);
+            }
+            builder->nodes[row + 1] = builder->nodes[row] + size;
+         }
+         builder->adjacency.resize(builder->nodes[count]);
+         builder->graph.nodes = builder->nodes.data();
+         builder->graph.adjacency = builder->adjacency.data();
+         builder->header.adjacency_size = builder->adjacency.size();
+         w2v_graph_run(builder, &w2v_graph_inserts, threads);
+         // an empty graph is searched exactly
+         if (builder->top < 0)
+            builder->header.links = 0;
+      }
+      // write the graph sections, followed by the header
+      file = CHECK(fopen(path, "wb"), "open_failed");
+      W2V_GRAPH_HEADER* graph = &builder->header;
+      W2V_GRAPH_HEADER empty;
+      memset(&empty, 0, sizeof(empty));
+      uint64_t offset = 0;
+      w2v_write_section(file, &empty, sizeof(empty), &offset);
+      graph->norms = offset;
+      w2v_write_section(
+         file,
+         builder->norms.data(),
+         builder->norms.size() * sizeof(float),
+         &offset);
+      if (graph->links > 0) {
+         graph->nodes = offset;
+         w2v_write_section(
+            file,
+            builder->nodes.data(),
+            builder->nodes.size() * sizeof(uint64_t),
+            &offset);
+         graph->adjacency = offset;
+         w2v_write_section(
+            file,
+            builder->adjacency.data(),
+            builder->adjacency.size() * sizeof(uint32_t),
+            &offset);
+      }
+      CHECK(fseeko(file, 0, SEEK_SET) == 0, "write_failed");
+      CHECK(fwrite(graph, sizeof(*graph), 1, file) == 1, "write_failed");
+      int closed = fclose(file);
+      file = NULL;
+      CHECK(closed == 0, "write_failed");
+   } catch (...) {
+      if (file) {
+         fclose(file);
+         unlink(path);
+      }
+      for (int i = 0; i < W2V_GRAPH_LOCKS; i++)
+         if (builder->locks[i])
+            enif_mutex_destroy(builder->locks[i]);
+      if (builder->lock)
+         enif_mutex_destroy(builder->lock);
+      delete builder;
+      throw;
+   }
+   for (int i = 0; i < W2V_GRAPH_LOCKS; i++)
+      enif_mutex_destroy(builder->locks[i]);
+   enif_mutex_destroy(builder->lock);
+   delete builder;
+}
+/*-----------< FUNCTION: w2v_graph_map >-------------------------------------
+// Purpose:    maps a similarity graph file into memory
+// Parameters: path  - path to the graph file
+//             graph - graph to map, with its store set
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_map (const char* path, W2V_GRAPH* graph)
+{
+   // map the entire file read-only, shared by all schedulers
+   int fd = open(path, O_RDONLY);
+   CHECK(fd != -1, "open_failed");
+   struct stat info;
+   void* base = MAP_FAILED;
+   if (fstat(fd, &info) == 0 &&
+         info.st_size >= (off_t)sizeof(W2V_GRAPH_HEADER))
+      base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   CHECK(base != MAP_FAILED, "open_failed");
+   graph->base = base;
+   graph->size = info.st_size;
+   // graph searches are random, so disable readahead
+   madvise(base, graph->size, MADV_RANDOM);
+   // validate the header against the store, and the section bounds
+   const char* data = (const char*)base;
+   const W2V_GRAPH_HEADER* header = graph->header =
+      (const W2V_GRAPH_HEADER*)data;
+   const W2V_HEADER* store = graph->store->header;
+   uint64_t size = graph->size;
+   uint64_t count = header->count;
+   uint64_t links = header->links;
+   CHECK(memcmp(header->magic, W2V_GRAPH_MAGIC, sizeof(header->magic)) == 0,
+      "invalid_graph");
+   CHECK(header->version == W2V_GRAPH_VERSION, "invalid_version");
+   CHECK(header->store_size == graph->store->size &&
+      header->count == store->count &&
+      header->vector_size == store->vector_size,
+      "graph_mismatch");
+   CHECK(header->norms <= size &&
+      count * sizeof(float) <= size - header->norms,
+      "invalid_graph");
+   graph->norms = (const float*)(data + header->norms);
+   if (links > 0) {
+      // bound the node list sizes before validating any lists
+      CHECK(links <= W2V_GRAPH_LINKS &&
+         header->levels > 0 && header->levels <= W2V_GRAPH_LEVELS &&
+         header->entry < count,
+         "invalid_graph");
+      CHECK(header->nodes <= size &&
+         (count + 1) * sizeof(uint64_t) <= size - header->nodes,
+         "invalid_graph");
+      CHECK(header->adjacency <= size &&
+         header->adjacency_size * sizeof(uint32_t) <=
+            size - header->adjacency,
+         "invalid_graph");
+      graph->nodes = (const uint64_t*)(data + header->nodes);
+      graph->adjacency = (const uint32_t*)(data + header->adjacency);
+      // every node's lists must lie within the adjacency table, and each
+      // list must be well formed
+      const uint64_t* nodes = graph->nodes;
+      CHECK(nodes[0] == 0 && nodes[count] == header->adjacency_size,
+         "invalid_graph");
+      for (uint64_t row = 0; row < count; row++) {
+         uint64_t length = nodes[row + 1] - nodes[row];
+         CHECK(nodes[row] <= nodes[row + 1], "invalid_graph");
+         if (length == 0)
+            continue;
+         CHECK(length >= 1 + 2 * links &&
+            (length - (1 + 2 * links)) % (1 + links) == 0 &&
+            (length - (1 + 2 * links)) / (1 + links) < header->levels,
+            "invalid_graph");
+         int levels = w2v_graph_level(graph, row) + 1;
+         for (int level = 0; level < levels; level++) {
+            const uint32_t* list = w2v_graph_list(graph, row, level);
+            CHECK(list[0] <= (level == 0 ? 2 : 1) * links,
+               "invalid_graph");
+            for (uint32_t i = 1; i <= list[0]; i++)
+               CHECK(list[i] < count && w2v_graph_level(graph, list[i]) >=
+                  level,
+                  "invalid_graph");
+         }
+      }
+      CHECK(w2v_graph_level(graph, header->entry) ==
+         (int)header->levels - 1,
+         "invalid_graph");
+   }
+}
+/*-----------< FUNCTION: w2v_graph_search >----------------------------------
+// Purpose:    finds the rows most similar to a query vector
+//             searches the HNSW graph, if there is one, or scores every
+//             row otherwise
+// Parameters: store   - store to search
+//             graph   - similarity graph of the store (or NULL)
+//             query   - query vector (vector_size floats)
+//             k       - maximum number of rows to find
+//             ef      - HNSW search candidate list size
+//             exclude - row to omit from the results (or -1)
+//             matches - return the matches, most similar first, via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_search (
+   const W2V_STORE*        store,
+   const W2V_GRAPH*        graph,
+   const float*            query,
+   uint32_t                k,
+   uint32_t                ef,
+   int64_t                 exclude,
+   std::vector<W2V_MATCH>* matches)
+{
+   uint32_t d = store->header->vector_size;
+   W2V_SEARCH search;
+   search.store = store;
+   search.graph = graph;
+   search.builder = NULL;
+   search.mark = 0;
+   search.left.resize(d);
+   search.right.resize(d);
+   // normalize the query, so that row scores are cosine similarities
+   float norm = cblas_snrm2(d, query, 1);
+   search.query.assign(query, query + d);
+   if (norm > 0)
+      cblas_sscal(d, 1 / norm, search.query.data(), 1);
+   matches->clear();
+   if (k == 0 || store->header->count == 0)
+      return;
+   if (!graph || graph->header->links == 0) {
+      w2v_graph_exact(&search, k, exclude);
+      matches->swap(search.heap);
+      return;
+   }
+   // descend greedily to the bottom layer, and search it with a list of
+   // ef candidates, leaving room for the excluded row
+   int top = graph->header->levels - 1;
+   uint32_t entry = w2v_graph_greedy(&search, graph->header->entry, top, 0);
+   w2v_graph_layer(&search, entry, std::max(ef, k) + 1, 0);
+   for (size_t i = 0; i < search.found.size() && matches->size() < k; i++)
+      if ((int64_t)search.found[i].row != exclude)
+         matches->push_back(search.found[i]);
+}
+/*-----------< FUNCTION: w2v_graph_run >-------------------------------------
+// Purpose:    runs a graph build task on each of a set of threads
+//             the first task runs on this thread and the rest on new
+//             threads, falling back to this thread if a thread cannot be
+//             created
+// Parameters: builder - shared graph builder
+//             run     - task function, which claims rows until none remain
+//             threads - number of threads
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_run (W2V_BUILDER* builder, W2V_BUILD_FN run, int threads)
+{
+   std::vector<W2V_BUILD_TASK> tasks(std::max(threads, 1));
+   builder->next = 0;
+   for (size_t t = 0; t < tasks.size(); t++) {
+      W2V_BUILD_TASK* task = &tasks[t];
+      memset(task, 0, sizeof(*task));
+      task->builder = builder;
+      task->run = run;
+   }
+   for (size_t t = 1; t < tasks.size(); t++) {
+      W2V_BUILD_TASK* task = &tasks[t];
+      task->threaded = enif_thread_create(
+         (char*)"w2v_graph",
+         &task->tid,
+         &w2v_graph_thread,
+         task,
+         NULL) == 0;
+   }
+   w2v_graph_thread(&tasks[0]);
+   for (size_t t = 1; t < tasks.size(); t++) {
+      W2V_BUILD_TASK* task = &tasks[t];
+      if (task->threaded)
+         enif_thread_join(task->tid, NULL);
+      else
+         w2v_graph_thread(task);
+   }
+   for (size_t t = 0; t < tasks.size(); t++)
+      CHECK(!tasks[t].failed, "alloc_failed");
+}
+/*-----------< FUNCTION: w2v_graph_thread >----------------------------------
+// Purpose:    graph build thread entry point
+// Parameters: arg - the task to run
+// Returns:    NULL
+---------------------------------------------------------------------------*/
+void* w2v_graph_thread (void* arg)
+{
+   W2V_BUILD_TASK* task = (W2V_BUILD_TASK*)arg;
+   try {
+      W2V_BUILDER* builder = task->builder;
+      uint32_t d = builder->header.vector_size;
+      W2V_SEARCH search;
+      search.store = builder->store;
+      search.graph = &builder->graph;
+      search.builder = builder;
+      search.query.resize(d);
+      search.left.resize(d);
+      search.right.resize(d);
+      search.marks.resize(builder->header.count);
+      search.mark = 0;
+      task->run(builder, &search);
+   } catch (std::bad_alloc&) {
+      task->failed = true;
+   }
+   return NULL;
+}
+/*-----------< FUNCTION: w2v_graph_norms >-----------------------------------
+// Purpose:    computes the inverse norms of batches of rows, until none
+//             remain
+// Parameters: builder - shared graph builder
+//             search  - search state of this thread
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_norms (W2V_BUILDER* builder, W2V_SEARCH* search)
+{
+   uint32_t count = builder->header.count;
+   uint32_t d = builder->header.vector_size;
+   for (;;) {
+      uint32_t begin = __atomic_fetch_add(
+         &builder->next,
+         W2V_GRAPH_BATCH,
+         __ATOMIC_RELAXED);
+      if (begin >= count)
+         break;
+      uint32_t end = std::min<uint32_t>(count - begin, W2V_GRAPH_BATCH) +
+         begin;
+      for (uint32_t row = begin; row < end; row++) {
+         float norm = 0;
+         if (w2v_graph_live(builder->store, row))
+            norm = cblas_snrm2(
+               d,
+               w2v_graph_row(builder->store, row, search->left.data()),
+               1);
+         builder->norms[row] = norm > 0 ? 1 / norm : 0;
+      }
+   }
+}
+/*-----------< FUNCTION: w2v_graph_inserts >---------------------------------
+// Purpose:    inserts batches of rows into the HNSW graph, until none
+//             remain
+// Parameters: builder - shared graph builder
+//             search  - search state of this thread
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_inserts (W2V_BUILDER* builder, W2V_SEARCH* search)
+{
+   uint32_t count = builder->header.count;
+   for (;;) {
+      uint32_t begin = __atomic_fetch_add(
+         &builder->next,
+         W2V_GRAPH_BATCH,
+         __ATOMIC_RELAXED);
+      if (begin >= count)
+         break;
+      uint32_t end = std::min<uint32_t>(count - begin, W2V_GRAPH_BATCH) +
+         begin;
+      for (uint32_t row = begin; row < end; row++)
+         if (w2v_graph_level(&builder->graph, row) >= 0)
+            w2v_graph_insert(builder, search, row);
+   }
+}
+/*-----------< FUNCTION: w2v_graph_insert >----------------------------------
+// Purpose:    inserts a row into the HNSW graph
+// Parameters: builder - shared graph builder
+//             search  - search state of this thread
+//             row     - row to insert
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_insert (W2V_BUILDER* builder, W2V_SEARCH* search, uint32_t row)
+{
+   uint32_t d = builder->header.vector_size;
+   uint32_t links = builder->header.links;
+   int level = w2v_graph_level(&builder->graph, row);
+   // the row's normalized vector is the query
+   const float* vector = w2v_graph_row(
+      builder->store,
+      row,
+      search->left.data());
+   for (uint32_t i = 0; i < d; i++)
+      search->query[i] = vector[i] * builder->norms[row];
+   // a row that raises the graph's top level keeps the entry point locked,
+   // so that it becomes the new entry point once it has been linked
+   enif_mutex_lock(builder->lock);
+   uint32_t entry = builder->header.entry;
+   int top = builder->top;
+   bool raise = level > top;
+   if (top < 0) {
+      builder->header.entry = row;
+      builder->top = level;
+      enif_mutex_unlock(builder->lock);
+      return;
+   }
+   if (!raise)
+      enif_mutex_unlock(builder->lock);
+   try {
+      entry = w2v_graph_greedy(search, entry, top, level);
+      for (int l = std::min(level, top); l >= 0; l--) {
+         w2v_graph_layer(search, entry, builder->ef, l);
+         entry = search->found[0].row;
+         // connect the row to its selected neighbors, in both directions
+         uint32_t max = (l == 0 ? 2 : 1) * links;
+         w2v_graph_select(search, &search->found, max);
+         ErlNifMutex* lock = builder->locks[row % W2V_GRAPH_LOCKS];
+         enif_mutex_lock(lock);
+         uint32_t* list = w2v_graph_list(&builder->graph, row, l);
+         list[0] = 0;
+         for (size_t i = 0; i < search->found.size(); i++)
+            list[++list[0]] = search->found[i].row;
+         enif_mutex_unlock(lock);
+         for (size_t i = 0; i < search->found.size(); i++)
+            w2v_graph_link(builder, search, search->found[i].row, row, l);
+      }
+   } catch (...) {
+      if (raise)
+         enif_mutex_unlock(builder->lock);
+      throw;
+   }
+   if (raise) {
+      builder->header.entry = row;
+      builder->top = level;
+      enif_mutex_unlock(builder->lock);
+   }
+}
+/*-----------< FUNCTION: w2v_graph_link >------------------------------------
+// Purpose:    adds a link to a node's neighbor list, reselecting its
+//             neighbors if the list is full
+// Parameters: builder - shared graph builder
+//             search  - search state of this thread
+//             node    - node to link from
+//             row     - node to link to
+//             level   - layer of the link
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_link (
+   W2V_BUILDER* builder,
+   W2V_SEARCH*  search,
+   uint32_t     node,
+   uint32_t     row,
+   int          level)
+{
+   uint32_t max = (level == 0 ? 2 : 1) * builder->header.links;
+   ErlNifMutex* lock = builder->locks[node % W2V_GRAPH_LOCKS];
+   enif_mutex_lock(lock);
+   uint32_t* list = w2v_graph_list(&builder->graph, node, level);
+   if (list[0] < max)
+      list[++list[0]] = row;
+   else {
+      std::vector<W2V_MATCH>& candidates = search->heap;
+      candidates.clear();
+      for (uint32_t i = 0; i <= list[0]; i++) {
+         W2V_MATCH match;
+         match.row = i < list[0] ? list[i + 1] : row;
+         match.similarity = w2v_graph_pair(search, node, match.row);
+         candidates.push_back(match);
+      }
+      std::sort(candidates.begin(), candidates.end(), &w2v_match_greater);
+      w2v_graph_select(search, &candidates, max);
+      list[0] = 0;
+      for (size_t i = 0; i < candidates.size(); i++)
+         list[++list[0]] = candidates[i].row;
+   }
+   enif_mutex_unlock(lock);
+}
+/*-----------< FUNCTION: w2v_graph_select >----------------------------------
+// Purpose:    selects the neighbors of a node from a list of candidates,
+//             using the HNSW diversity heuristic: a candidate is kept
+//             only if it is more similar to the node than to any
+//             candidate already kept
+// Parameters: search     - search state of this thread
+//             candidates - candidates, most similar first, replaced with
+//                          the selected neighbors
+//             max        - maximum number of neighbors
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_graph_select (
+   W2V_SEARCH*             search,
+   std::vector<W2V_MATCH>* candidates,
+   uint32_t                max)
+{
+   size_t selected = 0;
+   for (size_t i = 0; i < candidates->size() && selected < max; i++) {
+      W2V_MATCH candidate = (*candidates)[i];
+      bool diverse = true;
+      for (size_t j = 0; j < selected && diverse; j++)
+         diverse = w2v_graph_pair(
+            search,
+            candidate.row,
+            (*candidates)[j].row) < candidate.similarity;
+      if (diverse)
+         (*candidates)[selected++] = candidate;
+   }
+   candidates->resize(selected);
+}
+/*-----------< FUNCTION: w2v_graph_exact >-----------------------------------
+// Purpose:    finds the top k rows by scoring every row of the matrix
+//             rows are scored a block at a time, with a single sgemv
+// Parameters: search  - search state, with the normalized query
+//             k       - maximum number of rows to find
+//             exclude - row to omit from the results (or -1)
+// Returns:    none (the matches are returned, most similar first, in
+//             search->heap)
+---------------------------------------------------------------------------*/
+void w2v_graph_exact (W2V_SEARCH* search, uint32_t k, int64_t exclude)
+{
+   const W2V_STORE* store = search->store;
+   const W2V_GRAPH* graph = search->graph;
+   uint32_t count = store->header->count;
+   uint32_t d = store->header->vector_size;
+   bool decode = store->header->encoding != W2V_ENCODING_F32;
+   std::vector<float> block(decode ? (size_t)W2V_GRAPH_BLOCK * d : 0);
+   std::vector<float> scores(W2V_GRAPH_BLOCK);
+   std::vector<W2V_MATCH>& heap = search->heap;
+   heap.clear();
+   for (uint32_t begin = 0; begin < count; begin += W2V_GRAPH_BLOCK) {
+      uint32_t n = std::min<uint32_t>(W2V_GRAPH_BLOCK, count - begin);
+      const float* rows = (const float*)(
+         store->matrix + begin * store->row_size);
+      if (decode) {
+         memset(block.data(), 0, block.size() * sizeof(float));
+         for (uint32_t i = 0; i < n; i++)
+            w2v_decode_row(store, begin + i, 1, &block[(size_t)i * d]);
+         rows = block.data();
+      }
+      cblas_sgemv(
+         CblasRowMajor,
+         CblasNoTrans,
+         n,
+         d,
+         1,
+         rows,
+         d,
+         search->query.data(),
+         1,
+         0,
+         scores.data(),
+         1);
+      // keep the k best rows in a min-heap, checking that a row was not
+      // replaced by a later insert only once it qualifies
+      for (uint32_t i = 0; i < n; i++) {
+         uint32_t row = begin + i;
+         float norm = graph
+            ? graph->norms[row]
+            : cblas_snrm2(d, rows + (size_t)i * d, 1);
+         if (!graph)
+            norm = norm > 0 ? 1 / norm : 0;
+         W2V_MATCH match;
+         match.row = row;
+         match.similarity = scores[i] * norm;
+         if ((int64_t)row == exclude)
+            continue;
+         if (heap.size() == k && !(match.similarity > heap[0].similarity))
+            continue;
+         if (!w2v_graph_live(store, row))
+            continue;
+         if (heap.size() == k) {
+            std::pop_heap(heap.begin(), heap.end(), &w2v_match_greater);
+            heap.pop_back();
+         }
+         heap.push_back(match);
+         std::push_heap(heap.begin(), heap.end(), &w2v_match_greater);
+      }
+   }
+   std::sort_heap(heap.begin(), heap.end(), &w2v_match_greater);
+}
+/*-----------< FUNCTION: w2v_graph_greedy >----------------------------------
+// Purpose:    descends the upper HNSW layers, moving to the neighbor most
+//             similar to the query on each layer, until none is closer
+// Parameters: search - search state, with the normalized query
+//             entry  - node to start from
+//             top    - layer to start from
+//             bottom - layer to stop at (not searched)
+// Returns:    the most similar node found
+---------------------------------------------------------------------------*/
+uint32_t w2v_graph_greedy (
+   W2V_SEARCH* search,
+   uint32_t    entry,
+   int         top,
+   int         bottom)
+{
+   float best = w2v_graph_similarity(search, entry);
+   for (int level = top; level > bottom; level--) {
+      for (bool moved = true; moved; ) {
+         moved = false;
+         const uint32_t* list = w2v_graph_neighbors(search, entry, level);
+         for (uint32_t i = 1; i <= list[0]; i++) {
+            float similarity = w2v_graph_similarity(search, list[i]);
+            if (similarity > best) {
+               best = similarity;
+               entry = list[i];
+               moved = true;
+            }
+         }
+      }
+   }
+   return entry;
+}
+/*-----------< FUNCTION: w2v_graph_layer >-----------------------------------
+// Purpose:    searches one HNSW layer for the nodes most similar to the
+//             query (best-first search with a bounded result list)
+// Parameters: search - search state, with the normalized query
+//             entry  - node to start from
+//             ef     - maximum number of nodes to find
+//             level  - layer to search
+// Returns:    none (the nodes are returned, most similar first, in
+//             search->found)
+---------------------------------------------------------------------------*/
+void w2v_graph_layer (
+   W2V_SEARCH* search,
+   uint32_t    entry,
+   uint32_t    ef,
+   int         level)
+{
+   // candidates to expand (max-heap) and the best nodes found (min-heap)
+   std::vector<W2V_MATCH>& candidates = search->heap;
+   std::vector<W2V_MATCH>& found = search->found;
+   candidates.clear();
+   found.clear();
+   search->visited.clear();
+   search->mark++;
+   if (search->mark == 0) {
+      std::fill(search->marks.begin(), search->marks.end(), 0);
+      search->mark = 1;
+   }
+   W2V_MATCH start;
+   start.row = entry;
+   start.similarity = w2v_graph_similarity(search, entry);
+   w2v_graph_visit(search, entry);
+   candidates.push_back(start);
+   found.push_back(start);
+   while (!candidates.empty()) {
+      W2V_MATCH nearest = candidates[0];
+      if (found.size() >= ef && nearest.similarity < found[0].similarity)
+         break;
+      std::pop_heap(candidates.begin(), candidates.end(), &w2v_match_less);
+      candidates.pop_back();
+      const uint32_t* list = w2v_graph_neighbors(search, nearest.row, level);
+      for (uint32_t i = 1; i <= list[0]; i++) {
+         if (!w2v_graph_visit(search, list[i]))
+            continue;
+         W2V_MATCH match;
+         match.row = list[i];
+         match.similarity = w2v_graph_similarity(search, list[i]);
+         if (found.size() >= ef && !(match.similarity > found[0].similarity))
+            continue;
+         candidates.push_back(match);
+         std::push_heap(candidates.begin(), candidates.end(), &w2v_match_less);
+         found.push_back(match);
+         std::push_heap(found.begin(), found.end(), &w2v_match_greater);
+         if (found.size() > ef) {
+            std::pop_heap(found.begin(), found.end(), &w2v_match_greater);
+            found.pop_back();
+         }
+      }
+   }
+   std::sort_heap(found.begin(), found.end(), &w2v_match_greater);
+}
+/*-----------< FUNCTION: w2v_graph_visit >-----------------------------------
+// Purpose:    marks a row visited by the current layer search
+// Parameters: search - search state
+//             row    - row to visit
+// Returns:    true if the row was not yet visited, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_graph_visit (W2V_SEARCH* search, uint32_t row)
+{
+   // builds search the whole graph repeatedly, so they mark rows in a
+   // dense table, while queries only touch a few rows
+   if (search->builder) {
+      if (search->marks[row] == search->mark)
+         return false;
+      search->marks[row] = search->mark;
+      return true;
+   }
+   return search->visited.insert(row).second;
+}
+/*-----------< FUNCTION: w2v_graph_neighbors >-------------------------------
+// Purpose:    retrieves a node's neighbor list on a layer
+//             while building, the list is copied under the node's lock
+// Parameters: search - search state
+//             row    - node to query
+//             level  - layer of the list
+// Returns:    the neighbor list (count, followed by the neighbors)
+---------------------------------------------------------------------------*/
+const uint32_t* w2v_graph_neighbors (
+   W2V_SEARCH* search,
+   uint32_t    row,
+   int         level)
+{
+   const uint32_t* list = w2v_graph_list(search->graph, row, level);
+   if (!search->builder)
+      return list;
+   ErlNifMutex* lock = search->builder->locks[row % W2V_GRAPH_LOCKS];
+   enif_mutex_lock(lock);
+   search->links.assign(list, list + 1 + list[0]);
+   enif_mutex_unlock(lock);
+   return search->links.data();
+}
+/*-----------< FUNCTION: w2v_graph_level >-----------------------------------
+// Purpose:    retrieves the top layer of a node
+// Parameters: graph - similarity graph
+//             row   - node to query
+// Returns:    the node's level, or -1 if the row is not in the graph
+---------------------------------------------------------------------------*/
+int w2v_graph_level (const W2V_GRAPH* graph, uint32_t row)
+{
+   uint64_t links = graph->header->links;
+   uint64_t length = graph->nodes[row + 1] - graph->nodes[row];
+   if (length == 0)
+      return -1;
+   return (length - (1 + 2 * links)) / (1 + links);
+}
+/*-----------< FUNCTION: w2v_graph_list >------------------------------------
+// Purpose:    locates a node's neighbor list on a layer
+// Parameters: graph - similarity graph
+//             row   - node to query
+//             level - layer of the list (<= the node's level)
+// Returns:    the neighbor list (count, followed by the neighbor slots)
+---------------------------------------------------------------------------*/
+uint32_t* w2v_graph_list (const W2V_GRAPH* graph, uint32_t row, int level)
+{
+   uint64_t links = graph->header->links;
+   uint64_t offset = graph->nodes[row];
+   if (level > 0)
+      offset += (1 + 2 * links) + (uint64_t)(level - 1) * (1 + links);
+   return (uint32_t*)graph->adjacency + offset;
+}
+/*-----------< FUNCTION: w2v_graph_similarity >------------------------------
+// Purpose:    computes the cosine similarity of a row to the query
+// Parameters: search - search state, with the normalized query
+//             row    - row to score
+// Returns:    the similarity
+---------------------------------------------------------------------------*/
+float w2v_graph_similarity (W2V_SEARCH* search, uint32_t row)
+{
+   const W2V_STORE* store = search->store;
+   return search->graph->norms[row] * cblas_sdot(
+      store->header->vector_size,
+      search->query.data(),
+      1,
+      w2v_graph_row(store, row, search->left.data()),
+      1);
+}
+/*-----------< FUNCTION: w2v_graph_pair >------------------------------------
+// Purpose:    computes the cosine similarity of two rows
+// Parameters: search - search state
+//             a      - first row
+//             b      - second row
+// Returns:    the similarity
+---------------------------------------------------------------------------*/
+float w2v_graph_pair (W2V_SEARCH* search, uint32_t a, uint32_t b)
+{
+   const W2V_STORE* store = search->store;
+   const float* norms = search->graph->norms;
+   return norms[a] * norms[b] * cblas_sdot(
+      store->header->vector_size,
+      w2v_graph_row(store, a, search->left.data()),
+      1,
+      w2v_graph_row(store, b, search->right.data()),
+      1);
+}
+/*-----------< FUNCTION: w2v_graph_row >-------------------------------------
+// Purpose:    retrieves a matrix row as floats
+// Parameters: store  - store containing the row
+//             row    - matrix row
+//             buffer - decode a quantized row here (vector_size floats)
+// Returns:    the row's weights
+---------------------------------------------------------------------------*/
+const float* w2v_graph_row (
+   const W2V_STORE* store,
+   uint32_t         row,
+   float*           buffer)
+{
+   if (store->header->encoding == W2V_ENCODING_F32)
+      return (const float*)(store->matrix + row * store->row_size);
+   memset(buffer, 0, store->header->vector_size * sizeof(float));
+   w2v_decode_row(store, row, 1, buffer);
+   return buffer;
+}
+/*-----------< FUNCTION: w2v_graph_live >------------------------------------
+// Purpose:    determines whether a row is still reachable by its term
+// Parameters: store - store containing the row
+//             row   - matrix row
+// Returns:    false if the row's term was replaced by a later insert,
+//             true otherwise
+---------------------------------------------------------------------------*/
+bool w2v_graph_live (const W2V_STORE* store, uint32_t row)
+{
+   const W2V_ENTRY* entry = store->entries + row;
+   return w2v_find_term(
+      store,
+      store->strings + entry->term,
+      entry->length) == entry;
+}
+/*-----------< FUNCTION: w2v_match_less >------------------------------------
+// Purpose:    orders matches by similarity, for max-heaps
+// Parameters: a - first match
+//             b - second match
+// Returns:    true if a is less similar than b, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_match_less (const W2V_MATCH& a, const W2V_MATCH& b)
+{
+   return a.similarity < b.similarity;
+}
+/*-----------< FUNCTION: w2v_match_greater >---------------------------------
+// Purpose:    orders matches by descending similarity, for min-heaps and
+//             sorted results
+// Parameters: a - first match
+//             b - second match
+// Returns:    true if a is more similar than b, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_match_greater (const W2V_MATCH& a, const W2V_MATCH& b)
+{
+   return a.similarity > b.similarity;
+}
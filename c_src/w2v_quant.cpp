@@ -0,0 +1,533 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v_quant.cpp
+ * PURPOSE: word vector store matrix quantization
+ *
+ * A store's vectors are appended to its matrix as float32 rows, and are
+ * quantized when the store is closed, if another encoding was requested:
+ * . f16:  each weight is rounded to IEEE half precision (2x smaller)
+ * . int8: each vector is scaled by max|x| / 127 and its weights rounded to
+ *         int8, with the float32 scale stored ahead of the weights
+ *         (~4x smaller)
+ * . pq:   product quantization, where the vector is split into M
+ *         subvectors, each replaced by the 1-byte index of its nearest
+ *         centroid in the subspace's K-entry codebook (4D x smaller)
+ *
+ * Quantized rows are never larger than float32 rows, so the matrix
+ * (including any subword rows) is quantized in place, one block of rows at
+ * a time. Each block is read,
+ * quantized in parallel, and written back over the (already read) start
+ * of the matrix. PQ codebooks are trained with per-subspace k-means over
+ * an evenly spaced sample of the vectors, in parallel by subspace.
+ *
+ * The RMS quantization error, relative to the RMS vector norm, is measured
+ * while quantizing and recorded in the store header.
+ *
+ * for abbreviated names:
+ * . d is the vector size
+ * . M is the number of PQ subspaces
+ * . D is the PQ subspace size (d / M)
+ * . K is the PQ codebook size (W2V_PQ_CENTROIDS)
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "w2v.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define W2V_BLOCK_ROWS     16384  // rows quantized per block
+#define W2V_PQ_SAMPLE      32768  // maximum codebook training sample size
+#define W2V_PQ_ITERATIONS  16     // k-means iterations per subspace
+// quantizer state, shared by all quantization tasks
+typedef struct tagW2vQuantizer {
+   uint32_t     encoding;         // matrix encoding (W2V_ENCODING_*)
+   uint32_t     d;                // vector size
+   uint32_t     M;                // number of PQ subspaces
+   uint32_t     D;                // PQ subspace size
+   size_t       row_size;         // quantized row size, in bytes
+   const float* input;            // float32 rows (block or sample)
+   size_t       samples;          // number of codebook training samples
+   char*        output;           // quantized rows
+   float*       codebook;         // M x K x D PQ centroids
+} W2V_QUANTIZER;
+// quantization task, a range of rows or subspaces processed by one thread
+typedef struct tagW2vTask {
+   const W2V_QUANTIZER* quantizer;     // shared quantizer state
+   void (*run)(tagW2vTask*);           // task function
+   size_t               begin;         // first row/subspace
+   size_t               end;           // last row/subspace (exclusive)
+   double               error;         // squared quantization error sum
+   double               norm;          // squared vector norm sum
+   bool                 failed;        // allocation failed?
+   ErlNifTid            tid;           // task thread
+   bool                 threaded;      // running on a separate thread?
+} W2V_TASK;
+typedef void (*W2V_TASK_FN)(W2V_TASK*);
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static void w2v_run_tasks (
+   const W2V_QUANTIZER* quantizer,
+   W2V_TASK_FN          run,
+   size_t               count,
+   int                  threads,
+   double*              error,
+   double*              norm);
+static void* w2v_task_thread (
+   void* arg);
+static void w2v_encode_rows (
+   W2V_TASK* task);
+static void w2v_train_subspaces (
+   W2V_TASK* task);
+static int w2v_nearest (
+   const float* centroids,
+   const float* x,
+   uint32_t     D,
+   float*       distance);
+static void w2v_pread (
+   int      fd,
+   void*    data,
+   size_t   size,
+   uint64_t offset);
+static void w2v_pwrite (
+   int         fd,
+   const void* data,
+   size_t      size,
+   uint64_t    offset);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: w2v_row_size >--------------------------------------
+// Purpose:    calculates the size of an encoded matrix row
+// Parameters: encoding    - matrix encoding (W2V_ENCODING_*)
+//             vector_size - number of floats per vector
+//             subspaces   - number of PQ subspaces
+// Returns:    the row size, in bytes
+---------------------------------------------------------------------------*/
+size_t w2v_row_size (
+   uint32_t encoding,
+   uint32_t vector_size,
+   uint32_t subspaces)
+{
+   switch (encoding) {
+      case W2V_ENCODING_F16:
+         return vector_size * sizeof(uint16_t);
+      case W2V_ENCODING_INT8:
+         return (sizeof(float) + vector_size + 3) & ~(size_t)3;
+      case W2V_ENCODING_PQ:
+         return subspaces;
+      default:
+         return vector_size * sizeof(float);
+   }
+}
+/*-----------< FUNCTION: w2v_quantize >--------------------------------------
+// Purpose:    quantizes the float32 matrix of a store writer in place
+//             the file must contain count + 1 + buckets float32 rows at
+//             header->matrix (the entries, the missing term row and the
+//             subword rows)
+// Parameters: writer - store writer to quantize
+//             header - store header, with the matrix offset and encoding
+//                      the codebook offset and error are set on return
+//             offset - return the file offset past the quantized matrix
+//                      (and codebook) via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_quantize (
+   W2V_WRITER* writer,
+   W2V_HEADER* header,
+   uint64_t*   offset)
+{
+   size_t count = writer->entries.size();
+   size_t rows = count + 1 + header->buckets;
+   W2V_QUANTIZER quantizer;
+   memset(&quantizer, 0, sizeof(quantizer));
+   quantizer.encoding = header->encoding;
+   quantizer.d = header->vector_size;
+   quantizer.M = header->subspaces;
+   quantizer.D = quantizer.M > 0 ? quantizer.d / quantizer.M : 0;
+   quantizer.row_size = w2v_row_size(
+      header->encoding,
+      header->vector_size,
+      header->subspaces);
+   uint32_t d = quantizer.d;
+   size_t row_size = quantizer.row_size;
+   CHECK(fflush(writer->file) == 0, "write_failed");
+   int fd = fileno(writer->file);
+   // train the PQ codebooks on an evenly spaced sample of the vectors
+   std::vector<float> codebook;
+   if (header->encoding == W2V_ENCODING_PQ) {
+      size_t samples = std::min<size_t>(count, W2V_PQ_SAMPLE);
+      std::vector<float> sample(samples * d);
+      for (size_t i = 0; i < samples; i++)
+         w2v_pread(
+            fd,
+            &sample[i * d],
+            d * sizeof(float),
+            header->matrix + (i * count / samples) * d * sizeof(float));
+      codebook.resize((size_t)quantizer.M * W2V_PQ_CENTROIDS * quantizer.D);
+      quantizer.input = sample.data();
+      quantizer.samples = samples;
+      quantizer.codebook = codebook.data();
+      double unused;
+      w2v_run_tasks(
+         &quantizer,
+         &w2v_train_subspaces,
+         quantizer.M,
+         writer->threads,
+         &unused,
+         &unused);
+   }
+   // quantize the matrix in place, one block of rows at a time
+   std::vector<float> input((size_t)W2V_BLOCK_ROWS * d);
+   std::vector<char> output((size_t)W2V_BLOCK_ROWS * row_size);
+   quantizer.input = input.data();
+   quantizer.output = output.data();
+   double error = 0;
+   double norm = 0;
+   for (size_t start = 0; start < rows; start += W2V_BLOCK_ROWS) {
+      size_t n = std::min<size_t>(W2V_BLOCK_ROWS, rows - start);
+      w2v_pread(
+         fd,
+         input.data(),
+         n * d * sizeof(float),
+         header->matrix + start * d * sizeof(float));
+      w2v_run_tasks(
+         &quantizer,
+         &w2v_encode_rows,
+         n,
+         writer->threads,
+         &error,
+         &norm);
+      w2v_pwrite(
+         fd,
+         output.data(),
+         n * row_size,
+         header->matrix + start * row_size);
+   }
+   // clear the (never decoded) missing term row, and write the codebook
+   std::vector<char> zeros(row_size, 0);
+   w2v_pwrite(fd, zeros.data(), row_size, header->matrix + count * row_size);
+   *offset = W2V_ROUND(header->matrix + rows * row_size);
+   if (header->encoding == W2V_ENCODING_PQ) {
+      header->codebook = *offset;
+      w2v_pwrite(
+         fd,
+         codebook.data(),
+         codebook.size() * sizeof(float),
+         header->codebook);
+      *offset = W2V_ROUND(*offset + codebook.size() * sizeof(float));
+   }
+   header->error = norm > 0 ? sqrt(error / norm) : 0;
+   CHECK(fseeko(writer->file, *offset, SEEK_SET) == 0, "write_failed");
+}
+/*-----------< FUNCTION: w2v_float_to_half >---------------------------------
+// Purpose:    converts a float to IEEE half precision, rounding to nearest
+//             even
+// Parameters: value - value to convert
+// Returns:    the half precision bits
+---------------------------------------------------------------------------*/
+uint16_t w2v_float_to_half (float value)
+{
+   uint32_t bits;
+   memcpy(&bits, &value, sizeof(bits));
+   uint32_t sign = (bits >> 16) & 0x8000;
+   uint32_t abs = bits & 0x7FFFFFFF;
+   // infinity/nan, and overflow (>= 65520 rounds to infinity)
+   if (abs >= 0x7F800000)
+      return sign | 0x7C00 | (abs > 0x7F800000 ? 0x0200 : 0);
+   if (abs >= 0x477FF000)
+      return sign | 0x7C00;
+   // subnormal half (< 2^-14), zero below 2^-25
+   if (abs < 0x38800000) {
+      if (abs <= 0x33000000)
+         return sign;
+      uint32_t shift = 126 - (abs >> 23);
+      uint32_t mantissa = (abs & 0x007FFFFF) | 0x00800000;
+      uint32_t half = mantissa >> shift;
+      uint32_t rest = mantissa & ((1u << shift) - 1);
+      uint32_t tie = 1u << (shift - 1);
+      if (rest > tie || (rest == tie && (half & 1)))
+         half++;
+      return sign | half;
+   }
+   // normal half, rebiasing the exponent (a mantissa carry is exact)
+   uint32_t half = (abs - 0x38000000) >> 13;
+   uint32_t rest = abs & 0x1FFF;
+   if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+      half++;
+   return sign | half;
+}
+/*-----------< FUNCTION: w2v_half_to_float >---------------------------------
+// Purpose:    converts an IEEE half precision value to a float
+// Parameters: value - half precision bits
+// Returns:    the float value
+---------------------------------------------------------------------------*/
+float w2v_half_to_float (uint16_t value)
+{
+   uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+   uint32_t exponent = (value >> 10) & 0x1F;
+   uint32_t mantissa = value & 0x03FF;
+   if (exponent == 0) {
+      float result = ldexpf((float)mantissa, -24);
+      return sign ? -result : result;
+   }
+   uint32_t bits = exponent == 0x1F ?
+      sign | 0x7F800000 | (mantissa << 13) :
+      sign | ((exponent + 112) << 23) | (mantissa << 13);
+   float result;
+   memcpy(&result, &bits, sizeof(result));
+   return result;
+}
+/*-----------< FUNCTION: w2v_run_tasks >-------------------------------------
+// Purpose:    runs a quantization task over a range, in parallel
+//             the first task runs on this thread and the rest on new
+//             threads, falling back to this thread if a thread cannot be
+//             created
+// Parameters: quantizer - shared quantizer state
+//             run       - task function
+//             count     - number of rows/subspaces to process
+//             threads   - maximum number of threads
+//             error     - accumulate the squared quantization error here
+//             norm      - accumulate the squared vector norm here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_run_tasks (
+   const W2V_QUANTIZER* quantizer,
+   W2V_TASK_FN          run,
+   size_t               count,
+   int                  threads,
+   double*              error,
+   double*              norm)
+{
+   size_t num_tasks = std::max<size_t>(
+      1,
+      std::min<size_t>(std::max(threads, 1), count));
+   std::vector<W2V_TASK> tasks(num_tasks);
+   for (size_t t = 0; t < num_tasks; t++) {
+      W2V_TASK* task = &tasks[t];
+      memset(task, 0, sizeof(*task));
+      task->quantizer = quantizer;
+      task->run = run;
+      task->begin = count * t / num_tasks;
+      task->end = count * (t + 1) / num_tasks;
+   }
+   for (size_t t = 1; t < num_tasks; t++) {
+      W2V_TASK* task = &tasks[t];
+      task->threaded = enif_thread_create(
+         (char*)"w2v_quantize",
+         &task->tid,
+         &w2v_task_thread,
+         task,
+         NULL) == 0;
+   }
+   w2v_task_thread(&tasks[0]);
+   for (size_t t = 1; t < num_tasks; t++) {
+      W2V_TASK* task = &tasks[t];
+      if (task->threaded)
+         enif_thread_join(task->tid, NULL);
+      else
+         w2v_task_thread(task);
+   }
+   for (size_t t = 0; t < num_tasks; t++) {
+      CHECK(!tasks[t].failed, "alloc_failed");
+      *error += tasks[t].error;
+      *norm += tasks[t].norm;
+   }
+}
+/*-----------< FUNCTION: w2v_task_thread >-----------------------------------
+// Purpose:    quantization task thread entry point
+// Parameters: arg - the task to run
+// Returns:    NULL
+---------------------------------------------------------------------------*/
+void* w2v_task_thread (void* arg)
+{
+   W2V_TASK* task = (W2V_TASK*)arg;
+   try {
+      task->run(task);
+   } catch (std::bad_alloc&) {
+      task->failed = true;
+   }
+   return NULL;
+}
+/*-----------< FUNCTION: w2v_encode_rows >-----------------------------------
+// Purpose:    quantizes a range of float32 rows
+// Parameters: task - quantization task (rows of the current block)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_encode_rows (W2V_TASK* task)
+{
+   const W2V_QUANTIZER* q = task->quantizer;
+   uint32_t d = q->d;
+   for (size_t r = task->begin; r < task->end; r++) {
+      const float* x = q->input + r * d;
+      char* row = q->output + r * q->row_size;
+      double error = 0;
+      double norm = 0;
+      for (uint32_t i = 0; i < d; i++)
+         norm += (double)x[i] * x[i];
+      if (q->encoding == W2V_ENCODING_F16) {
+         uint16_t* weights = (uint16_t*)row;
+         for (uint32_t i = 0; i < d; i++) {
+            weights[i] = w2v_float_to_half(x[i]);
+            double delta = x[i] - w2v_half_to_float(weights[i]);
+            error += delta * delta;
+         }
+      } else if (q->encoding == W2V_ENCODING_INT8) {
+         float max = 0;
+         for (uint32_t i = 0; i < d; i++)
+            max = std::max(max, fabsf(x[i]));
+         float scale = max / 127;
+         int8_t* weights = (int8_t*)(row + sizeof(float));
+         memset(row, 0, q->row_size);
+         memcpy(row, &scale, sizeof(scale));
+         for (uint32_t i = 0; i < d; i++) {
+            weights[i] = scale > 0 ? (int8_t)lrintf(x[i] / scale) : 0;
+            double delta = x[i] - scale * weights[i];
+            error += delta * delta;
+         }
+      } else if (q->encoding == W2V_ENCODING_PQ) {
+         for (uint32_t s = 0; s < q->M; s++) {
+            float distance;
+            row[s] = (char)w2v_nearest(
+               q->codebook + (size_t)s * W2V_PQ_CENTROIDS * q->D,
+               x + s * q->D,
+               q->D,
+               &distance);
+            error += distance;
+         }
+      }
+      task->error += error;
+      task->norm += norm;
+   }
+}
+/*-----------< FUNCTION: w2v_train_subspaces >-------------------------------
+// Purpose:    trains the PQ codebooks of a range of subspaces, using
+//             k-means (Lloyd's algorithm) over the sample vectors
+//             centroids are initialized to evenly spaced samples, and
+//             empty clusters keep their previous centroid
+// Parameters: task - quantization task (subspaces)
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_train_subspaces (W2V_TASK* task)
+{
+   const W2V_QUANTIZER* q = task->quantizer;
+   const uint32_t K = W2V_PQ_CENTROIDS;
+   uint32_t D = q->D;
+   size_t n = q->samples;
+   std::vector<uint8_t> assignments(n);
+   std::vector<double> sums((size_t)K * D);
+   std::vector<size_t> sizes(K);
+   for (size_t s = task->begin; s < task->end; s++) {
+      float* centroids = q->codebook + s * K * D;
+      if (n == 0)
+         continue;
+      for (uint32_t k = 0; k < K; k++)
+         memcpy(
+            centroids + k * D,
+            q->input + (k * n / K) * q->d + s * D,
+            D * sizeof(float));
+      for (int iteration = 0; iteration < W2V_PQ_ITERATIONS; iteration++) {
+         // assign each sample to its nearest centroid
+         bool changed = false;
+         for (size_t i = 0; i < n; i++) {
+            float distance;
+            uint8_t k = (uint8_t)w2v_nearest(
+               centroids,
+               q->input + i * q->d + s * D,
+               D,
+               &distance);
+            changed |= iteration == 0 || k != assignments[i];
+            assignments[i] = k;
+         }
+         if (!changed)
+            break;
+         // move each centroid to the mean of its samples
+         std::fill(sums.begin(), sums.end(), 0);
+         std::fill(sizes.begin(), sizes.end(), 0);
+         for (size_t i = 0; i < n; i++) {
+            const float* x = q->input + i * q->d + s * D;
+            double* sum = &sums[(size_t)assignments[i] * D];
+            for (uint32_t j = 0; j < D; j++)
+               sum[j] += x[j];
+            sizes[assignments[i]]++;
+         }
+         for (uint32_t k = 0; k < K; k++)
+            if (sizes[k] > 0)
+               for (uint32_t j = 0; j < D; j++)
+                  centroids[k * D + j] = sums[k * D + j] / sizes[k];
+      }
+   }
+}
+/*-----------< FUNCTION: w2v_nearest >---------------------------------------
+// Purpose:    finds the nearest centroid to a subvector
+// Parameters: centroids - subspace codebook (K x D)
+//             x         - subvector to quantize
+//             D         - subspace size
+//             distance  - return the squared distance via here
+// Returns:    the index of the nearest centroid
+---------------------------------------------------------------------------*/
+int w2v_nearest (
+   const float* centroids,
+   const float* x,
+   uint32_t     D,
+   float*       distance)
+{
+   int nearest = 0;
+   float best = FLT_MAX;
+   for (int k = 0; k < W2V_PQ_CENTROIDS; k++) {
+      const float* c = centroids + (size_t)k * D;
+      float d2 = 0;
+      for (uint32_t j = 0; j < D; j++)
+         d2 += (x[j] - c[j]) * (x[j] - c[j]);
+      if (d2 < best) {
+         best = d2;
+         nearest = k;
+      }
+   }
+   *distance = best;
+   return nearest;
+}
+/*-----------< FUNCTION: w2v_pread >-----------------------------------------
+// Purpose:    reads a range of the store file
+// Parameters: fd     - store file descriptor
+//             data   - return the file data via here
+//             size   - number of bytes to read
+//             offset - file offset to read
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_pread (int fd, void* data, size_t size, uint64_t offset)
+{
+   for (size_t done = 0; done < size; ) {
+      ssize_t result = pread(
+         fd,
+         (char*)data + done,
+         size - done,
+         offset + done);
+      CHECK(result > 0, "read_failed");
+      done += result;
+   }
+}
+/*-----------< FUNCTION: w2v_pwrite >----------------------------------------
+// Purpose:    writes a range of the store file
+// Parameters: fd     - store file descriptor
+//             data   - data to write
+//             size   - number of bytes to write
+//             offset - file offset to write
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_pwrite (int fd, const void* data, size_t size, uint64_t offset)
+{
+   for (size_t done = 0; done < size; ) {
+      ssize_t result = pwrite(
+         fd,
+         (const char*)data + done,
+         size - done,
+         offset + done);
+      CHECK(result > 0, "write_failed");
+      done += result;
+   }
+}
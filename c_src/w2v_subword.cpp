@@ -0,0 +1,136 @@
+/****************************************************************************
+ *
+ * MODULE:  w2v_subword.cpp
+ * PURPOSE: fastText subword vectors for out-of-vocabulary terms
+ *
+ * A store compiled from a fastText model also contains the model's subword
+ * (character n-gram) bucket rows, which follow the missing term row of the
+ * matrix. The vector of a term is the mean of the rows of its n-grams,
+ * exactly as computed by fastText:
+ * . the term is wrapped in "<" and ">"
+ * . every substring of minn..maxn UTF-8 characters is an n-gram, except
+ *   for the single-character "<" and ">"
+ * . each n-gram is hashed with 32-bit FNV-1a, where each byte is
+ *   sign-extended before it is combined (as fastText hashes chars), and
+ *   the hash modulo the bucket count selects its row
+ *
+ * N-grams are hashed incrementally as they are extended, so a term of
+ * length L requires O(L x maxn) hash steps and no string copies. The rows
+ * are accumulated by the store's row decoder, directly from quantized
+ * rows, so a subword lookup costs one row decode per n-gram.
+ *
+ ***************************************************************************/
+/*-------------------[       Pre Include Defines       ]-------------------*/
+/*-------------------[      Library Include Files      ]-------------------*/
+/*-------------------[      Project Include Files      ]-------------------*/
+#include "w2v.hpp"
+/*-------------------[      Macros/Constants/Types     ]-------------------*/
+#define W2V_FNV32_BASIS 2166136261u
+#define W2V_FNV32_PRIME 16777619u
+/*-------------------[        Global Variables         ]-------------------*/
+/*-------------------[        Global Prototypes        ]-------------------*/
+/*-------------------[        Module Variables         ]-------------------*/
+/*-------------------[        Module Prototypes        ]-------------------*/
+static inline char w2v_subword_char (
+   const char* term,
+   size_t      length,
+   size_t      i);
+static inline bool w2v_is_continuation (
+   char c);
+/*-------------------[         Implementation          ]-------------------*/
+/*-----------< FUNCTION: w2v_subword_buckets >-------------------------------
+// Purpose:    enumerates the subword buckets of a term
+// Parameters: term    - term to split
+//             length  - term length
+//             minn    - minimum n-gram length, in characters
+//             maxn    - maximum n-gram length, in characters
+//             buckets - number of subword buckets
+//             result  - return the bucket of each n-gram via here
+// Returns:    none
+---------------------------------------------------------------------------*/
+void w2v_subword_buckets (
+   const char*            term,
+   size_t                 length,
+   uint32_t               minn,
+   uint32_t               maxn,
+   uint32_t               buckets,
+   std::vector<uint32_t>* result)
+{
+   result->clear();
+   if (buckets == 0)
+      return;
+   size_t size = length + 2;
+   for (size_t i = 0; i < size; i++) {
+      if (w2v_is_continuation(w2v_subword_char(term, length, i)))
+         continue;
+      // extend the n-gram one character at a time, hashing as it grows
+      uint32_t hash = W2V_FNV32_BASIS;
+      size_t j = i;
+      for (uint32_t n = 1; j < size && n <= maxn; n++) {
+         do {
+            hash ^= (uint32_t)(int8_t)w2v_subword_char(term, length, j++);
+            hash *= W2V_FNV32_PRIME;
+         } while (j < size &&
+                  w2v_is_continuation(w2v_subword_char(term, length, j)));
+         if (n >= minn && !(n == 1 && (i == 0 || j == size)))
+            result->push_back(hash % buckets);
+      }
+   }
+}
+/*-----------< FUNCTION: w2v_subword_vector >--------------------------------
+// Purpose:    accumulates the scaled subword vector of a term
+// Parameters: store  - store containing the subword rows
+//             term   - term to vectorize
+//             length - term length
+//             weight - vector scale factor
+//             vector - accumulate the scaled mean of the term's subword
+//                      rows here
+// Returns:    true if the term has subwords in the store, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_subword_vector (
+   const W2V_STORE* store,
+   const char*      term,
+   size_t           length,
+   float            weight,
+   float*           vector)
+{
+   const W2V_HEADER* header = store->header;
+   if (header->buckets == 0 || header->minn > header->maxn)
+      return false;
+   std::vector<uint32_t> buckets;
+   buckets.reserve((length + 2) * (header->maxn - header->minn + 1));
+   w2v_subword_buckets(
+      term,
+      length,
+      header->minn,
+      header->maxn,
+      header->buckets,
+      &buckets);
+   if (buckets.empty())
+      return false;
+   // the subword rows follow the missing term row
+   float scale = weight / buckets.size();
+   for (uint32_t bucket : buckets)
+      w2v_decode_row(store, header->count + 1 + bucket, scale, vector);
+   return true;
+}
+/*-----------< FUNCTION: w2v_subword_char >----------------------------------
+// Purpose:    retrieves a character of a term, wrapped in "<" and ">"
+// Parameters: term   - term to wrap
+//             length - term length
+//             i      - character index, within the wrapped term
+// Returns:    the character
+---------------------------------------------------------------------------*/
+char w2v_subword_char (const char* term, size_t length, size_t i)
+{
+   return i == 0 ? '<' : i > length ? '>' : term[i - 1];
+}
+/*-----------< FUNCTION: w2v_is_continuation >-------------------------------
+// Purpose:    checks for a UTF-8 continuation byte
+// Parameters: c - byte to check
+// Returns:    true if c continues a multibyte character, false otherwise
+---------------------------------------------------------------------------*/
+bool w2v_is_continuation (char c)
+{
+   return (c & 0xC0) == 0x80;
+}
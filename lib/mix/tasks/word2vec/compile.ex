@@ -1,6 +1,6 @@
 defmodule Mix.Tasks.Word2vec.Compile do
   @moduledoc """
-  This task compiles a word vector text file into a set of DETS indexes.
+  This task compiles a word vector text file into a word vector index.
   """
   @shortdoc @moduledoc
 
@@ -9,9 +9,12 @@ defmodule Mix.Tasks.Word2vec.Compile do
   alias Penelope.ML.Word2vec.Index, as: Index
 
   @switches [
-    partitions: :integer,
-    size_hint: :integer,
-    vector_size: :integer
+    vector_size: :integer,
+    format: :string,
+    encoding: :string,
+    subspaces: :integer,
+    nearest: :string,
+    threads: :integer
   ]
 
   def run(argv) do
@@ -24,28 +27,68 @@ defmodule Mix.Tasks.Word2vec.Compile do
   end
 
   defp execute(source, target, name, options) do
-    index = Index.create!(target, name, options)
+    index = Index.create!(target, name, create_options(options))
 
     try do
-      Index.compile!(index, source)
+      Index.compile!(index, source, compile_options(options))
     after
       Index.close(index)
     end
+
+    case Keyword.fetch(options, :nearest) do
+      {:ok, method} when method in ["auto", "exact", "hnsw"] ->
+        options = Keyword.put(options, :method, String.to_atom(method))
+        Index.build_nearest!(target, options)
+
+      {:ok, method} ->
+        Mix.raise("invalid nearest neighbor method: #{method}")
+
+      :error ->
+        :ok
+    end
+  end
+
+  defp create_options(options) do
+    case Keyword.fetch(options, :encoding) do
+      {:ok, encoding} when encoding in ["f32", "f16", "int8", "pq"] ->
+        Keyword.put(options, :encoding, String.to_atom(encoding))
+
+      {:ok, encoding} ->
+        Mix.raise("invalid encoding: #{encoding}")
+
+      :error ->
+        options
+    end
+  end
+
+  defp compile_options(options) do
+    case Keyword.fetch(options, :format) do
+      {:ok, "text"} -> Keyword.put(options, :format, :text)
+      {:ok, "binary"} -> Keyword.put(options, :format, :binary)
+      {:ok, "fasttext"} -> Keyword.put(options, :format, :fasttext)
+      {:ok, format} -> Mix.raise("invalid format: #{format}")
+      :error -> options
+    end
   end
 
   defp usage do
     IO.puts("""
-      Word2Vec DETS Compiler
+      Word2Vec Index Compiler
       usage: mix word2vec.compile [options] <source-file> <target-path> <name>
 
-      source-file: path to a word2vec standard text file
+      source-file: path to a word2vec text or binary (.bin) file, or a
+                   fastText model (.bin) file
       target-path: path to the output directory
-      name:        name of the index to create in the output directory
+      name:        name of the index, stored in its header
 
       options:
-        --partitions:  number of partitions (files) to create, default: 1
-        --size-hint:   index hint for the total number of words
         --vector-size: number of vectors/word, default: 300
+        --format:      source format (text|binary|fasttext), default: by
+                       extension and signature
+        --encoding:    vector encoding (f32|f16|int8|pq), default: f32
+        --subspaces:   number of pq subspaces, default: vector-size / 4
+        --nearest:     build a nearest neighbor graph (auto|exact|hnsw)
+        --threads:     number of worker threads, default: schedulers
     """)
   end
 end
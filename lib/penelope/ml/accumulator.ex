@@ -0,0 +1,63 @@
+defmodule Penelope.ML.Accumulator do
+  @moduledoc """
+  This module provides a mutable vector accumulator, for aggregating many
+  vectors without allocating an intermediate binary per operation. The
+  accumulator is a native float buffer that is updated in place, and
+  frozen into a `Penelope.ML.Vector` once accumulation is complete.
+
+  Accumulator operations are serialized, so an accumulator may be shared
+  between processes. Any operation on a frozen accumulator raises an
+  `ArgumentError`.
+  """
+
+  alias Penelope.ML.Vector
+  alias Penelope.NIF
+
+  @type t :: reference
+
+  @doc """
+  creates a new accumulator
+
+  The accumulator is initialized with a copy of a vector, or with zeros
+  if a vector length is specified.
+  """
+  @spec new(init :: Vector.t() | non_neg_integer) :: t
+  def new(init), do: NIF.blas_acc_new(init)
+
+  @doc "computes acc = acc + x in place"
+  @spec add(acc :: t, x :: Vector.t()) :: t
+  def add(acc, x), do: scale_add(acc, 1.0, x)
+
+  @doc "computes acc = ax + acc in place"
+  @spec scale_add(acc :: t, a :: float, x :: Vector.t()) :: t
+  def scale_add(acc, a, x) do
+    :ok = NIF.blas_acc_axpy(acc, a / 1, x)
+    acc
+  end
+
+  @doc "computes acc = a acc in place"
+  @spec scale(acc :: t, a :: float) :: t
+  def scale(acc, a) do
+    :ok = NIF.blas_acc_scale(acc, a / 1)
+    acc
+  end
+
+  @doc "adds a list of vectors to the accumulator in place"
+  @spec add_many(acc :: t, vectors :: [Vector.t()]) :: t
+  def add_many(acc, vectors) do
+    :ok = NIF.blas_acc_add_many(acc, vectors)
+    acc
+  end
+
+  @doc "copies the current value of the accumulator into a vector"
+  @spec to_vector(acc :: t) :: Vector.t()
+  def to_vector(acc), do: NIF.blas_acc_read(acc)
+
+  @doc """
+  converts the accumulator into a vector, without copying its buffer
+
+  The accumulator can no longer be used after it is frozen.
+  """
+  @spec freeze(acc :: t) :: Vector.t()
+  def freeze(acc), do: NIF.blas_acc_freeze(acc)
+end
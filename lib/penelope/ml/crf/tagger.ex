@@ -18,6 +18,7 @@ defmodule Penelope.ML.CRF.Tagger do
     http://www.chokkan.org/software/crfsuite/
     https://sklearn-crfsuite.readthedocs.io/en/latest/
   """
+  alias Penelope.ML.Job
   alias Penelope.NIF
 
   @doc """
@@ -51,6 +52,18 @@ defmodule Penelope.ML.CRF.Tagger do
   |`variance`                |1.0                 |
   |`gamma`                   |1.0                 |
   |`verbose`                 |false               |
+  |`decoder`                 |`:crfsuite`         |
+  |`threads`                 |1                   |
+  |`constraints`             |`:none`             |
+  |`beam`                    |0                   |
+  |`state_cache`             |0                   |
+  |`shared_context`          |`[]`                |
+  |`dedupe?`                 |false               |
+  |`holdout`                 |none                |
+  |`holdout_period`          |1                   |
+  |`holdout_metric`          |`:token`            |
+  |`patience`                |5                   |
+  |`max_seconds`             |`:infinity`         |
 
   algorithms:
   `:lbfgs`, `:l2sgd`, `:ap`, `:pa`, `:arow`
@@ -58,6 +71,67 @@ defmodule Penelope.ML.CRF.Tagger do
   linesearch:
   `:more_thuente`, `:backtracking`, `:strong_backtracking`
 
+  threads:
+  with `:lbfgs`, more than one thread shards the training sequences across
+  native threads for objective/gradient evaluation; results are
+  deterministic for a given thread count. Other algorithms ignore it.
+
+  decoders:
+  `:crfsuite` uses the crfsuite tagger for inference. `:native` compiles the
+  model weights into a single-precision decoder that uses SIMD (AVX2)
+  viterbi/forward kernels where available; its predictions match crfsuite,
+  with sequence probabilities accurate to single precision.
+
+  constraints/beam:
+  with the `:native` decoder, `constraints` restricts the label transitions
+  searched by the decoder. `:iob` derives them from IOB2 label names
+  (`i_<type>` must follow `b_<type>` or `i_<type>`, and cannot start a
+  sequence), or a list of `{from, to}` label tuples disallows those
+  transitions explicitly. `beam` enables beam decoding with the given
+  width (0 for exact decoding), which visits only the best scoring labels
+  at each position, so that decoding cost grows with the beam width rather
+  than quadratically in the number of labels; sequence probabilities are
+  then approximated over the pruned lattice.
+
+  state cache:
+  with the `:native` decoder, `state_cache` is the capacity (number of
+  entries, 0 for none) of a least-recently-used cache of the state scores
+  of token feature sets, which is shared by all predictions with the
+  model. Frequent tokens then skip the feature weight lookups, at the cost
+  of a label-count vector of memory per entry. The capacity is exported
+  with the model, and can also be set when compiling it. See
+  `cache_stats/1` for the hit/miss counts.
+
+  shared context:
+  `shared_context` is a list of context keys whose values are features of
+  the whole sequence (for example, a predicted intent), as with the
+  context featurizer. During prediction, they are resolved once per
+  sequence and their state scores are broadcast to every position,
+  instead of being copied onto (and looked up for) every token.
+
+  dedupe:
+  `dedupe?` collapses exact duplicate training sequences (identical
+  features and labels) into a single sequence, weighted by the number of
+  copies (or the sum of their `@weight` values, with `fit_file/2`), as the
+  training data is converted. Training time and memory then scale with
+  the number of unique sequences. The L-BFGS objective is unchanged; the
+  online algorithms apply one weighted update in place of the repeated
+  ones.
+
+  early stopping:
+  with `:lbfgs`, `holdout` sets aside sequences that are not trained on,
+  and are instead decoded natively every `holdout_period` iterations to
+  measure the `:token` or `:sequence` labeling accuracy. It is either a
+  fraction of the training sequences (chosen deterministically by content,
+  so that duplicates are held out together), or an `{x, y}` tuple of
+  separate holdout sequences (with `fit/4` only). Training stops once
+  `patience` evaluations pass without improving the accuracy (0 to only
+  stop on the usual objective-based criteria), and the best scoring
+  weights are kept. `max_seconds` bounds the wall-clock training time,
+  keeping the weights from the last iteration (or the best holdout
+  weights). Either option trains with the native L-BFGS trainer, and is
+  rejected for the other algorithms.
+
   for more information on parameters, see
     https://sklearn-crfsuite.readthedocs.io/en/latest/api.html
   """
@@ -70,11 +144,127 @@ defmodule Penelope.ML.CRF.Tagger do
   def fit(context, x, y, options \\ []) do
     if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
 
-    x = transform(%{}, context, x)
-    params = fit_params(x, y, options)
+    shared = Keyword.get(options, :shared_context, [])
+    x = fit_transform(context, x, shared)
+    params = fit_holdout(fit_params(x, y, options), context, shared)
     model = NIF.crf_train(x, y, params)
 
-    %{crf: model}
+    %{crf: model, shared_context: shared}
+  end
+
+  @doc """
+  starts training a CRF model on a background job, see `fit/4` for options
+
+  With `:lbfgs`, the job reports progress after each iteration and can be
+  cancelled between iterations (training uses the native L-BFGS trainer,
+  even with a single thread). The other algorithms report progress per
+  epoch, but only `:lbfgs` can be cancelled during training: the crfsuite
+  trainers cannot be interrupted, so a cancelled job runs them to
+  completion before it reports `{:error, :cancelled}`. See
+  `Penelope.ML.Job` for awaiting/cancelling the job.
+  """
+  @spec fit_async(
+          context :: map,
+          x :: [[String.t() | list | map]],
+          y :: [[String.t()]],
+          options :: keyword
+        ) :: Job.t()
+  def fit_async(context, x, y, options \\ []) do
+    if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
+
+    shared = Keyword.get(options, :shared_context, [])
+    x = fit_transform(context, x, shared)
+    params = fit_holdout(fit_params(x, y, options), context, shared)
+    job = NIF.crf_train_async(x, y, params)
+
+    Job.new(job, &%{crf: &1, shared_context: shared})
+  end
+
+  @doc """
+  trains a CRF model from a training file in the CRFSuite data format, and
+  returns it as a compiled model
+
+  The file is streamed directly into the native training structures, so the
+  training set is never materialized on the BEAM heap. Each line contains a
+  label followed by tab-separated attributes (`name` or `name:value`, with
+  `:` and `\\` escaped by `\\`). Sequences are separated by blank lines,
+  and an optional `@weight:<value>` line sets the weight of a sequence.
+
+  The options are the same as for `fit/4`.
+  """
+  @spec fit_file(path :: String.t(), options :: keyword) :: map
+  def fit_file(path, options \\ []) do
+    params = fit_params(nil, nil, options)
+    model = NIF.crf_train_file(path, params)
+
+    %{crf: model, shared_context: []}
+  end
+
+  @doc """
+  compacts a trained model, by removing the features whose weight
+  magnitudes are below a threshold (along with any zero-weight features),
+  and the attributes left without features
+
+  This is most effective after L1 (`c1`) training, which drives many
+  weights to zero. The remaining attributes and features are renumbered
+  into a new model, so both the model size and the attribute lookups
+  during prediction shrink. The model's decoding options are preserved.
+
+  Returns the pruned model along with a report of the feature/attribute
+  counts and model sizes (bytes) before and after pruning, and the
+  fraction of tokens in `sample` (a list of feature sequences, as for
+  `predict_sequence/3`) that the pruned model labels the same as the
+  original.
+  """
+  @spec prune(
+          model :: %{crf: reference},
+          threshold :: float,
+          sample :: [[String.t() | list | map]]
+        ) :: {map, map}
+  def prune(%{crf: crf} = model, threshold, sample \\ []) do
+    sample = Enum.map(sample, fn x -> Enum.map(x, &featurize/1) end)
+    {pruned, report} = NIF.crf_prune(crf, threshold / 1, sample)
+    {%{model | crf: pruned}, report}
+  end
+
+  @doc """
+  updates a trained model online from a batch of labeled sequences, such
+  as user corrections, without retraining from scratch
+
+  Each sequence is decoded with the current weights, and if any of its
+  labels are wrong, the weights move toward the expected labels and away
+  from the decoded ones. Attributes and labels that the model has not seen
+  are added to it. The updated model is returned as a new model, so the
+  original (and any predictions in flight on it) is unaffected; the
+  model's decoding options are preserved.
+
+  options:
+  |key          |default          |
+  |-------------|-----------------|
+  |`algorithm`  |`:pa`            |
+  |`c`          |1.0              |
+  |`epochs`     |1                |
+
+  `algorithm` is either `:pa` (passive-aggressive, PA-I), which takes the
+  smallest step that separates the expected labels by a margin (capped by
+  `c`), or `:perceptron`, which takes a unit step. `epochs` is the
+  maximum number of passes over the sequences, stopping early once all of
+  them are decoded correctly.
+  """
+  @spec update(
+          model :: %{crf: reference},
+          context :: map,
+          x :: [[String.t() | list | map]],
+          y :: [[String.t()]],
+          options :: keyword
+        ) :: map
+  def update(%{crf: crf} = model, context, x, y, options \\ []) do
+    if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
+
+    x = fit_transform(context, x, Map.get(model, :shared_context, []))
+    params = update_params(options)
+
+    %{model | crf: NIF.crf_update(crf, x, y, params)}
   end
 
   @spec transform(
@@ -93,10 +283,13 @@ defmodule Penelope.ML.CRF.Tagger do
   `compile` to prepare the model for inference.
   """
   @spec export(%{crf: reference}) :: map
-  def export(%{crf: crf}) do
+  def export(%{crf: crf} = model) do
     crf
     |> NIF.crf_export()
     |> Map.update!(:model, &Base.encode64/1)
+    |> Map.update!(:decoder, &to_string/1)
+    |> Map.update!(:constraints, &export_constraints/1)
+    |> Map.put(:shared_context, Map.get(model, :shared_context, []))
     |> Map.new(fn {k, v} -> {to_string(k), v} end)
   end
 
@@ -105,13 +298,34 @@ defmodule Penelope.ML.CRF.Tagger do
   """
   @spec compile(params :: map) :: map
   def compile(params) do
+    {shared, params} = Map.pop(params, "shared_context", [])
+
     model =
       params
       |> Map.new(fn {k, v} -> {String.to_existing_atom(k), v} end)
       |> Map.update!(:model, &Base.decode64!/1)
+      |> Map.update(:decoder, :crfsuite, &decoder_param/1)
+      |> Map.update(:constraints, :none, &constraints_param/1)
       |> NIF.crf_compile()
 
-    %{crf: model}
+    %{crf: model, shared_context: shared}
+  end
+
+  @doc """
+  retrieves the state score cache statistics of a model
+
+  Returns a map of the cache `capacity`, its current `size`, and the
+  number of lookup `hits` and `misses` since the model was loaded (all 0
+  if the model has no cache).
+  """
+  @spec cache_stats(%{crf: reference}) :: %{
+          capacity: non_neg_integer,
+          size: non_neg_integer,
+          hits: non_neg_integer,
+          misses: non_neg_integer
+        }
+  def cache_stats(%{crf: crf}) do
+    NIF.crf_cache_stats(crf)
   end
 
   @doc """
@@ -123,18 +337,56 @@ defmodule Penelope.ML.CRF.Tagger do
           context :: map,
           x :: [[String.t() | list | map]]
         ) :: [{[String.t()], float}]
-  def predict_sequence(model, _context, x) do
-    Enum.map(x, &do_predict_sequence(model, &1))
+  def predict_sequence(model, context, x) do
+    shared = shared_features(context, Map.get(model, :shared_context, []))
+    Enum.map(x, &do_predict_sequence(model, shared, &1))
   end
 
-  defp do_predict_sequence(_model, []) do
+  defp do_predict_sequence(_model, _shared, []) do
     {[], 1.0}
   end
 
-  defp do_predict_sequence(%{crf: model}, x) do
+  defp do_predict_sequence(%{crf: model}, shared, x)
+       when map_size(shared) === 0 do
     NIF.crf_predict(model, Enum.map(x, &featurize/1))
   end
 
+  defp do_predict_sequence(%{crf: model}, shared, x) do
+    NIF.crf_predict(model, Enum.map(x, &featurize/1), shared)
+  end
+
+  # training sequences carry the shared context features on every token,
+  # which is equivalent to broadcasting them during prediction
+  defp fit_transform(context, x, []) do
+    transform(%{}, context, x)
+  end
+
+  defp fit_transform(context, x, shared) do
+    features = shared_features(context, shared)
+
+    %{}
+    |> transform(context, x)
+    |> Enum.map(fn x -> Enum.map(x, &Map.merge(features, &1)) end)
+  end
+
+  # holdout sequences are featurized the same way as the training sequences
+  defp fit_holdout(%{holdout: {x, y}} = params, context, shared) do
+    if length(x) !== length(y),
+      do: raise(ArgumentError, "mismatched holdout x/y")
+
+    %{params | holdout: {fit_transform(context, x, shared), y}}
+  end
+
+  defp fit_holdout(params, _context, _shared) do
+    params
+  end
+
+  defp shared_features(context, keys) do
+    keys
+    |> Enum.map(&featurize(&1, context[String.to_existing_atom(&1)]))
+    |> Enum.reduce(%{}, &Map.merge/2)
+  end
+
   defp fit_params(_x, _y, options) do
     algorithm = Keyword.get(options, :algorithm, :lbfgs)
     min_freq = Keyword.get(options, :min_freq, 0) / 1
@@ -172,6 +424,17 @@ defmodule Penelope.ML.CRF.Tagger do
     variance = Keyword.get(options, :variance, 1.0) / 1
     gamma = Keyword.get(options, :gamma, 1.0) / 1
     verbose = Keyword.get(options, :verbose, false)
+    decoder = Keyword.get(options, :decoder, :crfsuite)
+    threads = Keyword.get(options, :threads, 1)
+    constraints = Keyword.get(options, :constraints, :none)
+    beam = Keyword.get(options, :beam, 0)
+    state_cache = Keyword.get(options, :state_cache, 0)
+    dedupe? = Keyword.get(options, :dedupe?, false)
+    holdout = Keyword.get(options, :holdout)
+    holdout_period = Keyword.get(options, :holdout_period, 1)
+    holdout_metric = Keyword.get(options, :holdout_metric, :token)
+    patience = Keyword.get(options, :patience, 5)
+    max_seconds = Keyword.get(options, :max_seconds, :infinity)
 
     %{
       algorithm: algorithm,
@@ -198,7 +461,26 @@ defmodule Penelope.ML.CRF.Tagger do
       averaging?: averaging?,
       variance: variance,
       gamma: gamma,
-      verbose: verbose
+      verbose: verbose,
+      decoder: decoder,
+      threads: threads,
+      constraints: constraints,
+      beam: beam,
+      state_cache: state_cache,
+      dedupe?: dedupe?,
+      holdout: holdout_param(holdout),
+      holdout_period: holdout_period,
+      holdout_metric: holdout_metric,
+      patience: patience,
+      max_seconds: max_seconds_param(max_seconds)
+    }
+  end
+
+  defp update_params(options) do
+    %{
+      algorithm: Keyword.get(options, :algorithm, :pa),
+      c: Keyword.get(options, :c, 1.0) / 1,
+      epochs: Keyword.get(options, :epochs, 1)
     }
   end
 
@@ -212,6 +494,43 @@ defmodule Penelope.ML.CRF.Tagger do
     end
   end
 
+  defp holdout_param(holdout) do
+    case holdout do
+      nil -> :none
+      fraction when is_number(fraction) -> fraction / 1
+      {x, y} -> {x, y}
+    end
+  end
+
+  defp max_seconds_param(max_seconds) do
+    case max_seconds do
+      :infinity -> :infinity
+      seconds -> seconds / 1
+    end
+  end
+
+  defp decoder_param(decoder) do
+    case decoder do
+      "crfsuite" -> :crfsuite
+      "native" -> :native
+    end
+  end
+
+  defp constraints_param(constraints) do
+    case constraints do
+      "none" -> :none
+      "iob" -> :iob
+      l when is_list(l) -> Enum.map(l, fn [from, to] -> {from, to} end)
+    end
+  end
+
+  defp export_constraints(constraints) do
+    case constraints do
+      l when is_list(l) -> Enum.map(l, fn {from, to} -> [from, to] end)
+      a -> to_string(a)
+    end
+  end
+
   defp linesearch_param(linesearch) do
     case linesearch do
       :more_thuente -> :MoreThuente
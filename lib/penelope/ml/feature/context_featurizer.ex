@@ -5,6 +5,9 @@ defmodule Penelope.ML.Feature.ContextFeaturizer do
   sequence for each sample. This is useful for biasing a sequence
   classifier at the sample level.
 
+  For the CRF tagger, the `shared_context` option provides the same
+  features without copying them onto every element.
+
   Example:
   ```
     model:   %{keys: ["k"]}
@@ -57,26 +57,28 @@ defmodule Penelope.ML.Feature.StackVectorizer do
           Vector.t()
         ]
   def transform(model, context, x) do
-    Enum.reduce(
-      model,
-      Enum.map(x, fn _x -> Vector.empty() end),
-      &do_transform(&1, context, &2, x)
-    )
+    model
+    |> Enum.map(&do_transform(&1, context, x))
+    |> Enum.reject(&is_nil/1)
+    |> stack(x)
   end
 
-  defp do_transform({module, model}, context, r_x, x) do
-    # call the inner vectorizer
-    x =
-      Pipeline.call_maybe(module, :transform, [model, context, x], fn ->
-        nil
-      end)
+  defp do_transform({module, model}, context, x) do
+    # call the inner vectorizer, which may not produce results
+    Pipeline.call_maybe(module, :transform, [model, context, x], fn ->
+      nil
+    end)
+  end
+
+  # concatenate the results of all vectorizers for each sample at once
+  defp stack([], x) do
+    Enum.map(x, fn _x -> Vector.empty() end)
+  end
 
-    # if results were produced, stack them into the existing vectors
-    if x do
-      Enum.map(Enum.zip(r_x, x), fn {r_x, x} -> Vector.concat(r_x, x) end)
-    else
-      r_x
-    end
+  defp stack(results, _x) do
+    results
+    |> Enum.zip()
+    |> Enum.map(&Vector.concat(Tuple.to_list(&1)))
   end
 
   @doc """
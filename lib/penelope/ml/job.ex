@@ -0,0 +1,89 @@
+defmodule Penelope.ML.Job do
+  @moduledoc """
+  Asynchronous training jobs
+
+  A job trains a model on its own native thread, so that long-running
+  training does not occupy a dirty scheduler, and so that it can report
+  progress and be cancelled. Jobs are started by the `fit_async` functions
+  of the model modules, and they report to the starting process with
+  messages of the following form:
+
+    `{:penelope_job, ref, {:progress, iteration, objective, elapsed}}`
+    `{:penelope_job, ref, {:ok, model}}`
+    `{:penelope_job, ref, {:error, reason}}`
+
+  where `elapsed` is the number of seconds since the job started. Only the
+  starting process receives these messages, so only it can `await/2` the
+  job, although any process can cancel it.
+
+  Progress is reported per iteration for iterative solvers (CRF L-BFGS and
+  the liblinear primal solvers), and otherwise when the solver finishes
+  (or each binary subproblem, for libsvm). Cancellation is cooperative:
+  L-BFGS training stops after the current iteration, while the other
+  solvers stop when they return.
+  """
+
+  alias Penelope.NIF
+
+  defstruct [:ref, :finish]
+
+  @type t :: %__MODULE__{ref: reference, finish: (reference -> map)}
+  @type progress :: {
+          iteration :: integer,
+          objective :: float,
+          elapsed :: float
+        }
+
+  @doc false
+  @spec new(ref :: reference, finish :: (reference -> map)) :: t
+  def new(ref, finish) do
+    %__MODULE__{ref: ref, finish: finish}
+  end
+
+  @doc """
+  requests cancellation of a job
+
+  The job subsequently completes with `{:error, :cancelled}`, unless it
+  finished first. Only CRF `:lbfgs` training stops early, after its
+  current iteration. The other solvers cannot be interrupted, so the job
+  only completes once they return.
+  """
+  @spec cancel(job :: t) :: :ok
+  def cancel(%__MODULE__{ref: ref}) do
+    NIF.job_cancel(ref)
+  end
+
+  @doc """
+  waits for a job to complete, and returns the trained model
+
+  ### options:
+  |key          |description                              |default    |
+  |-------------|-----------------------------------------|-----------|
+  |`on_progress`|function called with each progress tuple |none       |
+  |`timeout`    |maximum time to wait for each message, ms|`:infinity`|
+
+  Returns `{:ok, model}` on success, `{:error, reason}` if training failed
+  or was cancelled, or `{:error, :timeout}` if no message arrived within
+  the timeout (in which case the job is still running).
+  """
+  @spec await(job :: t, options :: keyword) ::
+          {:ok, map} | {:error, atom}
+  def await(%__MODULE__{ref: ref, finish: finish} = job, options \\ []) do
+    on_progress = Keyword.get(options, :on_progress, fn _ -> :ok end)
+    timeout = Keyword.get(options, :timeout, :infinity)
+
+    receive do
+      {:penelope_job, ^ref, {:progress, iteration, objective, elapsed}} ->
+        on_progress.({iteration, objective, elapsed})
+        await(job, options)
+
+      {:penelope_job, ^ref, {:ok, model}} ->
+        {:ok, finish.(model)}
+
+      {:penelope_job, ^ref, {:error, reason}} ->
+        {:error, reason}
+    after
+      timeout -> {:error, :timeout}
+    end
+  end
+end
@@ -17,7 +17,7 @@ defmodule Penelope.ML.Linear.Classifier do
   https://github.com/cjlin1/liblinear for details.
   """
 
-  alias Penelope.ML.Vector
+  alias Penelope.ML.{Job, Vector}
   alias Penelope.NIF
 
   @doc """
@@ -63,6 +63,99 @@ defmodule Penelope.ML.Linear.Classifier do
     %{lin: model, classes: classes}
   end
 
+  @doc """
+  starts training a linear model on a background job, see `fit/4` for
+  options
+
+  The job reports progress for the primal solvers, and it completes when
+  the solver returns. See `Penelope.ML.Job` for awaiting/cancelling it.
+  """
+  @spec fit_async(
+          context :: map,
+          x :: [Vector.t()],
+          y :: [any],
+          options :: keyword
+        ) :: Job.t()
+  def fit_async(_context, x, y, options \\ []) do
+    if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
+
+    classes = Enum.uniq(y)
+    y = Enum.map(y, &index_of(classes, &1))
+
+    params = fit_params(x, y, classes, options)
+    job = NIF.lin_train_async(x, y, params)
+    Job.new(job, &%{lin: &1, classes: classes})
+  end
+
+  @doc """
+  creates an online learner for a fixed set of classes and feature vector
+  size, to be updated incrementally with `partial_fit/4`
+
+  The learner trains one-vs-rest logistic (`:log`) or linear SVM
+  (`:hinge`) models with stochastic gradient descent and per-weight
+  AdaGrad step sizes. Its weights are updated in place and without
+  locking, so any number of processes may call `partial_fit/4` on it
+  concurrently (hogwild); use `snapshot/1` to obtain an immutable model
+  for prediction and export.
+
+  ### options:
+  |key      |description                            |default|
+  |---------|---------------------------------------|-------|
+  |`loss`   |`:log` or `:hinge`                     |`:log` |
+  |`eta`    |base learning rate                     |0.1    |
+  |`lambda` |L2 regularization strength             |0.0    |
+  |`bias`   |intercept bias (-1 for no intercept)   |1.0    |
+  """
+  @spec learner(classes :: [any], features :: pos_integer, keyword) :: map
+  def learner(classes, features, options \\ []) do
+    params = %{
+      loss: Keyword.get(options, :loss, :log),
+      classes: length(classes),
+      features: features,
+      eta: Keyword.get(options, :eta, 0.1) / 1,
+      lambda: Keyword.get(options, :lambda, 0.0) / 1,
+      bias: Keyword.get(options, :bias, 1) / 1
+    }
+
+    %{learner: NIF.lin_learner(params), classes: classes}
+  end
+
+  @doc """
+  updates an online learner with a batch of samples, taking a gradient
+  step per sample (in order), and returns the learner
+
+  Every class in `y` must be one of the learner's classes. The `epochs`
+  option (default 1) sets the number of passes over the batch.
+  """
+  @spec partial_fit(
+          %{learner: reference, classes: [any]},
+          x :: [Vector.t()],
+          y :: [any],
+          options :: keyword
+        ) :: map
+  def partial_fit(
+        %{learner: learner, classes: classes} = model,
+        x,
+        y,
+        options \\ []
+      ) do
+    if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
+
+    y = Enum.map(y, &class_index!(classes, &1))
+    params = %{epochs: Keyword.get(options, :epochs, 1)}
+    :ok = NIF.lin_partial_fit(learner, x, y, params)
+    model
+  end
+
+  @doc """
+  copies the current weights of an online learner into a compiled model,
+  which is unaffected by later updates to the learner
+  """
+  @spec snapshot(%{learner: reference, classes: [any]}) :: map
+  def snapshot(%{learner: learner, classes: classes}) do
+    %{lin: NIF.lin_snapshot(learner), classes: classes}
+  end
+
   @doc """
   extracts model parameters from the compiled model
 
@@ -175,6 +268,10 @@ defmodule Penelope.ML.Linear.Classifier do
     Map.new(weights, fn {k, v} -> {index_of(classes, k), v} end)
   end
 
+  defp class_index!(classes, y) do
+    index_of(classes, y) || raise(ArgumentError, "unknown class")
+  end
+
   defp index_of(l, e) do
     Enum.find_index(l, fn x -> x === e end)
   end
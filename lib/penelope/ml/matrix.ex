@@ -0,0 +1,93 @@
+defmodule Penelope.ML.Matrix do
+  @moduledoc """
+  This module provides matrix operations over the binary representation of
+  `Penelope.ML.Vector`. A matrix is stored as the row-major concatenation
+  of its row vectors, and its shape (`{rows, cols}`) is passed alongside
+  it. Math is done via the BLAS interface, wrapped in a NIF module.
+
+  Large operations run on a dirty CPU scheduler, while small ones run
+  inline on the calling scheduler.
+  """
+
+  alias Penelope.ML.Vector
+  alias Penelope.NIF
+
+  @type t :: binary
+  @type shape :: {non_neg_integer, non_neg_integer}
+
+  @doc "creates a matrix from a list of equal-length row vectors"
+  @spec from_rows(rows :: [Vector.t()]) :: {t, shape}
+  def from_rows([]), do: {Vector.empty(), {0, 0}}
+
+  def from_rows([row | _] = rows) do
+    {Vector.concat(rows), {length(rows), Vector.size(row)}}
+  end
+
+  @doc "retrieves a matrix row by 0-based index"
+  @spec row(matrix :: t, shape :: shape, index :: non_neg_integer) ::
+          Vector.t()
+  def row(matrix, {_rows, cols}, index) do
+    Vector.slice(matrix, index * cols, cols)
+  end
+
+  @doc """
+  computes the matrix-vector product y = alpha a x
+
+  If `transpose?` is set, computes y = alpha a' x instead. `shape` is the
+  shape of `a`, before transposition.
+  """
+  @spec multiply_vector(
+          a :: t,
+          shape :: shape,
+          x :: Vector.t(),
+          options :: keyword
+        ) :: Vector.t()
+  def multiply_vector(a, {m, n}, x, options \\ []) do
+    NIF.blas_sgemv(
+      Keyword.get(options, :transpose?, false),
+      m,
+      n,
+      Keyword.get(options, :alpha, 1) / 1,
+      a,
+      x
+    )
+  end
+
+  @doc """
+  computes the matrix product c = alpha a b
+
+  The `transpose_a?` and `transpose_b?` options transpose `a` and `b`
+  before multiplying them. The shapes are those of `a` and `b` before
+  transposition. Returns the product along with its shape.
+  """
+  @spec multiply(
+          a :: t,
+          a_shape :: shape,
+          b :: t,
+          b_shape :: shape,
+          options :: keyword
+        ) :: {t, shape}
+  def multiply(a, a_shape, b, b_shape, options \\ []) do
+    transpose_a? = Keyword.get(options, :transpose_a?, false)
+    transpose_b? = Keyword.get(options, :transpose_b?, false)
+    {m, k} = transpose(a_shape, transpose_a?)
+    {k_b, n} = transpose(b_shape, transpose_b?)
+
+    if k !== k_b, do: raise(ArgumentError, "mismatched matrix shapes")
+
+    alpha = Keyword.get(options, :alpha, 1) / 1
+    c = NIF.blas_sgemm(transpose_a?, transpose_b?, m, n, k, alpha, a, b)
+    {c, {m, n}}
+  end
+
+  @doc """
+  computes the cosine similarity between a vector and each row of a matrix
+
+  Rows with zero norm (or a zero vector) have zero similarity.
+  """
+  @spec cosine(matrix :: t, x :: Vector.t()) :: Vector.t()
+  def cosine(matrix, x), do: NIF.blas_cosine(matrix, x)
+
+  defp transpose(shape, false), do: shape
+  defp transpose({rows, cols}, true), do: {cols, rows}
+end
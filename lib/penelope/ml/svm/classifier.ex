@@ -11,7 +11,7 @@ defmodule Penelope.ML.SVM.Classifier do
   https://github.com/cjlin1/libsvm for details.
   """
 
-  alias Penelope.ML.Vector
+  alias Penelope.ML.{Job, Vector}
   alias Penelope.NIF
 
   @doc """
@@ -47,6 +47,31 @@ defmodule Penelope.ML.SVM.Classifier do
     %{svm: model, classes: classes}
   end
 
+  @doc """
+  starts training an SVM model on a background job, see `fit/4` for
+  options
+
+  The job reports progress as each binary subproblem is solved, and it
+  completes when the solver returns. See `Penelope.ML.Job` for
+  awaiting/cancelling it.
+  """
+  @spec fit_async(
+          context :: map,
+          x :: [Vector.t()],
+          y :: [any],
+          options :: keyword
+        ) :: Job.t()
+  def fit_async(_context, x, y, options \\ []) do
+    if length(x) !== length(y), do: raise(ArgumentError, "mismatched x/y")
+
+    classes = Enum.uniq(y)
+    y = Enum.map(y, &index_of(classes, &1))
+
+    params = fit_params(x, y, classes, options)
+    job = NIF.svm_train_async(x, y, params)
+    Job.new(job, &%{svm: &1, classes: classes})
+  end
+
   @doc """
   extracts model parameters from the compiled model
 
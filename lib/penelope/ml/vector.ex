@@ -31,27 +31,27 @@ defmodule Penelope.ML.Vector do
 
   @doc "creates a vector of length n containing all zeros"
   @spec zeros(n :: non_neg_integer) :: t
-  def zeros(0), do: empty()
+  def zeros(n), do: fill(n, 0)
 
-  def zeros(n) do
-    from_list(for _ <- 1..n, do: 0)
-  end
+  @doc "creates a vector of length n with every element set to a value"
+  @spec fill(n :: non_neg_integer, value :: float) :: t
+  def fill(n, value), do: NIF.blas_fill(n, value / 1)
 
   @doc "converts a list of floats to a vector"
   @spec from_list(numbers :: [float]) :: t
-  def from_list(numbers) do
-    numbers
-    |> Enum.map(&float2binary/1)
-    |> Enum.reduce(empty(), &(&2 <> &1))
-  end
+  def from_list(numbers), do: NIF.blas_from_list(numbers)
 
   @doc "converts a vector to a list of floats"
   @spec to_list(vector :: t) :: [float]
-  def to_list(<<>>), do: []
+  def to_list(vector), do: NIF.blas_to_list(vector)
 
-  def to_list(vector) do
-    Enum.map(0..(size(vector) - 1), &get(vector, &1))
-  end
+  @doc "retrieves count elements of a vector, starting at a 0-based index"
+  @spec slice(
+          vector :: t,
+          start :: non_neg_integer,
+          count :: non_neg_integer
+        ) :: t
+  def slice(vector, start, count), do: NIF.blas_slice(vector, start, count)
 
   @doc "concatenates two vectors"
   @spec concat(vector :: t, vector :: t) :: vector :: t
@@ -59,6 +59,10 @@ defmodule Penelope.ML.Vector do
     x <> y
   end
 
+  @doc "concatenates a list of vectors"
+  @spec concat(vectors :: [t]) :: t
+  def concat(vectors), do: NIF.blas_concat(vectors)
+
   @doc "computes y = ax"
   @spec scale(x :: t, a :: float) :: t
   def scale(x, a), do: NIF.blas_sscal(a / 1, x)
@@ -71,9 +75,24 @@ defmodule Penelope.ML.Vector do
   @spec scale_add(y :: t, a :: float, x :: t) :: t
   def scale_add(y, a, x), do: NIF.blas_saxpy(a / 1, x, y)
 
+  @doc "computes the dot product x . y"
+  @spec dot(x :: t, y :: t) :: float
+  def dot(x, y), do: NIF.blas_sdot(x, y)
+
+  @doc "computes the euclidean norm ||x||"
+  @spec norm(x :: t) :: float
+  def norm(x), do: NIF.blas_snrm2(x)
+
+  @doc "computes the mean of a nonempty list of vectors"
+  @spec mean(vectors :: [t]) :: t
+  def mean(vectors), do: NIF.blas_mean(vectors)
+
+  @doc "computes the sum of a nonempty list of vectors, weighted by a list"
+  @spec weighted_sum(weights :: [float], vectors :: [t]) :: t
+  def weighted_sum(weights, vectors) do
+    NIF.blas_weighted_sum(Enum.map(weights, &(&1 / 1)), vectors)
+  end
+
   defp binary2float(<<value::float()-native()-size(32)>>), do: value
   defp binary2float(_value), do: :NaN
-
-  defp float2binary(:NaN), do: <<0, 0, 128, 127>>
-  defp float2binary(x), do: <<x::float()-native()-size(32)>>
 end
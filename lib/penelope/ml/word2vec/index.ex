@@ -1,216 +1,226 @@
 defmodule Penelope.ML.Word2vec.Index do
   @moduledoc """
-  This module represents a word2vec-style vectorset, compiled into a
-  set of hash-partitioned DETS files. Each record is a tuple consisting
-  of the term (word) and a set of weights (vector). This module also
-  supports parsing the standard text representation of word vectors
-  via the compile function.
+  This module represents a word2vec-style vectorset, compiled into an
+  immutable native word vector store. Each record consists of the term
+  (word), a positive integer id, and a set of weights (vector). This module
+  also supports compiling the standard text and binary representations of
+  word vectors, and fastText binary models, via the compile function.
+
+  An index is built once, via create/insert/close, and then opened for
+  lookups. An open index is memory-mapped read-only and shared by all
+  schedulers, and the vectors and terms it returns reference the mapping
+  directly, without copying. The mapping is released once the index and
+  all of its returned vectors have been garbage collected.
+
+  The vectors may optionally be stored quantized, trading some precision
+  for a smaller index: as half precision floats (f16), as 8-bit integers
+  with a per-vector scale (int8), or product quantized against a trained
+  codebook (pq). Quantized vectors are decoded on lookup, and the relative
+  quantization error is recorded in the index.
+
+  An index compiled from a fastText model also contains the model's
+  subword (character n-gram) vectors. Looking up a term that is not in
+  such an index returns the mean vector of the term's subwords, as fastText
+  does, instead of a zero vector.
+
+  Terms can be searched by the similarity of their vectors, via nearest.
+  By default, searches compare the query to every vector in the index.
+  For larger indexes, build_nearest saves a nearest neighbor graph (HNSW)
+  alongside the index, which is loaded by open and searched approximately
+  instead.
 
   On disk, the following files are created:
-    <path>/header.dets          index header (version, metadata)
-    <path>/<name>_<part>.dets   partition file
+    <path>/index.w2v          word vector store
+    <path>/index.knn          nearest neighbor graph (optional)
   """
 
   alias __MODULE__, as: Index
+  alias Penelope.ML.Matrix, as: Matrix
   alias Penelope.ML.Vector, as: Vector
   alias Penelope.ML.Word2vec.IndexError, as: IndexError
+  alias Penelope.NIF, as: NIF
 
   defstruct version: 1,
             name: nil,
-            partitions: 1,
             vector_size: 300,
-            header: nil,
-            tables: []
+            encoding: :f32,
+            error: 0.0,
+            subwords: 0,
+            writer: nil,
+            store: nil,
+            graph: nil
 
   @type t :: %Index{
           version: pos_integer,
-          name: atom,
-          partitions: pos_integer,
+          name: String.t(),
           vector_size: pos_integer,
-          header: atom,
-          tables: [atom]
+          encoding: encoding,
+          error: float,
+          subwords: non_neg_integer,
+          writer: reference | nil,
+          store: reference | nil,
+          graph: reference | nil
         }
-  @version 1
+  @type encoding :: :f32 | :f16 | :int8 | :pq
+  @type oov :: :zero | :skip | :hash | :subword
+  @version 2
+  @fasttext_magic <<793_712_314::little-32>>
+  @hnsw_threshold 10_000
 
   @doc """
   creates a new word2vec index
 
-  files will be created as <path>/<name>_<part>.dets, one per partition
+  the index file will be created as <path>/index.w2v
+
+  The vectors are quantized to the requested encoding when the index is
+  closed. Product quantization splits each vector into `subspaces` equal
+  parts, each encoded as one byte, so `subspaces` must divide the vector
+  size.
+
+  options:
+  |key          |default                   |description                   |
+  |-------------|--------------------------|------------------------------|
+  |`vector_size`|300                       |number of weights per vector  |
+  |`encoding`   |`:f32`                    |`:f32`, `:f16`, `:int8`, `:pq`|
+  |`subspaces`  |vector_size / 4           |number of pq subspaces        |
+  |`threads`    |`System.schedulers_online`|number of quantizing threads  |
   """
   @spec create!(
           path :: String.t(),
           name :: String.t(),
-          partitions: pos_integer,
-          size_hint: pos_integer,
-          vector_size: pos_integer
+          vector_size: pos_integer,
+          encoding: encoding,
+          subspaces: pos_integer,
+          threads: pos_integer
         ) :: Index.t()
   def create!(path, name, options \\ []) do
-    name = String.to_atom(name)
-    partitions = Keyword.get(options, :partitions, 1)
     vector_size = Keyword.get(options, :vector_size, 300)
-    size_hint = div(Keyword.get(options, :size_hint, 200_000), partitions)
+    encoding = Keyword.get(options, :encoding, :f32)
 
-    header_data = [
-      version: @version,
-      name: name,
-      partitions: partitions,
-      vector_size: vector_size
-    ]
+    store_options = %{
+      encoding: encoding,
+      subspaces: Keyword.get(options, :subspaces, subspaces(vector_size)),
+      threads: Keyword.get(options, :threads, System.schedulers_online())
+    }
 
     File.mkdir_p!(path)
-    header = create_header(path, header_data)
+    File.rm(graph_file(path))
 
-    tables =
-      0..(partitions - 1)
-      |> Stream.map(&create_table(path, name, &1, size_hint))
-      |> Enum.reduce([], &(&2 ++ [&1]))
+    writer =
+      nif_call!(fn ->
+        NIF.w2v_create(index_file(path), name, vector_size, store_options)
+      end)
 
     %Index{
       version: @version,
       name: name,
-      partitions: partitions,
       vector_size: vector_size,
-      header: header,
-      tables: tables
+      encoding: encoding,
+      writer: writer
     }
   end
 
-  defp create_header(path, header) do
-    file =
-      path
-      |> Path.join("header.dets")
-      |> String.to_charlist()
-
-    options = [file: file, access: :read_write, type: :set, min_no_slots: 1]
-
-    name = String.to_atom(path)
-
-    with {:ok, file} <- :dets.open_file(name, options),
-         :ok <- :dets.insert(file, {:header, header}) do
-      file
-    else
-      {:error, reason} -> raise IndexError, inspect(reason)
+  # default to 4-weight subspaces, where the vector size allows it
+  defp subspaces(vector_size) do
+    cond do
+      rem(vector_size, 4) === 0 -> div(vector_size, 4)
+      rem(vector_size, 2) === 0 -> div(vector_size, 2)
+      true -> vector_size
     end
   end
 
-  defp create_table(path, name, partition, size_hint) do
-    {name, file} = table_file(path, name, partition)
-
-    options = [
-      file: file,
-      access: :read_write,
-      type: :set,
-      min_no_slots: size_hint
-    ]
-
-    case :dets.open_file(name, options) do
-      {:ok, file} -> file
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
+  defp index_file(path) do
+    Path.join(path, "index.w2v")
   end
 
-  defp table_file(path, name, partition) do
-    part =
-      partition
-      |> Integer.to_string()
-      |> String.pad_leading(2, "0")
-
-    name = "#{name}_#{part}"
-
-    file =
-      path
-      |> Path.join("#{name}.dets")
-      |> String.to_charlist()
-
-    {String.to_atom(name), file}
+  defp graph_file(path) do
+    Path.join(path, "index.knn")
   end
 
   @doc """
   opens an existing word2vec index at the specified path
   """
-  @spec open!(path :: String.t(), cache_size: pos_integer) :: Index.t()
-  def open!(path, options \\ []) do
-    {
-      header,
-      [
-        version: version,
-        name: name,
-        partitions: partitions,
-        vector_size: vector_size
-      ]
-    } = open_header(path)
-
-    tables =
-      0..(partitions - 1)
-      |> Stream.map(&open_table(path, name, &1))
-      |> Enum.reduce([], &(&2 ++ [&1]))
-
-    cache_size = Keyword.get(options, :cache_size, 1_000_000)
-
-    try do
-      :e2qc.setup(name, size: cache_size)
-    rescue
-      _ in ErlangError -> :ok
-    end
+  @spec open!(path :: String.t()) :: Index.t()
+  def open!(path) do
+    store = nif_call!(fn -> NIF.w2v_open(index_file(path)) end)
+    info = NIF.w2v_info(store)
+
+    graph =
+      if File.exists?(graph_file(path)) do
+        nif_call!(fn -> NIF.w2v_open_graph(store, graph_file(path)) end)
+      end
 
     %Index{
-      version: version,
-      name: name,
-      partitions: partitions,
-      vector_size: vector_size,
-      header: header,
-      tables: tables
+      version: @version,
+      name: info.name,
+      vector_size: info.vector_size,
+      encoding: info.encoding,
+      error: info.error,
+      subwords: info.subwords,
+      store: store,
+      graph: graph
     }
   end
 
-  defp open_header(path) do
-    file =
-      path
-      |> Path.join("header.dets")
-      |> String.to_charlist()
-
-    options = [file: file, access: :read, type: :set]
-
-    name = String.to_atom(path)
-
-    with {:ok, file} <- :dets.open_file(name, options),
-         [{:header, header}] <- :dets.lookup(file, :header) do
-      {file, header}
-    else
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
-  end
-
-  defp open_table(path, name, partition) do
-    {name, file} = table_file(path, name, partition)
-
-    case :dets.open_file(name, file: file, access: :read) do
-      {:ok, file} -> file
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
-  end
-
   @doc """
   closes the index
+
+  closing an index created via create() completes the index file, after
+  which it can be opened for lookups
   """
   @spec close(index :: Index.t()) :: :ok
-  def close(%Index{header: header, tables: tables}) do
-    :dets.close(header)
-    Enum.each(tables, &:dets.close/1)
+  def close(%Index{writer: nil}), do: :ok
+
+  def close(%Index{writer: writer}) do
+    nif_call!(fn -> NIF.w2v_close(writer) end)
   end
 
   @doc """
-  inserts word vectors from a text file into a word2vec index
+  inserts word vectors from a source file into a word2vec index
 
   the index must have been opened using create()
+
+  The source file is parsed natively, and each vector's id is its 1-based
+  position within the file. The standard text format (with or without a
+  "<count> <dimensions>" header line), the original word2vec binary format
+  and the fastText binary model format are supported.
+
+  The words of a fastText model are compiled with their fastText word
+  vectors, and the model's subword vectors are added to the index when it
+  is closed, so the model file must not be modified until then. Only one
+  model's subwords can be added to an index, and quantized (.ftz) models
+  are not supported.
+
+  options:
+  |key      |default                    |description                     |
+  |---------|---------------------------|--------------------------------|
+  |`format` |by extension and signature |`:text`, `:binary`, `:fasttext` |
+  |`threads`|`System.schedulers_online` |number of text parsing threads  |
   """
-  @spec compile!(index :: Index.t(), path :: String.t()) :: :ok
-  def compile!(index, path) do
-    path
-    |> File.stream!()
-    |> Stream.with_index(_offset = 1)
-    |> Task.async_stream(&parse_insert!(index, &1), ordered: false)
-    |> Stream.run()
+  @spec compile!(
+          index :: Index.t(),
+          path :: String.t(),
+          format: :text | :binary | :fasttext,
+          threads: pos_integer
+        ) :: non_neg_integer
+  def compile!(%Index{writer: writer}, path, options \\ []) do
+    format =
+      if Path.extname(path) === ".bin", do: binary_format(path), else: :text
+
+    options = %{
+      format: Keyword.get(options, :format, format),
+      threads: Keyword.get(options, :threads, System.schedulers_online())
+    }
+
+    nif_call!(fn -> NIF.w2v_compile(writer, path, options) end)
+  end
+
+  # fastText and word2vec models share the .bin extension
+  defp binary_format(path) do
+    case File.open(path, [:read, :binary], &IO.binread(&1, 4)) do
+      {:ok, @fasttext_magic} -> :fasttext
+      _ -> :binary
+    end
   end
 
   @doc """
@@ -249,14 +259,16 @@ defmodule Penelope.ML.Word2vec.Index do
 
   @doc """
   inserts a word vector tuple into a word2vec index
+
+  the index must have been opened using create()
   """
   @spec insert!(
           index :: Index.t(),
           record :: {String.t(), pos_integer, Vector.t()}
         ) :: :ok
   def insert!(
-        %Index{vector_size: vector_size, header: header} = index,
-        {term, id, vector} = record
+        %Index{vector_size: vector_size, writer: writer},
+        {term, id, vector}
       ) do
     actual_size = div(byte_size(vector), 4)
 
@@ -265,14 +277,7 @@ defmodule Penelope.ML.Word2vec.Index do
             "invalid vector size: #{actual_size} != #{vector_size}"
     end
 
-    table = get_table(index, elem(record, 0))
-
-    with :ok <- :dets.insert(header, {id, term}),
-         :ok <- :dets.insert(table, record) do
-      :ok
-    else
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
+    nif_call!(fn -> NIF.w2v_insert(writer, term, id, vector) end)
   end
 
   @doc """
@@ -281,51 +286,155 @@ defmodule Penelope.ML.Word2vec.Index do
   if found, returns the term string
   otherwise, returns nil
   """
-  @spec fetch!(index :: Index.t(), id :: pos_integer) :: String.t() | nil
-  def fetch!(%{name: name} = index, id) do
-    :e2qc.cache(name, id, fn -> do_fetch(index, id) end)
-  end
-
-  defp do_fetch(%{header: header}, id) do
-    case :dets.lookup(header, id) do
-      [{_id, term}] -> term
-      [] -> nil
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
+  @spec fetch!(index :: Index.t(), id :: non_neg_integer) ::
+          String.t() | nil
+  def fetch!(%Index{store: store}, id) do
+    NIF.w2v_fetch(store, id)
   end
 
   @doc """
   searches for a term in the word2vec index
 
   if found, returns the id and word vector (no term)
-  otherwise, returns nil
+  otherwise, returns 0 and the term's subword vector, for an index compiled
+  from a fastText model, or a zero vector
   """
   @spec lookup!(index :: Index.t(), term :: String.t()) ::
-          {integer, Vector.t()}
-  def lookup!(%{name: name} = index, term) do
-    :e2qc.cache(name, term, fn -> do_lookup(index, term) end)
+          {non_neg_integer, Vector.t()}
+  def lookup!(%Index{store: store}, term) do
+    NIF.w2v_lookup(store, term)
   end
 
-  defp do_lookup(%{vector_size: vector_size} = index, term) do
-    bit_size = vector_size * 32
+  @doc """
+  computes the mean word vector of a list of terms
 
-    case index
-         |> get_table(term)
-         |> :dets.lookup(term) do
-      [{_term, id, vector}] -> {id, vector}
-      [] -> {0, <<0::size(bit_size)>>}
-      {:error, reason} -> raise IndexError, inspect(reason)
-    end
+  see mean_batch() for options
+  """
+  @spec mean!(
+          index :: Index.t(),
+          terms :: [String.t()],
+          oov: oov
+        ) :: Vector.t()
+  def mean!(index, terms, options \\ []) do
+    mean_batch!(index, [terms], options)
+  end
+
+  @doc """
+  computes the mean word vector of each of a list of documents
+
+  Each document's terms are looked up and averaged natively, in a single
+  call for the batch. The result is a row-major matrix (see
+  `Penelope.ML.Matrix`), with one row per document. The mean of a document
+  with no terms is a zero vector.
+
+  options:
+  |key      |default|description                                        |
+  |---------|-------|---------------------------------------------------|
+  |`oov`    |`:zero`|`:zero` vectors, `:skip`, `:hash` or `:subword`    |
+
+  With `oov: :hash`, each missing term is replaced by one of the subword
+  bucket vectors of an index compiled from a fastText model, selected by
+  hashing the whole term, so that a missing term always contributes the
+  same vector, distinct from any term in the index. An index without
+  subwords raises `ArgumentError`. With `oov: :subword`, each missing term
+  is replaced by its subword vector, as returned by lookup (a zero vector
+  if the index has no subwords).
+  """
+  @spec mean_batch!(
+          index :: Index.t(),
+          documents :: [[String.t()]],
+          oov: oov
+        ) :: Matrix.t()
+  def mean_batch!(%Index{store: store}, documents, options \\ []) do
+    NIF.w2v_mean_batch(store, documents, Map.new(options))
+  end
+
+  @doc """
+  builds the nearest neighbor graph of a completed word2vec index
+
+  the graph is saved as <path>/index.knn, and loaded by open()
+
+  An HNSW graph supports approximate searches in time roughly logarithmic
+  in the size of the index. An exact graph only records the vector norms,
+  for faster exact searches. By default, an HNSW graph is built for indexes
+  of at least 10,000 terms. The graph must be rebuilt if the index is
+  recreated.
+
+  options:
+  |key      |default                   |description                      |
+  |---------|--------------------------|---------------------------------|
+  |`method` |`:auto`                   |`:auto`, `:exact` or `:hnsw`     |
+  |`links`  |16                        |HNSW links per node (M)          |
+  |`ef`     |200                       |HNSW construction candidates     |
+  |`threads`|`System.schedulers_online`|number of build threads          |
+  """
+  @spec build_nearest!(
+          path :: String.t(),
+          method: :auto | :exact | :hnsw,
+          links: pos_integer,
+          ef: pos_integer,
+          threads: pos_integer
+        ) :: :ok
+  def build_nearest!(path, options \\ []) do
+    store = nif_call!(fn -> NIF.w2v_open(index_file(path)) end)
+    %{count: count} = NIF.w2v_info(store)
+
+    links =
+      case Keyword.get(options, :method, :auto) do
+        :exact -> 0
+        :hnsw -> Keyword.get(options, :links, 16)
+        :auto when count < @hnsw_threshold -> 0
+        :auto -> Keyword.get(options, :links, 16)
+      end
+
+    graph_options = %{
+      links: links,
+      ef: Keyword.get(options, :ef, 200),
+      threads: Keyword.get(options, :threads, System.schedulers_online())
+    }
+
+    nif_call!(fn ->
+      NIF.w2v_build_graph(store, graph_file(path), graph_options)
+    end)
+  end
+
+  @doc """
+  finds the terms most similar to a query term or vector
+
+  Terms are ranked by the cosine similarity of their vectors to the query.
+  If the query is a term in the index, its vector is the query, and the
+  term itself is omitted from the results. Otherwise, the query must be a
+  vector, or a term with a subword vector. Indexes opened with an HNSW
+  graph are searched approximately, considering `ef` candidates (at least
+  k).
+
+  returns up to k {term, id, similarity} tuples, most similar first
+  """
+  @spec nearest!(
+          index :: Index.t(),
+          query :: String.t() | Vector.t(),
+          k :: pos_integer,
+          ef: pos_integer
+        ) :: [{String.t(), pos_integer, float}]
+  def nearest!(
+        %Index{store: store, graph: graph},
+        query,
+        k,
+        options \\ []
+      ) do
+    ef = Keyword.get(options, :ef, 64)
+    NIF.w2v_nearest(graph || store, query, k, ef)
   end
 
-  defp get_table(%Index{tables: tables, partitions: partitions}, term) do
-    partition = rem(:erlang.phash2(term), partitions)
-    Enum.at(tables, partition)
+  defp nif_call!(fun) do
+    fun.()
+  rescue
+    e in ErlangError -> raise IndexError, inspect(e.original)
   end
 end
 
 defmodule Penelope.ML.Word2vec.IndexError do
-  @moduledoc "DETS index processing error"
+  @moduledoc "word vector index processing error"
 
   defexception message: "an index error occurred"
 end
@@ -2,26 +2,24 @@ defmodule Penelope.ML.Word2vec.MeanVectorizer do
   @moduledoc """
   This module vectorizes a list of tokens using word vectors. Token vectors
   are retrieved from the word2vec index (see index.ex). These are combined
-  into a single document vector by taking their vector mean.
+  into a single document vector by taking their vector mean, which is
+  accumulated natively (directly from quantized vectors, if applicable),
+  in a single call per batch of documents.
+
+  The `oov` option controls the handling of tokens that are not in the
+  index (see `Index.mean_batch!/3`). By default, they count as zero
+  vectors.
   """
 
-  alias Penelope.ML.Vector, as: Vector
   alias Penelope.ML.Word2vec.Index, as: Index
 
-  def transform(_model, context, x) do
+  def transform(model, context, x) do
     %{word2vec_index: index = %Index{vector_size: vector_size}} = context
-    Enum.map(x, &vectorize(&1, index, vector_size))
-  end
-
-  defp vectorize(x, index, vector_size) do
-    x
-    |> Stream.map(&lookup(&1, index))
-    |> Enum.reduce(Vector.zeros(vector_size), &Vector.add/2)
-    |> Vector.scale(1 / Enum.count(x))
-  end
+    options = model |> Map.take([:oov]) |> Map.to_list()
+    matrix = Index.mean_batch!(index, x, options)
+    size = vector_size * 4
 
-  defp lookup(x, index) do
-    {_id, v} = Index.lookup!(index, x)
-    v
+    # split the packed document vectors without copying them
+    for <<vector::binary-size(size) <- matrix>>, do: vector
   end
 end
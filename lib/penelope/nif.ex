@@ -33,6 +33,117 @@ defmodule Penelope.NIF do
     :erlang.nif_error(:nif_library_not_loaded)
   end
 
+  @spec blas_mean(vectors :: [Vector.t()]) :: Vector.t()
+  def blas_mean(_vectors) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_weighted_sum(weights :: [float], vectors :: [Vector.t()]) ::
+          Vector.t()
+  def blas_weighted_sum(_weights, _vectors) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_from_list(numbers :: [float | integer | :NaN]) :: Vector.t()
+  def blas_from_list(_numbers) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_to_list(x :: Vector.t()) :: [float | :NaN]
+  def blas_to_list(_x) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_fill(n :: non_neg_integer, value :: float) :: Vector.t()
+  def blas_fill(_n, _value) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_slice(
+          x :: Vector.t(),
+          start :: non_neg_integer,
+          count :: non_neg_integer
+        ) :: Vector.t()
+  def blas_slice(_x, _start, _count) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_concat(vectors :: [Vector.t()]) :: Vector.t()
+  def blas_concat(_vectors) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_sdot(x :: Vector.t(), y :: Vector.t()) :: float
+  def blas_sdot(_x, _y) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_snrm2(x :: Vector.t()) :: float
+  def blas_snrm2(_x) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_sgemv(
+          trans :: boolean,
+          m :: non_neg_integer,
+          n :: non_neg_integer,
+          alpha :: float,
+          a :: binary,
+          x :: Vector.t()
+        ) :: Vector.t()
+  def blas_sgemv(_trans, _m, _n, _alpha, _a, _x) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_sgemm(
+          trans_a :: boolean,
+          trans_b :: boolean,
+          m :: non_neg_integer,
+          n :: non_neg_integer,
+          k :: non_neg_integer,
+          alpha :: float,
+          a :: binary,
+          b :: binary
+        ) :: binary
+  def blas_sgemm(_trans_a, _trans_b, _m, _n, _k, _alpha, _a, _b) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_cosine(a :: binary, x :: Vector.t()) :: Vector.t()
+  def blas_cosine(_a, _x) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_new(init :: Vector.t() | non_neg_integer) :: reference
+  def blas_acc_new(_init) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_axpy(acc :: reference, a :: float, x :: Vector.t()) :: :ok
+  def blas_acc_axpy(_acc, _a, _x) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_scale(acc :: reference, a :: float) :: :ok
+  def blas_acc_scale(_acc, _a) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_add_many(acc :: reference, vectors :: [Vector.t()]) :: :ok
+  def blas_acc_add_many(_acc, _vectors) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_read(acc :: reference) :: Vector.t()
+  def blas_acc_read(_acc) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @spec blas_acc_freeze(acc :: reference) :: Vector.t()
+  def blas_acc_freeze(_acc) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
   @doc "trains a inear model using liblinear"
   @spec lin_train(x :: [Vector.t()], y :: [integer], params :: map) ::
           reference
@@ -40,6 +151,13 @@ defmodule Penelope.NIF do
     :erlang.nif_error(:nif_library_not_loaded)
   end
 
+  @doc "trains a linear model on a background job thread"
+  @spec lin_train_async(x :: [Vector.t()], y :: [integer], params :: map) ::
+          reference
+  def lin_train_async(_x, _y, _params) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
   @doc "extracts linear model parameters from a model resource"
   @spec lin_export(model :: reference) :: map
   def lin_export(_model) do
@@ -66,6 +184,29 @@ defmodule Penelope.NIF do
     :erlang.nif_error(:nif_library_not_loaded)
   end
 
+  @doc "creates an online linear learner"
+  @spec lin_learner(params :: map) :: reference
+  def lin_learner(_params) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "updates an online linear learner with a batch of samples"
+  @spec lin_partial_fit(
+          learner :: reference,
+          x :: [Vector.t()],
+          y :: [integer],
+          options :: map
+        ) :: :ok
+  def lin_partial_fit(_learner, _x, _y, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "copies the weights of an online learner into a linear model"
+  @spec lin_snapshot(learner :: reference) :: reference
+  def lin_snapshot(_learner) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
   @doc "trains an svm model using libsvm"
   @spec svm_train(x :: [Vector.t()], y :: [integer], params :: map) ::
           reference
@@ -73,6 +214,13 @@ defmodule Penelope.NIF do
     :erlang.nif_error(:nif_library_not_loaded)
   end
 
+  @doc "trains an svm model on a background job thread"
+  @spec svm_train_async(x :: [Vector.t()], y :: [integer], params :: map) ::
+          reference
+  def svm_train_async(_x, _y, _params) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
   @doc "extracts svm model parameters from a model resource"
   @spec svm_export(model :: reference) :: map
   def svm_export(_model) do
@@ -109,6 +257,22 @@ defmodule Penelope.NIF do
     :erlang.nif_error(:nif_library_not_loaded)
   end
 
+  @doc "trains a crf model from a crfsuite-format training file"
+  @spec crf_train_file(path :: String.t(), params :: map) :: reference
+  def crf_train_file(_path, _params) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "trains a crf model on a background job thread"
+  @spec crf_train_async(
+          x :: [[%{String.t() => float}]],
+          y :: [[String.t()]],
+          params :: map
+        ) :: reference
+  def crf_train_async(_x, _y, _params) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
   @doc "extracts crf model parameters from a model resource"
   @spec crf_export(model :: reference) :: map
   def crf_export(_model) do
@@ -127,4 +291,166 @@ defmodule Penelope.NIF do
   def crf_predict(_model, _x) do
     :erlang.nif_error(:nif_library_not_loaded)
   end
+
+  @doc """
+  predicts a sequence from a sequence of features, with a set of features
+  shared by every element of the sequence
+  """
+  @spec crf_predict(
+          model :: reference,
+          x :: [[String.t() | list | map]],
+          shared :: %{String.t() => float}
+        ) :: {[String.t()], float}
+  def crf_predict(_model, _x, _shared) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc """
+  prunes low-weight features and unused attributes from a model, returning
+  the pruned model and a report comparing it to the original on a sample
+  """
+  @spec crf_prune(
+          model :: reference,
+          threshold :: float,
+          sample :: [[map]]
+        ) :: {reference, map}
+  def crf_prune(_model, _threshold, _sample) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc """
+  applies online updates to a model for a batch of labeled sequences,
+  returning the updated model
+  """
+  @spec crf_update(
+          model :: reference,
+          x :: [[map]],
+          y :: [[String.t()]],
+          options :: map
+        ) :: reference
+  def crf_update(_model, _x, _y, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "retrieves the state score cache statistics of a model"
+  @spec crf_cache_stats(model :: reference) :: map
+  def crf_cache_stats(_model) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc """
+  featurizes a token sequence with the POS featurizer, and predicts its tags
+  """
+  @spec crf_predict_pos(model :: reference, tokens :: [String.t()]) ::
+          {[String.t()], float}
+  def crf_predict_pos(_model, _tokens) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "creates a word vector store file, returning its writer"
+  @spec w2v_create(
+          path :: String.t(),
+          name :: String.t(),
+          vector_size :: pos_integer,
+          options :: map
+        ) :: reference
+  def w2v_create(_path, _name, _vector_size, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "appends a word vector to a store writer"
+  @spec w2v_insert(
+          writer :: reference,
+          term :: String.t(),
+          id :: pos_integer,
+          vector :: Vector.t()
+        ) :: :ok
+  def w2v_insert(_writer, _term, _id, _vector) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "completes a word vector store file"
+  @spec w2v_close(writer :: reference) :: :ok
+  def w2v_close(_writer) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "appends the word vectors of a source file to a store writer"
+  @spec w2v_compile(
+          writer :: reference,
+          path :: String.t(),
+          options :: map
+        ) :: non_neg_integer
+  def w2v_compile(_writer, _path, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "maps a word vector store file into memory"
+  @spec w2v_open(path :: String.t()) :: reference
+  def w2v_open(_path) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "retrieves the metadata of a word vector store"
+  @spec w2v_info(store :: reference) :: map
+  def w2v_info(_store) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "searches a word vector store for a term"
+  @spec w2v_lookup(store :: reference, term :: String.t()) ::
+          {non_neg_integer, Vector.t()}
+  def w2v_lookup(_store, _term) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "retrieves a term from a word vector store by id"
+  @spec w2v_fetch(store :: reference, id :: non_neg_integer) ::
+          String.t() | nil
+  def w2v_fetch(_store, _id) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "computes the mean term vector of each of a list of documents"
+  @spec w2v_mean_batch(
+          store :: reference,
+          documents :: [[String.t()]],
+          options :: map
+        ) :: binary
+  def w2v_mean_batch(_store, _documents, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "builds the nearest neighbor graph of a word vector store"
+  @spec w2v_build_graph(
+          store :: reference,
+          path :: String.t(),
+          options :: map
+        ) :: :ok
+  def w2v_build_graph(_store, _path, _options) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "maps the nearest neighbor graph of a word vector store"
+  @spec w2v_open_graph(store :: reference, path :: String.t()) :: reference
+  def w2v_open_graph(_store, _path) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "finds the terms nearest to a query term or vector"
+  @spec w2v_nearest(
+          source :: reference,
+          query :: binary,
+          k :: non_neg_integer,
+          ef :: non_neg_integer
+        ) :: [{String.t(), pos_integer, float}]
+  def w2v_nearest(_source, _query, _k, _ef) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
+
+  @doc "requests cancellation of a training job"
+  @spec job_cancel(job :: reference) :: :ok
+  def job_cancel(_job) do
+    :erlang.nif_error(:nif_library_not_loaded)
+  end
 end
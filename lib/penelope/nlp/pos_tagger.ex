@@ -14,7 +14,10 @@ defmodule Penelope.NLP.POSTagger do
   of how to train a new POS tagger model.
   """
 
+  alias Penelope.ML.CRF.Tagger
   alias Penelope.ML.Pipeline
+  alias Penelope.ML.Text.POSFeaturizer
+  alias Penelope.NIF
 
   @type model :: %{pos_tagger: [{atom, any}]}
 
@@ -35,6 +38,11 @@ defmodule Penelope.NLP.POSTagger do
   @doc """
   Attaches part of speech tags to a list of tokens.
 
+  Models using the default pipeline (the POS featurizer followed by the CRF
+  tagger) are featurized natively, resolving the features directly against
+  the CRF model in a single call, instead of building feature maps for each
+  token.
+
   Example:
   ```
   iex> POSTagger.tag(model, %{}, ["Judy", "saw", "her"])
@@ -45,12 +53,30 @@ defmodule Penelope.NLP.POSTagger do
           {String.t(), String.t()}
         ]
   def tag(model, context, tokens) do
-    [{tags, _probability}] =
-      Pipeline.predict_sequence(model.pos_tagger, context, [tokens])
-
+    {tags, _probability} = predict(model.pos_tagger, context, tokens)
     Enum.zip(tokens, tags)
   end
 
+  defp predict(_pipeline, _context, []) do
+    {[], 1.0}
+  end
+
+  defp predict(
+         [
+           {POSFeaturizer, _featurizer},
+           {Tagger, %{crf: crf, shared_context: []}}
+         ],
+         _context,
+         tokens
+       ) do
+    NIF.crf_predict_pos(crf, tokens)
+  end
+
+  defp predict(pipeline, context, tokens) do
+    [result] = Pipeline.predict_sequence(pipeline, context, [tokens])
+    result
+  end
+
   @doc """
   Imports parameters from a serialized model.
   """
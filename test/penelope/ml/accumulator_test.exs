@@ -0,0 +1,88 @@
+defmodule Penelope.ML.AccumulatorTest do
+  @moduledoc """
+  These tests verify the vector accumulator module.
+  """
+
+  use ExUnit.Case, async: true
+
+  import ExUnitProperties
+  import Penelope.TestUtility
+
+  alias Penelope.ML.Accumulator
+  alias Penelope.ML.Vector
+  alias StreamData, as: Gen
+
+  test "create" do
+    assert_raise ArgumentError, fn -> Accumulator.new(-1) end
+    assert_raise ArgumentError, fn -> Accumulator.new(:invalid) end
+
+    assert Accumulator.to_vector(Accumulator.new(0)) === Vector.empty()
+    assert Accumulator.to_vector(Accumulator.new(3)) === Vector.zeros(3)
+
+    x = Vector.from_list([1, 2, 3])
+    assert Accumulator.to_vector(Accumulator.new(x)) === x
+  end
+
+  test "update" do
+    x = Vector.from_list([1, 2, 3])
+    acc = Accumulator.new(3)
+
+    assert_raise ArgumentError, fn ->
+      Accumulator.add(acc, Vector.zeros(2))
+    end
+
+    assert_raise ArgumentError, fn ->
+      Accumulator.add_many(acc, [x, Vector.zeros(2)])
+    end
+
+    # failed updates leave the accumulator unchanged
+    assert Accumulator.to_vector(acc) === Vector.zeros(3)
+
+    acc
+    |> Accumulator.add(x)
+    |> Accumulator.scale_add(2, x)
+    |> Accumulator.scale(0.5)
+    |> Accumulator.add_many([x, x])
+
+    assert Accumulator.to_vector(acc) === Vector.from_list([3.5, 7, 10.5])
+  end
+
+  test "freeze" do
+    x = Vector.from_list([1, 2, 3])
+    acc = Accumulator.new(x)
+
+    assert Accumulator.freeze(acc) === x
+
+    assert_raise ArgumentError, fn -> Accumulator.freeze(acc) end
+    assert_raise ArgumentError, fn -> Accumulator.to_vector(acc) end
+    assert_raise ArgumentError, fn -> Accumulator.add(acc, x) end
+    assert_raise ArgumentError, fn -> Accumulator.scale(acc, 2) end
+  end
+
+  test "sum" do
+    check all(
+            n <- Gen.integer(1..16),
+            vectors <-
+              Gen.list_of(
+                Gen.list_of(Gen.float(min: -1, max: 1), length: n),
+                min_length: 1,
+                max_length: 8
+              )
+          ) do
+      vectors = Enum.map(vectors, &Vector.from_list/1)
+
+      actual =
+        n
+        |> Accumulator.new()
+        |> Accumulator.add_many(vectors)
+        |> Accumulator.freeze()
+
+      expect = Enum.reduce(vectors, Vector.zeros(n), &Vector.add/2)
+
+      actual = Vector.to_list(actual)
+      expect = Vector.to_list(expect)
+
+      for {x, y} <- Enum.zip(actual, expect), do: assert(float_equals(x, y))
+    end
+  end
+end
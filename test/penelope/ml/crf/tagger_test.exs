@@ -12,6 +12,7 @@ defmodule Penelope.ML.CRF.TaggerTest do
   import Penelope.TestUtility
 
   alias Penelope.ML.CRF.Tagger
+  alias Penelope.ML.Job
   alias StreamData, as: Gen
 
   @x_train [
@@ -66,7 +67,12 @@ defmodule Penelope.ML.CRF.TaggerTest do
             averaging? <- Gen.boolean(),
             variance <- Gen.float(min: 0, max: 1),
             gamma <- Gen.float(min: 1.0e-5),
-            verbose <- Gen.boolean()
+            verbose <- Gen.boolean(),
+            decoder <- Gen.one_of([:crfsuite, :native]),
+            constraints <- Gen.one_of([:none, :iob]),
+            beam <- Gen.integer(0..4),
+            state_cache <- Gen.integer(0..20),
+            dedupe? <- Gen.boolean()
           ) do
       options = [
         algorithm: algorithm,
@@ -93,7 +99,12 @@ defmodule Penelope.ML.CRF.TaggerTest do
         averaging?: averaging?,
         variance: variance,
         gamma: gamma,
-        verbose: verbose
+        verbose: verbose,
+        decoder: decoder,
+        constraints: if(decoder === :native, do: constraints, else: :none),
+        beam: if(decoder === :native, do: beam, else: 0),
+        state_cache: if(decoder === :native, do: state_cache, else: 0),
+        dedupe?: dedupe?
       ]
 
       model = Tagger.fit(%{}, @x_train, @y_train, options)
@@ -171,6 +182,418 @@ defmodule Penelope.ML.CRF.TaggerTest do
     assert y_prob >= 0 and y_prob <= 1
   end
 
+  test "native decoder" do
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, decoder: :invalid)
+    end)
+
+    reference = Tagger.fit(%{}, @x_train, @y_train, c2: 0.1)
+    params = Tagger.export(reference)
+    native = Tagger.compile(Map.put(params, "decoder", "native"))
+
+    assert Tagger.export(native)["decoder"] === "native"
+
+    x =
+      @x_train ++
+        [
+          ["some", "unseen", "input"],
+          ["four", "hundred", "pears", "and", "one", "apples"]
+        ]
+
+    expect = Tagger.predict_sequence(reference, %{}, x)
+    actual = Tagger.predict_sequence(native, %{}, x)
+
+    for {{y_expect, p_expect}, {y_actual, p_actual}} <-
+          Enum.zip(expect, actual) do
+      assert y_actual === y_expect
+      assert_in_delta p_actual, p_expect, 1.0e-4
+    end
+  end
+
+  test "constrained decoding" do
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, constraints: :iob)
+    end)
+
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, decoder: :native, beam: -1)
+    end)
+
+    reference = Tagger.fit(%{}, @x_train, @y_train, decoder: :native)
+    params = Tagger.export(reference)
+    assert params["constraints"] === "none"
+    assert params["beam"] === 0
+
+    x = @x_train ++ [["some", "unseen", "input"], ["hundred", "apples"]]
+
+    for constraints <- ["iob", [["o", "i_num"], ["b_num", "b_num"]]],
+        beam <- [0, 1, 2, 100] do
+      params =
+        params
+        |> Map.put("constraints", constraints)
+        |> Map.put("beam", beam)
+
+      model = Tagger.compile(params)
+      assert Tagger.export(model) === params
+
+      y = Tagger.predict_sequence(model, %{}, x)
+
+      for {x, {y_pred, y_prob}} <- Enum.zip(x, y) do
+        assert length(y_pred) === length(x)
+        assert y_prob >= 0 and y_prob <= 1
+
+        # no disallowed transitions are predicted
+        pairs = Enum.chunk_every(y_pred, 2, 1, :discard)
+
+        if constraints === "iob" do
+          refute List.first(y_pred) === "i_num"
+          refute ["o", "i_num"] in pairs
+        else
+          assert Enum.all?(pairs, &(&1 not in constraints))
+        end
+      end
+
+      # exact decoding (or a beam covering all labels) recovers the
+      # training set
+      if beam in [0, 100] do
+        y = Tagger.predict_sequence(model, %{}, @x_train)
+
+        for {{y_pred, _y_prob}, y_true} <- Enum.zip(y, @y_train) do
+          assert y_pred === y_true
+        end
+      end
+    end
+  end
+
+  test "state cache" do
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, state_cache: 10)
+    end)
+
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, decoder: :native, state_cache: -1)
+    end)
+
+    reference = Tagger.fit(%{}, @x_train, @y_train, decoder: :native)
+    expected = Tagger.predict_sequence(reference, %{}, @x_train)
+    params = Tagger.export(reference)
+
+    assert params["state_cache"] === 0
+
+    assert Tagger.cache_stats(reference) ===
+             %{capacity: 0, size: 0, hits: 0, misses: 0}
+
+    # small capacities evict entries, but never change the predictions
+    for capacity <- [1, 3, 1000] do
+      params = Map.put(params, "state_cache", capacity)
+      model = Tagger.compile(params)
+      assert Tagger.export(model) === params
+
+      for _ <- 1..3 do
+        y = Tagger.predict_sequence(model, %{}, @x_train)
+
+        for {{y_pred, p}, {y_ref, p_ref}} <- Enum.zip(y, expected) do
+          assert y_pred === y_ref
+          assert_in_delta p, p_ref, 1.0e-5
+        end
+      end
+
+      # each of the 8 tokens is looked up once per prediction
+      stats = Tagger.cache_stats(model)
+      assert stats.capacity === capacity
+      assert stats.size <= capacity
+      assert stats.hits + stats.misses === 24
+
+      if capacity === 1000 do
+        assert stats.size === 8
+        assert stats.misses === 8
+      end
+    end
+  end
+
+  test "shared context" do
+    context = %{intent: "fruit"}
+    x = @x_train ++ [["some", "unseen", "input"], ["four", "apples"]]
+
+    copied =
+      for x_i <- x do
+        Enum.map(x_i, &%{&1 => 1, "intent" => "fruit"})
+      end
+
+    for decoder <- [:crfsuite, :native] do
+      options = [decoder: decoder, c2: 0.1]
+
+      expect =
+        %{}
+        |> Tagger.fit(Enum.take(copied, 3), @y_train, options)
+        |> Tagger.predict_sequence(%{}, copied)
+
+      model =
+        Tagger.fit(
+          context,
+          @x_train,
+          @y_train,
+          [shared_context: ["intent"]] ++ options
+        )
+
+      params = Tagger.export(model)
+      assert params["shared_context"] === ["intent"]
+      model = Tagger.compile(params)
+
+      actual = Tagger.predict_sequence(model, context, x)
+
+      for {{y_expect, p_expect}, {y_actual, p_actual}} <-
+            Enum.zip(expect, actual) do
+        assert y_actual === y_expect
+        assert_in_delta p_actual, p_expect, 1.0e-4
+      end
+    end
+  end
+
+  test "fit file" do
+    path = "/tmp/penelope_ml_crf_tagger_fit_file.txt"
+
+    try do
+      assert_raise(fn -> Tagger.fit_file(path) end)
+
+      # write the training set in crfsuite format, with an escaped feature
+      # and a weighted sequence
+      lines =
+        for {x, y} <- Enum.zip(@x_train, @y_train), x !== [] do
+          items =
+            x
+            |> Enum.zip(y)
+            |> Enum.map(fn {x, y} -> "#{y}\t#{x}\tw\\:#{x}:0.5\n" end)
+
+          ["@weight:2.0\n" | items] ++ ["\n"]
+        end
+
+      File.write!(path, lines)
+
+      model = Tagger.fit_file(path, c2: 0.1)
+      y = Tagger.predict_sequence(model, %{}, @x_train)
+
+      for {{y_pred, y_prob}, y_true} <- Enum.zip(y, @y_train) do
+        assert y_pred === y_true
+        assert y_prob >= 0 and y_prob <= 1
+      end
+
+      File.write!(path, "o\tx:invalid\n")
+      assert_raise(fn -> Tagger.fit_file(path) end)
+
+      File.write!(path, "\t\t\n")
+      assert_raise(fn -> Tagger.fit_file(path) end)
+
+      File.write!(path, "\tx\n")
+      assert_raise(fn -> Tagger.fit_file(path) end)
+    after
+      File.rm(path)
+    end
+  end
+
+  test "prune" do
+    for decoder <- [:crfsuite, :native] do
+      model = Tagger.fit(%{}, @x_train, @y_train, c1: 0.1, decoder: decoder)
+
+      # pruning zero weights leaves the predictions unchanged
+      {pruned, report} = Tagger.prune(model, 0, @x_train)
+
+      assert report.features_after <= report.features_before
+      assert report.attrs_after <= report.attrs_before
+      assert report.bytes_after <= report.bytes_before
+      assert report.agreement === 1.0
+
+      assert Tagger.predict_sequence(pruned, %{}, @x_train) ===
+               Tagger.predict_sequence(model, %{}, @x_train)
+
+      params = Tagger.export(pruned)
+      assert params === Tagger.export(Tagger.compile(params))
+
+      # pruning every feature leaves only the label set
+      {pruned, report} = Tagger.prune(model, 1.0e9)
+      assert report.features_after === 0
+      assert report.attrs_after === 0
+      assert report.agreement === 1.0
+
+      predictions = Tagger.predict_sequence(pruned, %{}, @x_train)
+
+      for {x, {y, _p}} <- Enum.zip(@x_train, predictions) do
+        assert length(y) === length(x)
+      end
+    end
+
+    model = Tagger.fit(%{}, @x_train, @y_train)
+    assert_raise(fn -> Tagger.prune(model, -1) end)
+  end
+
+  test "update" do
+    x = [["you", "have", "six", "kiwis"]]
+    y = [["o", "o", "b_num", "b_veg"]]
+
+    for decoder <- [:crfsuite, :native], algorithm <- [:pa, :perceptron] do
+      model = Tagger.fit(%{}, @x_train, @y_train, decoder: decoder)
+      expect = Tagger.predict_sequence(model, %{}, @x_train)
+
+      # the update adds the new attributes/label to a new model, leaving
+      # the original model unchanged
+      updated =
+        Tagger.update(model, %{}, x, y,
+          algorithm: algorithm,
+          c: 10.0,
+          epochs: 10
+        )
+
+      assert Tagger.predict_sequence(model, %{}, @x_train) === expect
+
+      [{labels, _p}] = Tagger.predict_sequence(updated, %{}, x)
+      assert labels === hd(y)
+
+      params = Tagger.export(updated)
+      assert params === Tagger.export(Tagger.compile(params))
+
+      # sequences that are already decoded correctly leave the weights as
+      # they are
+      labels = Enum.map(expect, &elem(&1, 0))
+      same = Tagger.update(model, %{}, @x_train, labels)
+
+      for {{y_pred, y_prob}, {y_ref, y_ref_prob}} <-
+            Enum.zip(Tagger.predict_sequence(same, %{}, @x_train), expect) do
+        assert y_pred === y_ref
+        assert_in_delta y_prob, y_ref_prob, 1.0e-6
+      end
+    end
+
+    model = Tagger.fit(%{}, @x_train, @y_train)
+    assert_raise(fn -> Tagger.update(model, %{}, x, []) end)
+    assert_raise(fn -> Tagger.update(model, %{}, x, y, algorithm: :x) end)
+    assert_raise(fn -> Tagger.update(model, %{}, x, y, c: 0) end)
+    assert_raise(fn -> Tagger.update(model, %{}, x, y, epochs: 0) end)
+  end
+
+  test "dedupe" do
+    # duplicated sequences collapse into weighted sequences, which leaves
+    # the L-BFGS objective unchanged
+    x = Enum.flat_map(1..10, fn _ -> @x_train end)
+    y = Enum.flat_map(1..10, fn _ -> @y_train end)
+
+    reference =
+      %{}
+      |> Tagger.fit(x, y, c2: 0.1)
+      |> Tagger.predict_sequence(%{}, @x_train)
+
+    model = Tagger.fit(%{}, x, y, c2: 0.1, dedupe?: true)
+    y = Tagger.predict_sequence(model, %{}, @x_train)
+
+    for {{y_pred, y_prob}, {y_ref, y_ref_prob}} <- Enum.zip(y, reference) do
+      assert y_pred === y_ref
+      assert_in_delta y_prob, y_ref_prob, 1.0e-3
+    end
+  end
+
+  test "multi-threaded training" do
+    assert_raise(fn ->
+      Tagger.fit(%{}, @x_train, @y_train, threads: 0)
+    end)
+
+    for threads <- [2, 3, 8], c1 <- [0.0, 0.01] do
+      options = [threads: threads, c1: c1, c2: 0.1]
+      model = Tagger.fit(%{}, @x_train, @y_train, options)
+
+      y = Tagger.predict_sequence(model, %{}, @x_train)
+
+      for {{y_pred, y_prob}, y_true} <- Enum.zip(y, @y_train) do
+        assert y_pred === y_true
+        assert y_prob >= 0 and y_prob <= 1
+      end
+
+      # training is deterministic for a fixed thread count
+      assert Tagger.export(model) ===
+               Tagger.export(Tagger.fit(%{}, @x_train, @y_train, options))
+    end
+  end
+
+  test "early stopping" do
+    invalid = [
+      [holdout: 0],
+      [holdout: 1.0],
+      [holdout: {[hd(@x_train)], @y_train}],
+      [holdout: 0.5, algorithm: :ap],
+      [holdout: 0.5, holdout_period: 0],
+      [holdout: 0.5, holdout_metric: :invalid],
+      [holdout: 0.5, patience: -1],
+      [max_seconds: 0],
+      [max_seconds: 1, algorithm: :pa]
+    ]
+
+    for options <- invalid do
+      assert_raise(fn -> Tagger.fit(%{}, @x_train, @y_train, options) end)
+    end
+
+    # without patience, the first weights that label the holdout set
+    # perfectly are kept
+    for metric <- [:token, :sequence], period <- [1, 3] do
+      options = [
+        holdout: {@x_train, @y_train},
+        holdout_metric: metric,
+        holdout_period: period,
+        patience: 0
+      ]
+
+      model = Tagger.fit(%{}, @x_train, @y_train, options)
+      y = Tagger.predict_sequence(model, %{}, @x_train)
+
+      for {{y_pred, _y_prob}, y_true} <- Enum.zip(y, @y_train) do
+        assert y_pred === y_true
+      end
+    end
+
+    # a holdout fraction is split off from the training sequences
+    x = for i <- 1..20, x <- @x_train, do: ["x#{i}" | x]
+    y = for _ <- 1..20, y <- @y_train, do: ["o" | y]
+    model = Tagger.fit(%{}, x, y, holdout: 0.25, c2: 0.1)
+    y = Tagger.predict_sequence(model, %{}, x)
+
+    for {{y_pred, _y_prob}, x} <- Enum.zip(y, x) do
+      assert length(y_pred) === length(x)
+    end
+
+    # patience and time budgets cut training short
+    full = fit_iterations([])
+    assert fit_iterations(holdout: {@x_train, @y_train}, patience: 1) < full
+    assert fit_iterations(max_seconds: 1.0e-6) === 1
+  end
+
+  test "fit async" do
+    assert_raise(fn ->
+      Tagger.fit_async(%{}, @x_train, [hd(@y_train)])
+    end)
+
+    for algorithm <- [:lbfgs, :l2sgd, :ap, :pa, :arow] do
+      job = Tagger.fit_async(%{}, @x_train, @y_train, algorithm: algorithm)
+      parent = self()
+
+      {:ok, model} =
+        Job.await(job, on_progress: &send(parent, {:progress, &1}))
+
+      assert_received {:progress, {iteration, _objective, elapsed}}
+      assert iteration > 0 and elapsed >= 0
+
+      y = Tagger.predict_sequence(model, %{}, @x_train)
+
+      for {{y_pred, y_prob}, y_true} <- Enum.zip(y, @y_train) do
+        assert y_pred === y_true
+        assert y_prob >= 0 and y_prob <= 1
+      end
+    end
+
+    # cancel a longer training run before it completes
+    x = Enum.concat(List.duplicate(@x_train, 1000))
+    y = Enum.concat(List.duplicate(@y_train, 1000))
+    job = Tagger.fit_async(%{}, x, y, max_iterations: 10_000, epsilon: 0.0)
+    assert Job.cancel(job) === :ok
+    assert Job.await(job) === {:error, :cancelled}
+  end
+
   test "global parallelism" do
     tasks =
       Task.async_stream(
@@ -214,6 +637,25 @@ defmodule Penelope.ML.CRF.TaggerTest do
     Stream.run(tasks)
   end
 
+  # counts the training iterations reported by a training job
+  defp fit_iterations(options) do
+    parent = self()
+    job = Tagger.fit_async(%{}, @x_train, @y_train, options)
+
+    {:ok, _model} =
+      Job.await(job, on_progress: &send(parent, {:progress, &1}))
+
+    count_progress(0)
+  end
+
+  defp count_progress(count) do
+    receive do
+      {:progress, _progress} -> count_progress(count + 1)
+    after
+      0 -> count
+    end
+  end
+
   @tag :stress
   test "fit stress" do
     for _ <- 1..30_000 do
@@ -0,0 +1,33 @@
+defmodule Penelope.ML.JobTest do
+  @moduledoc """
+  These tests verify the asynchronous job interface.
+  """
+
+  use ExUnit.Case, async: true
+
+  alias Penelope.ML.Job
+
+  test "await" do
+    ref = make_ref()
+    job = Job.new(ref, &%{model: &1})
+
+    assert Job.await(job, timeout: 0) === {:error, :timeout}
+
+    # progress is reported in order, and other jobs' messages are ignored
+    send(self(), {:penelope_job, ref, {:progress, 1, 2.0, 0.1}})
+    send(self(), {:penelope_job, make_ref(), {:ok, :other}})
+    send(self(), {:penelope_job, ref, {:progress, 2, 1.0, 0.2}})
+    send(self(), {:penelope_job, ref, {:ok, :model}})
+
+    parent = self()
+
+    assert Job.await(job, on_progress: &send(parent, {:progress, &1})) ===
+             {:ok, %{model: :model}}
+
+    assert_received {:progress, {1, 2.0, 0.1}}
+    assert_received {:progress, {2, 1.0, 0.2}}
+
+    send(self(), {:penelope_job, ref, {:error, :cancelled}})
+    assert Job.await(job) === {:error, :cancelled}
+  end
+end
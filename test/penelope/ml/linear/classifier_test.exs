@@ -11,6 +11,7 @@ defmodule Penelope.ML.Linear.ClassifierTest do
   import ExUnitProperties
   import Penelope.TestUtility
 
+  alias Penelope.ML.Job
   alias Penelope.ML.Linear.Classifier
   alias Penelope.ML.Vector
   alias StreamData, as: Gen
@@ -95,6 +96,85 @@ defmodule Penelope.ML.Linear.ClassifierTest do
     assert predictions === @y_train
   end
 
+  test "partial fit" do
+    assert_raise(fn -> Classifier.learner(["a"], 2) end)
+    assert_raise(fn -> Classifier.learner(["a", "b"], 0) end)
+    assert_raise(fn -> Classifier.learner(["a", "b"], 2, loss: nil) end)
+    assert_raise(fn -> Classifier.learner(["a", "b"], 2, eta: 0) end)
+    assert_raise(fn -> Classifier.learner(["a", "b"], 2, lambda: -1) end)
+
+    for loss <- [:log, :hinge] do
+      learner = Classifier.learner(["a", "b", "c"], 2, loss: loss)
+      before = Classifier.snapshot(learner)
+
+      # concurrent partial fits update the shared weights
+      1..8
+      |> Task.async_stream(fn _i ->
+        Classifier.partial_fit(learner, @x_train, @y_train, epochs: 20)
+      end)
+      |> Stream.run()
+
+      model = Classifier.snapshot(learner)
+      assert Classifier.predict_class(model, %{}, @x_train) === @y_train
+
+      # snapshots are unaffected by later updates, and can be exported
+      assert Classifier.export(before) !== Classifier.export(model)
+
+      params = Classifier.export(model)
+      assert params === Classifier.export(Classifier.compile(params))
+    end
+
+    # binary learners train a single model
+    x = Enum.take(@x_train, 2)
+    y = Enum.take(@y_train, 2)
+    learner = Classifier.learner(["c", "b"], 2, lambda: 1.0e-4)
+
+    model =
+      learner
+      |> Classifier.partial_fit(x, y, epochs: 50)
+      |> Classifier.snapshot()
+
+    assert Classifier.predict_class(model, %{}, x) === y
+
+    for p <- Classifier.predict_probability(model, %{}, x) do
+      assert float_equals(Enum.sum(Map.values(p)), 1.0)
+    end
+
+    assert_raise(fn -> Classifier.partial_fit(learner, x, ["c"]) end)
+    assert_raise(fn -> Classifier.partial_fit(learner, x, ["c", "a"]) end)
+    assert_raise(fn -> Classifier.partial_fit(learner, x, y, epochs: 0) end)
+
+    assert_raise(fn ->
+      Classifier.partial_fit(learner, [Vector.from_list([1])], ["c"])
+    end)
+  end
+
+  test "fit async" do
+    assert_raise(fn ->
+      Classifier.fit_async(%{}, @x_train, [hd(@y_train)])
+    end)
+
+    job = Classifier.fit_async(%{}, @x_train, @y_train, solver: :l2r_lr)
+    parent = self()
+
+    {:ok, model} =
+      Job.await(job, on_progress: &send(parent, {:progress, &1}))
+
+    assert_received {:progress, {iteration, objective, elapsed}}
+    assert iteration > 0 and objective > 0 and elapsed >= 0
+
+    predictions = Classifier.predict_class(model, %{}, @x_train)
+    assert predictions === @y_train
+
+    for solver <- @solvers do
+      job = Classifier.fit_async(%{}, @x_train, @y_train, solver: solver)
+      assert {:ok, %{lin: _, classes: _}} = Job.await(job)
+    end
+
+    job = Classifier.fit_async(%{}, @x_train, @y_train, c: 0)
+    assert {:error, _reason} = Job.await(job)
+  end
+
   test "predict svm probability" do
     assert_raise(fn ->
       model = Classifier.fit(%{}, @x_train, @y_train)
@@ -0,0 +1,124 @@
+defmodule Penelope.ML.MatrixTest do
+  @moduledoc """
+  These tests verify the matrix module.
+  """
+
+  use ExUnit.Case, async: true
+
+  import ExUnitProperties
+  import Penelope.TestUtility
+
+  alias Penelope.ML.Matrix
+  alias Penelope.ML.Vector
+  alias StreamData, as: Gen
+
+  # 2 x 3
+  @a Vector.from_list([1, 2, 3, 4, 5, 6])
+
+  test "rows" do
+    assert Matrix.from_rows([]) === {Vector.empty(), {0, 0}}
+
+    rows = [Vector.from_list([1, 2, 3]), Vector.from_list([4, 5, 6])]
+    assert Matrix.from_rows(rows) === {@a, {2, 3}}
+
+    assert Matrix.row(@a, {2, 3}, 1) === Vector.from_list([4, 5, 6])
+  end
+
+  test "matrix-vector product" do
+    assert_raise ArgumentError, fn ->
+      Matrix.multiply_vector(@a, {3, 3}, Vector.from_list([1, 1, 1]))
+    end
+
+    assert_raise ArgumentError, fn ->
+      Matrix.multiply_vector(@a, {2, 3}, Vector.from_list([1, 1]))
+    end
+
+    x = Vector.from_list([1, 0, 1])
+    y = Matrix.multiply_vector(@a, {2, 3}, x)
+    assert y === Vector.from_list([4, 10])
+
+    x = Vector.from_list([1, 1])
+    y = Matrix.multiply_vector(@a, {2, 3}, x, transpose?: true, alpha: 2)
+    assert y === Vector.from_list([10, 14, 18])
+
+    x = Vector.from_list([1, 0, 1])
+    y = Matrix.multiply_vector(Vector.empty(), {0, 3}, x)
+    assert y === Vector.empty()
+  end
+
+  test "matrix product" do
+    assert_raise ArgumentError, fn ->
+      Matrix.multiply(@a, {2, 3}, @a, {2, 3})
+    end
+
+    # a a' and a' a
+    assert Matrix.multiply(@a, {2, 3}, @a, {2, 3}, transpose_b?: true) ===
+             {Vector.from_list([14, 32, 32, 77]), {2, 2}}
+
+    {c, shape} = Matrix.multiply(@a, {2, 3}, @a, {2, 3}, transpose_a?: true)
+    assert shape === {3, 3}
+    assert c === Vector.from_list([17, 22, 27, 22, 29, 36, 27, 36, 45])
+
+    check all(
+            m <- Gen.integer(1..8),
+            n <- Gen.integer(1..8),
+            k <- Gen.integer(1..8),
+            a <- Gen.list_of(Gen.float(min: -1, max: 1), length: m * k),
+            b <- Gen.list_of(Gen.float(min: -1, max: 1), length: k * n)
+          ) do
+      va = Vector.from_list(a)
+      vb = Vector.from_list(b)
+      {c, {^m, ^n}} = Matrix.multiply(va, {m, k}, vb, {k, n})
+
+      # each column of c is a times the corresponding column of b
+      for j <- 0..(n - 1) do
+        column = Enum.map(0..(k - 1), &Enum.at(b, &1 * n + j))
+
+        column = Vector.from_list(column)
+        expect = Matrix.multiply_vector(va, {m, k}, column)
+
+        actual = Enum.map(0..(m - 1), &Vector.get(c, &1 * n + j))
+
+        for {x, y} <- Enum.zip(Vector.to_list(expect), actual) do
+          assert float_equals(x, y)
+        end
+      end
+    end
+  end
+
+  test "cosine similarity" do
+    assert_raise ArgumentError, fn -> Matrix.cosine(@a, Vector.empty()) end
+
+    assert_raise ArgumentError, fn ->
+      Matrix.cosine(@a, Vector.from_list([1, 1, 1, 1]))
+    end
+
+    a = Vector.from_list([1, 0, 0, 1, 2, 2, 0, 0])
+    similarity = Matrix.cosine(a, Vector.from_list([1, 1]))
+
+    [x, y, z, w] = Vector.to_list(similarity)
+    assert float_equals(x, :math.sqrt(0.5))
+    assert float_equals(y, :math.sqrt(0.5))
+    assert float_equals(z, 1.0)
+    assert w === 0.0
+
+    assert Matrix.cosine(Vector.empty(), Vector.from_list([1])) ===
+             Vector.empty()
+  end
+
+  test "large operations" do
+    # large enough to run on a dirty scheduler
+    n = 1024
+    a = Vector.fill(n * n, 1)
+    x = Vector.fill(n, 1)
+
+    assert Matrix.multiply_vector(a, {n, n}, x) === Vector.fill(n, n)
+
+    for similarity <- Vector.to_list(Matrix.cosine(a, x)) do
+      assert float_equals(similarity, 1.0)
+    end
+
+    {c, {^n, ^n}} = Matrix.multiply(a, {n, n}, a, {n, n})
+    assert c === Vector.fill(n * n, n)
+  end
+end
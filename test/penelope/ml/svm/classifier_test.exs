@@ -11,6 +11,7 @@ defmodule Penelope.ML.SVM.ClassifierTest do
   import ExUnitProperties
   import Penelope.TestUtility
 
+  alias Penelope.ML.Job
   alias Penelope.ML.SVM.Classifier
   alias Penelope.ML.Vector
   alias StreamData, as: Gen
@@ -106,6 +107,27 @@ defmodule Penelope.ML.SVM.ClassifierTest do
     assert predictions === @y_train
   end
 
+  test "fit async" do
+    assert_raise(fn ->
+      Classifier.fit_async(%{}, @x_train, [hd(@y_train)])
+    end)
+
+    job = Classifier.fit_async(%{}, @x_train, @y_train)
+    parent = self()
+
+    {:ok, model} =
+      Job.await(job, on_progress: &send(parent, {:progress, &1}))
+
+    assert_received {:progress, {_iteration, _objective, elapsed}}
+    assert elapsed >= 0
+
+    predictions = Classifier.predict_class(model, %{}, @x_train)
+    assert predictions === @y_train
+
+    job = Classifier.fit_async(%{}, @x_train, @y_train, c: 0)
+    assert {:error, _reason} = Job.await(job)
+  end
+
   test "predict probability" do
     assert_raise(fn ->
       model = Classifier.fit(%{}, @x_train, @y_train)
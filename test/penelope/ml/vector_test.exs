@@ -41,10 +41,57 @@ defmodule Penelope.ML.VectorTest do
     assert zeros(2) === from_list([0, 0])
   end
 
+  test "fill" do
+    assert_raise ArgumentError, fn -> fill(-1, 0) end
+
+    assert fill(0, 1) === empty()
+    assert fill(2, 1.5) === from_list([1.5, 1.5])
+  end
+
   test "list conversion" do
+    assert_raise ArgumentError, fn -> from_list([nil]) end
+
     assert to_list(from_list([])) === []
     assert to_list(from_list([1])) === [1.0]
     assert to_list(from_list([1, 2])) === [1.0, 2.0]
+
+    # non-finite values convert to/from :NaN
+    assert from_list([:NaN]) === <<0, 0, 128, 127>>
+    assert to_list(from_list([1, :NaN])) === [1.0, :NaN]
+
+    check all(x <- Gen.list_of(Gen.float(min: -1.0e6, max: 1.0e6))) do
+      expect = Enum.map(x, &<<&1::float()-native()-size(32)>>)
+      assert from_list(x) === Enum.join(expect)
+
+      decode = fn <<v::float()-native()-size(32)>> -> v end
+      assert to_list(from_list(x)) === Enum.map(expect, decode)
+    end
+  end
+
+  test "slice" do
+    x = from_list([1, 2, 3])
+
+    assert_raise ArgumentError, fn -> slice(x, -1, 1) end
+    assert_raise ArgumentError, fn -> slice(x, 2, 2) end
+
+    assert slice(x, 0, 0) === empty()
+    assert slice(x, 0, 3) === x
+    assert slice(x, 1, 2) === from_list([2, 3])
+  end
+
+  test "concatenation" do
+    assert_raise ArgumentError, fn -> concat([nil]) end
+
+    assert concat([]) === empty()
+    assert concat([empty(), empty()]) === empty()
+
+    assert concat([from_list([1]), empty(), from_list([2, 3])]) ===
+             from_list([1, 2, 3])
+
+    check all(x <- Gen.list_of(Gen.list_of(Gen.float(min: 0, max: 1)))) do
+      vx = Enum.map(x, &from_list/1)
+      assert concat(vx) === Enum.reduce(vx, empty(), &concat(&2, &1))
+    end
   end
 
   test "scaling" do
@@ -144,4 +191,88 @@ defmodule Penelope.ML.VectorTest do
       |> Enum.each(fn {x, y, z} -> assert float_equals(a * x + y, z) end)
     end
   end
+
+  test "mean" do
+    assert_raise ArgumentError, fn -> mean([]) end
+
+    assert_raise ArgumentError, fn ->
+      mean([from_list([1]), from_list([1, 2])])
+    end
+
+    assert mean([empty()]) === empty()
+    x = [from_list([1, 2]), from_list([3, 6])]
+    assert mean(x) === from_list([2, 4])
+
+    check all(
+            n <- Gen.positive_integer(),
+            x <-
+              Gen.nonempty(
+                Gen.list_of(Gen.float(min: 0, max: 1), length: n)
+              )
+          ) do
+      # the fused mean matches the reduction it replaces
+      vx = Enum.map(x, &from_list/1)
+
+      expect =
+        vx
+        |> Enum.reduce(zeros(n), &add/2)
+        |> scale(1 / length(vx))
+
+      assert mean(vx) === expect
+    end
+  end
+
+  test "weighted sum" do
+    assert_raise ArgumentError, fn -> weighted_sum([], []) end
+
+    assert_raise ArgumentError, fn ->
+      weighted_sum([1], [from_list([1]), from_list([2])])
+    end
+
+    assert_raise ArgumentError, fn ->
+      weighted_sum([1, 1], [from_list([1]), from_list([1, 2])])
+    end
+
+    x = [from_list([1, 2]), from_list([4, 8])]
+    assert weighted_sum([2, 0.5], x) === from_list([4, 8])
+
+    check all(
+            n <- Gen.positive_integer(),
+            x <-
+              Gen.nonempty(
+                Gen.list_of(Gen.float(min: 0, max: 1), length: n)
+              ),
+            w <- Gen.list_of(Gen.float(min: -1, max: 1), length: length(x))
+          ) do
+      vx = Enum.map(x, &from_list/1)
+
+      expect =
+        [w, vx]
+        |> Enum.zip()
+        |> Enum.reduce(zeros(n), fn {a, x}, y -> scale_add(y, a, x) end)
+
+      assert weighted_sum(w, vx) === expect
+    end
+  end
+
+  test "dot product" do
+    assert_raise ArgumentError, fn -> dot(from_list([1]), empty()) end
+
+    assert dot(empty(), empty()) === 0.0
+    assert dot(from_list([1, 2]), from_list([3, 4])) === 11.0
+
+    check all(
+            n <- Gen.positive_integer(),
+            x <- Gen.list_of(Gen.float(min: 0, max: 1), length: n),
+            y <- Gen.list_of(Gen.float(min: 0, max: 1), length: n)
+          ) do
+      expect = [x, y] |> Enum.zip() |> Enum.map(fn {x, y} -> x * y end)
+      assert float_equals(dot(from_list(x), from_list(y)), Enum.sum(expect))
+    end
+  end
+
+  test "norm" do
+    assert norm(empty()) === 0.0
+    assert norm(from_list([3, 4])) === 5.0
+  end
 end
@@ -89,4 +89,295 @@ defmodule Penelope.ML.Word2vec.IndexTest do
 
     Index.close(index)
   end
+
+  test "quantized encodings", %{input: input, output: output} do
+    path = Path.join(output, "quantized")
+
+    assert_raise IndexError, fn ->
+      Index.create!(path, "quantized", vector_size: 10, encoding: :none)
+    end
+
+    assert_raise IndexError, fn ->
+      Index.create!(path, "quantized", vector_size: 1, encoding: :int8)
+    end
+
+    assert_raise IndexError, fn ->
+      Index.create!(path, "quantized",
+        vector_size: 10,
+        encoding: :pq,
+        subspaces: 3
+      )
+    end
+
+    for {encoding, delta} <- [f32: 0, f16: 0.01, int8: 0.05, pq: 0.05] do
+      index =
+        Index.create!(path, "quantized",
+          vector_size: 10,
+          encoding: encoding,
+          threads: 2
+        )
+
+      Index.compile!(index, input)
+      Index.close(index)
+
+      index = Index.open!(path)
+      assert index.encoding === encoding
+      assert index.error <= delta
+      assert Index.lookup!(index, "missing") == {0, Vector.zeros(10)}
+
+      for i <- 1..10 do
+        {id, vector} = Index.lookup!(index, "a" <> Integer.to_string(i))
+        assert id === i
+
+        vector
+        |> Vector.to_list()
+        |> Enum.zip(Enum.map(1..10, fn j -> i / j end))
+        |> Enum.each(fn {a, e} -> assert_in_delta a, e, delta * 10 end)
+      end
+
+      assert Index.mean!(index, []) == Vector.zeros(10)
+
+      mean =
+        Vector.mean([
+          elem(Index.lookup!(index, "a1"), 1),
+          elem(Index.lookup!(index, "a2"), 1),
+          Vector.zeros(10)
+        ])
+
+      index
+      |> Index.mean!(["a1", "a2", "missing"])
+      |> Vector.to_list()
+      |> Enum.zip(Vector.to_list(mean))
+      |> Enum.each(fn {a, e} -> assert_in_delta a, e, 1.0e-5 end)
+    end
+  end
+
+  test "nearest", %{output: output} do
+    path = Path.join(output, "nearest")
+
+    index = Index.create!(path, "nearest", vector_size: 2)
+    Index.parse_insert!(index, {"a 1 0", 1})
+    Index.parse_insert!(index, {"b 0.9 0.1", 2})
+    Index.parse_insert!(index, {"c 0 2", 3})
+    Index.parse_insert!(index, {"d -1 0", 4})
+    Index.parse_insert!(index, {"e 0 0", 5})
+    Index.parse_insert!(index, {"e -3 -0.1", 6})
+    Index.close(index)
+
+    for method <- [nil, :exact, :hnsw] do
+      if method, do: Index.build_nearest!(path, method: method, links: 2)
+      index = Index.open!(path)
+
+      assert [{"b", 2, s1}, {"c", 3, s2}] = Index.nearest!(index, "a", 2)
+      assert_in_delta s1, 0.9 / :math.sqrt(0.82), 1.0e-5
+      assert_in_delta s2, 0.0, 1.0e-5
+
+      assert index
+             |> Index.nearest!(Vector.from_list([-1, 0]), 10)
+             |> Enum.map(fn {term, id, _s} -> {term, id} end) ==
+               [{"d", 4}, {"e", 6}, {"c", 3}, {"b", 2}, {"a", 1}]
+
+      assert Index.nearest!(index, "missing", 2) === []
+      assert Index.nearest!(index, "a", 0) === []
+    end
+
+    # recreating the index discards its graph
+    Index.close(Index.create!(path, "nearest", vector_size: 2))
+    assert Index.open!(path).graph === nil
+  end
+
+  test "nearest graph recall", %{output: output} do
+    path = Path.join(output, "recall")
+    :rand.seed(:exsss, {1, 2, 3})
+
+    index = Index.create!(path, "recall", vector_size: 8)
+
+    for i <- 1..2000 do
+      vector = Vector.from_list(Enum.map(1..8, fn _ -> :rand.normal() end))
+      Index.insert!(index, {"w" <> Integer.to_string(i), i, vector})
+    end
+
+    Index.close(index)
+
+    exact = Index.open!(path)
+    Index.build_nearest!(path, method: :hnsw, threads: 4)
+    approx = Index.open!(path)
+    assert approx.graph !== nil
+
+    hits =
+      Enum.map(1..50, fn i ->
+        term = "w" <> Integer.to_string(i * 40)
+        expect = MapSet.new(nearest_ids(exact, term))
+
+        approx
+        |> nearest_ids(term)
+        |> Enum.count(&MapSet.member?(expect, &1))
+      end)
+
+    assert Enum.sum(hits) >= 450
+  end
+
+  test "compile formats", %{output: output} do
+    path = Path.join(output, "formats")
+    text = Path.join(output, "formats.txt")
+    binary = Path.join(output, "formats.bin")
+
+    File.mkdir_p!(output)
+    File.write!(text, "2 3\nx 1 -2.5 3e-1\r\n\ny 4 5 6\n")
+
+    File.write!(
+      binary,
+      "2 3\nx " <>
+        Vector.from_list([1, -2.5, 0.3]) <>
+        "\ny " <> Vector.from_list([4, 5, 6]) <> "\n"
+    )
+
+    for {source, options} <- [
+          {text, [threads: 2]},
+          {binary, []},
+          {binary, [format: :binary]}
+        ] do
+      index = Index.create!(path, "formats", vector_size: 3)
+      assert Index.compile!(index, source, options) === 2
+      Index.close(index)
+
+      index = Index.open!(path)
+
+      assert Index.lookup!(index, "x") ==
+               {1, Vector.from_list([1, -2.5, 0.3])}
+
+      assert Index.lookup!(index, "y") == {2, Vector.from_list([4, 5, 6])}
+      assert Index.fetch!(index, 2) == "y"
+    end
+
+    index = Index.create!(path, "formats", vector_size: 2)
+
+    assert_raise IndexError, fn -> Index.compile!(index, text) end
+    assert_raise IndexError, fn -> Index.compile!(index, binary) end
+
+    assert_raise IndexError, fn ->
+      Index.compile!(index, Path.join(output, "missing.txt"))
+    end
+
+    Index.close(index)
+  end
+
+  test "compile fasttext", %{output: output} do
+    path = Path.join(output, "fasttext")
+    model = Path.join(output, "fasttext.bin")
+
+    # a 2-d model with a single subword bucket, which all n-grams share
+    args =
+      for a <- [2, 5, 5, 1, 5, 1, 1, 2, 1, 3, 6, 100], into: "" do
+        <<a::little-32>>
+      end
+
+    File.mkdir_p!(output)
+
+    File.write!(
+      model,
+      <<793_712_314::little-32, 12::little-32>> <>
+        args <>
+        <<1.0e-4::little-float-64>> <>
+        <<2::little-32, 2::little-32, 0::little-32>> <>
+        <<10::little-64, -1::little-signed-64>> <>
+        "</s>" <>
+        <<0, 5::little-64, 0>> <>
+        "cat" <>
+        <<0, 5::little-64, 0>> <>
+        <<0, 3::little-64, 2::little-64>> <>
+        Vector.from_list([2, 4, 7, 14, 0, 7])
+    )
+
+    index = Index.create!(path, "fasttext", vector_size: 2)
+    assert Index.compile!(index, model) === 2
+    Index.close(index)
+
+    index = Index.open!(path)
+    assert index.subwords === 1
+
+    # "cat" averages its row with the bucket row of its 6 n-grams,
+    # and a missing term's vector is the bucket row
+    assert Index.lookup!(index, "</s>") == {1, Vector.from_list([2, 4])}
+    assert_vector(Index.lookup!(index, "cat"), 2, [1, 8])
+    assert_vector(Index.lookup!(index, "dog"), 0, [0, 7])
+    assert Index.lookup!(index, "") == {0, Vector.from_list([0, 0])}
+
+    mean = Index.mean!(index, ["cat", "dog"], oov: :subword)
+    assert_vector({0, mean}, 0, [0.5, 7.5])
+
+    # a hashed missing term uses a bucket row, never a term row
+    mean = Index.mean!(index, ["cat", "dog"], oov: :hash)
+    assert_vector({0, mean}, 0, [0.5, 7.5])
+
+    assert [{"cat", 2, _similarity}] = Index.nearest!(index, "dog", 1)
+
+    index = Index.create!(path, "fasttext", vector_size: 3)
+    assert_raise IndexError, fn -> Index.compile!(index, model) end
+    Index.close(index)
+
+    # minn > maxn is an invalid subword range
+    invalid = Path.join(output, "fasttext_invalid.bin")
+    <<prefix::binary-size(44), _minn::little-32, rest::binary>> =
+      File.read!(model)
+
+    File.write!(invalid, prefix <> <<7::little-32>> <> rest)
+    index = Index.create!(path, "fasttext", vector_size: 2)
+    assert_raise IndexError, fn -> Index.compile!(index, invalid) end
+    Index.close(index)
+
+    index = Index.create!(path, "fasttext", vector_size: 2)
+    assert Index.compile!(index, model, format: :fasttext) === 2
+
+    assert_raise IndexError, fn ->
+      Index.compile!(index, model, format: :fasttext)
+    end
+
+    Index.close(index)
+  end
+
+  test "open", %{output: output} do
+    path = Path.join(output, "open")
+
+    assert_raise IndexError, fn -> Index.open!(path) end
+
+    # an index that was never closed is incomplete
+    index = Index.create!(path, "open", vector_size: 2)
+    Index.parse_insert!(index, {"a 1 2", 1})
+
+    assert_raise IndexError, fn -> Index.open!(path) end
+
+    # later inserts replace earlier terms and ids
+    Index.parse_insert!(index, {"b 3 4", 2})
+    Index.parse_insert!(index, {"a 5 6", 3})
+    Index.parse_insert!(index, {"c 7 8", 2})
+    Index.close(index)
+
+    assert_raise IndexError, fn -> Index.close(index) end
+
+    index = Index.open!(path)
+    assert index.name === "open"
+    assert index.vector_size === 2
+
+    assert Index.lookup!(index, "a") == {3, Vector.from_list([5, 6])}
+    assert Index.lookup!(index, "b") == {2, Vector.from_list([3, 4])}
+    assert Index.fetch!(index, 1) == "a"
+    assert Index.fetch!(index, 2) == "c"
+    assert Index.fetch!(index, 3) == "a"
+  end
+
+  defp nearest_ids(index, term) do
+    index
+    |> Index.nearest!(term, 10)
+    |> Enum.map(fn {_term, id, _similarity} -> id end)
+  end
+
+  defp assert_vector({id, vector}, expected_id, expected) do
+    assert id === expected_id
+
+    vector
+    |> Vector.to_list()
+    |> Enum.zip(expected)
+    |> Enum.each(fn {a, e} -> assert_in_delta a, e, 1.0e-5 end)
+  end
 end
@@ -17,11 +17,11 @@ defmodule Penelope.ML.Word2vec.MeanVectorizerTest do
     Index.parse_insert!(index, {"fox 2 4.5", 2})
     Index.parse_insert!(index, {"dog 5 7.5", 3})
     Index.parse_insert!(index, {"horse 0 3", 4})
+    Index.close(index)
 
-    on_exit(fn ->
-      Index.close(index)
-      File.rm_rf(output)
-    end)
+    index = Index.open!(output)
+
+    on_exit(fn -> File.rm_rf(output) end)
 
     {:ok, word2vec_index: index}
   end
@@ -30,15 +30,44 @@ defmodule Penelope.ML.Word2vec.MeanVectorizerTest do
     x = [
       ["the", "quick", "brown", "fox"],
       ["the", "lazy", "dog"],
-      ["some", "old", "horse"]
+      ["some", "old", "horse"],
+      []
     ]
 
     expect = [
       Vector.from_list([0.75, 1.5]),
       Vector.from_list([2.0, 3.0]),
-      Vector.from_list([0.0, 1.0])
+      Vector.from_list([0.0, 1.0]),
+      Vector.from_list([0.0, 0.0])
     ]
 
     assert Vectorizer.transform(%{}, context, x) === expect
   end
+
+  test "transform oov", context do
+    x = [
+      ["the", "quick", "brown", "fox"],
+      ["some", "old", "horse"],
+      ["quick"],
+      []
+    ]
+
+    expect = [
+      Vector.from_list([1.5, 3.0]),
+      Vector.from_list([0.0, 3.0]),
+      Vector.from_list([0.0, 0.0]),
+      Vector.from_list([0.0, 0.0])
+    ]
+
+    assert Vectorizer.transform(%{oov: :skip}, context, x) === expect
+
+    # hashing requires subword buckets, which are never index terms
+    assert_raise ArgumentError, fn ->
+      Vectorizer.transform(%{oov: :hash}, context, x)
+    end
+
+    assert_raise ArgumentError, fn ->
+      Vectorizer.transform(%{oov: :invalid}, context, x)
+    end
+  end
 end
@@ -1,6 +1,7 @@
 defmodule Penelope.NLP.POSTaggerTest do
   use ExUnit.Case
 
+  alias Penelope.ML.Pipeline
   alias Penelope.NLP.POSTagger
 
   @x_train [
@@ -25,4 +26,33 @@ defmodule Penelope.NLP.POSTaggerTest do
     tagged = POSTagger.tag(model, %{}, unseen)
     assert tagged === Enum.zip(unseen, String.split("NNP VBZ DT NN"))
   end
+
+  test "native featurization" do
+    x = [
+      String.split("The well-known café opened in 1998 ."),
+      String.split("Ünter ÉCOLE naïve x2 e\u0301tude 👍🏽 🇫🇷 A-1 -"),
+      String.split(
+        "ที่นั่น שָׁלוֹם क्षत्रिय தமிழ் \u1100\u1161\u11A8각 👩‍👩‍👧 \u0600\u0661"
+      )
+    ]
+
+    y = Enum.map(x, fn tokens -> Enum.map(tokens, &tag_of/1) end)
+    model = POSTagger.fit(%{}, x, y)
+
+    for tokens <- x ++ [["", "café", ""], ["e\u0301\u0301"], []] do
+      [{tags, _probability}] =
+        Pipeline.predict_sequence(model.pos_tagger, %{}, [tokens])
+
+      assert POSTagger.tag(model, %{}, tokens) === Enum.zip(tokens, tags)
+    end
+  end
+
+  defp tag_of(token) do
+    cond do
+      token =~ ~r/\d/ -> "CD"
+      token =~ ~r/\p{Lu}/ -> "NNP"
+      token =~ "-" -> "JJ"
+      true -> "NN"
+    end
+  end
 end